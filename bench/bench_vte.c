@@ -0,0 +1,538 @@
+/*
+ * TSM - Parser Throughput Benchmark
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Parser Throughput Benchmark
+ * Feeds a corpus through tsm_vte_input() in pty-sized chunks and reports
+ * MB/s, ns/byte and heap allocations per MB. Corpora are either generated
+ * here, from a fixed seed so every run parses the same bytes, or read from
+ * files, for example raw streams recorded from real sessions.
+ *
+ * Each corpus is parsed once to warm up the terminal, then repeatedly until
+ * the time limit is reached. The fastest pass is reported, since it is the
+ * least disturbed by the rest of the system. Allocations are counted over all
+ * passes after the warm-up, that is, in steady state.
+ *
+ * Usage: bench_vte [-t seconds] [corpus|file]...
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libtsm.h"
+
+#define BENCH_WIDTH 80
+#define BENCH_HEIGHT 24
+#define BENCH_CHUNK 4096
+#define BENCH_SIZE (4 << 20)
+
+/*
+ * Allocation Counting
+ * With glibc, the allocator is replaced by wrappers around the libc functions
+ * so allocations inside libtsm are counted, too. Elsewhere allocations are not
+ * reported.
+ */
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long alloc_cnt;
+#define HAVE_ALLOC_CNT 1
+
+void *malloc(size_t size)
+{
+	++alloc_cnt;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	++alloc_cnt;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	++alloc_cnt;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+#else
+
+static unsigned long alloc_cnt;
+#define HAVE_ALLOC_CNT 0
+
+#endif
+
+/*
+ * Corpus Generators
+ * All generators append to a growing buffer until BENCH_SIZE is reached. The
+ * random numbers come from a fixed-seed LCG so corpora are identical across
+ * runs and machines.
+ */
+
+struct corpus {
+	char *data;
+	size_t len;
+	size_t size;
+	uint32_t seed;
+};
+
+static uint32_t rnd(struct corpus *c, uint32_t max)
+{
+	c->seed = c->seed * 1103515245 + 12345;
+	return (c->seed >> 8) % max;
+}
+
+static void put(struct corpus *c, const char *data, size_t len)
+{
+	char *tmp;
+	size_t size;
+
+	if (c->len + len > c->size) {
+		size = c->size ? c->size * 2 : BENCH_SIZE + 4096;
+		while (size < c->len + len)
+			size *= 2;
+		tmp = realloc(c->data, size);
+		if (!tmp) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		c->data = tmp;
+		c->size = size;
+	}
+
+	memcpy(c->data + c->len, data, len);
+	c->len += len;
+}
+
+static void putf(struct corpus *c, const char *format, ...)
+{
+	char buf[128];
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	len = vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	put(c, buf, len);
+}
+
+static void put_ucs4(struct corpus *c, uint32_t ch)
+{
+	char buf[4];
+	size_t len;
+
+	if (ch < 0x80) {
+		buf[0] = ch;
+		len = 1;
+	} else if (ch < 0x800) {
+		buf[0] = 0xc0 | (ch >> 6);
+		buf[1] = 0x80 | (ch & 0x3f);
+		len = 2;
+	} else if (ch < 0x10000) {
+		buf[0] = 0xe0 | (ch >> 12);
+		buf[1] = 0x80 | ((ch >> 6) & 0x3f);
+		buf[2] = 0x80 | (ch & 0x3f);
+		len = 3;
+	} else {
+		buf[0] = 0xf0 | (ch >> 18);
+		buf[1] = 0x80 | ((ch >> 12) & 0x3f);
+		buf[2] = 0x80 | ((ch >> 6) & 0x3f);
+		buf[3] = 0x80 | (ch & 0x3f);
+		len = 4;
+	}
+
+	put(c, buf, len);
+}
+
+static void put_word(struct corpus *c)
+{
+	unsigned int i, n;
+	char ch;
+
+	n = 1 + rnd(c, 10);
+	for (i = 0; i < n; ++i) {
+		ch = 'a' + rnd(c, 26);
+		put(c, &ch, 1);
+	}
+}
+
+/* plain text, like compiler output or cat of a source file */
+static void gen_ascii(struct corpus *c)
+{
+	unsigned int col;
+
+	while (c->len < BENCH_SIZE) {
+		for (col = 0; col < 70; col += 6) {
+			put_word(c);
+			put(c, " ", 1);
+		}
+		put(c, "\r\n", 2);
+	}
+}
+
+/* every word in another color, like ls --color or a highlighted diff */
+static void gen_sgr(struct corpus *c)
+{
+	unsigned int col;
+
+	while (c->len < BENCH_SIZE) {
+		for (col = 0; col < 70; col += 6) {
+			switch (rnd(c, 4)) {
+			case 0:
+				putf(c, "\e[%um", 30 + rnd(c, 8));
+				break;
+			case 1:
+				putf(c, "\e[1;38;5;%um", rnd(c, 256));
+				break;
+			case 2:
+				putf(c, "\e[38;2;%u;%u;%u;48;2;%u;%u;%um",
+				     rnd(c, 256), rnd(c, 256), rnd(c, 256),
+				     rnd(c, 256), rnd(c, 256), rnd(c, 256));
+				break;
+			default:
+				put(c, "\e[0m", 4);
+				break;
+			}
+			put_word(c);
+			put(c, " ", 1);
+		}
+		put(c, "\e[0m\r\n", 6);
+	}
+}
+
+/* full-screen application redraws, like htop or an editor */
+static void gen_tui(struct corpus *c)
+{
+	unsigned int y, x, n;
+
+	while (c->len < BENCH_SIZE) {
+		put(c, "\e[?25l\e[H\e[44;37m", 18);
+		put_ucs4(c, 0x250c);
+		for (x = 1; x < BENCH_WIDTH - 1; ++x)
+			put_ucs4(c, 0x2500);
+		put_ucs4(c, 0x2510);
+
+		for (y = 2; y < BENCH_HEIGHT; ++y) {
+			if (rnd(c, 3))
+				continue;
+			putf(c, "\e[%u;1H\e[44;37m", y);
+			put_ucs4(c, 0x2502);
+			putf(c, "\e[0;%um", 31 + rnd(c, 7));
+			for (x = 0, n = rnd(c, 60); x < n; x += 4) {
+				put_word(c);
+				put(c, " ", 1);
+			}
+			put(c, "\e[K", 3);
+			putf(c, "\e[%u;%uH\e[44;37m", y, BENCH_WIDTH);
+			put_ucs4(c, 0x2502);
+		}
+
+		putf(c, "\e[%u;1H\e[7m", BENCH_HEIGHT);
+		putf(c, " CPU %3u%% MEM %3u%% ", rnd(c, 100), rnd(c, 100));
+		put(c, "\e[K\e[0m\e[?25h", 13);
+	}
+}
+
+/* wide CJK characters and emoji */
+static void gen_cjk(struct corpus *c)
+{
+	unsigned int col;
+
+	while (c->len < BENCH_SIZE) {
+		for (col = 0; col < BENCH_WIDTH - 2; col += 2) {
+			if (rnd(c, 8))
+				put_ucs4(c, 0x4e00 + rnd(c, 0x5200));
+			else
+				put_ucs4(c, 0x1f600 + rnd(c, 0x50));
+		}
+		put(c, "\r\n", 2);
+	}
+}
+
+/* short lines scrolling through the whole screen or a scroll region */
+static void gen_scroll(struct corpus *c)
+{
+	unsigned int i, n;
+
+	while (c->len < BENCH_SIZE) {
+		if (rnd(c, 2))
+			putf(c, "\e[%u;%ur\e[%uH", 2, BENCH_HEIGHT - 1,
+			     BENCH_HEIGHT - 1);
+		else
+			putf(c, "\e[r\e[%uH", BENCH_HEIGHT);
+
+		for (i = 0, n = 100 + rnd(c, 400); i < n; ++i) {
+			putf(c, "%u: ", i);
+			put_word(c);
+			put(c, "\n\r", 2);
+		}
+	}
+}
+
+/* applications starting and exiting on the alternate screen */
+static void gen_altscreen(struct corpus *c)
+{
+	unsigned int y;
+
+	while (c->len < BENCH_SIZE) {
+		put(c, "\e[?1049h\e[H\e[2J", 16);
+		for (y = 1; y <= BENCH_HEIGHT; y += 1 + rnd(c, 4)) {
+			putf(c, "\e[%uH", y);
+			put_word(c);
+		}
+		put(c, "\e[?1049l", 8);
+		put_word(c);
+		put(c, "\r\n", 2);
+	}
+}
+
+/*
+ * Sequences that do much work for few bytes, each repeated in a row. Most of
+ * them do not change anything after the first repetition and should parse
+ * about as fast as plain text.
+ */
+static const char *const adversarial[] = {
+	"\e[2J",
+	"\e[?2J",
+	"\e[2K",
+	"\e[H\e[65535X",
+	"\e[H\e[65535@",
+	"\e[H\e[65535P",
+	"\e[H\e[65535L",
+	"\e[H\e[65535M",
+	"\e[65535T",
+	"\e[65535I",
+	"\e[65535Z",
+	"\e[?1049h\e[65535S\e[?1049l",
+	"\e[2;20r\e[3H\e[65535L\e[r",
+	"x\e[2J",
+	"\e[41m\e[2J\e[42m\e[2J\e[m",
+	"\e[65535S",
+	"\e[65535;65535H\e[1J",
+	"x\e[2147483647b",
+};
+
+static void gen_adversarial(struct corpus *c)
+{
+	unsigned int i, j;
+
+	while (c->len < BENCH_SIZE) {
+		for (i = 0; i < sizeof(adversarial) / sizeof(*adversarial); ++i)
+			for (j = 0; j < 1000; ++j)
+				put(c, adversarial[i], strlen(adversarial[i]));
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*gen) (struct corpus *c);
+} generators[] = {
+	{ "ascii", gen_ascii },
+	{ "sgr", gen_sgr },
+	{ "tui", gen_tui },
+	{ "cjk", gen_cjk },
+	{ "scroll", gen_scroll },
+	{ "altscreen", gen_altscreen },
+	{ "adversarial", gen_adversarial },
+};
+
+#define GENERATOR_NUM (sizeof(generators) / sizeof(*generators))
+
+static int load_file(struct corpus *c, const char *path)
+{
+	char buf[BENCH_CHUNK];
+	size_t len;
+	FILE *f;
+	int r = 0;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return -errno;
+
+	while ((len = fread(buf, 1, sizeof(buf), f)))
+		put(c, buf, len);
+	if (ferror(f))
+		r = -EIO;
+
+	fclose(f);
+	return r;
+}
+
+/*
+ * Benchmark Runner
+ */
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void write_cb(struct tsm_vte *vte, const char *u8, size_t len,
+		     void *data)
+{
+}
+
+static void parse(struct tsm_vte *vte, const struct corpus *c)
+{
+	size_t off, n;
+
+	for (off = 0; off < c->len; off += n) {
+		n = c->len - off;
+		if (n > BENCH_CHUNK)
+			n = BENCH_CHUNK;
+		tsm_vte_input(vte, c->data + off, n);
+	}
+}
+
+static int run(const char *name, const struct corpus *c, double limit)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	uint64_t start, t, best = UINT64_MAX, total = 0;
+	unsigned long allocs, passes = 0;
+	double mb;
+	int r;
+
+	if (!c->len) {
+		fprintf(stderr, "%s: empty corpus\n", name);
+		return -EINVAL;
+	}
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	if (r)
+		return r;
+	r = tsm_screen_resize(screen, BENCH_WIDTH, BENCH_HEIGHT);
+	if (r)
+		goto err_screen;
+	tsm_screen_set_max_sb(screen, 1000);
+	r = tsm_vte_new(&vte, screen, write_cb, NULL, NULL, NULL);
+	if (r)
+		goto err_screen;
+
+	parse(vte, c);
+
+	allocs = alloc_cnt;
+	do {
+		start = now();
+		parse(vte, c);
+		t = now() - start;
+
+		if (t < best)
+			best = t;
+		total += t;
+		++passes;
+	} while (passes < 3 || total < limit * 1e9);
+	allocs = alloc_cnt - allocs;
+
+	mb = c->len / (1024.0 * 1024.0);
+	printf("%-12s %8.2f MB %8.1f MB/s %8.2f ns/byte", name, mb,
+	       mb / (best / 1e9), (double)best / c->len);
+	if (HAVE_ALLOC_CNT)
+		printf(" %10.1f allocs/MB", allocs / (mb * passes));
+	printf("\n");
+
+	tsm_vte_unref(vte);
+err_screen:
+	tsm_screen_unref(screen);
+	return r;
+}
+
+static int run_arg(const char *arg, double limit)
+{
+	struct corpus c;
+	unsigned int i;
+	int r;
+
+	memset(&c, 0, sizeof(c));
+	c.seed = 1;
+
+	for (i = 0; i < GENERATOR_NUM; ++i) {
+		if (!strcmp(arg, generators[i].name)) {
+			generators[i].gen(&c);
+			break;
+		}
+	}
+
+	if (i == GENERATOR_NUM) {
+		r = load_file(&c, arg);
+		if (r) {
+			fprintf(stderr, "%s: cannot read corpus (%d)\n", arg,
+				r);
+			free(c.data);
+			return r;
+		}
+	}
+
+	r = run(arg, &c, limit);
+	free(c.data);
+	return r;
+}
+
+int main(int argc, char **argv)
+{
+	double limit = 1.0;
+	unsigned int i;
+	int r, ret = 0;
+
+	if (argc > 2 && !strcmp(argv[1], "-t")) {
+		limit = strtod(argv[2], NULL);
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc < 2) {
+		for (i = 0; i < GENERATOR_NUM; ++i) {
+			r = run_arg(generators[i].name, limit);
+			if (r)
+				ret = 1;
+		}
+	} else {
+		for (i = 1; i < (unsigned int)argc; ++i) {
+			r = run_arg(argv[i], limit);
+			if (r)
+				ret = 1;
+		}
+	}
+
+	return ret;
+}
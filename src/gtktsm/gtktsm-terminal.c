@@ -539,6 +539,7 @@ struct gtktsm_renderer_ctx {
 	unsigned int cell_height;
 
 	bool debug;
+	bool frozen;			/* keep the last frame */
 };
 
 static int renderer_realloc(struct gtktsm_renderer *rend,
@@ -1051,11 +1052,13 @@ static void gtktsm_renderer_draw(const struct gtktsm_renderer_ctx *ctx)
 	 * cairo to blit it into the gtk buffer. This way we get two mem-writes
 	 * but at least it's fast enough to render a whole screen. */
 
-	cairo_surface_flush(rend->surface);
-	rend->age = tsm_screen_draw(ctx->screen,
-				    renderer_draw_cell,
-				    (void*)ctx);
-	cairo_surface_mark_dirty(rend->surface);
+	if (!ctx->frozen || !rend->age) {
+		cairo_surface_flush(rend->surface);
+		rend->age = tsm_screen_draw(ctx->screen,
+					    renderer_draw_cell,
+					    (void*)ctx);
+		cairo_surface_mark_dirty(rend->surface);
+	}
 
 	cairo_set_source_surface(ctx->cr, rend->surface, 0, 0);
 	cairo_paint(ctx->cr);
@@ -1096,7 +1099,7 @@ typedef struct _GtkTsmTerminalPrivate {
 	struct tsm_vte *vte;
 
 	/* pty bridge */
-	int pty_bridge;
+	struct shl_pty_bridge *pty_bridge;
 	GIOChannel *bridge_chan;
 	guint bridge_src;
 
@@ -1122,6 +1125,7 @@ typedef struct _GtkTsmTerminalPrivate {
 	struct shl_pty *pty;
 	guint child_src;
 	guint idle_src;
+	guint sync_src;
 
 	/* cache */
 	GdkKeymap *keymap;
@@ -1329,6 +1333,7 @@ static gboolean terminal_draw_fn(GtkWidget *widget,
 	ctx.vte = p->vte;
 	ctx.cell_width = p->face_regular->width;
 	ctx.cell_height = p->face_regular->height;
+	ctx.frozen = tsm_vte_check_sync(p->vte) >= 0;
 
 	gtktsm_renderer_draw(&ctx);
 
@@ -1535,8 +1540,9 @@ static void terminal_write_fn(struct tsm_vte *vte,
 	if (!p->pty)
 		return;
 
+	/* -ENOBUFS drops output while the client does not read its input */
 	r = shl_pty_write(p->pty, u8, len);
-	if (r < 0)
+	if (r < 0 && r != -ENOBUFS)
 		g_error("OOM in pty-write: %d", r);
 
 	/* dont directly call into pty-bridge to avoid possible recursion */
@@ -1595,6 +1601,40 @@ static void terminal_osc_fn(struct tsm_vte *vte,
 	}
 }
 
+static void terminal_sync_fn(struct tsm_vte *vte,
+			     bool active,
+			     void *data)
+{
+	GtkTsmTerminal *term = data;
+	GtkTsmTerminalPrivate *p = gtktsm_terminal_get_instance_private(term);
+
+	if (active)
+		return;
+
+	if (p->sync_src) {
+		g_source_remove(p->sync_src);
+		p->sync_src = 0;
+	}
+
+	gtk_widget_queue_draw(GTK_WIDGET(term));
+}
+
+static gboolean terminal_sync_timeout_fn(gpointer data)
+{
+	GtkTsmTerminal *term = data;
+	GtkTsmTerminalPrivate *p = gtktsm_terminal_get_instance_private(term);
+	int ms;
+
+	p->sync_src = 0;
+
+	/* ends the update on timeout, which queues a redraw */
+	ms = tsm_vte_check_sync(p->vte);
+	if (ms >= 0)
+		p->sync_src = g_timeout_add(ms, terminal_sync_timeout_fn, term);
+
+	return G_SOURCE_REMOVE;
+}
+
 static gboolean terminal_bridge_fn(GIOChannel *chan,
 				   GIOCondition cond,
 				   gpointer data)
@@ -1757,6 +1797,8 @@ static void terminal_finalize(GObject *gobj)
 
 	if (p->idle_src)
 		g_source_remove(p->idle_src);
+	if (p->sync_src)
+		g_source_remove(p->sync_src);
 
 	gtktsm_face_free(p->face_regular);
 	gtktsm_face_free(p->face_bold);
@@ -1805,13 +1847,14 @@ static void gtktsm_terminal_init(GtkTsmTerminal *term)
 	if (r < 0)
 		g_error("tsm_vte_new() failed: %d", r);
 	tsm_vte_set_osc_cb(p->vte, terminal_osc_fn, term);
+	tsm_vte_set_sync_cb(p->vte, terminal_sync_fn, term);
 
-	p->pty_bridge = shl_pty_bridge_new();
-	if (p->pty_bridge < 0)
-		g_error("shl_pty_bridge_new() failed: %d",
-			p->pty_bridge);
+	r = shl_pty_bridge_new(&p->pty_bridge, 0);
+	if (r < 0)
+		g_error("shl_pty_bridge_new() failed: %d", r);
 
-	p->bridge_chan = g_io_channel_unix_new(p->pty_bridge);
+	p->bridge_chan = g_io_channel_unix_new(
+				shl_pty_bridge_get_fd(p->pty_bridge));
 	p->bridge_src = g_io_add_watch(p->bridge_chan,
 				       G_IO_IN,
 				       terminal_bridge_fn,
@@ -1948,9 +1991,16 @@ static void terminal_read_fn(struct shl_pty *pty,
 {
 	GtkTsmTerminal *term = data;
 	GtkTsmTerminalPrivate *p = gtktsm_terminal_get_instance_private(term);
+	int ms;
 
 	tsm_vte_input(p->vte, u8, len);
-	gtk_widget_queue_draw(GTK_WIDGET(term));
+
+	/* don't draw half of a synchronized update */
+	ms = tsm_vte_check_sync(p->vte);
+	if (ms < 0)
+		gtk_widget_queue_draw(GTK_WIDGET(term));
+	else if (!p->sync_src)
+		p->sync_src = g_timeout_add(ms, terminal_sync_timeout_fn, term);
 }
 
 static void terminal_child_fn(GPid pid,
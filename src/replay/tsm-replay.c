@@ -0,0 +1,877 @@
+/*
+ * TSM - Session Recorder and Replayer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Session Recorder and Replayer
+ * tsm-replay records the output of a program running on a pty and replays it
+ * into a tsm_vte/tsm_screen pair to profile the parser and the screen on real
+ * sessions.
+ *
+ * Recordings use the ttyrec format: every read from the pty is stored as a
+ * record with a 12 byte header of three little-endian 32bit integers, the
+ * seconds and microseconds of the wall-clock time and the length of the data
+ * that follows. Recordings of other ttyrec tools can be replayed, too. The
+ * format does not contain the terminal size, so it has to be passed to
+ * "play" if the session was not recorded on 80x24.
+ *
+ * "play" feeds the records into the VTE either as fast as possible or with
+ * the recorded timing. The screen is drawn with a no-op callback whenever
+ * 1/60s of recorded time passed, like a terminal limited to the refresh rate
+ * would. Time spent in tsm_vte_input() and tsm_screen_draw() is reported
+ * separately, together with the peak memory usage.
+ *
+ * To start at a later point of a long recording, "index" stores keyframes,
+ * that is tsm_screen_save() and tsm_vte_save() snapshots taken every few
+ * seconds of recorded time, in FILE.keys. "play -s" restores the last
+ * keyframe before the requested time and only parses the records after it.
+ * Without an index, the records before that time are parsed untimed.
+ *
+ * "raw" writes the concatenated pty output to stdout, which can be fed to
+ * bench_vte as a corpus.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "libtsm.h"
+#include "shl-pty.h"
+
+#define REPLAY_HEADER 12
+#define REPLAY_FRAME_US 16667
+#define REPLAY_KEY_MAGIC "TSMK"
+#define REPLAY_KEY_VERSION 1
+#define REPLAY_KEY_HEADER 24
+#define REPLAY_KEY_ENTRY 32
+
+static unsigned int cols = 80;
+static unsigned int rows = 24;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+	put_le32(p, v);
+	put_le32(p + 4, v >> 32);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+	       (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+	return get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t r;
+
+	while (len) {
+		r = write(fd, p, len);
+		if (r < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -errno;
+		}
+		p += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+static int read_file(const char *path, char **out, size_t *out_len)
+{
+	char *data = NULL, *tmp;
+	size_t len = 0, size = 0, n;
+	FILE *f;
+	int r = 0;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return -errno;
+
+	do {
+		if (len == size) {
+			size = size ? size * 2 : 65536;
+			tmp = realloc(data, size);
+			if (!tmp) {
+				r = -ENOMEM;
+				break;
+			}
+			data = tmp;
+		}
+
+		n = fread(data + len, 1, size - len, f);
+		len += n;
+	} while (n);
+
+	if (!r && ferror(f))
+		r = -EIO;
+	fclose(f);
+
+	if (r) {
+		free(data);
+		return r;
+	}
+
+	*out = data;
+	*out_len = len;
+	return 0;
+}
+
+/*
+ * Recordings
+ * The whole recording is read into memory and split into records. Times are
+ * converted to microseconds since the first record.
+ */
+
+struct record {
+	uint64_t time;
+	const char *data;
+	size_t len;
+};
+
+struct recording {
+	char *data;
+	size_t len;
+	struct record *recs;
+	size_t num;
+};
+
+static void recording_free(struct recording *rec)
+{
+	free(rec->recs);
+	free(rec->data);
+}
+
+static int recording_load(struct recording *rec, const char *path)
+{
+	const uint8_t *h;
+	size_t pos, size = 0, len;
+	uint64_t t, first = 0;
+	void *tmp;
+	int r;
+
+	memset(rec, 0, sizeof(*rec));
+	r = read_file(path, &rec->data, &rec->len);
+	if (r)
+		return r;
+
+	for (pos = 0; pos + REPLAY_HEADER <= rec->len; pos += len) {
+		h = (const uint8_t *)rec->data + pos;
+		t = get_le32(h) * 1000000ULL + get_le32(h + 4);
+		len = get_le32(h + 8);
+		pos += REPLAY_HEADER;
+		if (len > rec->len - pos)
+			break;
+
+		if (rec->num == size) {
+			size = size ? size * 2 : 1024;
+			tmp = realloc(rec->recs, size * sizeof(*rec->recs));
+			if (!tmp) {
+				recording_free(rec);
+				return -ENOMEM;
+			}
+			rec->recs = tmp;
+		}
+
+		if (!rec->num)
+			first = t;
+		rec->recs[rec->num].time = t > first ? t - first : 0;
+		rec->recs[rec->num].data = rec->data + pos;
+		rec->recs[rec->num].len = len;
+		++rec->num;
+	}
+
+	/* a recording cut off by a crash is still useful */
+	if (pos != rec->len)
+		fprintf(stderr, "%s: ignoring truncated record at offset %zu\n",
+			path, pos);
+
+	return 0;
+}
+
+/*
+ * Recorder
+ * Runs a command on a pty with the size of the current terminal, forwards
+ * stdin to it and writes everything it prints to both stdout and the
+ * recording. The terminal is put into raw mode so the command receives all
+ * keys unchanged.
+ */
+
+struct recorder {
+	FILE *f;
+	int err;
+};
+
+static void recorder_input(struct shl_pty *pty, void *data, char *u8,
+			   size_t len)
+{
+	struct recorder *rc = data;
+	struct timespec ts;
+	uint8_t h[REPLAY_HEADER];
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	put_le32(h, ts.tv_sec);
+	put_le32(h + 4, ts.tv_nsec / 1000);
+	put_le32(h + 8, len);
+
+	if (fwrite(h, sizeof(h), 1, rc->f) != 1 ||
+	    fwrite(u8, len, 1, rc->f) != 1)
+		rc->err = -EIO;
+
+	write_all(STDOUT_FILENO, u8, len);
+}
+
+static int cmd_record(const char *path, char **argv)
+{
+	char *shell[] = { getenv("SHELL") ? : "/bin/sh", NULL };
+	struct recorder rc = { NULL, 0 };
+	struct termios old, raw;
+	struct winsize ws;
+	struct shl_pty *pty;
+	struct pollfd pfd[2];
+	char buf[4096];
+	bool tty;
+	ssize_t len;
+	pid_t pid;
+	int r, status;
+
+	if (!*argv)
+		argv = shell;
+
+	if (!ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) && ws.ws_col && ws.ws_row) {
+		cols = ws.ws_col;
+		rows = ws.ws_row;
+	}
+
+	rc.f = fopen(path, "wbe");
+	if (!rc.f) {
+		fprintf(stderr, "%s: cannot create: %m\n", path);
+		return 1;
+	}
+
+	pid = shl_pty_open(&pty, recorder_input, &rc, cols, rows);
+	if (pid < 0) {
+		fprintf(stderr, "shl_pty_open() failed: %d\n", (int)pid);
+		fclose(rc.f);
+		return 1;
+	} else if (!pid) {
+		/* child */
+		setenv("TERM", "xterm-256color", 1);
+		execvp(argv[0], argv);
+		fprintf(stderr, "%s: cannot execute: %m\n", argv[0]);
+		_exit(127);
+	}
+
+	tty = !tcgetattr(STDIN_FILENO, &old);
+	if (tty) {
+		raw = old;
+		cfmakeraw(&raw);
+		tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+	}
+
+	pfd[0].fd = shl_pty_get_fd(pty);
+	pfd[0].events = POLLIN;
+	pfd[1].fd = STDIN_FILENO;
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		r = poll(pfd, 2, -1);
+		if (r < 0 && errno != EINTR)
+			break;
+
+		if (pfd[1].revents & (POLLIN | POLLHUP)) {
+			len = read(STDIN_FILENO, buf, sizeof(buf));
+			if (len > 0)
+				shl_pty_write(pty, buf, len);
+			else
+				pfd[1].fd = -1;
+		}
+
+		/* the read fails with EIO once the child closed the pty */
+		r = shl_pty_dispatch(pty);
+		if (r < 0 && r != -EAGAIN)
+			break;
+	}
+
+	if (tty)
+		tcsetattr(STDIN_FILENO, TCSANOW, &old);
+
+	shl_pty_unref(pty);
+	waitpid(pid, &status, 0);
+
+	if (fclose(rc.f))
+		rc.err = -EIO;
+	if (rc.err) {
+		fprintf(stderr, "%s: write failed\n", path);
+		return 1;
+	}
+
+	fprintf(stderr, "recorded %ux%u session to %s\n", cols, rows, path);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+/*
+ * Replayer
+ */
+
+struct replay {
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+
+	uint64_t next_draw;		/* recorded time of the next frame */
+	uint64_t parse_ns;		/* time spent in tsm_vte_input() */
+	uint64_t draw_ns;		/* time spent in tsm_screen_draw() */
+	unsigned long frames;
+	size_t bytes;
+};
+
+static void replay_write(struct tsm_vte *vte, const char *u8, size_t len,
+			 void *data)
+{
+}
+
+static int replay_draw(struct tsm_screen *con, uint64_t id,
+		       const uint32_t *ch, size_t len, unsigned int cwidth,
+		       unsigned int posx, unsigned int posy,
+		       const struct tsm_screen_attr *attr, tsm_age_t age,
+		       void *data)
+{
+	return 0;
+}
+
+static int replay_new(struct replay *rp)
+{
+	int r;
+
+	memset(rp, 0, sizeof(*rp));
+
+	r = tsm_screen_new(&rp->screen, NULL, NULL);
+	if (r)
+		return r;
+
+	r = tsm_screen_resize(rp->screen, cols, rows);
+	if (r)
+		goto err_screen;
+
+	tsm_screen_set_max_sb(rp->screen, 1000);
+
+	r = tsm_vte_new(&rp->vte, rp->screen, replay_write, NULL, NULL, NULL);
+	if (r)
+		goto err_screen;
+
+	return 0;
+
+err_screen:
+	tsm_screen_unref(rp->screen);
+	return r;
+}
+
+static void replay_free(struct replay *rp)
+{
+	tsm_vte_unref(rp->vte);
+	tsm_screen_unref(rp->screen);
+}
+
+static void replay_record(struct replay *rp, const struct record *rec)
+{
+	uint64_t start, mid;
+
+	start = now_ns();
+	tsm_vte_input(rp->vte, rec->data, rec->len);
+	mid = now_ns();
+	rp->parse_ns += mid - start;
+	rp->bytes += rec->len;
+
+	if (rec->time < rp->next_draw)
+		return;
+
+	tsm_screen_draw(rp->screen, replay_draw, NULL);
+	rp->draw_ns += now_ns() - mid;
+	rp->next_draw = rec->time + REPLAY_FRAME_US;
+	++rp->frames;
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+/* cells of the dumped screen; 0 marks the second half of wide characters */
+struct dump {
+	uint32_t *cells;
+};
+
+static int dump_cell(struct tsm_screen *con, uint64_t id, const uint32_t *ch,
+		     size_t len, unsigned int cwidth, unsigned int posx,
+		     unsigned int posy, const struct tsm_screen_attr *attr,
+		     tsm_age_t age, void *data)
+{
+	struct dump *d = data;
+
+	if (posx < cols && posy < rows)
+		d->cells[posy * cols + posx] = !cwidth ? 0 : len ? ch[0] : ' ';
+	return 0;
+}
+
+static void replay_dump(struct replay *rp)
+{
+	struct dump d;
+	unsigned int x, y, end;
+	char buf[4];
+	size_t len;
+
+	d.cells = calloc(cols * rows, sizeof(*d.cells));
+	if (!d.cells)
+		return;
+
+	tsm_screen_draw(rp->screen, dump_cell, &d);
+
+	for (y = 0; y < rows; ++y) {
+		for (end = cols; end; --end) {
+			if (d.cells[y * cols + end - 1] != ' ')
+				break;
+		}
+
+		for (x = 0; x < end; ++x) {
+			if (!d.cells[y * cols + x])
+				continue;
+			len = tsm_ucs4_to_utf8(d.cells[y * cols + x], buf);
+			fwrite(buf, 1, len, stdout);
+		}
+		putchar('\n');
+	}
+
+	free(d.cells);
+}
+
+/*
+ * Keyframes
+ * FILE.keys starts with the magic, the version, the size of the recording and
+ * the screen size, so an index of another recording or size is rejected. Each
+ * keyframe stores its recorded time, the number of the first record after it
+ * and the lengths of the screen and VTE snapshots that follow. All integers
+ * are little-endian.
+ */
+
+static char *keys_path(const char *path)
+{
+	char *p;
+
+	p = malloc(strlen(path) + 6);
+	if (p)
+		sprintf(p, "%s.keys", path);
+	return p;
+}
+
+static void keys_header(uint8_t *h, const struct recording *rec)
+{
+	memcpy(h, REPLAY_KEY_MAGIC, 4);
+	put_le32(h + 4, REPLAY_KEY_VERSION);
+	put_le64(h + 8, rec->len);
+	put_le32(h + 16, cols);
+	put_le32(h + 20, rows);
+}
+
+static int keys_write(FILE *f, struct replay *rp, uint64_t time, size_t idx)
+{
+	char *scr = NULL, *vte = NULL;
+	size_t scr_len, vte_len;
+	uint8_t e[REPLAY_KEY_ENTRY];
+	int r;
+
+	r = tsm_screen_save(rp->screen, &scr, &scr_len);
+	if (r)
+		return r;
+
+	r = tsm_vte_save(rp->vte, &vte, &vte_len);
+	if (r)
+		goto out;
+
+	put_le64(e, time);
+	put_le64(e + 8, idx);
+	put_le64(e + 16, scr_len);
+	put_le64(e + 24, vte_len);
+
+	if (fwrite(e, sizeof(e), 1, f) != 1 ||
+	    fwrite(scr, scr_len, 1, f) != 1 ||
+	    fwrite(vte, vte_len, 1, f) != 1)
+		r = -EIO;
+
+out:
+	free(vte);
+	free(scr);
+	return r;
+}
+
+static int cmd_index(const char *path, double interval)
+{
+	struct recording rec;
+	struct replay rp;
+	uint8_t h[REPLAY_KEY_HEADER];
+	uint64_t next = 0, step = interval * 1000000;
+	unsigned long keys = 0;
+	char *kpath;
+	FILE *f;
+	size_t i;
+	int r;
+
+	r = recording_load(&rec, path);
+	if (r) {
+		fprintf(stderr, "%s: cannot read recording (%d)\n", path, r);
+		return 1;
+	}
+
+	kpath = keys_path(path);
+	f = kpath ? fopen(kpath, "wb") : NULL;
+	if (!f) {
+		fprintf(stderr, "%s.keys: cannot create\n", path);
+		free(kpath);
+		recording_free(&rec);
+		return 1;
+	}
+
+	r = replay_new(&rp);
+	if (r)
+		goto out;
+
+	keys_header(h, &rec);
+	if (fwrite(h, sizeof(h), 1, f) != 1)
+		r = -EIO;
+
+	for (i = 0; !r && i < rec.num; ++i) {
+		if (rec.recs[i].time >= next) {
+			r = keys_write(f, &rp, rec.recs[i].time, i);
+			next = rec.recs[i].time + step;
+			++keys;
+		}
+		tsm_vte_input(rp.vte, rec.recs[i].data, rec.recs[i].len);
+	}
+
+	replay_free(&rp);
+out:
+	if (fclose(f) && !r)
+		r = -EIO;
+	if (r)
+		fprintf(stderr, "%s: cannot write index (%d)\n", kpath, r);
+	else
+		printf("%lu keyframes written to %s\n", keys, kpath);
+
+	free(kpath);
+	recording_free(&rec);
+	return r ? 1 : 0;
+}
+
+/*
+ * Restores the last keyframe before @time. Stores the index of the record to
+ * continue with in @idx, or 0 if there is no usable index. A keyframe that
+ * cannot be restored leaves @rp in an unknown state, so it is recreated; only
+ * that can fail.
+ */
+static int keys_seek(struct replay *rp, const char *path,
+		     const struct recording *rec, uint64_t time, size_t *idx)
+{
+	uint8_t h[REPLAY_KEY_HEADER];
+	const uint8_t *p, *best = NULL;
+	char *kpath, *data = NULL;
+	size_t len, pos, scr_len, vte_len;
+	int r = 0;
+
+	*idx = 0;
+
+	kpath = keys_path(path);
+	if (!kpath || read_file(kpath, &data, &len))
+		goto out;
+
+	keys_header(h, rec);
+	if (len < sizeof(h) || memcmp(data, h, sizeof(h))) {
+		fprintf(stderr, "%s: index does not match recording\n", kpath);
+		goto out;
+	}
+
+	for (pos = sizeof(h); len - pos >= REPLAY_KEY_ENTRY; ) {
+		p = (const uint8_t *)data + pos;
+		scr_len = get_le64(p + 16);
+		vte_len = get_le64(p + 24);
+		if (scr_len > len - pos - REPLAY_KEY_ENTRY ||
+		    vte_len > len - pos - REPLAY_KEY_ENTRY - scr_len)
+			break;
+		if (get_le64(p) > time || get_le64(p + 8) >= rec->num)
+			break;
+
+		best = p;
+		pos += REPLAY_KEY_ENTRY + scr_len + vte_len;
+	}
+
+	if (!best)
+		goto out;
+
+	scr_len = get_le64(best + 16);
+	vte_len = get_le64(best + 24);
+	r = tsm_screen_load(rp->screen, best + REPLAY_KEY_ENTRY, scr_len);
+	if (!r)
+		r = tsm_vte_load(rp->vte, best + REPLAY_KEY_ENTRY + scr_len,
+				 vte_len);
+	if (r) {
+		fprintf(stderr, "%s: cannot restore keyframe (%d)\n", kpath,
+			r);
+		replay_free(rp);
+		r = replay_new(rp);
+		goto out;
+	}
+
+	*idx = get_le64(best + 8);
+
+out:
+	free(data);
+	free(kpath);
+	return r;
+}
+
+static int cmd_play(const char *path, bool realtime, double seek, double end,
+		    bool dump)
+{
+	struct recording rec;
+	struct replay rp;
+	struct rusage ru;
+	uint64_t seek_us = seek * 1000000, end_us = end * 1000000;
+	uint64_t start, base = 0, t0 = 0;
+	size_t i = 0, skip;
+	double s;
+	int r;
+
+	r = recording_load(&rec, path);
+	if (r) {
+		fprintf(stderr, "%s: cannot read recording (%d)\n", path, r);
+		return 1;
+	}
+
+	r = replay_new(&rp);
+	if (r) {
+		fprintf(stderr, "cannot create terminal (%d)\n", r);
+		recording_free(&rec);
+		return 1;
+	}
+
+	if (seek_us) {
+		start = now_ns();
+		r = keys_seek(&rp, path, &rec, seek_us, &i);
+		if (r) {
+			fprintf(stderr, "cannot create terminal (%d)\n", r);
+			recording_free(&rec);
+			return 1;
+		}
+		skip = i;
+		for (; i < rec.num && rec.recs[i].time < seek_us; ++i)
+			tsm_vte_input(rp.vte, rec.recs[i].data,
+				      rec.recs[i].len);
+
+		printf("seek:      %.3f s from keyframe at record %zu in %.2f ms\n",
+		       seek, skip, (now_ns() - start) / 1e6);
+	}
+
+	if (i < rec.num)
+		t0 = rec.recs[i].time;
+	rp.next_draw = t0;
+
+	start = now_ns();
+	for (; i < rec.num; ++i) {
+		if (end_us && rec.recs[i].time > end_us)
+			break;
+
+		if (realtime) {
+			if (!base)
+				base = now_ns();
+			sleep_until(base + (rec.recs[i].time - t0) * 1000);
+		}
+
+		replay_record(&rp, &rec.recs[i]);
+	}
+	s = (now_ns() - start) / 1e9;
+
+	if (dump)
+		replay_dump(&rp);
+
+	getrusage(RUSAGE_SELF, &ru);
+	printf("records:   %zu, %.2f MB, %.3f s recorded, %.3f s replayed\n",
+	       rec.num, rp.bytes / 1e6,
+	       rec.num ? rec.recs[rec.num - 1].time / 1e6 : 0.0, s);
+	printf("parse:     %.2f ms, %.1f MB/s, %.2f ns/byte\n",
+	       rp.parse_ns / 1e6,
+	       rp.parse_ns ? rp.bytes * 1e3 / rp.parse_ns : 0.0,
+	       rp.bytes ? (double)rp.parse_ns / rp.bytes : 0.0);
+	printf("render:    %.2f ms, %lu frames, %.2f us/frame\n",
+	       rp.draw_ns / 1e6, rp.frames,
+	       rp.frames ? rp.draw_ns / 1e3 / rp.frames : 0.0);
+	printf("peak rss:  %ld KiB (recording: %zu KiB)\n", ru.ru_maxrss,
+	       rec.len / 1024);
+
+	replay_free(&rp);
+	recording_free(&rec);
+	return 0;
+}
+
+static int cmd_raw(const char *path)
+{
+	struct recording rec;
+	size_t i;
+	int r;
+
+	r = recording_load(&rec, path);
+	if (r) {
+		fprintf(stderr, "%s: cannot read recording (%d)\n", path, r);
+		return 1;
+	}
+
+	for (i = 0; !r && i < rec.num; ++i)
+		r = write_all(STDOUT_FILENO, rec.recs[i].data,
+			      rec.recs[i].len);
+
+	recording_free(&rec);
+	return r ? 1 : 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: tsm-replay record FILE [COMMAND [ARG]...]\n"
+		"       tsm-replay play [-g WxH] [-r] [-s SEC] [-e SEC] [-d] FILE\n"
+		"       tsm-replay index [-g WxH] [-k SEC] FILE\n"
+		"       tsm-replay raw FILE\n"
+		"\n"
+		"  -g WxH  terminal size of the recording (default: 80x24)\n"
+		"  -r      replay with the recorded timing\n"
+		"  -s SEC  start at SEC seconds, from FILE.keys if present\n"
+		"  -e SEC  stop at SEC seconds\n"
+		"  -d      print the screen after the replay\n"
+		"  -k SEC  keyframe interval (default: 10)\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *cmd;
+	double seek = 0, end = 0, interval = 10;
+	bool realtime = false, dump = false;
+	int c;
+
+	if (argc < 2) {
+		usage();
+		return 1;
+	}
+
+	cmd = argv[1];
+	--argc;
+	++argv;
+
+	if (!strcmp(cmd, "record")) {
+		if (argc < 2) {
+			usage();
+			return 1;
+		}
+		return cmd_record(argv[1], argv + 2);
+	}
+
+	while ((c = getopt(argc, argv, "g:rs:e:dk:")) >= 0) {
+		switch (c) {
+		case 'g':
+			if (sscanf(optarg, "%ux%u", &cols, &rows) != 2 ||
+			    !cols || !rows) {
+				usage();
+				return 1;
+			}
+			break;
+		case 'r':
+			realtime = true;
+			break;
+		case 's':
+			seek = strtod(optarg, NULL);
+			break;
+		case 'e':
+			end = strtod(optarg, NULL);
+			break;
+		case 'd':
+			dump = true;
+			break;
+		case 'k':
+			interval = strtod(optarg, NULL);
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage();
+		return 1;
+	}
+
+	if (!strcmp(cmd, "play"))
+		return cmd_play(argv[optind], realtime, seek, end, dump);
+	if (!strcmp(cmd, "index"))
+		return cmd_index(argv[optind], interval);
+	if (!strcmp(cmd, "raw"))
+		return cmd_raw(argv[optind]);
+
+	usage();
+	return 1;
+}
@@ -0,0 +1,97 @@
+/*
+ * SHL - Pluggable allocator
+ *
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Pluggable allocator
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shl-alloc.h"
+
+static void *libc_alloc(void *data, size_t size)
+{
+	return malloc(size);
+}
+
+static void *libc_realloc(void *data, void *ptr, size_t size)
+{
+	return realloc(ptr, size);
+}
+
+static void libc_free(void *data, void *ptr)
+{
+	free(ptr);
+}
+
+static struct {
+	shl_alloc_fn alloc_fn;
+	shl_realloc_fn realloc_fn;
+	shl_free_fn free_fn;
+	void *data;
+} allocator = {
+	libc_alloc,
+	libc_realloc,
+	libc_free,
+	NULL,
+};
+
+void shl_set_allocator(shl_alloc_fn alloc_fn, shl_realloc_fn realloc_fn,
+		       shl_free_fn free_fn, void *data)
+{
+	if (!alloc_fn || !realloc_fn || !free_fn) {
+		alloc_fn = libc_alloc;
+		realloc_fn = libc_realloc;
+		free_fn = libc_free;
+		data = NULL;
+	}
+
+	allocator.alloc_fn = alloc_fn;
+	allocator.realloc_fn = realloc_fn;
+	allocator.free_fn = free_fn;
+	allocator.data = data;
+}
+
+void *shl_malloc(size_t size)
+{
+	return allocator.alloc_fn(allocator.data, size);
+}
+
+void *shl_calloc(size_t nmemb, size_t size)
+{
+	void *p;
+
+	if (size && nmemb > SIZE_MAX / size)
+		return NULL;
+
+	p = allocator.alloc_fn(allocator.data, nmemb * size);
+	if (p)
+		memset(p, 0, nmemb * size);
+	return p;
+}
+
+void *shl_realloc(void *ptr, size_t size)
+{
+	return allocator.realloc_fn(allocator.data, ptr, size);
+}
+
+void shl_free(void *ptr)
+{
+	if (ptr)
+		allocator.free_fn(allocator.data, ptr);
+}
+
+char *shl_strdup(const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *p;
+
+	p = shl_malloc(len);
+	if (p)
+		memcpy(p, str, len);
+	return p;
+}
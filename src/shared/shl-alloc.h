@@ -0,0 +1,36 @@
+/*
+ * SHL - Pluggable allocator
+ *
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Pluggable allocator
+ * All heap memory of the shared helpers and of libtsm is allocated through
+ * these functions. By default they forward to the C library, but
+ * shl_set_allocator() can redirect them process-wide to an arena, a
+ * per-terminal heap or a counting allocator in tests. It must be called
+ * before anything is allocated, as memory must be freed by the allocator it
+ * came from.
+ */
+
+#ifndef SHL_ALLOC_H
+#define SHL_ALLOC_H
+
+#include <stdlib.h>
+
+typedef void *(*shl_alloc_fn) (void *data, size_t size);
+typedef void *(*shl_realloc_fn) (void *data, void *ptr, size_t size);
+typedef void (*shl_free_fn) (void *data, void *ptr);
+
+/* NULL functions restore the C library allocator */
+void shl_set_allocator(shl_alloc_fn alloc_fn, shl_realloc_fn realloc_fn,
+		       shl_free_fn free_fn, void *data);
+
+void *shl_malloc(size_t size);
+void *shl_calloc(size_t nmemb, size_t size);
+void *shl_realloc(void *ptr, size_t size);
+void shl_free(void *ptr);
+char *shl_strdup(const char *str);
+
+#endif /* SHL_ALLOC_H */
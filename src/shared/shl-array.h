@@ -33,6 +33,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include "shl-alloc.h"
 
 struct shl_array {
 	size_t element_size;
@@ -55,7 +56,7 @@ static inline int shl_array_new(struct shl_array **out, size_t element_size,
 	if (!initial_size)
 		initial_size = 4;
 
-	arr = malloc(sizeof(*arr));
+	arr = shl_malloc(sizeof(*arr));
 	if (!arr)
 		return -ENOMEM;
 	memset(arr, 0, sizeof(*arr));
@@ -63,9 +64,9 @@ static inline int shl_array_new(struct shl_array **out, size_t element_size,
 	arr->length = 0;
 	arr->size = initial_size;
 
-	arr->data = malloc(arr->element_size * arr->size);
+	arr->data = shl_malloc(arr->element_size * arr->size);
 	if (!arr->data) {
-		free(arr);
+		shl_free(arr);
 		return -ENOMEM;
 	}
 
@@ -78,8 +79,8 @@ static inline void shl_array_free(struct shl_array *arr)
 	if (!arr)
 		return;
 
-	free(arr->data);
-	free(arr);
+	shl_free(arr->data);
+	shl_free(arr);
 }
 
 /* Compute next higher power-of-2 of @v. Returns 4 in case v is 0. */
@@ -109,7 +110,7 @@ static inline int shl_array_zresize(struct shl_array *arr, size_t size)
 
 	if (size > arr->size) {
 		newsize = shl_array_pow2(size);
-		tmp = realloc(arr->data, arr->element_size * newsize);
+		tmp = shl_realloc(arr->data, arr->element_size * newsize);
 		if (!tmp)
 			return -ENOMEM;
 
@@ -134,7 +135,7 @@ static inline int shl_array_push(struct shl_array *arr, const void *data)
 
 	if (arr->length >= arr->size) {
 		newsize = arr->size * 2;
-		tmp = realloc(arr->data, arr->element_size * newsize);
+		tmp = shl_realloc(arr->data, arr->element_size * newsize);
 		if (!tmp)
 			return -ENOMEM;
 
@@ -23,6 +23,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include "shl-alloc.h"
 #include "shl-htable.h"
 
 #define COLD __attribute__((cold))
@@ -112,7 +113,7 @@ static void htable_clear(struct htable *ht,
 			}
 		}
 
-		free((void *)ht->table);
+		shl_free((void *)ht->table);
 	}
 
 	htable_init(ht, ht->rehash, ht->priv);
@@ -189,7 +190,7 @@ static COLD bool double_table(struct htable *ht)
 	uintptr_t *oldtable, e;
 
 	oldtable = ht->table;
-	ht->table = calloc(1 << (ht->bits+1), sizeof(size_t));
+	ht->table = shl_calloc(1 << (ht->bits+1), sizeof(size_t));
 	if (!ht->table) {
 		ht->table = oldtable;
 		return false;
@@ -215,7 +216,7 @@ static COLD bool double_table(struct htable *ht)
 				ht_add(ht, p, ht->rehash(p, ht->priv));
 			}
 		}
-		free(oldtable);
+		shl_free(oldtable);
 	}
 	ht->deleted = 0;
 	return true;
@@ -0,0 +1,54 @@
+/*
+ * SHL - Library Log/Debug Interface
+ *
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * Runtime level and per call-site rate limiting of llog messages
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "shl-llog.h"
+
+unsigned int llog_level = LLOG_DEBUG;
+
+static uint64_t llog_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Call sites are shared by all threads, so the state is only touched
+ * atomically. Whoever starts a new interval collects the suppressed messages
+ * of the last one.
+ */
+bool llog_ratelimit(struct llog_ratelimit *rl, unsigned int *missed)
+{
+	uint64_t now, begin;
+
+	*missed = 0;
+	now = llog_now();
+	begin = __atomic_load_n(&rl->begin, __ATOMIC_RELAXED);
+	if (!begin || now - begin >= LLOG_RATELIMIT_INTERVAL) {
+		if (__atomic_compare_exchange_n(&rl->begin, &begin, now ? : 1,
+						false, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED)) {
+			__atomic_store_n(&rl->num, 0, __ATOMIC_RELAXED);
+			*missed = __atomic_exchange_n(&rl->missed, 0,
+						      __ATOMIC_RELAXED);
+		}
+	}
+
+	if (__atomic_add_fetch(&rl->num, 1, __ATOMIC_RELAXED) <=
+	    LLOG_RATELIMIT_BURST)
+		return true;
+
+	__atomic_add_fetch(&rl->missed, 1, __ATOMIC_RELAXED);
+	return false;
+}
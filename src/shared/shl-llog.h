@@ -58,6 +58,7 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 enum llog_severity {
@@ -109,45 +110,86 @@ static const char *LLOG_SUBSYSTEM __attribute__((__unused__));
 
 #define LLOG_DEFAULT __FILE__, __LINE__, __func__, LLOG_SUBSYSTEM
 
-#define llog_printf(obj, sev, format, ...) \
-	llog_format((obj)->llog, \
-		    (obj)->llog_data, \
-		    LLOG_DEFAULT, \
-		    (sev), \
-		    (format), \
-		    ##__VA_ARGS__)
+/*
+ * Filtering
+ * Messages less severe than LLOG_MAX_SEVERITY are compiled out, messages less
+ * severe than llog_level are dropped at runtime. Both checks, and the check for
+ * a missing log-function, happen before any argument of the message is
+ * evaluated. LLOG_MAX_SEVERITY is usually set via config.h, otherwise debug
+ * messages are only compiled in if BUILD_ENABLE_DEBUG is defined.
+ */
+
+#ifndef LLOG_MAX_SEVERITY
+	#ifdef BUILD_ENABLE_DEBUG
+		#define LLOG_MAX_SEVERITY LLOG_DEBUG
+	#else
+		#define LLOG_MAX_SEVERITY LLOG_INFO
+	#endif
+#endif
+
+extern unsigned int llog_level;
+
+#define llog_enabled(llog, sev) \
+	((sev) <= LLOG_MAX_SEVERITY && (sev) <= llog_level && (llog))
+
+/*
+ * Rate limiting
+ * Every call site may submit LLOG_RATELIMIT_BURST messages per
+ * LLOG_RATELIMIT_INTERVAL milliseconds. Further messages are dropped and
+ * counted, the next message that gets through reports the number first. This
+ * keeps a misbehaving client from flooding the log through a single
+ * diagnostic in the parser. Errors and more severe messages are never dropped;
+ * they point at bugs or broken resources rather than at client input.
+ * The state is static per call site, not per object, so all objects that log
+ * through the same call site share one limit.
+ */
+
+#define LLOG_RATELIMIT_INTERVAL 5000
+#define LLOG_RATELIMIT_BURST 10
+
+struct llog_ratelimit {
+	uint64_t begin;
+	unsigned int num;
+	unsigned int missed;
+};
+
+bool llog_ratelimit(struct llog_ratelimit *rl, unsigned int *missed);
+
 #define llog_dprintf(obj, data, sev, format, ...) \
-	llog_format((obj), \
-		    (data), \
-		    LLOG_DEFAULT, \
-		    (sev), \
-		    (format), \
-		    ##__VA_ARGS__)
-
-static inline __attribute__((format(printf, 4, 5)))
-void llog_dummyf(llog_submit_t llog, void *data, unsigned int sev,
-		 const char *format, ...)
-{
-}
+	({ \
+		static struct llog_ratelimit _llog_rl; \
+		unsigned int _llog_missed = 0; \
+		if (llog_enabled((obj), (sev)) && \
+		    ((sev) <= LLOG_ERROR || \
+		     llog_ratelimit(&_llog_rl, &_llog_missed))) { \
+			if (_llog_missed) \
+				llog_format((obj), (data), LLOG_DEFAULT, \
+					    (sev), \
+					    "%u similar messages suppressed", \
+					    _llog_missed); \
+			llog_format((obj), \
+				    (data), \
+				    LLOG_DEFAULT, \
+				    (sev), \
+				    (format), \
+				    ##__VA_ARGS__); \
+		} \
+	})
+#define llog_printf(obj, sev, format, ...) \
+	llog_dprintf((obj)->llog, (obj)->llog_data, (sev), (format), \
+		     ##__VA_ARGS__)
 
 /*
  * Helpers
  * They pick up all the default values and submit the message to the
  * llog-subsystem. The llog_debug() function will discard the message unless
- * BUILD_ENABLE_DEBUG is defined.
+ * debug messages are compiled in, see LLOG_MAX_SEVERITY.
  */
 
-#ifdef BUILD_ENABLE_DEBUG
-	#define llog_ddebug(obj, data, format, ...) \
-		llog_dprintf((obj), (data), LLOG_DEBUG, (format), ##__VA_ARGS__)
-	#define llog_debug(obj, format, ...) \
-		llog_ddebug((obj)->llog, (obj)->llog_data, (format), ##__VA_ARGS__)
-#else
-	#define llog_ddebug(obj, data, format, ...) \
-		llog_dummyf((obj), (data), LLOG_DEBUG, (format), ##__VA_ARGS__)
-	#define llog_debug(obj, format, ...) \
-		llog_ddebug((obj)->llog, (obj)->llog_data, (format), ##__VA_ARGS__)
-#endif
+#define llog_ddebug(obj, data, format, ...) \
+	llog_dprintf((obj), (data), LLOG_DEBUG, (format), ##__VA_ARGS__)
+#define llog_debug(obj, format, ...) \
+	llog_printf((obj), LLOG_DEBUG, (format), ##__VA_ARGS__)
 
 #define llog_info(obj, format, ...) \
 	llog_printf((obj), LLOG_INFO, (format), ##__VA_ARGS__)
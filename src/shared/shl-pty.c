@@ -19,16 +19,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/uio.h>
 #include <termios.h>
 #include <unistd.h>
+#include "shl-alloc.h"
 #include "shl-macro.h"
 #include "shl-pty.h"
 #include "shl-ring.h"
+#ifdef BUILD_HAVE_IO_URING
+#include "shl-uring.h"
+#endif
 
 #define SHL_PTY_BUFSIZE 16384
+#define SHL_PTY_BUFSIZE_MAX (1024 * 1024)
+#define SHL_PTY_READS 2
+#define SHL_PTY_SHRINK_DRAINS 8
+#define SHL_PTY_OUT_LOW (256 * 1024)
+#define SHL_PTY_OUT_HIGH (4 * 1024 * 1024)
 
 /*
  * PTY
@@ -56,14 +66,44 @@
  *
  * Note that shl_pty does not track SIGHUP, you need to do that yourself
  * and call shl_pty_close() once the client exited.
+ *
+ * Input is read straight into a heap buffer that is passed to the input
+ * callback, which may consume it in place. The buffer starts at
+ * SHL_PTY_BUFSIZE and doubles whenever the pty fills it, up to the limit of
+ * shl_pty_set_read_policy(). After SHL_PTY_SHRINK_DRAINS drains in a row
+ * without a full read, it shrinks to half its size again, so idle ptys fall
+ * back to the default while bursty ones do not reallocate on every dispatch.
+ *
+ * Both directions have watermarks. Writes that would grow the output queue
+ * beyond its high watermark fail with -ENOBUFS, and so does every write until
+ * the child read the queue down to the low watermark. For input, the caller
+ * reports how much parse or render work is pending. Once that reaches the
+ * high watermark, the pty is no longer read, so the kernel pty buffer fills
+ * up and blocks the child. Reading resumes at the low watermark.
  */
 
 struct shl_pty {
 	unsigned long ref;
 	int fd;
 	pid_t child;
-	char in_buf[SHL_PTY_BUFSIZE];
+	char *in_buf;
+	size_t in_size;
+	size_t in_max;
+	unsigned int in_reads;
+	unsigned int in_idle;		/* drains without a full read */
 	struct shl_ring out_buf;
+	size_t out_low;
+	size_t out_high;
+	bool out_full;
+
+	size_t in_low;
+	size_t in_high;
+	bool in_paused;
+
+	struct shl_pty_bridge *bridge;
+	struct shl_pty_bridge *uring;	/* io_uring with pending requests */
+	bool uring_read;
+	bool uring_poll;
 
 	shl_pty_input_fn fn_input;
 	void *fn_input_data;
@@ -198,15 +238,25 @@ pid_t shl_pty_open(struct shl_pty **out,
 	if (!out)
 		return -EINVAL;
 
-	pty = calloc(1, sizeof(*pty));
+	pty = shl_calloc(1, sizeof(*pty));
 	if (!pty)
 		return -ENOMEM;
 
 	pty->ref = 1;
 	pty->fd = -1;
+	pty->in_size = SHL_PTY_BUFSIZE;
+	pty->in_max = SHL_PTY_BUFSIZE_MAX;
+	pty->in_reads = SHL_PTY_READS;
+	pty->out_low = SHL_PTY_OUT_LOW;
+	pty->out_high = SHL_PTY_OUT_HIGH;
 	pty->fn_input = fn_input;
 	pty->fn_input_data = fn_input_data;
 
+	/* one more byte for the terminating zero */
+	pty->in_buf = shl_malloc(pty->in_size + 1);
+	if (!pty->in_buf)
+		return -ENOMEM;
+
 	fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC | O_NONBLOCK);
 	if (fd < 0)
 		return -errno;
@@ -231,7 +281,8 @@ pid_t shl_pty_open(struct shl_pty **out,
 		close(comm[0]);
 		close(fd);
 		fd = -1;
-		free(pty);
+		shl_free(pty->in_buf);
+		shl_free(pty);
 		pty = NULL;
 
 		r = pty_setup_child(slave, term_width, term_height);
@@ -283,7 +334,8 @@ void shl_pty_unref(struct shl_pty *pty)
 
 	shl_pty_close(pty);
 	shl_ring_clear(&pty->out_buf);
-	free(pty);
+	shl_free(pty->in_buf);
+	shl_free(pty);
 }
 
 void shl_pty_close(struct shl_pty *pty)
@@ -347,44 +399,88 @@ static int pty_write(struct shl_pty *pty)
 			return -EPIPE;
 		} else {
 			shl_ring_pull(&pty->out_buf, (size_t)r);
+			if (shl_ring_get_size(&pty->out_buf) <= pty->out_low)
+				pty->out_full = false;
 		}
 	}
 
 	return shl_ring_get_size(&pty->out_buf) > 0 ? -EAGAIN : 0;
 }
 
+static void pty_resize_in(struct shl_pty *pty, size_t size)
+{
+	char *buf;
+
+	/* keep the current buffer if we cannot get another one */
+	buf = shl_realloc(pty->in_buf, size + 1);
+	if (!buf)
+		return;
+
+	pty->in_buf = buf;
+	pty->in_size = size;
+}
+
 static int pty_read(struct shl_pty *pty)
 {
 	unsigned int i;
+	size_t pos;
 	ssize_t len;
+	bool full = false;
+	int r = 0;
 
 	/*
 	 * We're edge-triggered, means we need to read the whole queue. This,
 	 * however, might cause us to stall if the writer is faster than we
-	 * are. Therefore, we read twice and if the second read still returned
-	 * data, we return -EAGAIN and let the caller deal with rescheduling the
-	 * dispatcher.
+	 * are. Therefore, we fill the buffer at most in_reads times and if the
+	 * last time still filled it, we return -EAGAIN and let the caller deal
+	 * with rescheduling the dispatcher. in_reads of 0 reads until the
+	 * queue is empty.
+	 * The tty layer hands out at most a few KiB per read(), so the buffer
+	 * is filled with as many reads as it takes.
 	 */
 
-	for (i = 0; i < 2; ++i) {
-		len = read(pty->fd, pty->in_buf, sizeof(pty->in_buf) - 1);
-		if (len < 0) {
-			if (errno == EAGAIN)
-				return 0;
-			if (errno == EINTR)
-				return -EAGAIN;
+	for (i = 0; !pty->in_reads || i < pty->in_reads; ++i) {
+		for (pos = 0; pos < pty->in_size; pos += len) {
+			len = read(pty->fd, pty->in_buf + pos,
+				   pty->in_size - pos);
+			if (len <= 0) {
+				r = len < 0 ? -errno : -EPIPE;
+				break;
+			}
+		}
 
-			return -errno;
-		} else if (!len) {
-			return -EPIPE;
-		} else if (len > 0 && pty->fn_input) {
+		if (pos && pty->fn_input) {
 			/* set terminating zero for debugging safety */
-			pty->in_buf[len] = 0;
+			pty->in_buf[pos] = 0;
 			pty->fn_input(pty,
 				      pty->fn_input_data,
 				      pty->in_buf,
-				      len);
+				      pos);
 		}
+
+		/* the writer keeps up, read more at once next time */
+		if (pos == pty->in_size) {
+			full = true;
+			if (pty->in_size < pty->in_max)
+				pty_resize_in(pty, shl_min(pty->in_size * 2,
+							   pty->in_max));
+			continue;
+		}
+
+		if (r == -EAGAIN) {
+			if (full || pty->in_size <= SHL_PTY_BUFSIZE) {
+				pty->in_idle = 0;
+			} else if (++pty->in_idle >= SHL_PTY_SHRINK_DRAINS) {
+				pty->in_idle = 0;
+				pty_resize_in(pty,
+					      shl_max_t(size_t,
+							pty->in_size / 2,
+							SHL_PTY_BUFSIZE));
+			}
+			return 0;
+		}
+
+		return r == -EINTR ? -EAGAIN : r;
 	}
 
 	return -EAGAIN;
@@ -397,19 +493,123 @@ int shl_pty_dispatch(struct shl_pty *pty)
 	if (!shl_pty_is_open(pty))
 		return -ENODEV;
 
-	r = pty_read(pty);
+	r = pty->in_paused ? 0 : pty_read(pty);
 	pty_write(pty);
 	return r;
 }
 
+/*
+ * Limit reads of @pty to @max_size bytes at once and @max_reads reads per
+ * dispatch, 0 reads until the pty is drained. @max_size cannot go below
+ * SHL_PTY_BUFSIZE.
+ */
+int shl_pty_set_read_policy(struct shl_pty *pty,
+			    size_t max_size,
+			    unsigned int max_reads)
+{
+	if (!pty || max_size < SHL_PTY_BUFSIZE)
+		return -EINVAL;
+
+	pty->in_max = max_size;
+	pty->in_reads = max_reads;
+	if (pty->in_size > max_size)
+		pty_resize_in(pty, max_size);
+
+	return 0;
+}
+
+/* return the size of the next read of @pty */
+size_t shl_pty_get_read_size(struct shl_pty *pty)
+{
+	return pty ? pty->in_size : 0;
+}
+
+/*
+ * Set the output watermarks of @pty, a @high of 0 disables the limit.
+ * Defaults are SHL_PTY_OUT_LOW and SHL_PTY_OUT_HIGH.
+ */
+int shl_pty_set_out_watermarks(struct shl_pty *pty, size_t low, size_t high)
+{
+	if (!pty || (high && low > high))
+		return -EINVAL;
+
+	pty->out_low = low;
+	pty->out_high = high;
+	if (!high || shl_ring_get_size(&pty->out_buf) <= low)
+		pty->out_full = false;
+
+	return 0;
+}
+
+bool shl_pty_is_full(struct shl_pty *pty)
+{
+	return pty && pty->out_full;
+}
+
 int shl_pty_write(struct shl_pty *pty, const char *u8, size_t len)
 {
 	if (!shl_pty_is_open(pty))
 		return -ENODEV;
 
+	if (pty->out_high) {
+		if (!pty->out_full &&
+		    len > pty->out_high - shl_min(pty->out_high,
+					shl_ring_get_size(&pty->out_buf)))
+			pty->out_full = true;
+		if (pty->out_full)
+			return -ENOBUFS;
+	}
+
 	return shl_ring_push(&pty->out_buf, u8, len);
 }
 
+static void pty_bridge_update(struct shl_pty *pty);
+
+/*
+ * Set the input watermarks of @pty, a @high of 0 disables them. The pending
+ * work is reported with shl_pty_set_in_pending(), in whatever unit the caller
+ * likes.
+ */
+int shl_pty_set_in_watermarks(struct shl_pty *pty, size_t low, size_t high)
+{
+	if (!pty || (high && low > high))
+		return -EINVAL;
+
+	pty->in_low = low;
+	pty->in_high = high;
+	if (!high && pty->in_paused) {
+		pty->in_paused = false;
+		pty_bridge_update(pty);
+	}
+
+	return 0;
+}
+
+void shl_pty_set_in_pending(struct shl_pty *pty, size_t pending)
+{
+	bool paused;
+
+	if (!pty || !pty->in_high)
+		return;
+
+	if (pending >= pty->in_high)
+		paused = true;
+	else if (pending <= pty->in_low)
+		paused = false;
+	else
+		return;
+
+	if (paused != pty->in_paused) {
+		pty->in_paused = paused;
+		pty_bridge_update(pty);
+	}
+}
+
+bool shl_pty_is_paused(struct shl_pty *pty)
+{
+	return pty && pty->in_paused;
+}
+
 int shl_pty_signal(struct shl_pty *pty, int sig)
 {
 	if (!shl_pty_is_open(pty))
@@ -446,45 +646,421 @@ int shl_pty_resize(struct shl_pty *pty,
  * This interface is provided to allow integration of PTYs into event-loops
  * that do not support edge-triggered interfaces. There is no other reason
  * to use this bridge.
+ *
+ * If the kernel supports multishot reads and provided buffer rings, the
+ * bridge is an io_uring instead of an epoll-set. Each pty then has a single
+ * multishot read pending, which the kernel completes into buffers of a ring
+ * shared by all ptys of the bridge. This needs no read() per chunk and no
+ * re-arming of edge-triggered events. Output is still written directly, a
+ * poll request is only queued while the pty is full. The read policy of a pty
+ * does not apply in this mode.
+ *
+ * Every pending request holds a reference to its pty. Removing a pty cancels
+ * its requests, the references are dropped as the completions come in. Ptys
+ * must be removed before they are closed, pending requests keep the file
+ * open otherwise.
+ *
+ * A pty has at most one read and one poll request pending, so the pty and the
+ * operation in the user_data identify a request, and its flag is only cleared
+ * by its final completion. Anything that needs a new request while the old one
+ * is still being cancelled, like re-adding a pty right after removing it or
+ * resuming right after a pause, leaves it to that completion to re-arm. A pty
+ * cannot be added to another bridge until all its requests completed.
  */
 
-int shl_pty_bridge_new(void)
-{
+#define SHL_PTY_URING_ENTRIES 256
+#define SHL_PTY_URING_BUFS 64
+#define SHL_PTY_URING_GROUP 0
+
+enum bridge_op {
+	BRIDGE_OP_READ,
+	BRIDGE_OP_POLL,
+	BRIDGE_OP_MASK = 3,
+};
+
+struct shl_pty_bridge {
 	int fd;
+	unsigned int batch;
+	struct epoll_event *events;	/* NULL for io_uring */
+
+#ifdef BUILD_HAVE_IO_URING
+	bool uring;
+	bool closing;
+	unsigned long inflight;
+	struct shl_uring ring;
+#endif
+};
 
-	fd = epoll_create1(EPOLL_CLOEXEC);
-	if (fd < 0)
-		return -errno;
+static uint32_t bridge_epoll_events(struct shl_pty *pty)
+{
+	uint32_t events = EPOLLHUP | EPOLLERR | EPOLLOUT | EPOLLET;
+
+	return pty->in_paused ? events : events | EPOLLIN;
+}
+
+#ifdef BUILD_HAVE_IO_URING
+
+static int bridge_uring_init(struct shl_pty_bridge *bridge)
+{
+	struct shl_uring *u = &bridge->ring;
+	int r;
+
+	r = shl_uring_init(u, SHL_PTY_URING_ENTRIES);
+	if (r < 0)
+		return r;
+
+	if (!(u->features & IORING_FEAT_EXT_ARG) ||
+	    !shl_uring_has_op(u, SHL_URING_OP_READ_MULTISHOT) ||
+	    !shl_uring_has_op(u, IORING_OP_POLL_ADD) ||
+	    !shl_uring_has_op(u, IORING_OP_ASYNC_CANCEL)) {
+		r = -EOPNOTSUPP;
+		goto error;
+	}
+
+	r = shl_uring_bufs_init(u, SHL_PTY_URING_GROUP, SHL_PTY_URING_BUFS,
+				SHL_PTY_BUFSIZE);
+	if (r < 0)
+		goto error;
+
+	bridge->uring = true;
+	bridge->fd = u->fd;
+	return 0;
+
+error:
+	shl_uring_deinit(u);
+	return r;
+}
+
+static struct io_uring_sqe *bridge_uring_sqe(struct shl_pty_bridge *bridge,
+					     struct shl_pty *pty,
+					     enum bridge_op op)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = shl_uring_get_sqe(&bridge->ring);
+	if (!sqe)
+		return NULL;
+
+	sqe->fd = pty->fd;
+	sqe->user_data = (uint64_t)(uintptr_t)pty | op;
+	shl_pty_ref(pty);
+	pty->uring = bridge;
+	++bridge->inflight;
+	return sqe;
+}
+
+static int bridge_uring_read(struct shl_pty_bridge *bridge,
+			     struct shl_pty *pty)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = bridge_uring_sqe(bridge, pty, BRIDGE_OP_READ);
+	if (!sqe)
+		return -EBUSY;
 
-	return fd;
+	sqe->opcode = SHL_URING_OP_READ_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = SHL_PTY_URING_GROUP;
+	pty->uring_read = true;
+	return 0;
 }
 
-void shl_pty_bridge_free(int bridge)
+static int bridge_uring_poll(struct shl_pty_bridge *bridge,
+			     struct shl_pty *pty)
 {
-	if (bridge < 0)
+	struct io_uring_sqe *sqe;
+	uint32_t events = POLLOUT;
+
+	sqe = bridge_uring_sqe(bridge, pty, BRIDGE_OP_POLL);
+	if (!sqe)
+		return -EBUSY;
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = (events << 16) | (events >> 16);
+#endif
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->poll32_events = events;
+	pty->uring_poll = true;
+	return 0;
+}
+
+static void bridge_uring_cancel(struct shl_pty_bridge *bridge,
+				int fd,
+				uint64_t data,
+				unsigned int flags)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = shl_uring_get_sqe(&bridge->ring);
+	if (!sqe)
 		return;
 
-	close(bridge);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = fd;
+	sqe->addr = data;
+	sqe->cancel_flags = flags;
+	shl_uring_submit(&bridge->ring, false, 0);
 }
 
-int shl_pty_bridge_dispatch_pty(int bridge, struct shl_pty *pty)
+static bool bridge_uring_attached(struct shl_pty_bridge *bridge,
+				  struct shl_pty *pty)
+{
+	return !bridge->closing && pty->bridge == bridge &&
+	       shl_pty_is_open(pty);
+}
+
+static void bridge_uring_write(struct shl_pty_bridge *bridge,
+			       struct shl_pty *pty)
+{
+	/* wait for POLLOUT if the pty could not take everything */
+	pty_write(pty);
+	if (shl_ring_get_size(&pty->out_buf) > 0 && !pty->uring_poll)
+		bridge_uring_poll(bridge, pty);
+}
+
+static void bridge_uring_complete(struct shl_pty_bridge *bridge,
+				  uint64_t data,
+				  int res,
+				  unsigned int flags)
+{
+	struct shl_pty *pty;
+	unsigned int op, bid;
+	char *buf;
+
+	pty = (void *)(uintptr_t)(data & ~(uint64_t)BRIDGE_OP_MASK);
+	op = data & BRIDGE_OP_MASK;
+
+	/* completion of a cancel request */
+	if (!pty)
+		return;
+
+	if (op == BRIDGE_OP_READ && (flags & IORING_CQE_F_BUFFER)) {
+		bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		buf = shl_uring_bufs_get(&bridge->ring, bid);
+		if (res > 0 && bridge_uring_attached(bridge, pty) &&
+		    pty->fn_input) {
+			/* set terminating zero for debugging safety */
+			buf[res] = 0;
+			pty->fn_input(pty, pty->fn_input_data, buf, res);
+		}
+		shl_uring_bufs_recycle(&bridge->ring, bid);
+	}
+
+	if (flags & IORING_CQE_F_MORE)
+		return;
+
+	/*
+	 * The request is done, re-arm it unless the pty hung up. A cancelled
+	 * read is re-armed, too, if the pty was re-added or resumed since.
+	 */
+	--bridge->inflight;
+	if (op == BRIDGE_OP_READ) {
+		pty->uring_read = false;
+		if (bridge_uring_attached(bridge, pty) && !pty->in_paused &&
+		    (res > 0 || res == -ENOBUFS || res == -EAGAIN ||
+		     res == -EINTR || res == -ECANCELED))
+			bridge_uring_read(bridge, pty);
+	} else {
+		pty->uring_poll = false;
+		if (bridge_uring_attached(bridge, pty))
+			bridge_uring_write(bridge, pty);
+	}
+
+	if (!pty->uring_read && !pty->uring_poll)
+		pty->uring = NULL;
+	shl_pty_unref(pty);
+}
+
+static void bridge_uring_reap(struct shl_pty_bridge *bridge,
+			      unsigned int max)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int i, flags;
+	uint64_t data;
+	int res;
+
+	for (i = 0; i < max; ++i) {
+		cqe = shl_uring_peek_cqe(&bridge->ring);
+		if (!cqe)
+			break;
+
+		data = cqe->user_data;
+		res = cqe->res;
+		flags = cqe->flags;
+		shl_uring_cqe_seen(&bridge->ring);
+
+		bridge_uring_complete(bridge, data, res, flags);
+	}
+}
+
+static int bridge_uring_dispatch(struct shl_pty_bridge *bridge, int timeout)
+{
+	bool wait;
+	int r;
+
+	wait = timeout && !shl_uring_peek_cqe(&bridge->ring);
+	r = shl_uring_submit(&bridge->ring, wait, timeout);
+	if (r < 0)
+		return r;
+
+	bridge_uring_reap(bridge, bridge->batch);
+
+	/* submit re-armed requests */
+	r = shl_uring_submit(&bridge->ring, false, 0);
+	return r < 0 ? r : 0;
+}
+
+static void bridge_uring_free(struct shl_pty_bridge *bridge)
+{
+	bridge->closing = true;
+	bridge_uring_cancel(bridge, -1, 0, IORING_ASYNC_CANCEL_ANY);
+
+	/* wait for all requests to drop their pty references */
+	while (bridge->inflight) {
+		if (shl_uring_submit(&bridge->ring, true, -1) < 0)
+			break;
+		bridge_uring_reap(bridge, UINT_MAX);
+	}
+
+	shl_uring_deinit(&bridge->ring);
+}
+
+#endif /* BUILD_HAVE_IO_URING */
+
+int shl_pty_bridge_new(struct shl_pty_bridge **out, unsigned int flags)
+{
+	struct shl_pty_bridge *bridge;
+	int r;
+
+	if (!out)
+		return -EINVAL;
+
+	bridge = shl_calloc(1, sizeof(*bridge));
+	if (!bridge)
+		return -ENOMEM;
+
+	bridge->fd = -1;
+	bridge->batch = SHL_PTY_BRIDGE_EVENTS;
+
+#ifdef BUILD_HAVE_IO_URING
+	if (!(flags & SHL_PTY_BRIDGE_EPOLL) && bridge_uring_init(bridge) >= 0) {
+		*out = bridge;
+		return 0;
+	}
+#endif
+
+	bridge->events = shl_calloc(bridge->batch, sizeof(*bridge->events));
+	if (!bridge->events) {
+		r = -ENOMEM;
+		goto error;
+	}
+
+	bridge->fd = epoll_create1(EPOLL_CLOEXEC);
+	if (bridge->fd < 0) {
+		r = -errno;
+		goto error;
+	}
+
+	*out = bridge;
+	return 0;
+
+error:
+	shl_free(bridge->events);
+	shl_free(bridge);
+	return r;
+}
+
+void shl_pty_bridge_free(struct shl_pty_bridge *bridge)
+{
+	if (!bridge)
+		return;
+
+#ifdef BUILD_HAVE_IO_URING
+	if (bridge->uring)
+		bridge_uring_free(bridge);
+	else
+#endif
+		close(bridge->fd);
+
+	shl_free(bridge->events);
+	shl_free(bridge);
+}
+
+int shl_pty_bridge_get_fd(struct shl_pty_bridge *bridge)
+{
+	if (!bridge)
+		return -EINVAL;
+
+	return bridge->fd;
+}
+
+bool shl_pty_bridge_is_uring(struct shl_pty_bridge *bridge)
+{
+#ifdef BUILD_HAVE_IO_URING
+	return bridge && bridge->uring;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Dispatch at most @num ready ptys, or completions with io_uring, per call
+ * of shl_pty_bridge_dispatch().
+ */
+int shl_pty_bridge_set_batch(struct shl_pty_bridge *bridge, unsigned int num)
+{
+	struct epoll_event *events;
+
+	if (!bridge || !num || num > INT_MAX)
+		return -EINVAL;
+
+	if (bridge->events) {
+		events = shl_realloc(bridge->events, num * sizeof(*events));
+		if (!events)
+			return -ENOMEM;
+		bridge->events = events;
+	}
+
+	bridge->batch = num;
+	return 0;
+}
+
+int shl_pty_bridge_dispatch_pty(struct shl_pty_bridge *bridge,
+				struct shl_pty *pty)
 {
 	struct epoll_event up;
 	int r;
 
-	if (bridge < 0 || !pty)
+	if (!bridge || !pty)
 		return -EINVAL;
 
+#ifdef BUILD_HAVE_IO_URING
+	if (bridge->uring) {
+		if (!bridge_uring_attached(bridge, pty))
+			return 0;
+
+		/* reading stops on hangup, try again */
+		if (!pty->uring_read && !pty->in_paused)
+			bridge_uring_read(bridge, pty);
+		bridge_uring_write(bridge, pty);
+
+		r = shl_uring_submit(&bridge->ring, false, 0);
+		return r < 0 ? r : 0;
+	}
+#endif
+
 	r = shl_pty_dispatch(pty);
-	if (r == -EAGAIN) {
+	if (r == -EAGAIN && shl_pty_is_open(pty)) {
 		/* EAGAIN means we couldn't dispatch data fast enough. Modify
 		 * the fd in the epoll-set so we get edge-triggered events
-		 * next round. */
+		 * next round. This queues the pty behind all others that are
+		 * ready already, so a flooding pty cannot starve them. */
 		memset(&up, 0, sizeof(up));
-		up.events = EPOLLHUP | EPOLLERR | EPOLLIN | EPOLLOUT | EPOLLET;
+		up.events = bridge_epoll_events(pty);
 		up.data.ptr = pty;
-		epoll_ctl(bridge,
-			  EPOLL_CTL_ADD,
+		epoll_ctl(bridge->fd,
+			  EPOLL_CTL_MOD,
 			  shl_pty_get_fd(pty),
 			  &up);
 	}
@@ -492,16 +1068,26 @@ int shl_pty_bridge_dispatch_pty(int bridge, struct shl_pty *pty)
 	return 0;
 }
 
-int shl_pty_bridge_dispatch(int bridge, int timeout)
+/*
+ * Each ready pty gets the budget of one shl_pty_dispatch() per call, ptys with
+ * data left are re-armed and come back after every other ready pty had its
+ * turn. Input callbacks must not free other ptys of the bridge, their events
+ * may still be pending.
+ */
+int shl_pty_bridge_dispatch(struct shl_pty_bridge *bridge, int timeout)
 {
-	struct epoll_event ev;
-	struct shl_pty *pty;
-	int r;
+	int r, i;
 
-	if (bridge < 0)
+	if (!bridge)
 		return -EINVAL;
 
-	r = epoll_wait(bridge, &ev, 1, timeout);
+#ifdef BUILD_HAVE_IO_URING
+	if (bridge->uring)
+		return bridge_uring_dispatch(bridge, timeout);
+#endif
+
+	r = epoll_wait(bridge->fd, bridge->events, (int)bridge->batch,
+		       timeout);
 	if (r < 0) {
 		if (errno == EAGAIN || errno == EINTR)
 			return 0;
@@ -509,44 +1095,109 @@ int shl_pty_bridge_dispatch(int bridge, int timeout)
 		return -errno;
 	}
 
-	if (!r)
-		return 0;
+	for (i = 0; i < r; ++i)
+		shl_pty_bridge_dispatch_pty(bridge, bridge->events[i].data.ptr);
 
-	pty = ev.data.ptr;
-	return shl_pty_bridge_dispatch_pty(bridge, pty);
+	return 0;
 }
 
-int shl_pty_bridge_add(int bridge, struct shl_pty *pty)
+int shl_pty_bridge_add(struct shl_pty_bridge *bridge, struct shl_pty *pty)
 {
 	struct epoll_event ev;
 	int r;
 
-	if (bridge < 0)
+	if (!bridge)
 		return -EINVAL;
 	if (!shl_pty_is_open(pty))
 		return -ENODEV;
+	if (pty->bridge)
+		return -EALREADY;
+	/* requests of a previous bridge are not cancelled yet */
+	if (pty->uring && pty->uring != bridge)
+		return -EBUSY;
+
+#ifdef BUILD_HAVE_IO_URING
+	if (bridge->uring) {
+		pty->bridge = bridge;
+		r = 0;
+		if (!pty->in_paused && !pty->uring_read)
+			r = bridge_uring_read(bridge, pty);
+		if (r >= 0)
+			r = shl_uring_submit(&bridge->ring, false, 0);
+		if (r < 0) {
+			pty->bridge = NULL;
+			return r;
+		}
+
+		return 0;
+	}
+#endif
 
 	memset(&ev, 0, sizeof(ev));
-	ev.events = EPOLLHUP | EPOLLERR | EPOLLIN | EPOLLOUT | EPOLLET;
+	ev.events = bridge_epoll_events(pty);
 	ev.data.ptr = pty;
 
-	r = epoll_ctl(bridge,
+	r = epoll_ctl(bridge->fd,
 		      EPOLL_CTL_ADD,
 		      shl_pty_get_fd(pty),
 		      &ev);
 	if (r < 0)
 		return -errno;
 
+	pty->bridge = bridge;
 	return 0;
 }
 
-void shl_pty_bridge_remove(int bridge, struct shl_pty *pty)
+void shl_pty_bridge_remove(struct shl_pty_bridge *bridge, struct shl_pty *pty)
 {
-	if (bridge < 0 || !shl_pty_is_open(pty))
+	if (!bridge || !pty || pty->bridge != bridge)
+		return;
+
+	pty->bridge = NULL;
+	if (!shl_pty_is_open(pty))
+		return;
+
+#ifdef BUILD_HAVE_IO_URING
+	if (bridge->uring) {
+		if (pty->uring_read || pty->uring_poll)
+			bridge_uring_cancel(bridge, pty->fd, 0,
+					    IORING_ASYNC_CANCEL_FD |
+					    IORING_ASYNC_CANCEL_ALL);
 		return;
+	}
+#endif
 
-	epoll_ctl(bridge,
+	epoll_ctl(bridge->fd,
 		  EPOLL_CTL_DEL,
 		  shl_pty_get_fd(pty),
 		  NULL);
 }
+
+/* stop or resume reading after the input watermarks were crossed */
+static void pty_bridge_update(struct shl_pty *pty)
+{
+	struct shl_pty_bridge *bridge = pty->bridge;
+	struct epoll_event up;
+
+	if (!bridge || !shl_pty_is_open(pty))
+		return;
+
+#ifdef BUILD_HAVE_IO_URING
+	if (bridge->uring) {
+		if (pty->in_paused && pty->uring_read)
+			bridge_uring_cancel(bridge, -1,
+					    (uint64_t)(uintptr_t)pty |
+					    BRIDGE_OP_READ, 0);
+		else if (!pty->in_paused && !pty->uring_read &&
+			 bridge_uring_read(bridge, pty) >= 0)
+			shl_uring_submit(&bridge->ring, false, 0);
+		return;
+	}
+#endif
+
+	/* modifying the set re-checks the fd, so we get an edge on resume */
+	memset(&up, 0, sizeof(up));
+	up.events = bridge_epoll_events(pty);
+	up.data.ptr = pty;
+	epoll_ctl(bridge->fd, EPOLL_CTL_MOD, pty->fd, &up);
+}
@@ -50,7 +50,16 @@ int shl_pty_get_fd(struct shl_pty *pty);
 pid_t shl_pty_get_child(struct shl_pty *pty);
 
 int shl_pty_dispatch(struct shl_pty *pty);
+int shl_pty_set_read_policy(struct shl_pty *pty,
+			    size_t max_size,
+			    unsigned int max_reads);
+size_t shl_pty_get_read_size(struct shl_pty *pty);
+int shl_pty_set_out_watermarks(struct shl_pty *pty, size_t low, size_t high);
+bool shl_pty_is_full(struct shl_pty *pty);
 int shl_pty_write(struct shl_pty *pty, const char *u8, size_t len);
+int shl_pty_set_in_watermarks(struct shl_pty *pty, size_t low, size_t high);
+void shl_pty_set_in_pending(struct shl_pty *pty, size_t pending);
+bool shl_pty_is_paused(struct shl_pty *pty);
 int shl_pty_signal(struct shl_pty *pty, int sig);
 int shl_pty_resize(struct shl_pty *pty,
 		   unsigned short term_width,
@@ -58,12 +67,25 @@ int shl_pty_resize(struct shl_pty *pty,
 
 /* pty bridge */
 
-int shl_pty_bridge_new(void);
-void shl_pty_bridge_free(int bridge);
+/* ready ptys dispatched per shl_pty_bridge_dispatch() by default */
+#define SHL_PTY_BRIDGE_EVENTS 64
 
-int shl_pty_bridge_dispatch_pty(int bridge, struct shl_pty *pty);
-int shl_pty_bridge_dispatch(int bridge, int timeout);
-int shl_pty_bridge_add(int bridge, struct shl_pty *pty);
-void shl_pty_bridge_remove(int bridge, struct shl_pty *pty);
+struct shl_pty_bridge;
+
+enum shl_pty_bridge_flags {
+	SHL_PTY_BRIDGE_EPOLL = 1,	/* never use io_uring */
+};
+
+int shl_pty_bridge_new(struct shl_pty_bridge **out, unsigned int flags);
+void shl_pty_bridge_free(struct shl_pty_bridge *bridge);
+int shl_pty_bridge_get_fd(struct shl_pty_bridge *bridge);
+bool shl_pty_bridge_is_uring(struct shl_pty_bridge *bridge);
+int shl_pty_bridge_set_batch(struct shl_pty_bridge *bridge, unsigned int num);
+
+int shl_pty_bridge_dispatch_pty(struct shl_pty_bridge *bridge,
+				struct shl_pty *pty);
+int shl_pty_bridge_dispatch(struct shl_pty_bridge *bridge, int timeout);
+int shl_pty_bridge_add(struct shl_pty_bridge *bridge, struct shl_pty *pty);
+void shl_pty_bridge_remove(struct shl_pty_bridge *bridge, struct shl_pty *pty);
 
 #endif  /* SHL_PTY_H */
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/uio.h>
+#include "shl-alloc.h"
 #include "shl-macro.h"
 #include "shl-ring.h"
 
@@ -26,7 +27,7 @@ void shl_ring_flush(struct shl_ring *r)
 
 void shl_ring_clear(struct shl_ring *r)
 {
-	free(r->buf);
+	shl_free(r->buf);
 	memset(r, 0, sizeof(*r));
 }
 
@@ -97,7 +98,7 @@ static int ring_resize(struct shl_ring *r, size_t nsize)
 	uint8_t *buf;
 	size_t l;
 
-	buf = malloc(nsize);
+	buf = shl_malloc(nsize);
 	if (!buf)
 		return -ENOMEM;
 
@@ -111,7 +112,7 @@ static int ring_resize(struct shl_ring *r, size_t nsize)
 		}
 	}
 
-	free(r->buf);
+	shl_free(r->buf);
 	r->buf = buf;
 	r->size = nsize;
 	r->start = 0;
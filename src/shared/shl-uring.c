@@ -0,0 +1,292 @@
+/*
+ * SHL - io_uring helpers
+ *
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * io_uring helpers
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "shl-alloc.h"
+#include "shl-uring.h"
+
+/* completion queue size relative to the submission queue */
+#define SHL_URING_CQ_FACTOR 8
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	int r;
+
+	r = syscall(__NR_io_uring_setup, entries, p);
+	return r < 0 ? -errno : r;
+}
+
+static int uring_enter(int fd, unsigned int to_submit, unsigned int min,
+		       unsigned int flags, void *arg, size_t argsz)
+{
+	int r;
+
+	r = syscall(__NR_io_uring_enter, fd, to_submit, min, flags, arg,
+		    argsz);
+	return r < 0 ? -errno : r;
+}
+
+static int uring_register(int fd, unsigned int op, void *arg,
+			  unsigned int nr)
+{
+	int r;
+
+	r = syscall(__NR_io_uring_register, fd, op, arg, nr);
+	return r < 0 ? -errno : r;
+}
+
+int shl_uring_init(struct shl_uring *u, unsigned int entries)
+{
+	struct io_uring_params p;
+	size_t sq_size, cq_size;
+	unsigned int i, *array;
+	char *map;
+	int r;
+
+	memset(u, 0, sizeof(*u));
+	u->fd = -1;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = entries * SHL_URING_CQ_FACTOR;
+
+	r = uring_setup(entries, &p);
+	if (r < 0)
+		return r;
+
+	u->fd = r;
+	u->features = p.features;
+
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		r = -EOPNOTSUPP;
+		goto error;
+	}
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->map_size = sq_size > cq_size ? sq_size : cq_size;
+
+	map = mmap(NULL, u->map_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (map == MAP_FAILED) {
+		r = -errno;
+		goto error;
+	}
+	u->map = map;
+
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		r = -errno;
+		goto error;
+	}
+
+	u->sq_head = (void *)(map + p.sq_off.head);
+	u->sq_tail = (void *)(map + p.sq_off.tail);
+	u->sq_mask = *(unsigned int *)(map + p.sq_off.ring_mask);
+	u->sq_entries = p.sq_entries;
+	u->sq_local = *u->sq_tail;
+
+	/* sqes are always used in ring order */
+	array = (void *)(map + p.sq_off.array);
+	for (i = 0; i < p.sq_entries; ++i)
+		array[i] = i;
+
+	u->cq_head = (void *)(map + p.cq_off.head);
+	u->cq_tail = (void *)(map + p.cq_off.tail);
+	u->cq_mask = *(unsigned int *)(map + p.cq_off.ring_mask);
+	u->cqes = (void *)(map + p.cq_off.cqes);
+
+	return 0;
+
+error:
+	shl_uring_deinit(u);
+	return r;
+}
+
+void shl_uring_deinit(struct shl_uring *u)
+{
+	/* closing the ring drops the buffer registration, unmap afterwards */
+	if (u->fd >= 0)
+		close(u->fd);
+	if (u->br)
+		munmap(u->br, u->br_size);
+	shl_free(u->bufs);
+	if (u->sqes)
+		munmap(u->sqes, u->sqes_size);
+	if (u->map)
+		munmap(u->map, u->map_size);
+
+	memset(u, 0, sizeof(*u));
+	u->fd = -1;
+}
+
+bool shl_uring_has_op(struct shl_uring *u, unsigned int op)
+{
+	struct io_uring_probe *probe;
+	bool ret = false;
+	size_t size;
+
+	size = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+	probe = shl_calloc(1, size);
+	if (!probe)
+		return false;
+
+	if (uring_register(u->fd, IORING_REGISTER_PROBE, probe, 256) >= 0)
+		ret = op <= probe->last_op && op < probe->ops_len &&
+		      (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+
+	shl_free(probe);
+	return ret;
+}
+
+struct io_uring_sqe *shl_uring_get_sqe(struct shl_uring *u)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head;
+
+	head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (u->sq_local - head >= u->sq_entries) {
+		shl_uring_submit(u, false, 0);
+		head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+		if (u->sq_local - head >= u->sq_entries)
+			return NULL;
+	}
+
+	sqe = &u->sqes[u->sq_local & u->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	++u->sq_local;
+	return sqe;
+}
+
+int shl_uring_submit(struct shl_uring *u, bool wait, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int flags = 0, tail;
+	int r;
+
+	tail = *u->sq_tail;
+	__atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+
+	if (!wait && tail == u->sq_local)
+		return 0;
+
+	if (wait && timeout >= 0) {
+		memset(&arg, 0, sizeof(arg));
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000LL;
+		arg.sigmask_sz = _NSIG / 8;
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+	if (wait)
+		flags |= IORING_ENTER_GETEVENTS;
+
+	r = uring_enter(u->fd, u->sq_local - tail, wait ? 1 : 0, flags,
+			(flags & IORING_ENTER_EXT_ARG) ? (void *)&arg : NULL,
+			(flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0);
+	if (r == -ETIME || r == -EINTR || r == -EAGAIN || r == -EBUSY)
+		return 0;
+
+	return r;
+}
+
+struct io_uring_cqe *shl_uring_peek_cqe(struct shl_uring *u)
+{
+	unsigned int head, tail;
+
+	head = *u->cq_head;
+	tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		return NULL;
+
+	return &u->cqes[head & u->cq_mask];
+}
+
+void shl_uring_cqe_seen(struct shl_uring *u)
+{
+	__atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int shl_uring_bufs_init(struct shl_uring *u, unsigned short group,
+			unsigned int num, size_t size)
+{
+	struct io_uring_buf_reg reg;
+	unsigned int i;
+	void *br;
+	int r;
+
+	if (!num || num > 32768 || (num & (num - 1)) || u->br)
+		return -EINVAL;
+
+	u->bufs = shl_malloc((size + 1) * num);
+	if (!u->bufs)
+		return -ENOMEM;
+
+	/* the ring must be page aligned, mmap() gives us that */
+	u->br_size = num * sizeof(struct io_uring_buf);
+	br = mmap(NULL, u->br_size, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (br == MAP_FAILED) {
+		r = -errno;
+		goto error;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)br;
+	reg.ring_entries = num;
+	reg.bgid = group;
+	r = uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+	if (r < 0) {
+		munmap(br, u->br_size);
+		goto error;
+	}
+
+	u->br = br;
+	u->br_mask = num - 1;
+	u->br_tail = 0;
+	u->br_group = group;
+	u->buf_size = size;
+
+	for (i = 0; i < num; ++i)
+		shl_uring_bufs_recycle(u, i);
+
+	return 0;
+
+error:
+	shl_free(u->bufs);
+	u->bufs = NULL;
+	return r;
+}
+
+void shl_uring_bufs_recycle(struct shl_uring *u, unsigned int bid)
+{
+	struct io_uring_buf *buf;
+
+	buf = &u->br->bufs[u->br_tail & u->br_mask];
+	buf->addr = (uint64_t)(uintptr_t)shl_uring_bufs_get(u, bid);
+	buf->len = u->buf_size;
+	buf->bid = bid;
+
+	++u->br_tail;
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
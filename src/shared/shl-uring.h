@@ -0,0 +1,91 @@
+/*
+ * SHL - io_uring helpers
+ *
+ * Dedicated to the Public Domain
+ */
+
+/*
+ * io_uring helpers
+ * A minimal io_uring wrapper on top of the raw syscalls, so we do not depend
+ * on liburing. It maps the submission and completion queues and manages a
+ * single ring of provided buffers, which is all the pty bridge needs.
+ */
+
+#ifndef SHL_URING_H
+#define SHL_URING_H
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* not part of older uapi headers, available since linux-6.7 */
+#define SHL_URING_OP_READ_MULTISHOT 49
+
+struct shl_uring {
+	int fd;
+	unsigned int features;
+
+	void *map;			/* shared sq/cq ring */
+	size_t map_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int sq_local;		/* tail including unpublished sqes */
+
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct io_uring_buf_ring *br;	/* provided buffers or NULL */
+	size_t br_size;
+	unsigned int br_mask;
+	unsigned short br_tail;
+	unsigned short br_group;
+	char *bufs;
+	size_t buf_size;
+};
+
+/* create a ring with @entries sqes, fails unless the kernel maps sq/cq once */
+int shl_uring_init(struct shl_uring *u, unsigned int entries);
+
+/* tear down the ring and its buffers, the kernel cancels pending requests */
+void shl_uring_deinit(struct shl_uring *u);
+
+/* return true if the kernel supports @op */
+bool shl_uring_has_op(struct shl_uring *u, unsigned int op);
+
+/* get a zeroed sqe, submits queued ones if full, NULL if still full */
+struct io_uring_sqe *shl_uring_get_sqe(struct shl_uring *u);
+
+/*
+ * Submit queued sqes. With @wait, block until a cqe is available or
+ * @timeout milliseconds passed, -1 waits forever.
+ */
+int shl_uring_submit(struct shl_uring *u, bool wait, int timeout);
+
+/* return the next cqe or NULL, release it with shl_uring_cqe_seen() */
+struct io_uring_cqe *shl_uring_peek_cqe(struct shl_uring *u);
+void shl_uring_cqe_seen(struct shl_uring *u);
+
+/*
+ * Register @num buffers of @size bytes as buffer group @group. @num must be a
+ * power of two. Every buffer has one spare byte behind @size.
+ */
+int shl_uring_bufs_init(struct shl_uring *u, unsigned short group,
+			unsigned int num, size_t size);
+
+/* return buffer @bid to the kernel */
+void shl_uring_bufs_recycle(struct shl_uring *u, unsigned int bid);
+
+static inline char *shl_uring_bufs_get(struct shl_uring *u, unsigned int bid)
+{
+	return u->bufs + (size_t)bid * (u->buf_size + 1);
+}
+
+#endif  /* SHL_URING_H */
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include "libtsm.h"
+#include "shl-alloc.h"
 #include "shl-llog.h"
 
 #define SHL_EXPORT __attribute__((visibility("default")))
@@ -54,9 +55,16 @@ tsm_symbol_t tsm_symbol_append(struct tsm_symbol_table *tbl,
 			       tsm_symbol_t sym, uint32_t ucs4);
 const uint32_t *tsm_symbol_get(struct tsm_symbol_table *tbl,
 			       tsm_symbol_t *sym, size_t *size);
+const uint32_t *tsm_symbol_index_get(uint32_t *const *index, size_t num,
+				     tsm_symbol_t *sym, size_t *size);
+uint32_t **tsm_symbol_table_copy_index(struct tsm_symbol_table *tbl,
+				       size_t *num);
 unsigned int tsm_symbol_get_width(struct tsm_symbol_table *tbl,
 				  tsm_symbol_t sym);
 
+#define TSM_SYMBOL_COMBINED(_n) ((tsm_symbol_t)(TSM_UCS4_MAX + 3 + (_n)))
+unsigned int tsm_symbol_table_get_count(struct tsm_symbol_table *tbl);
+
 /* utf8 state machine */
 
 struct tsm_utf8_mach;
@@ -76,6 +84,35 @@ void tsm_utf8_mach_free(struct tsm_utf8_mach *mach);
 int tsm_utf8_mach_feed(struct tsm_utf8_mach *mach, char c);
 uint32_t tsm_utf8_mach_get(struct tsm_utf8_mach *mach);
 void tsm_utf8_mach_reset(struct tsm_utf8_mach *mach);
+void tsm_utf8_mach_get_state(struct tsm_utf8_mach *mach, int *state,
+			     uint32_t *ch);
+void tsm_utf8_mach_set_state(struct tsm_utf8_mach *mach, int state,
+			     uint32_t ch);
+
+/* statistics counters, compiled out without BUILD_ENABLE_STATS */
+
+#ifdef BUILD_ENABLE_STATS
+#define STAT_ADD(_obj, _field, _num) ((_obj)->stats._field += (_num))
+#else
+#define STAT_ADD(_obj, _field, _num) ((void)0)
+#endif
+
+/*
+ * USDT probes of the "libtsm" provider, compiled in with BUILD_ENABLE_USDT.
+ * A disabled probe is a single nop, so they may sit on hot paths. Without
+ * BUILD_ENABLE_USDT the arguments are not even evaluated.
+ */
+
+#ifdef BUILD_ENABLE_USDT
+#include <sys/sdt.h>
+#define TRACE1(_name, _a) DTRACE_PROBE1(libtsm, _name, _a)
+#define TRACE2(_name, _a, _b) DTRACE_PROBE2(libtsm, _name, _a, _b)
+#define TRACE3(_name, _a, _b, _c) DTRACE_PROBE3(libtsm, _name, _a, _b, _c)
+#else
+#define TRACE1(_name, _a) ((void)0)
+#define TRACE2(_name, _a, _b) ((void)0)
+#define TRACE3(_name, _a, _b, _c) ((void)0)
+#endif
 
 /* TSM screen */
 
@@ -94,8 +131,59 @@ struct line {
 	struct cell *cells;		/* actuall cells */
 	uint64_t sb_id;			/* sb ID */
 	tsm_age_t age;			/* age of the whole line */
+	unsigned long ref;		/* screen and snapshot references */
+	bool blank;			/* all visible cells are cleared with
+					 * the attributes of the first cell */
+};
+
+/* UTF-8 rendering of a line */
+
+struct line_text {
+	char *text;			/* UTF-8 text of a line */
+	unsigned int *cols;		/* column of each byte in @text or NULL */
+	size_t size;			/* allocated size of @text and @cols */
+};
+
+int line_render(struct tsm_symbol_table *tbl, struct line *line, bool fold,
+		struct line_text *t, size_t *out);
+
+/* binary state serialization */
+
+#define SAVE_TAG(_a, _b, _c, _d) \
+	((uint32_t)(_a) | (uint32_t)(_b) << 8 | \
+	 (uint32_t)(_c) << 16 | (uint32_t)(_d) << 24)
+
+struct save_buf {
+	uint8_t *data;
+	size_t len;
+	size_t size;
+	bool failed;			/* allocation failed */
+};
+
+struct load_buf {
+	const uint8_t *data;
+	size_t len;
+	size_t pos;
+	bool failed;			/* data truncated or invalid */
 };
 
+void save_begin(struct save_buf *b, uint32_t magic, uint32_t version);
+int save_finish(struct save_buf *b, char **out, size_t *out_len);
+void save_bytes(struct save_buf *b, const void *data, size_t len);
+void save_u8(struct save_buf *b, uint8_t v);
+void save_uint(struct save_buf *b, uint64_t v);
+void save_attr(struct save_buf *b, const struct tsm_screen_attr *attr);
+size_t save_section_begin(struct save_buf *b, uint32_t tag);
+void save_section_end(struct save_buf *b, size_t start);
+
+int load_begin(struct load_buf *b, const void *data, size_t len,
+	       uint32_t magic, uint32_t version);
+const void *load_bytes(struct load_buf *b, size_t len);
+uint8_t load_u8(struct load_buf *b);
+uint64_t load_uint(struct load_buf *b, uint64_t max);
+void load_attr(struct load_buf *b, struct tsm_screen_attr *attr);
+bool load_section(struct load_buf *b, uint32_t *tag, struct load_buf *sec);
+
 #define SELECTION_TOP -1
 struct selection_pos {
 	struct line *line;
@@ -142,6 +230,15 @@ struct tsm_screen {
 	struct line *sb_pos;		/* current position in sb or NULL */
 	unsigned int sb_pos_num;	/* current numeric position in sb */
 	uint64_t sb_last_id;		/* last id given to sb-line */
+	struct tsm_screen_index *sb_index;	/* search index or NULL */
+	tsm_screen_sb_cb sb_cb;		/* called for each line leaving screen */
+	void *sb_data;
+	struct line_text sb_text;	/* text buffer for sb_cb */
+	struct tsm_screen_log *sb_log;	/* scrollback logger or NULL */
+	struct line *spare;		/* line recycled by scrolling or NULL */
+
+	/* counters of tsm_screen_get_stats() */
+	struct tsm_screen_stats stats;
 
 	/* cursor: positions are always in-bound, but cursor_x might be
 	 * bigger than size_x if new-line is pending */
@@ -158,6 +255,21 @@ struct tsm_screen {
 };
 
 void screen_cell_init(struct tsm_screen *con, struct cell *cell);
+int line_new(struct tsm_screen *con, struct line **out, unsigned int width);
+void line_free(struct line *line);
+
+/* scrollback search index */
+
+struct tsm_screen_index;
+
+void screen_index_add(struct tsm_screen *con, struct line *line);
+void screen_index_evict(struct tsm_screen *con, struct line *line);
+void screen_index_clear(struct tsm_screen *con);
+void screen_index_free(struct tsm_screen_index *idx);
+
+/* scrollback logger */
+
+void screen_log_add(struct tsm_screen *con, struct line *line);
 
 void tsm_screen_set_opts(struct tsm_screen *scr, unsigned int opts);
 void tsm_screen_reset_opts(struct tsm_screen *scr, unsigned int opts);
@@ -171,6 +283,44 @@ static inline void screen_inc_age(struct tsm_screen *con)
 	}
 }
 
+/*
+ * Glyph id handed to draw callbacks. Attributes are encoded into the id to
+ * avoid caching problems. Cells that draw nothing get their @len cleared.
+ */
+static inline uint64_t screen_cell_id(tsm_symbol_t ch,
+				      const struct tsm_screen_attr *attr,
+				      size_t *len)
+{
+	uint64_t id = ch;
+
+	if (attr->bold)
+		id |= 1ULL << TSM_UCS4_MAX_BITS;
+	if (attr->italic)
+		id |= 1ULL << (TSM_UCS4_MAX_BITS + 1);
+	if (attr->underline)
+		id |= 1ULL << (TSM_UCS4_MAX_BITS + 2);
+	if (attr->inverse)
+		id |= 1ULL << (TSM_UCS4_MAX_BITS + 3);
+	if (attr->blink)
+		id |= 1ULL << (TSM_UCS4_MAX_BITS + 4);
+
+	if (ch == 0 || (ch == ' ' && !attr->underline))
+		*len = 0;
+
+	return id;
+}
+
+/* shared snapshots */
+
+void screen_snapshot_merge(struct tsm_screen_snapshot *snap,
+			   const struct tsm_screen_snapshot *old);
+
+/* vte internals */
+
+void vte_swap_write_cb(struct tsm_vte *vte, tsm_vte_write_cb *write_cb,
+		       void **data);
+struct tsm_screen *vte_get_screen(struct tsm_vte *vte);
+
 /* available character sets */
 
 typedef tsm_symbol_t tsm_vte_charset[96];
@@ -87,6 +87,53 @@ typedef void (*tsm_log_t) (void *data,
 			   const char *format,
 			   va_list args);
 
+/**
+ * @brief Drop log messages less severe than @p sev.
+ *
+ * The level is process-wide and defaults to 7=DEBUG, so every message that is
+ * compiled in is passed to the logging callback. Dropped messages are
+ * discarded before their arguments are evaluated or formatted. Messages below
+ * the "log_level" build option are never compiled in, regardless of @p sev.
+ * Independent of the level, warnings and less severe messages are rate
+ * limited per call site. The limit is shared by all screens and VTEs of the
+ * process, so a noisy terminal can suppress the same message of all others.
+ *
+ * @param sev Kernel-style severity between 0=FATAL and 7=DEBUG
+ */
+void tsm_set_log_level(unsigned int sev);
+
+/**
+ * Allocator
+ *
+ * All heap memory of libtsm is allocated through these callbacks. By default
+ * they forward to malloc(), realloc() and free() of the C library.
+ * @p realloc_fn must accept a NULL @p ptr like realloc(). @p free_fn is never
+ * called with NULL.
+ */
+struct tsm_allocator {
+	void *(*alloc_fn) (void *data, size_t size);
+	void *(*realloc_fn) (void *data, void *ptr, size_t size);
+	void (*free_fn) (void *data, void *ptr);
+	void *data;
+};
+
+/**
+ * @brief Replace the allocator of libtsm.
+ *
+ * The allocator is process-wide. It must be set before any libtsm object is
+ * created and stay in place until the last one is freed, as memory is always
+ * released to the allocator it came from. Buffers libtsm returns to the caller,
+ * like those of tsm_screen_save() or tsm_screen_selection_copy(), must be
+ * released with @p alloc->free_fn then instead of free().
+ *
+ * @param alloc The new allocator, or NULL to restore the C library allocator.
+ * The structure is copied.
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if @p alloc lacks a callback.
+ */
+int tsm_set_allocator(const struct tsm_allocator *alloc);
+
 /** @} */
 
 /**
@@ -154,6 +201,7 @@ typedef uint_fast32_t tsm_age_t;
 #define TSM_SCREEN_HIDE_CURSOR	0x10
 #define TSM_SCREEN_FIXED_POS	0x20
 #define TSM_SCREEN_ALTERNATE	0x40
+#define TSM_SCREEN_SYNC_UPDATE	0x80	/* synchronized update in progress */
 
 struct tsm_screen_attr {
 	int8_t fccode;			/* foreground color code or <0 for rgb */
@@ -220,6 +268,9 @@ void tsm_screen_reset_all_tabstops(struct tsm_screen *con);
 
 void tsm_screen_write(struct tsm_screen *con, tsm_symbol_t ch,
 		      const struct tsm_screen_attr *attr);
+void tsm_screen_write_repeat(struct tsm_screen *con, tsm_symbol_t ch,
+			     const struct tsm_screen_attr *attr,
+			     unsigned int num);
 void tsm_screen_newline(struct tsm_screen *con);
 void tsm_screen_scroll_up(struct tsm_screen *con, unsigned int num);
 void tsm_screen_scroll_down(struct tsm_screen *con, unsigned int num);
@@ -265,6 +316,347 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out);
 tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
 			  void *data);
 
+/* scrollback observer */
+
+struct tsm_screen_line;
+
+typedef void (*tsm_screen_sb_cb) (struct tsm_screen *con,
+				  const struct tsm_screen_line *line,
+				  uint64_t id,
+				  void *data);
+
+/**
+ * @brief Set a callback for lines scrolled off the screen.
+ *
+ * @p sb_cb is called whenever a line is pushed into the scrollback-buffer,
+ * including lines that are dropped right away because the scrollback-buffer
+ * is disabled. Lines scrolled off the alternate screen are not reported. @p id
+ * is the scrollback ID of the line; IDs increase by one for each line.
+ *
+ * @p line is only valid during the callback. Use tsm_screen_line_draw() or
+ * tsm_screen_line_get_text() to access its content. The callback must not
+ * modify the screen.
+ *
+ * @param con The screen object.
+ * @param sb_cb The callback or NULL to disable it.
+ * @param data User-data passed to @p sb_cb.
+ */
+void tsm_screen_set_sb_cb(struct tsm_screen *con, tsm_screen_sb_cb sb_cb,
+			  void *data);
+
+/**
+ * @brief Iterate the cells of a scrollback line.
+ *
+ * Calls @p draw_cb for each cell of @p line within the current screen width,
+ * with @c posy set to 0. Unlike
+ * tsm_screen_draw(), no cursor, selection or inverse-screen state is applied.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if an argument is NULL.
+ */
+int tsm_screen_line_draw(struct tsm_screen *con,
+			 const struct tsm_screen_line *line,
+			 tsm_screen_draw_cb draw_cb, void *data);
+
+/**
+ * @brief Get the UTF-8 text of a scrollback line.
+ *
+ * Empty cells are returned as spaces, trailing empty cells are skipped. The
+ * text is not terminated by a newline. The returned buffer is owned by the
+ * screen and is only valid until the callback returns.
+ *
+ * @param con The screen object.
+ * @param line The line passed to the callback.
+ * @param out Returns the zero-terminated text.
+ * @param len Returns the length of the text in bytes. May be NULL.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if an argument is NULL.
+ * @retval -ENOMEM if malloc fails.
+ */
+int tsm_screen_line_get_text(struct tsm_screen *con,
+			     const struct tsm_screen_line *line,
+			     const char **out, size_t *len);
+
+/* snapshots */
+
+/**
+ * @brief Serialize a screen into a binary snapshot.
+ *
+ * The snapshot contains both grids, the scrollback-buffer, the combined-symbol
+ * table, the cursor, margins, tab-stops, flags and default attributes. It does
+ * not contain callbacks, the search index or the selection.
+ *
+ * @param con The screen object.
+ * @param out Returns the snapshot. Must be freed with free().
+ * @param out_len Returns the size of the snapshot in bytes.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if an argument is NULL.
+ * @retval -ENOMEM if malloc fails.
+ */
+int tsm_screen_save(struct tsm_screen *con, char **out, size_t *out_len);
+
+/**
+ * @brief Restore a screen from a snapshot.
+ *
+ * Replaces the content and state of @p con with the snapshot. @p data is only
+ * read, so it may point to a read-only mapping of a file. If loading fails,
+ * @p con is left unchanged. Callbacks, the search index and the scrollback
+ * logger of @p con are kept; all cells are marked as changed.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if an argument is NULL.
+ * @retval -EBADMSG if @p data is not a valid screen snapshot.
+ * @retval -EPROTONOSUPPORT if the snapshot was written by a newer,
+ *         incompatible version of libtsm.
+ * @retval -EFBIG if the snapshot describes more cells than libtsm is willing
+ *         to allocate for it.
+ * @retval -ENOMEM if malloc fails.
+ */
+int tsm_screen_load(struct tsm_screen *con, const void *data, size_t len);
+
+/* statistics */
+
+/**
+ * Counters of a screen, see tsm_screen_get_stats(). The counters only grow,
+ * the sb_lines, sb_bytes and symbols fields are the current values.
+ */
+struct tsm_screen_stats {
+	uint64_t cells;			/* cells written by printed characters */
+	uint64_t scroll_lines;		/* lines scrolled up or down */
+	uint64_t sb_evictions;		/* lines dropped from a full scrollback */
+	uint64_t draws;			/* tsm_screen_draw() calls */
+	unsigned int sb_lines;		/* lines in the scrollback-buffer */
+	size_t sb_bytes;		/* memory used by the scrollback-buffer */
+	unsigned int symbols;		/* combined symbols in the symbol table */
+};
+
+/**
+ * @brief Read the statistics of a screen.
+ *
+ * Counting is a plain increment in the paths that write, scroll and draw, so
+ * this must be called from the thread that feeds the screen, like all other
+ * screen functions. sb_bytes walks the scrollback-buffer.
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if an argument is NULL.
+ * @retval -EOPNOTSUPP if libtsm was built without statistics.
+ */
+int tsm_screen_get_stats(struct tsm_screen *con, struct tsm_screen_stats *out);
+
+/* scrollback logging */
+
+struct tsm_screen_log;
+
+#define TSM_SCREEN_LOG_SGR		0x01	/* keep attributes as SGR */
+#define TSM_SCREEN_LOG_GZIP		0x02	/* gzip-compress the output */
+
+/**
+ * @brief Log all lines pushed into the scrollback-buffer to a file.
+ *
+ * Each line is written as one record "<UTC time> <text>\n", where the time is
+ * formatted as "YYYY-MM-DDTHH:MM:SS.uuuuuuZ". With TSM_SCREEN_LOG_SGR, the
+ * text contains SGR escape sequences for its attributes. With
+ * TSM_SCREEN_LOG_GZIP, the output is a series of gzip members that can be
+ * read with zcat.
+ *
+ * Lines are rendered by the caller of tsm_vte_input() and handed to a
+ * background thread that does all compression and I/O. If that thread falls
+ * behind by more than @p ring_size bytes, further lines are dropped. A screen
+ * can have only one logger; it is independent of tsm_screen_set_sb_cb().
+ *
+ * @param out Returns the new logger.
+ * @param con The screen object. The logger keeps a reference to it.
+ * @param fd File descriptor to write to. It is not closed by the logger.
+ * @param flags Bitmask of TSM_SCREEN_LOG_* flags.
+ * @param ring_size Size of the ring buffer in bytes or 0 for the default.
+ *        It is rounded up to a power of two and must not exceed 1 GiB.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if an argument is invalid.
+ * @retval -EALREADY if @p con already has a logger.
+ * @retval -EOPNOTSUPP if TSM_SCREEN_LOG_GZIP is given but libtsm was built
+ *         without zlib.
+ * @retval -ENOMEM if malloc fails.
+ */
+int tsm_screen_log_new(struct tsm_screen_log **out, struct tsm_screen *con,
+		       int fd, unsigned int flags, size_t ring_size);
+
+/**
+ * @brief Detach and destroy a logger.
+ *
+ * Blocks until all pending lines are written to the file descriptor.
+ */
+void tsm_screen_log_free(struct tsm_screen_log *log);
+
+/**
+ * @brief Get the number of lines dropped so far.
+ *
+ * Lines are dropped if the ring buffer is full or if writing failed. Must be
+ * called from the thread that feeds the screen.
+ */
+uint64_t tsm_screen_log_get_dropped(struct tsm_screen_log *log);
+
+/* concurrent readers */
+
+struct tsm_screen_snapshot;
+
+/**
+ * @brief Take an immutable snapshot of the visible screen.
+ *
+ * The snapshot holds the content of the viewport (including scrollback lines
+ * if the screen is scrolled back), the cursor, the selection and the screen
+ * flags at the time of the call. Lines are shared with the screen and only
+ * lines that the screen modifies afterwards get copied, so taking a snapshot
+ * costs a few pointers per row.
+ *
+ * Must be called from the thread that feeds the screen. The snapshot does not
+ * access @p con again, so it can be drawn and freed from any thread while the
+ * screen keeps changing. Like tsm_screen_draw(), the snapshot takes over a
+ * pending age-reset of @p con.
+ *
+ * @param out Returns the new snapshot.
+ * @param con The screen object.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if an argument is NULL.
+ * @retval -ENOMEM if malloc fails.
+ */
+int tsm_screen_snapshot_new(struct tsm_screen_snapshot **out,
+			    struct tsm_screen *con);
+
+/**
+ * @brief Free a snapshot. May be called from any thread.
+ */
+void tsm_screen_snapshot_free(struct tsm_screen_snapshot *snap);
+
+unsigned int tsm_screen_snapshot_get_width(struct tsm_screen_snapshot *snap);
+unsigned int tsm_screen_snapshot_get_height(struct tsm_screen_snapshot *snap);
+unsigned int tsm_screen_snapshot_get_cursor_x(struct tsm_screen_snapshot *snap);
+unsigned int tsm_screen_snapshot_get_cursor_y(struct tsm_screen_snapshot *snap);
+unsigned int tsm_screen_snapshot_get_flags(struct tsm_screen_snapshot *snap);
+
+/**
+ * @brief Draw a snapshot.
+ *
+ * Same as tsm_screen_draw() but draws the state captured by
+ * tsm_screen_snapshot_new(). @p draw_cb is called with a NULL screen. A
+ * snapshot must not be drawn from two threads at once.
+ *
+ * @return The age of the snapshot, see tsm_screen_draw().
+ */
+tsm_age_t tsm_screen_snapshot_draw(struct tsm_screen_snapshot *snap,
+				   tsm_screen_draw_cb draw_cb, void *data);
+
+/* screen search */
+
+struct tsm_screen_search;
+
+#define TSM_SCREEN_SEARCH_ICASE		0x01 /* case-insensitive matching */
+#define TSM_SCREEN_SEARCH_REGEX		0x02 /* pattern is a POSIX extended regex */
+#define TSM_SCREEN_SEARCH_BACKWARD	0x04 /* search towards older lines */
+
+struct tsm_screen_match {
+	uint64_t row;			/* row of the match */
+	unsigned int start_x;		/* first cell of the match */
+	unsigned int end_x;		/* last cell of the match (inclusive) */
+};
+
+/**
+ * @brief Create a new search over the scrollback-buffer and the screen.
+ *
+ * Lines are addressed by rows. Scrollback lines use their scrollback ID as
+ * row and the screen lines follow right after the newest scrollback line, so
+ * a row keeps addressing the same line while it scrolls into the
+ * scrollback-buffer. Use tsm_screen_get_row() to get the row of a line
+ * currently shown on screen.
+ *
+ * A forward search starts at the oldest line, a backward search at the newest
+ * line. Use tsm_screen_search_seek() to start somewhere else. Matches never
+ * span multiple lines.
+ *
+ * The search keeps a reference to @p con.
+ *
+ * @param out Returns the new search object.
+ * @param con The screen to search.
+ * @param pattern The UTF-8 pattern to look for. Must not be empty.
+ * @param flags Bitmask of TSM_SCREEN_SEARCH_* flags.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if an argument is invalid or the regex does not compile.
+ * @retval -ENOMEM if malloc fails.
+ */
+int tsm_screen_search_new(struct tsm_screen_search **out,
+			  struct tsm_screen *con, const char *pattern,
+			  unsigned int flags);
+void tsm_screen_search_free(struct tsm_screen_search *search);
+
+/**
+ * @brief Continue the search at the given position.
+ *
+ * A forward search continues with matches starting at or after cell @p x of
+ * row @p row, a backward search with matches starting before it.
+ */
+void tsm_screen_search_seek(struct tsm_screen_search *search, uint64_t row,
+			    unsigned int x);
+
+/**
+ * @brief Find the next match.
+ *
+ * Scans at most @p max_lines lines and returns. The search continues where it
+ * stopped on the next call, even if the screen was modified in between. Each
+ * match is only returned once.
+ *
+ * @param search The search object.
+ * @param max_lines Maximum number of lines to scan, or 0 for no limit.
+ * @param out Returns the match.
+ *
+ * @retval 0 if a match was found.
+ * @retval -EAGAIN if @p max_lines lines were scanned without a match.
+ * @retval -ENOENT if there are no further matches.
+ * @retval -ENOMEM if malloc fails.
+ */
+int tsm_screen_search_next(struct tsm_screen_search *search,
+			   unsigned int max_lines,
+			   struct tsm_screen_match *out);
+
+uint64_t tsm_screen_get_row(struct tsm_screen *con, unsigned int posy);
+
+/**
+ * @brief Enable or disable the scrollback search index.
+ *
+ * The index keeps track of the trigrams contained in each scrollback line so
+ * literal searches with patterns of at least three bytes can skip lines that
+ * cannot match. It is updated whenever lines are pushed into or evicted from
+ * the scrollback-buffer. Regular expressions and the lines on screen are always
+ * scanned linearly.
+ *
+ * The index never uses more than @p max_size bytes. If it would, the oldest
+ * lines are removed from the index, which makes searching them slower but does
+ * not change the search results. The index is disabled by default.
+ *
+ * @param con The screen object.
+ * @param max_size Memory limit of the index in bytes, or 0 to disable it.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if @p max_size is too small to hold the index.
+ * @retval -ENOMEM if malloc fails.
+ */
+int tsm_screen_set_sb_index(struct tsm_screen *con, size_t max_size);
+
+/**
+ * @brief Select a match.
+ *
+ * Scrolls the scrollback-buffer so the match is visible and selects it as if
+ * tsm_screen_selection_start() and tsm_screen_selection_target() were called.
+ *
+ * @retval 0 on success.
+ * @retval -ENOENT if the matched line is no longer available.
+ */
+int tsm_screen_search_select(struct tsm_screen *con,
+			     const struct tsm_screen_match *match);
+
 /** @} */
 
 /**
@@ -305,6 +697,7 @@ struct tsm_vte;
 #define TSM_VTE_FLAG_BACKGROUND_COLOR_ERASE_MODE	0x00008000 /* Set background color on erase (bce) */
 #define TSM_VTE_FLAG_PREPEND_ESCAPE			0x00010000 /* Prepend escape character to next output */
 #define TSM_VTE_FLAG_TITE_INHIBIT_MODE			0x00020000 /* Prevent switching to alternate screen buffer */
+#define TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT		0x00040000 /* Synchronized update in progress (mode 2026) */
 
 /* keep in sync with shl_xkb_mods */
 enum tsm_vte_modifier {
@@ -422,6 +815,160 @@ void tsm_vte_unref(struct tsm_vte *vte);
 void tsm_vte_set_osc_cb(struct tsm_vte *vte, tsm_vte_osc_cb osc_cb, void *osc_data);
 void tsm_vte_set_mouse_cb(struct tsm_vte *vte, tsm_vte_mouse_cb mouse_cb, void *mouse_data);
 
+/* phases of a streamed OSC payload */
+enum tsm_vte_osc_phase {
+	TSM_VTE_OSC_BEGIN,	/* a new OSC starts, no data */
+	TSM_VTE_OSC_DATA,	/* next fragment of the payload */
+	TSM_VTE_OSC_END,	/* the OSC is terminated */
+	TSM_VTE_OSC_DROP,	/* the payload exceeds the limit, discard it */
+};
+
+typedef void (*tsm_vte_osc_stream_cb) (struct tsm_vte *vte,
+				       enum tsm_vte_osc_phase phase,
+				       const char *u8,
+				       size_t len,
+				       void *data);
+
+/**
+ * @brief Receive OSC payloads of any length in fragments.
+ *
+ * The callback set with tsm_vte_set_osc_cb() only sees the first 127 bytes of
+ * an OSC. With a stream callback, each OSC is reported as
+ * TSM_VTE_OSC_BEGIN, any number of TSM_VTE_OSC_DATA fragments and
+ * TSM_VTE_OSC_END. Fragments are UTF-8 and are only valid during the call.
+ * Printable ASCII is passed straight from the buffer given to
+ * tsm_vte_input(), so base64 payloads like OSC 52 are never copied.
+ *
+ * If @p max_len is not 0 and the payload grows beyond @p max_len bytes,
+ * TSM_VTE_OSC_DROP is reported instead of more data and the rest of the OSC
+ * is ignored without a TSM_VTE_OSC_END.
+ *
+ * While a stream callback is set, the callback of tsm_vte_set_osc_cb() is not
+ * called. Changing the stream callback while an OSC is parsed reports
+ * TSM_VTE_OSC_DROP to the old one and ignores the rest of that OSC.
+ *
+ * @param vte The vte object.
+ * @param cb The callback or NULL to go back to tsm_vte_set_osc_cb().
+ * @param data User data for @p cb.
+ * @param max_len Payload limit in bytes or 0 for none.
+ */
+void tsm_vte_set_osc_stream_cb(struct tsm_vte *vte, tsm_vte_osc_stream_cb cb,
+			       void *data, size_t max_len);
+
+/* a DCS sequence as passed to tsm_vte_dcs_cb */
+struct tsm_vte_dcs {
+	uint32_t final;			/* final character */
+	const char *intermediates;	/* private marker and intermediates */
+	unsigned int argc;		/* number of parameters */
+	const int *argv;		/* parameters, -1 if omitted */
+};
+
+/* phases of a DCS */
+enum tsm_vte_dcs_phase {
+	TSM_VTE_DCS_BEGIN,	/* a new DCS starts, no data */
+	TSM_VTE_DCS_DATA,	/* next chunk of the passthrough data */
+	TSM_VTE_DCS_END,	/* the DCS is terminated */
+	TSM_VTE_DCS_DROP,	/* the DCS is aborted by a reset, discard it */
+};
+
+typedef void (*tsm_vte_dcs_cb) (struct tsm_vte *vte,
+				enum tsm_vte_dcs_phase phase,
+				const struct tsm_vte_dcs *dcs,
+				const char *u8,
+				size_t len,
+				void *data);
+
+/**
+ * @brief Handle DCS sequences in the embedder.
+ *
+ * libtsm does not implement any DCS itself and discards them without a
+ * handler. With a handler, each DCS is reported as TSM_VTE_DCS_BEGIN, any
+ * number of TSM_VTE_DCS_DATA chunks and TSM_VTE_DCS_END. @p dcs describes the
+ * sequence in every phase. Data is UTF-8 and is only valid during the call.
+ * 7-bit data is passed in chunks straight from the buffer given to
+ * tsm_vte_input(), so image protocols like sixel are never copied or split
+ * into characters.
+ *
+ * Changing the handler discards the rest of a DCS in progress.
+ *
+ * @param vte The vte object.
+ * @param cb The handler or NULL.
+ * @param data User data for @p cb.
+ */
+void tsm_vte_set_dcs_cb(struct tsm_vte *vte, tsm_vte_dcs_cb cb, void *data);
+
+typedef void (*tsm_vte_sync_cb) (struct tsm_vte *vte,
+				 bool active,
+				 void *data);
+
+/**
+ * @brief Get notified about synchronized updates.
+ *
+ * Applications set DEC private mode 2026 before redrawing the screen and reset
+ * it when they are done. In between, TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT and
+ * TSM_SCREEN_SYNC_UPDATE are set and renderers should not draw intermediate
+ * frames. @p cb is called with @p active set when an update begins and unset
+ * when it ends, including by reset or timeout. tsm_vte_load() reports a change
+ * of the mode the same way.
+ *
+ * @param vte The vte object.
+ * @param cb The callback or NULL.
+ * @param data User data for @p cb.
+ */
+void tsm_vte_set_sync_cb(struct tsm_vte *vte, tsm_vte_sync_cb cb, void *data);
+
+/**
+ * @brief Limit the duration of synchronized updates.
+ *
+ * An update that is not finished after @p ms milliseconds is ended by
+ * tsm_vte_check_sync(). The default is 150ms. 0 disables mode 2026, which is
+ * then reported as permanently reset.
+ *
+ * @param vte The vte object.
+ * @param ms The timeout in milliseconds or 0.
+ */
+void tsm_vte_set_sync_timeout(struct tsm_vte *vte, unsigned int ms);
+
+/**
+ * @brief Enforce the timeout of a synchronized update.
+ *
+ * Renderers that skip frames during a synchronized update call this when they
+ * would draw otherwise. An update that exceeded its timeout is ended here.
+ *
+ * @param vte The vte object.
+ *
+ * @return Milliseconds until the current update times out, or -1 if there is
+ * no synchronized update (anymore).
+ */
+int tsm_vte_check_sync(struct tsm_vte *vte);
+
+/**
+ * Counters of a VTE, see tsm_vte_get_stats(). Escape sequences are counted
+ * by their class when they are dispatched. Unhandled sequences are those
+ * libtsm does not implement, including unknown modes and SGR attributes.
+ */
+struct tsm_vte_stats {
+	uint64_t bytes;			/* bytes passed to tsm_vte_input() */
+	uint64_t controls;		/* C0 and C1 control characters */
+	uint64_t esc;			/* ESC sequences */
+	uint64_t csi;			/* CSI sequences */
+	uint64_t osc;			/* OSC strings */
+	uint64_t dcs;			/* DCS strings */
+	uint64_t unhandled;		/* ignored controls and sequences */
+};
+
+/**
+ * @brief Read the statistics of a VTE.
+ *
+ * Same as tsm_screen_get_stats(), this must be called from the thread that
+ * feeds the VTE. With a pipeline, use tsm_pipeline_call().
+ *
+ * @retval 0 on success
+ * @retval -EINVAL if an argument is NULL.
+ * @retval -EOPNOTSUPP if libtsm was built without statistics.
+ */
+int tsm_vte_get_stats(struct tsm_vte *vte, struct tsm_vte_stats *out);
+
 /**
  * @brief Set color palette to one of the predefined palette on the vte object.
  *
@@ -498,6 +1045,91 @@ void tsm_vte_reset(struct tsm_vte *vte);
 void tsm_vte_hard_reset(struct tsm_vte *vte);
 void tsm_vte_input(struct tsm_vte *vte, const char *u8, size_t len);
 
+/* when data for the client is passed to the write-callback */
+enum tsm_vte_flush_mode {
+	TSM_VTE_FLUSH_INPUT,		/* at the end of tsm_vte_input() */
+	TSM_VTE_FLUSH_IMMEDIATE,	/* on every reply */
+	TSM_VTE_FLUSH_MANUAL,		/* only in tsm_vte_flush() */
+};
+
+/**
+ * @brief Choose when the write-callback is called.
+ *
+ * Replies to queries like DA or DSR and keyboard input are collected in a
+ * buffer. With TSM_VTE_FLUSH_INPUT, the default, all replies generated by one
+ * call to tsm_vte_input() are passed to the write-callback at once when it
+ * returns; everything else, like keyboard and mouse input, is passed on
+ * directly. TSM_VTE_FLUSH_IMMEDIATE passes each reply on as soon as it is
+ * generated. With TSM_VTE_FLUSH_MANUAL, the caller decides by calling
+ * tsm_vte_flush(). In all modes the write-callback is called early if the
+ * buffer is full.
+ *
+ * Like the write-callback, the flush mode belongs to the embedder and is not
+ * part of VTE snapshots. tsm_vte_load() keeps the mode of the loading VTE, so
+ * set it again on a new VTE that restores a snapshot.
+ *
+ * @param vte The vte object.
+ * @param mode The new flush mode.
+ */
+void tsm_vte_set_flush_mode(struct tsm_vte *vte, enum tsm_vte_flush_mode mode);
+
+/**
+ * @brief Pass all buffered data to the write-callback.
+ *
+ * Data that is still buffered when the last reference to @p vte is dropped is
+ * discarded without calling the write-callback. Call this before
+ * tsm_vte_unref() to keep it.
+ *
+ * @param vte The vte object.
+ */
+void tsm_vte_flush(struct tsm_vte *vte);
+
+struct tsm_vte_budget {
+	uint64_t deadline;	/* CLOCK_MONOTONIC time in ns or 0 */
+	size_t cells;		/* max printed characters or 0 */
+	size_t sequences;	/* max control functions or 0 */
+};
+
+/**
+ * @brief Parse input until a budget is exhausted.
+ *
+ * Like tsm_vte_input() but returns early once the deadline has passed or the
+ * given number of characters were printed or control functions (control
+ * characters, escape sequences, CSI, OSC and DCS sequences) were executed.
+ * Limits that are 0 are not enforced. Partial UTF-8 and escape sequences are
+ * kept in the parser, so the caller resumes by passing the remaining bytes.
+ *
+ * @param vte The vte object.
+ * @param u8 The input.
+ * @param len The length of @p u8 in bytes.
+ * @param budget The budget or NULL for none.
+ *
+ * @return The number of bytes consumed.
+ */
+size_t tsm_vte_input_budget(struct tsm_vte *vte, const char *u8, size_t len,
+			    const struct tsm_vte_budget *budget);
+
+/**
+ * @brief Serialize the parser and terminal state of a VTE.
+ *
+ * This covers the parser state, current attributes, character sets, the
+ * saved cursor, modes and mouse state. The screen is not included, use
+ * tsm_screen_save() on it. Like tsm_screen_save(), @p out must be freed with
+ * free().
+ */
+int tsm_vte_save(struct tsm_vte *vte, char **out, size_t *out_len);
+
+/**
+ * @brief Restore a VTE from a snapshot written by tsm_vte_save().
+ *
+ * Callbacks, the palette and the flush mode of @p vte are kept. The callbacks
+ * of @p vte never saw the start of an OSC or DCS that was parsed when saving,
+ * so the rest of such a string is ignored. An OSC or DCS that @p vte itself
+ * was parsing is reported as TSM_VTE_OSC_DROP or TSM_VTE_DCS_DROP. Errors are
+ * the same as for tsm_screen_load().
+ */
+int tsm_vte_load(struct tsm_vte *vte, const void *data, size_t len);
+
 /**
  * @brief Set backspace key to send either backspace or delete.
  *
@@ -519,6 +1151,115 @@ bool tsm_vte_handle_mouse(struct tsm_vte *vte, unsigned int cell_x,
 
 /** @} */
 
+/**
+ * @defgroup pipeline Pipelined Parsing
+ * Parse input on a worker thread
+ *
+ * A pipeline moves a VTE and its screen onto a worker thread. The application
+ * hands input to the pipeline and consumes finished frames, which are
+ * snapshots of the screen (see tsm_screen_snapshot_new()). Parsing heavy
+ * output therefore never blocks the thread that handles user input and
+ * drawing.
+ *
+ * While a pipeline exists, the VTE and the screen must only be accessed from
+ * callbacks queued with tsm_pipeline_call(). The write-callback of the VTE is
+ * called from tsm_pipeline_dispatch(), in the order the data was produced.
+ * Other VTE callbacks run on the worker thread.
+ *
+ * @{
+ */
+
+struct tsm_pipeline;
+
+typedef void (*tsm_pipeline_call_cb) (struct tsm_screen *con,
+				      struct tsm_vte *vte,
+				      void *data);
+
+/**
+ * @brief Start a worker thread for a VTE.
+ *
+ * @param out Returns the new pipeline.
+ * @param vte The VTE object. The pipeline keeps a reference to it and to its
+ *            screen.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if an argument is NULL.
+ * @retval -ENOMEM if malloc fails.
+ */
+int tsm_pipeline_new(struct tsm_pipeline **out, struct tsm_vte *vte);
+
+/**
+ * @brief Stop the worker thread.
+ *
+ * Queued input is still parsed and pending responses are passed to the
+ * write-callback before this returns. Afterwards the VTE and the screen can
+ * be used directly again.
+ */
+void tsm_pipeline_free(struct tsm_pipeline *pl);
+
+/**
+ * @brief Queue input for the VTE.
+ *
+ * The data is copied and parsed on the worker thread in order.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if an argument is NULL.
+ * @retval -ENOMEM if malloc fails.
+ */
+int tsm_pipeline_input(struct tsm_pipeline *pl, const char *u8, size_t len);
+
+/**
+ * @brief Run a function on the worker thread.
+ *
+ * Use this for anything that accesses the VTE or the screen, like keyboard
+ * handling, resizing or selections. Calls run in order and ahead of input
+ * that is not parsed yet, so they are not delayed by heavy output.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if an argument is NULL.
+ * @retval -ENOMEM if malloc fails.
+ */
+int tsm_pipeline_call(struct tsm_pipeline *pl, tsm_pipeline_call_cb cb,
+		      void *data);
+
+/**
+ * @brief Get the number of input bytes not parsed yet.
+ *
+ * Applications can stop reading their input source while this is high.
+ */
+size_t tsm_pipeline_get_pending(struct tsm_pipeline *pl);
+
+/**
+ * @brief Get a file descriptor to wait on.
+ *
+ * The descriptor becomes readable if a new frame or responses for the
+ * write-callback are available. Call tsm_pipeline_dispatch() then.
+ */
+int tsm_pipeline_get_fd(struct tsm_pipeline *pl);
+
+/**
+ * @brief Pass pending responses to the write-callback of the VTE.
+ *
+ * Must be called from a single application thread, usually whenever the
+ * descriptor of tsm_pipeline_get_fd() is readable.
+ */
+void tsm_pipeline_dispatch(struct tsm_pipeline *pl);
+
+/**
+ * @brief Take the latest frame.
+ *
+ * Frames are published whenever the worker runs out of input and at least
+ * once per frame interval while it is busy. If a frame is not taken before the
+ * next one is published, it is dropped. This never blocks.
+ *
+ * @return The newest frame, which the caller must free with
+ *         tsm_screen_snapshot_free(), or NULL if no new frame was published
+ *         since the last call.
+ */
+struct tsm_screen_snapshot *tsm_pipeline_get_frame(struct tsm_pipeline *pl);
+
+/** @} */
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,55 @@
+/*
+ * libtsm - Global Settings
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Global Settings
+ * Process-wide configuration that is not bound to any screen or VTE. It only
+ * forwards to the shared helpers, which keep the actual state.
+ */
+
+#include <errno.h>
+#include "libtsm.h"
+#include "libtsm-int.h"
+#include "shl-llog.h"
+
+SHL_EXPORT
+void tsm_set_log_level(unsigned int sev)
+{
+	llog_level = sev;
+}
+
+SHL_EXPORT
+int tsm_set_allocator(const struct tsm_allocator *alloc)
+{
+	if (!alloc) {
+		shl_set_allocator(NULL, NULL, NULL, NULL);
+		return 0;
+	}
+
+	if (!alloc->alloc_fn || !alloc->realloc_fn || !alloc->free_fn)
+		return -EINVAL;
+
+	shl_set_allocator(alloc->alloc_fn, alloc->realloc_fn, alloc->free_fn,
+			  alloc->data);
+	return 0;
+}
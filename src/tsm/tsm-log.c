@@ -0,0 +1,616 @@
+/*
+ * libtsm - Scrollback Logger
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Scrollback Logger
+ * A logger writes every line that is pushed into the scrollback-buffer to a
+ * file descriptor, prefixed with the wall-clock time the line left the screen.
+ *
+ * The thread feeding the screen only renders the line and copies it into a
+ * single-producer/single-consumer ring. A background thread drains the ring,
+ * formats the records into blocks and writes them out, so a slow disk never
+ * blocks tsm_vte_input(). If the ring is full, lines are dropped and counted
+ * instead of waiting for the writer.
+ *
+ * The ring is a power-of-two sized byte buffer. @head is only advanced by the
+ * producer, @tail only by the consumer; both increase monotonically and are
+ * masked on access. Each record is a struct log_record followed by the text
+ * of the line, padded to LOG_ALIGN. A record never wraps around the end of
+ * the buffer; instead, a padding record fills the remaining space.
+ *
+ * The consumer sleeps on a pipe. To keep the producer free of syscalls, it is
+ * only woken if it sleeps without timeout or if the ring runs half-full. A
+ * sleeping consumer with buffered output wakes up after LOG_FLUSH_MS on its
+ * own and writes out the partial block.
+ *
+ * If built with zlib, each block is written as a separate gzip member. The
+ * resulting file can be read with the usual gzip tools and a truncated file
+ * loses at most its last block.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "libtsm.h"
+#include "libtsm-int.h"
+#include "shl-llog.h"
+
+#ifdef BUILD_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define LLOG_SUBSYSTEM "tsm-log"
+
+#define LOG_RING_DEFAULT (1U << 20)
+#define LOG_RING_MIN (1U << 12)
+#define LOG_RING_MAX (1U << 30)
+#define LOG_BLOCK_SIZE (1U << 16)
+#define LOG_FLUSH_MS 250
+#define LOG_ALIGN 16
+#define LOG_PAD UINT32_MAX
+
+/* longest SGR sequence emitted for a single cell */
+#define LOG_SGR_MAX 64
+
+enum log_sleep {
+	LOG_AWAKE,
+	LOG_SLEEP_TIMED,		/* wakes up after LOG_FLUSH_MS */
+	LOG_SLEEP_IDLE,			/* waits until woken */
+};
+
+struct log_record {
+	uint64_t time;			/* wall-clock time in ns */
+	uint32_t len;			/* text length or LOG_PAD */
+	uint32_t unused;
+};
+
+struct tsm_screen_log {
+	llog_submit_t llog;
+	void *llog_data;
+	struct tsm_screen *con;
+	unsigned int flags;
+	int fd;
+
+	/* producer side */
+	struct line_text text;		/* rendered line */
+	uint64_t dropped;		/* number of dropped lines */
+
+	/* ring shared between both threads */
+	char *ring;
+	size_t size;
+	uint64_t head;			/* written by producer */
+	uint64_t tail;			/* written by consumer */
+	int sleeping;			/* enum log_sleep of consumer */
+	int stop;			/* set by tsm_screen_log_free() */
+	int error;			/* write error of consumer or 0 */
+
+	/* consumer side */
+	pthread_t thread;
+	int wake[2];
+	char *block;			/* formatted, uncompressed output */
+	size_t block_len;
+	time_t stamp_sec;		/* second cached in @stamp */
+	char stamp[32];
+#ifdef BUILD_HAVE_ZLIB
+	z_stream zs;
+	unsigned char *zbuf;
+	size_t zbuf_size;
+#endif
+};
+
+static inline size_t log_align(size_t len)
+{
+	return (len + LOG_ALIGN - 1) & ~(size_t)(LOG_ALIGN - 1);
+}
+
+static bool log_attr_eq(const struct tsm_screen_attr *a,
+			const struct tsm_screen_attr *b)
+{
+	if (a->fccode != b->fccode || a->bccode != b->bccode)
+		return false;
+	if (a->fccode < 0 &&
+	    (a->fr != b->fr || a->fg != b->fg || a->fb != b->fb))
+		return false;
+	if (a->bccode < 0 &&
+	    (a->br != b->br || a->bg != b->bg || a->bb != b->bb))
+		return false;
+
+	return a->bold == b->bold &&
+	       a->italic == b->italic &&
+	       a->underline == b->underline &&
+	       a->inverse == b->inverse &&
+	       a->blink == b->blink;
+}
+
+static char *log_sgr_color(char *p, int8_t code, uint8_t r, uint8_t g,
+			   uint8_t b, bool bg)
+{
+	if (code < 0)
+		return p + sprintf(p, ";%d;2;%u;%u;%u", bg ? 48 : 38,
+				   r, g, b);
+	if (code < 8)
+		return p + sprintf(p, ";%d", (bg ? 40 : 30) + code);
+	if (code < 16)
+		return p + sprintf(p, ";%d", (bg ? 100 : 90) + code - 8);
+
+	/* TSM_COLOR_FOREGROUND and TSM_COLOR_BACKGROUND */
+	return p;
+}
+
+/* Writes an SGR sequence that resets all attributes and then sets @attr. */
+static size_t log_sgr(char *out, const struct tsm_screen_attr *attr)
+{
+	char *p = out;
+
+	p = stpcpy(p, "\e[0");
+	if (attr->bold)
+		p = stpcpy(p, ";1");
+	if (attr->italic)
+		p = stpcpy(p, ";3");
+	if (attr->underline)
+		p = stpcpy(p, ";4");
+	if (attr->blink)
+		p = stpcpy(p, ";5");
+	if (attr->inverse)
+		p = stpcpy(p, ";7");
+	p = log_sgr_color(p, attr->fccode, attr->fr, attr->fg, attr->fb,
+			  false);
+	p = log_sgr_color(p, attr->bccode, attr->br, attr->bg, attr->bb,
+			  true);
+	*p++ = 'm';
+
+	return p - out;
+}
+
+/* Like line_render() but emits an SGR sequence whenever the attributes
+ * change. The line always ends with default attributes. */
+static int log_render_sgr(struct tsm_symbol_table *tbl, struct line *line,
+			  struct line_text *t, size_t *out)
+{
+	static const struct tsm_screen_attr def = {
+		.fccode = TSM_COLOR_FOREGROUND,
+		.bccode = TSM_COLOR_BACKGROUND,
+	};
+	const struct tsm_screen_attr *cur = &def;
+	unsigned int i, end;
+	size_t n, j, len, max;
+	const uint32_t *ucs4;
+	tsm_symbol_t sym;
+	char *text;
+
+	end = line->size;
+	while (end && !line->cells[end - 1].ch)
+		--end;
+
+	max = (size_t)end * (TSM_UCS4_MAXLEN * 4 + LOG_SGR_MAX) +
+	      LOG_SGR_MAX + 1;
+	if (max > t->size) {
+		text = shl_realloc(t->text, max);
+		if (!text)
+			return -ENOMEM;
+		t->text = text;
+		t->size = max;
+	}
+
+	text = t->text;
+	n = 0;
+
+	for (i = 0; i < end; ++i) {
+		if (!line->cells[i].width)
+			continue;
+
+		if (!log_attr_eq(cur, &line->cells[i].attr)) {
+			cur = &line->cells[i].attr;
+			n += log_sgr(&text[n], cur);
+		}
+
+		sym = line->cells[i].ch;
+		if (sym < 0x80) {
+			text[n++] = sym ? sym : ' ';
+			continue;
+		}
+
+		ucs4 = tsm_symbol_get(tbl, &sym, &len);
+		for (j = 0; j < len; ++j)
+			n += tsm_ucs4_to_utf8(ucs4[j], &text[n]);
+	}
+
+	if (!log_attr_eq(cur, &def))
+		n += log_sgr(&text[n], &def);
+
+	text[n] = 0;
+	*out = n;
+	return 0;
+}
+
+static void log_wake(struct tsm_screen_log *log)
+{
+	ssize_t l;
+
+	/* a full pipe already wakes the consumer */
+	l = write(log->wake[1], "", 1);
+	(void)l;
+}
+
+void screen_log_add(struct tsm_screen *con, struct line *line)
+{
+	struct tsm_screen_log *log = con->sb_log;
+	struct log_record *rec;
+	struct timespec ts;
+	uint64_t head, tail;
+	size_t len, need, pos, pad;
+	int ret, sleeping;
+
+	if (__atomic_load_n(&log->error, __ATOMIC_RELAXED))
+		goto drop;
+
+	if (log->flags & TSM_SCREEN_LOG_SGR)
+		ret = log_render_sgr(con->sym_table, line, &log->text, &len);
+	else
+		ret = line_render(con->sym_table, line, false, &log->text,
+				  &len);
+	if (ret)
+		goto drop;
+
+	head = log->head;
+	tail = __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE);
+	need = log_align(sizeof(*rec) + len);
+	pos = head & (log->size - 1);
+	pad = need > log->size - pos ? log->size - pos : 0;
+	if (need + pad > log->size - (head - tail))
+		goto drop;
+
+	if (pad) {
+		rec = (void*)&log->ring[pos];
+		rec->len = LOG_PAD;
+		head += pad;
+		pos = 0;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec = (void*)&log->ring[pos];
+	rec->time = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	rec->len = len;
+	memcpy(rec + 1, log->text.text, len);
+	head += need;
+	__atomic_store_n(&log->head, head, __ATOMIC_SEQ_CST);
+
+	sleeping = __atomic_load_n(&log->sleeping, __ATOMIC_SEQ_CST);
+	if (sleeping == LOG_SLEEP_IDLE ||
+	    (sleeping == LOG_SLEEP_TIMED && head - tail >= log->size / 2)) {
+		if (__atomic_exchange_n(&log->sleeping, LOG_AWAKE,
+					__ATOMIC_SEQ_CST) != LOG_AWAKE)
+			log_wake(log);
+	}
+	return;
+
+drop:
+	++log->dropped;
+}
+
+static void log_write(struct tsm_screen_log *log, const void *data,
+		      size_t len)
+{
+	struct pollfd pfd;
+	const char *p = data;
+	ssize_t l;
+
+	while (len && !log->error) {
+		l = write(log->fd, p, len);
+		if (l < 0 && errno == EAGAIN) {
+			pfd.fd = log->fd;
+			pfd.events = POLLOUT;
+			poll(&pfd, 1, -1);
+		} else if (l < 0 && errno != EINTR) {
+			__atomic_store_n(&log->error, errno, __ATOMIC_RELAXED);
+		} else if (l > 0) {
+			p += l;
+			len -= l;
+		}
+	}
+}
+
+static void log_flush(struct tsm_screen_log *log)
+{
+	if (!log->block_len)
+		return;
+
+#ifdef BUILD_HAVE_ZLIB
+	if (log->flags & TSM_SCREEN_LOG_GZIP) {
+		int ret;
+
+		log->zs.next_in = (unsigned char*)log->block;
+		log->zs.avail_in = log->block_len;
+		do {
+			log->zs.next_out = log->zbuf;
+			log->zs.avail_out = log->zbuf_size;
+			ret = deflate(&log->zs, Z_FINISH);
+			log_write(log, log->zbuf,
+				  log->zbuf_size - log->zs.avail_out);
+		} while (ret == Z_OK);
+		deflateReset(&log->zs);
+		log->block_len = 0;
+		return;
+	}
+#endif
+
+	log_write(log, log->block, log->block_len);
+	log->block_len = 0;
+}
+
+static void log_put(struct tsm_screen_log *log, const char *data, size_t len)
+{
+	size_t l;
+
+	while (len) {
+		l = LOG_BLOCK_SIZE - log->block_len;
+		if (l > len)
+			l = len;
+		memcpy(&log->block[log->block_len], data, l);
+		log->block_len += l;
+		data += l;
+		len -= l;
+
+		if (log->block_len == LOG_BLOCK_SIZE)
+			log_flush(log);
+	}
+}
+
+static void log_put_record(struct tsm_screen_log *log,
+			   const struct log_record *rec)
+{
+	time_t sec = rec->time / 1000000000ULL;
+	char buf[48];
+	struct tm tm;
+	int l;
+
+	/* formatting the date is expensive, do it once per second only */
+	if (sec != log->stamp_sec || !log->stamp[0]) {
+		gmtime_r(&sec, &tm);
+		strftime(log->stamp, sizeof(log->stamp), "%Y-%m-%dT%H:%M:%S",
+			 &tm);
+		log->stamp_sec = sec;
+	}
+
+	l = snprintf(buf, sizeof(buf), "%s.%06uZ ", log->stamp,
+		     (unsigned int)(rec->time % 1000000000ULL / 1000));
+	log_put(log, buf, l);
+	log_put(log, (const char*)(rec + 1), rec->len);
+	log_put(log, "\n", 1);
+}
+
+static void log_drain(struct tsm_screen_log *log)
+{
+	const struct log_record *rec;
+	uint64_t head, tail;
+	size_t pos;
+
+	head = __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+	tail = log->tail;
+
+	while (tail != head) {
+		pos = tail & (log->size - 1);
+		rec = (const void*)&log->ring[pos];
+		if (rec->len == LOG_PAD) {
+			tail += log->size - pos;
+		} else {
+			log_put_record(log, rec);
+			tail += log_align(sizeof(*rec) + rec->len);
+		}
+
+		/* hand space back early so the producer can go on */
+		__atomic_store_n(&log->tail, tail, __ATOMIC_RELEASE);
+	}
+}
+
+static void *log_thread(void *data)
+{
+	struct tsm_screen_log *log = data;
+	struct pollfd pfd;
+	char buf[64];
+	int ret, timeout;
+
+	for (;;) {
+		log_drain(log);
+
+		if (__atomic_load_n(&log->stop, __ATOMIC_ACQUIRE) &&
+		    __atomic_load_n(&log->head, __ATOMIC_ACQUIRE) == log->tail)
+			break;
+
+		timeout = log->block_len ? LOG_FLUSH_MS : -1;
+		__atomic_store_n(&log->sleeping,
+				 log->block_len ? LOG_SLEEP_TIMED :
+						  LOG_SLEEP_IDLE,
+				 __ATOMIC_SEQ_CST);
+
+		/* recheck after announcing the sleep to not miss a wake-up */
+		if (__atomic_load_n(&log->head, __ATOMIC_SEQ_CST) !=
+		    log->tail) {
+			__atomic_store_n(&log->sleeping, LOG_AWAKE,
+					 __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		pfd.fd = log->wake[0];
+		pfd.events = POLLIN;
+		ret = poll(&pfd, 1, timeout);
+		__atomic_store_n(&log->sleeping, LOG_AWAKE, __ATOMIC_SEQ_CST);
+
+		if (!ret)
+			log_flush(log);
+		else if (ret > 0)
+			while (read(log->wake[0], buf, sizeof(buf)) > 0)
+				/* empty */ ;
+	}
+
+	log_flush(log);
+	return NULL;
+}
+
+#ifdef BUILD_HAVE_ZLIB
+/* zlib allocates its state through the libtsm allocator, too */
+static voidpf log_zalloc(voidpf opaque, uInt items, uInt size)
+{
+	return shl_calloc(items, size);
+}
+
+static void log_zfree(voidpf opaque, voidpf ptr)
+{
+	shl_free(ptr);
+}
+#endif
+
+static void log_free(struct tsm_screen_log *log)
+{
+#ifdef BUILD_HAVE_ZLIB
+	if (log->zbuf)
+		deflateEnd(&log->zs);
+	shl_free(log->zbuf);
+#endif
+	if (log->wake[0] >= 0)
+		close(log->wake[0]);
+	if (log->wake[1] >= 0)
+		close(log->wake[1]);
+	shl_free(log->block);
+	shl_free(log->ring);
+	shl_free(log->text.text);
+	shl_free(log);
+}
+
+SHL_EXPORT
+int tsm_screen_log_new(struct tsm_screen_log **out, struct tsm_screen *con,
+		       int fd, unsigned int flags, size_t ring_size)
+{
+	struct tsm_screen_log *log;
+	int ret;
+
+	if (!out || !con || fd < 0 || ring_size > LOG_RING_MAX)
+		return -EINVAL;
+	if (con->sb_log)
+		return -EALREADY;
+#ifndef BUILD_HAVE_ZLIB
+	if (flags & TSM_SCREEN_LOG_GZIP)
+		return -EOPNOTSUPP;
+#endif
+
+	log = shl_calloc(1, sizeof(*log));
+	if (!log)
+		return -ENOMEM;
+	log->llog = con->llog;
+	log->llog_data = con->llog_data;
+	log->con = con;
+	log->flags = flags;
+	log->fd = fd;
+	log->wake[0] = -1;
+	log->wake[1] = -1;
+
+	if (!ring_size)
+		ring_size = LOG_RING_DEFAULT;
+	log->size = LOG_RING_MIN;
+	while (log->size < ring_size)
+		log->size <<= 1;
+
+	ret = -ENOMEM;
+	log->ring = shl_malloc(log->size);
+	log->block = shl_malloc(LOG_BLOCK_SIZE);
+	if (!log->ring || !log->block)
+		goto err_free;
+
+#ifdef BUILD_HAVE_ZLIB
+	if (flags & TSM_SCREEN_LOG_GZIP) {
+		/* windowBits + 16 selects the gzip container */
+		log->zs.zalloc = log_zalloc;
+		log->zs.zfree = log_zfree;
+		if (deflateInit2(&log->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+				 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			goto err_free;
+		log->zbuf_size = deflateBound(&log->zs, LOG_BLOCK_SIZE);
+		log->zbuf = shl_malloc(log->zbuf_size);
+		if (!log->zbuf) {
+			deflateEnd(&log->zs);
+			goto err_free;
+		}
+	}
+#endif
+
+	if (pipe2(log->wake, O_CLOEXEC | O_NONBLOCK) < 0) {
+		ret = -errno;
+		llog_error(log, "cannot create wake-up pipe (%d)", errno);
+		goto err_free;
+	}
+
+	ret = -pthread_create(&log->thread, NULL, log_thread, log);
+	if (ret) {
+		llog_error(log, "cannot start logger thread (%d)", -ret);
+		goto err_free;
+	}
+
+	tsm_screen_ref(con);
+	con->sb_log = log;
+	*out = log;
+	return 0;
+
+err_free:
+	log_free(log);
+	return ret;
+}
+
+SHL_EXPORT
+void tsm_screen_log_free(struct tsm_screen_log *log)
+{
+	if (!log)
+		return;
+
+	log->con->sb_log = NULL;
+
+	__atomic_store_n(&log->stop, 1, __ATOMIC_RELEASE);
+	log_wake(log);
+	pthread_join(log->thread, NULL);
+
+	if (log->error)
+		llog_warning(log, "scrollback log write failed (%d)",
+			     log->error);
+	if (log->dropped)
+		llog_debug(log, "dropped %" PRIu64 " scrollback log lines",
+			   log->dropped);
+
+	tsm_screen_unref(log->con);
+	log_free(log);
+}
+
+SHL_EXPORT
+uint64_t tsm_screen_log_get_dropped(struct tsm_screen_log *log)
+{
+	if (!log)
+		return 0;
+
+	return log->dropped;
+}
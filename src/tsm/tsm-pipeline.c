@@ -0,0 +1,527 @@
+/*
+ * libtsm - Pipelined Parsing
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Pipelined Parsing
+ * A pipeline owns a VTE and its screen and runs them on a worker thread. The
+ * application thread queues input and calls, and takes frames and responses.
+ *
+ * Input and calls are kept in two FIFOs protected by @lock. The worker parses
+ * input in chunks of at most PIPE_CHUNK bytes, which end early at the frame
+ * deadline (see tsm_vte_input_budget()). Queued calls run between chunks, so
+ * keyboard input and similar requests are handled with the VTE state of the
+ * next chunk boundary, not after all pending output.
+ *
+ * Frames are shared snapshots of the screen. The worker publishes a frame
+ * whenever its queues run empty and, while it is busy, every PIPE_FRAME_NS.
+ * No frames are published during a synchronized update (DEC mode 2026). If
+ * the worker runs out of work in the middle of one, it sleeps until the update
+ * times out (see tsm_vte_check_sync()).
+ * There is a single frame slot which is exchanged atomically: the worker
+ * replaces an unconsumed frame, the application takes it by swapping in NULL.
+ * Together with the frame the application is drawing, this gives double
+ * buffering without any lock on the drawing side.
+ *
+ * The write-callback of the VTE is replaced while the pipeline exists. Data
+ * written by the VTE is appended to @out, and tsm_pipeline_dispatch() passes
+ * it to the original callback on the application thread. Since all VTE
+ * operations run on the worker, the output keeps its order.
+ *
+ * The application is woken via a pipe. @notified is set by whoever writes the
+ * wake-up byte and cleared by the application before it looks at the shared
+ * state, so at most one byte is in flight and no event is lost.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "libtsm.h"
+#include "libtsm-int.h"
+#include "shl-llog.h"
+
+#define LLOG_SUBSYSTEM "tsm-pipeline"
+
+#define PIPE_CHUNK (16U << 10)
+#define PIPE_FRAME_NS (16 * 1000 * 1000ULL)
+
+struct pipe_item {
+	struct pipe_item *next;
+	tsm_pipeline_call_cb cb;	/* call or NULL for input */
+	void *data;
+	size_t len;
+	char buf[];
+};
+
+struct pipe_queue {
+	struct pipe_item *first;
+	struct pipe_item **last;
+};
+
+struct tsm_pipeline {
+	llog_submit_t llog;
+	void *llog_data;
+	struct tsm_screen *con;
+	struct tsm_vte *vte;
+	tsm_vte_write_cb write_cb;	/* original callback of @vte */
+	void *write_data;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* protected by @lock */
+	struct pipe_queue input;
+	struct pipe_queue calls;
+	bool stop;
+	char *out;			/* output of @vte */
+	size_t out_len;
+	size_t out_size;
+
+	/* shared without lock */
+	struct tsm_screen_snapshot *frame;
+	size_t pending;			/* queued input bytes */
+	unsigned int pending_calls;
+	int notified;
+	int wake[2];
+
+	/* worker only */
+	bool dirty;			/* screen changed since last frame */
+	uint64_t frame_time;
+};
+
+static uint64_t pipe_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void pipe_queue_init(struct pipe_queue *q)
+{
+	q->first = NULL;
+	q->last = &q->first;
+}
+
+static void pipe_queue_push(struct pipe_queue *q, struct pipe_item *item)
+{
+	item->next = NULL;
+	*q->last = item;
+	q->last = &item->next;
+}
+
+static struct pipe_item *pipe_queue_pop(struct pipe_queue *q)
+{
+	struct pipe_item *item = q->first;
+
+	if (item) {
+		q->first = item->next;
+		if (!q->first)
+			q->last = &q->first;
+	}
+
+	return item;
+}
+
+static void pipe_notify(struct tsm_pipeline *pl)
+{
+	ssize_t l;
+
+	if (__atomic_exchange_n(&pl->notified, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	l = write(pl->wake[1], "", 1);
+	(void)l;
+}
+
+static void pipe_publish(struct tsm_pipeline *pl)
+{
+	struct tsm_screen_snapshot *snap, *old;
+	int ret;
+
+	pl->frame_time = pipe_now();
+	if (!pl->dirty)
+		return;
+	if (tsm_vte_check_sync(pl->vte) >= 0)
+		return;
+
+	ret = tsm_screen_snapshot_new(&snap, pl->con);
+	if (ret) {
+		llog_warning(pl, "cannot create frame (%d)", ret);
+		return;
+	}
+
+	/* @old is not in use by the application if we get it back */
+	old = __atomic_exchange_n(&pl->frame, snap, __ATOMIC_ACQ_REL);
+	if (old) {
+		screen_snapshot_merge(snap, old);
+		tsm_screen_snapshot_free(old);
+	}
+
+	pl->dirty = false;
+	pipe_notify(pl);
+}
+
+static void pipe_write(struct tsm_vte *vte, const char *u8, size_t len,
+		       void *data)
+{
+	struct tsm_pipeline *pl = data;
+	size_t size;
+	char *tmp;
+
+	pthread_mutex_lock(&pl->lock);
+
+	if (pl->out_len + len > pl->out_size) {
+		size = pl->out_size ? pl->out_size * 2 : 256;
+		while (size < pl->out_len + len)
+			size *= 2;
+		tmp = shl_realloc(pl->out, size);
+		if (!tmp) {
+			pthread_mutex_unlock(&pl->lock);
+			llog_warning(pl, "dropping %zu bytes of VTE output",
+				     len);
+			return;
+		}
+		pl->out = tmp;
+		pl->out_size = size;
+	}
+
+	memcpy(pl->out + pl->out_len, u8, len);
+	pl->out_len += len;
+
+	pthread_mutex_unlock(&pl->lock);
+	pipe_notify(pl);
+}
+
+/* Runs all queued calls. Must be called with @lock held. */
+static void pipe_run_calls(struct tsm_pipeline *pl)
+{
+	struct pipe_item *item;
+
+	while ((item = pipe_queue_pop(&pl->calls))) {
+		pthread_mutex_unlock(&pl->lock);
+		__atomic_sub_fetch(&pl->pending_calls, 1, __ATOMIC_RELAXED);
+		item->cb(pl->con, pl->vte, item->data);
+		tsm_vte_flush(pl->vte);
+		shl_free(item);
+		pl->dirty = true;
+		pthread_mutex_lock(&pl->lock);
+	}
+}
+
+/* Parses one input item. Must be called without @lock held. */
+static void pipe_parse(struct tsm_pipeline *pl, struct pipe_item *item)
+{
+	struct tsm_vte_budget budget = { 0 };
+	size_t off, n;
+
+	for (off = 0; off < item->len; off += n) {
+		n = item->len - off;
+		if (n > PIPE_CHUNK)
+			n = PIPE_CHUNK;
+
+		/* expensive sequences must not delay the next frame */
+		budget.deadline = pl->frame_time + PIPE_FRAME_NS;
+		n = tsm_vte_input_budget(pl->vte, item->buf + off, n, &budget);
+		tsm_vte_flush(pl->vte);
+		__atomic_sub_fetch(&pl->pending, n, __ATOMIC_RELAXED);
+		pl->dirty = true;
+
+		if (pipe_now() >= budget.deadline)
+			pipe_publish(pl);
+
+		if (__atomic_load_n(&pl->pending_calls, __ATOMIC_RELAXED)) {
+			pthread_mutex_lock(&pl->lock);
+			pipe_run_calls(pl);
+			pthread_mutex_unlock(&pl->lock);
+		}
+	}
+}
+
+static void *pipe_thread(void *data)
+{
+	struct tsm_pipeline *pl = data;
+	struct pipe_item *item;
+	struct timespec ts;
+	uint64_t end;
+	int ms;
+
+	pthread_mutex_lock(&pl->lock);
+
+	for (;;) {
+		pipe_run_calls(pl);
+
+		item = pipe_queue_pop(&pl->input);
+		if (item) {
+			pthread_mutex_unlock(&pl->lock);
+			pipe_parse(pl, item);
+			shl_free(item);
+			pthread_mutex_lock(&pl->lock);
+			continue;
+		}
+
+		/* out of work, this is a frame boundary */
+		pthread_mutex_unlock(&pl->lock);
+		pipe_publish(pl);
+		pthread_mutex_lock(&pl->lock);
+
+		if (pl->input.first || pl->calls.first)
+			continue;
+		if (pl->stop)
+			break;
+
+		ms = tsm_vte_check_sync(pl->vte);
+		if (ms < 0) {
+			pthread_cond_wait(&pl->cond, &pl->lock);
+			continue;
+		}
+
+		/* wake up for the frame of an unfinished synchronized update */
+		end = pipe_now() + ms * 1000000ULL;
+		ts.tv_sec = end / 1000000000ULL;
+		ts.tv_nsec = end % 1000000000ULL;
+		pthread_cond_timedwait(&pl->cond, &pl->lock, &ts);
+	}
+
+	pthread_mutex_unlock(&pl->lock);
+	return NULL;
+}
+
+static int pipe_queue_item(struct tsm_pipeline *pl, struct pipe_queue *q,
+			   struct pipe_item *item)
+{
+	pthread_mutex_lock(&pl->lock);
+	pipe_queue_push(q, item);
+	pthread_cond_signal(&pl->cond);
+	pthread_mutex_unlock(&pl->lock);
+
+	return 0;
+}
+
+static void pipe_free(struct tsm_pipeline *pl)
+{
+	struct pipe_item *item;
+
+	while ((item = pipe_queue_pop(&pl->input)))
+		shl_free(item);
+	while ((item = pipe_queue_pop(&pl->calls)))
+		shl_free(item);
+
+	tsm_screen_snapshot_free(pl->frame);
+	if (pl->wake[0] >= 0)
+		close(pl->wake[0]);
+	if (pl->wake[1] >= 0)
+		close(pl->wake[1]);
+	pthread_cond_destroy(&pl->cond);
+	pthread_mutex_destroy(&pl->lock);
+	shl_free(pl->out);
+	shl_free(pl);
+}
+
+SHL_EXPORT
+int tsm_pipeline_new(struct tsm_pipeline **out, struct tsm_vte *vte)
+{
+	struct tsm_pipeline *pl;
+	pthread_condattr_t attr;
+	int ret;
+
+	if (!out || !vte)
+		return -EINVAL;
+
+	pl = shl_calloc(1, sizeof(*pl));
+	if (!pl)
+		return -ENOMEM;
+	pl->vte = vte;
+	pl->con = vte_get_screen(vte);
+	pl->llog = pl->con->llog;
+	pl->llog_data = pl->con->llog_data;
+	pl->wake[0] = -1;
+	pl->wake[1] = -1;
+	pipe_queue_init(&pl->input);
+	pipe_queue_init(&pl->calls);
+	pthread_mutex_init(&pl->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pl->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if (pipe2(pl->wake, O_CLOEXEC | O_NONBLOCK) < 0) {
+		ret = -errno;
+		llog_error(pl, "cannot create wake-up pipe (%d)", errno);
+		goto err_free;
+	}
+
+	/* the first frame shows the current screen */
+	pl->dirty = true;
+
+	pl->write_cb = pipe_write;
+	pl->write_data = pl;
+	vte_swap_write_cb(vte, &pl->write_cb, &pl->write_data);
+
+	ret = -pthread_create(&pl->thread, NULL, pipe_thread, pl);
+	if (ret) {
+		llog_error(pl, "cannot start pipeline thread (%d)", -ret);
+		vte_swap_write_cb(vte, &pl->write_cb, &pl->write_data);
+		goto err_free;
+	}
+
+	tsm_vte_ref(vte);
+	tsm_screen_ref(pl->con);
+	*out = pl;
+	return 0;
+
+err_free:
+	pipe_free(pl);
+	return ret;
+}
+
+SHL_EXPORT
+void tsm_pipeline_free(struct tsm_pipeline *pl)
+{
+	if (!pl)
+		return;
+
+	pthread_mutex_lock(&pl->lock);
+	pl->stop = true;
+	pthread_cond_signal(&pl->cond);
+	pthread_mutex_unlock(&pl->lock);
+	pthread_join(pl->thread, NULL);
+
+	tsm_vte_flush(pl->vte);
+	tsm_pipeline_dispatch(pl);
+	vte_swap_write_cb(pl->vte, &pl->write_cb, &pl->write_data);
+
+	tsm_vte_unref(pl->vte);
+	tsm_screen_unref(pl->con);
+	pipe_free(pl);
+}
+
+SHL_EXPORT
+int tsm_pipeline_input(struct tsm_pipeline *pl, const char *u8, size_t len)
+{
+	struct pipe_item *item;
+
+	if (!pl || !u8)
+		return -EINVAL;
+	if (!len)
+		return 0;
+
+	item = shl_malloc(sizeof(*item) + len);
+	if (!item)
+		return -ENOMEM;
+	item->cb = NULL;
+	item->data = NULL;
+	item->len = len;
+	memcpy(item->buf, u8, len);
+
+	__atomic_add_fetch(&pl->pending, len, __ATOMIC_RELAXED);
+	return pipe_queue_item(pl, &pl->input, item);
+}
+
+SHL_EXPORT
+int tsm_pipeline_call(struct tsm_pipeline *pl, tsm_pipeline_call_cb cb,
+		      void *data)
+{
+	struct pipe_item *item;
+
+	if (!pl || !cb)
+		return -EINVAL;
+
+	item = shl_malloc(sizeof(*item));
+	if (!item)
+		return -ENOMEM;
+	item->cb = cb;
+	item->data = data;
+	item->len = 0;
+
+	__atomic_add_fetch(&pl->pending_calls, 1, __ATOMIC_RELAXED);
+	return pipe_queue_item(pl, &pl->calls, item);
+}
+
+SHL_EXPORT
+size_t tsm_pipeline_get_pending(struct tsm_pipeline *pl)
+{
+	if (!pl)
+		return 0;
+
+	return __atomic_load_n(&pl->pending, __ATOMIC_RELAXED);
+}
+
+SHL_EXPORT
+int tsm_pipeline_get_fd(struct tsm_pipeline *pl)
+{
+	if (!pl)
+		return -EINVAL;
+
+	return pl->wake[0];
+}
+
+SHL_EXPORT
+void tsm_pipeline_dispatch(struct tsm_pipeline *pl)
+{
+	char buf[64], *out;
+	size_t len, size;
+
+	if (!pl)
+		return;
+
+	while (read(pl->wake[0], buf, sizeof(buf)) > 0)
+		/* empty */ ;
+	__atomic_store_n(&pl->notified, 0, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_lock(&pl->lock);
+	out = pl->out;
+	len = pl->out_len;
+	size = pl->out_size;
+	pl->out = NULL;
+	pl->out_len = 0;
+	pl->out_size = 0;
+	pthread_mutex_unlock(&pl->lock);
+
+	if (len)
+		pl->write_cb(pl->vte, out, len, pl->write_data);
+
+	/* hand the buffer back unless the worker allocated a new one */
+	pthread_mutex_lock(&pl->lock);
+	if (!pl->out) {
+		pl->out = out;
+		pl->out_size = size;
+		out = NULL;
+	}
+	pthread_mutex_unlock(&pl->lock);
+	shl_free(out);
+}
+
+SHL_EXPORT
+struct tsm_screen_snapshot *tsm_pipeline_get_frame(struct tsm_pipeline *pl)
+{
+	if (!pl)
+		return NULL;
+
+	return __atomic_exchange_n(&pl->frame, NULL, __ATOMIC_ACQ_REL);
+}
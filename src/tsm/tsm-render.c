@@ -61,6 +61,8 @@ tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
 	if (!con || !draw_cb)
 		return 0;
 
+	STAT_ADD(con, draws, 1);
+	TRACE1(screen_draw_begin, con);
 	screen_cell_init(con, &empty);
 
 	cur_x = con->cursor_x;
@@ -162,22 +164,8 @@ tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
 					age = con->age;
 			}
 
-			/* Encode attributes into the id to avoid caching problems */
-			id = cell->ch;
-			if (attr.bold)
-				id |= 1ULL << TSM_UCS4_MAX_BITS;
-			if (attr.italic)
-				id |= 1ULL << (TSM_UCS4_MAX_BITS + 1);
-			if (attr.underline)
-				id |= 1ULL << (TSM_UCS4_MAX_BITS + 2);
-			if (attr.inverse)
-				id |= 1ULL << (TSM_UCS4_MAX_BITS + 3);
-			if (attr.blink)
-				id |= 1ULL << (TSM_UCS4_MAX_BITS + 4);
-
 			ch = tsm_symbol_get(con->sym_table, &cell->ch, &len);
-			if (cell->ch == 0 || (cell->ch == ' ' && !attr.underline))
-				len = 0;
+			id = screen_cell_id(cell->ch, &attr, &len);
 			ret = draw_cb(con, id, ch, len, cell->width,
 				      j, i, &attr, age, data);
 			if (ret && warned++ < 3) {
@@ -191,6 +179,8 @@ tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
 		}
 	}
 
+	TRACE1(screen_draw_end, con);
+
 	if (con->age_reset) {
 		con->age_reset = 0;
 		return 0;
@@ -198,3 +188,55 @@ tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
 		return con->age_cnt;
 	}
 }
+
+SHL_EXPORT
+int tsm_screen_line_draw(struct tsm_screen *con,
+			 const struct tsm_screen_line *line,
+			 tsm_screen_draw_cb draw_cb, void *data)
+{
+	const struct line *l = (const struct line*)line;
+	const struct cell *cell;
+	const uint32_t *ch;
+	tsm_symbol_t sym;
+	unsigned int i;
+	uint64_t id;
+	size_t len;
+
+	if (!con || !line || !draw_cb)
+		return -EINVAL;
+
+	/* lines might be bigger than the screen, see tsm_screen_resize() */
+	for (i = 0; i < l->size && i < con->size_x; ++i) {
+		cell = &l->cells[i];
+
+		sym = cell->ch;
+		ch = tsm_symbol_get(con->sym_table, &sym, &len);
+		id = screen_cell_id(cell->ch, &cell->attr, &len);
+		draw_cb(con, id, ch, len, cell->width, i, 0, &cell->attr,
+			cell->age, data);
+	}
+
+	return 0;
+}
+
+SHL_EXPORT
+int tsm_screen_line_get_text(struct tsm_screen *con,
+			     const struct tsm_screen_line *line,
+			     const char **out, size_t *len)
+{
+	size_t n;
+	int ret;
+
+	if (!con || !line || !out)
+		return -EINVAL;
+
+	ret = line_render(con->sym_table, (struct line*)line, false,
+			  &con->sb_text, &n);
+	if (ret)
+		return ret;
+
+	*out = con->sb_text.text;
+	if (len)
+		*len = n;
+	return 0;
+}
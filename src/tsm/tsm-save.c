@@ -0,0 +1,852 @@
+/*
+ * libtsm - Screen Snapshots
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Screen Snapshots
+ * Screens and VTEs can be serialized into a binary blob and restored from it
+ * later, possibly by a newer version of the library.
+ *
+ * FORMAT:
+ * A blob starts with a 4-byte magic and a 4-byte version, followed by a list
+ * of sections. Each section is a 4-byte tag, an 8-byte length and the payload.
+ * All fixed-size integers are little-endian. Inside of sections, integers are
+ * stored as unsigned LEB128 so small values take a single byte.
+ * Readers skip sections with unknown tags and ignore trailing bytes of known
+ * sections. New data can therefore be added as new sections or appended to
+ * existing ones without bumping the version. The version only changes if
+ * existing fields change their meaning; blobs with a newer version are
+ * rejected.
+ *
+ * Loading only reads the blob sequentially and never modifies it, so it can be
+ * passed straight from mmap(). A blob is always parsed completely before the
+ * target object is modified. If parsing fails, the object is left untouched.
+ *
+ * SCREEN:
+ * A screen blob contains the following sections:
+ *   "SCRN": geometry, cursor, flags, default attributes, scrollback limits
+ *           and tab-stops
+ *   "SYMS": all combined symbols of the symbol table in order of creation
+ *   "MAIN": the lines of the main screen
+ *   "ALTS": the lines of the alternate screen
+ *   "SBUF": the scrollback-buffer and the ID of its first line
+ * Lines are stored as their width followed by run-length encoded cells.
+ * Combined symbols are re-created in the symbol table of the target screen
+ * and cells are remapped to the new IDs. Loading into a fresh screen thus
+ * yields the same IDs as in the saved screen.
+ * Cell ages, the selection and all callbacks are not part of a snapshot. All
+ * cells are marked as changed after loading.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtsm.h"
+#include "libtsm-int.h"
+#include "shl-llog.h"
+
+#define LLOG_SUBSYSTEM "tsm-save"
+
+#define SCREEN_MAGIC SAVE_TAG('T', 'S', 'M', 'S')
+#define SCREEN_VERSION 1
+
+#define TAG_SCRN SAVE_TAG('S', 'C', 'R', 'N')
+#define TAG_SYMS SAVE_TAG('S', 'Y', 'M', 'S')
+#define TAG_MAIN SAVE_TAG('M', 'A', 'I', 'N')
+#define TAG_ALTS SAVE_TAG('A', 'L', 'T', 'S')
+#define TAG_SBUF SAVE_TAG('S', 'B', 'U', 'F')
+
+/* sanity limits for untrusted input */
+#define SAVE_MAX_WIDTH 0xffff
+#define SAVE_MAX_CELLS (1U << 25)	/* all lines of a screen blob */
+
+#define ATTR_BOLD	0x01
+#define ATTR_ITALIC	0x02
+#define ATTR_UNDERLINE	0x04
+#define ATTR_INVERSE	0x08
+#define ATTR_PROTECT	0x10
+#define ATTR_BLINK	0x20
+
+static void save_reserve(struct save_buf *b, size_t len)
+{
+	size_t size;
+	uint8_t *data;
+
+	if (b->failed || b->len + len <= b->size)
+		return;
+
+	size = b->size ? b->size : 4096;
+	while (size < b->len + len)
+		size *= 2;
+
+	data = shl_realloc(b->data, size);
+	if (!data) {
+		b->failed = true;
+		return;
+	}
+
+	b->data = data;
+	b->size = size;
+}
+
+void save_bytes(struct save_buf *b, const void *data, size_t len)
+{
+	save_reserve(b, len);
+	if (b->failed)
+		return;
+
+	memcpy(&b->data[b->len], data, len);
+	b->len += len;
+}
+
+void save_u8(struct save_buf *b, uint8_t v)
+{
+	save_bytes(b, &v, 1);
+}
+
+static void save_fixed(struct save_buf *b, uint64_t v, unsigned int len)
+{
+	uint8_t buf[8];
+	unsigned int i;
+
+	for (i = 0; i < len; ++i)
+		buf[i] = v >> (i * 8);
+	save_bytes(b, buf, len);
+}
+
+void save_uint(struct save_buf *b, uint64_t v)
+{
+	uint8_t buf[10];
+	unsigned int n = 0;
+
+	while (v >= 0x80) {
+		buf[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	buf[n++] = v;
+
+	save_bytes(b, buf, n);
+}
+
+void save_attr(struct save_buf *b, const struct tsm_screen_attr *attr)
+{
+	uint8_t buf[9];
+
+	buf[0] = (attr->bold ? ATTR_BOLD : 0) |
+		 (attr->italic ? ATTR_ITALIC : 0) |
+		 (attr->underline ? ATTR_UNDERLINE : 0) |
+		 (attr->inverse ? ATTR_INVERSE : 0) |
+		 (attr->protect ? ATTR_PROTECT : 0) |
+		 (attr->blink ? ATTR_BLINK : 0);
+	buf[1] = attr->fccode;
+	buf[2] = attr->bccode;
+	buf[3] = attr->fr;
+	buf[4] = attr->fg;
+	buf[5] = attr->fb;
+	buf[6] = attr->br;
+	buf[7] = attr->bg;
+	buf[8] = attr->bb;
+
+	save_bytes(b, buf, sizeof(buf));
+}
+
+void save_begin(struct save_buf *b, uint32_t magic, uint32_t version)
+{
+	memset(b, 0, sizeof(*b));
+	save_fixed(b, magic, 4);
+	save_fixed(b, version, 4);
+}
+
+/* Writes the section header and returns the position of its payload. The
+ * length is filled in by save_section_end(). */
+size_t save_section_begin(struct save_buf *b, uint32_t tag)
+{
+	save_fixed(b, tag, 4);
+	save_fixed(b, 0, 8);
+	return b->len;
+}
+
+void save_section_end(struct save_buf *b, size_t start)
+{
+	uint64_t len = b->len - start;
+	unsigned int i;
+
+	if (b->failed)
+		return;
+
+	for (i = 0; i < 8; ++i)
+		b->data[start - 8 + i] = len >> (i * 8);
+}
+
+int save_finish(struct save_buf *b, char **out, size_t *out_len)
+{
+	if (b->failed) {
+		shl_free(b->data);
+		return -ENOMEM;
+	}
+
+	*out = (char*)b->data;
+	*out_len = b->len;
+	return 0;
+}
+
+const void *load_bytes(struct load_buf *b, size_t len)
+{
+	const void *p;
+
+	if (b->failed || len > b->len - b->pos) {
+		b->failed = true;
+		return NULL;
+	}
+
+	p = &b->data[b->pos];
+	b->pos += len;
+	return p;
+}
+
+uint8_t load_u8(struct load_buf *b)
+{
+	const uint8_t *p = load_bytes(b, 1);
+
+	return p ? *p : 0;
+}
+
+static uint64_t load_fixed(struct load_buf *b, unsigned int len)
+{
+	const uint8_t *p = load_bytes(b, len);
+	uint64_t v = 0;
+	unsigned int i;
+
+	for (i = 0; p && i < len; ++i)
+		v |= (uint64_t)p[i] << (i * 8);
+
+	return v;
+}
+
+/* Reads an integer and fails if it is bigger than @max. */
+uint64_t load_uint(struct load_buf *b, uint64_t max)
+{
+	uint64_t v = 0;
+	unsigned int shift;
+	uint8_t c;
+
+	for (shift = 0; shift < 64; shift += 7) {
+		c = load_u8(b);
+		v |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			break;
+	}
+
+	if (b->failed || shift >= 64 || v > max) {
+		b->failed = true;
+		return 0;
+	}
+
+	return v;
+}
+
+void load_attr(struct load_buf *b, struct tsm_screen_attr *attr)
+{
+	const uint8_t *p = load_bytes(b, 9);
+
+	memset(attr, 0, sizeof(*attr));
+	if (!p)
+		return;
+
+	attr->bold = !!(p[0] & ATTR_BOLD);
+	attr->italic = !!(p[0] & ATTR_ITALIC);
+	attr->underline = !!(p[0] & ATTR_UNDERLINE);
+	attr->inverse = !!(p[0] & ATTR_INVERSE);
+	attr->protect = !!(p[0] & ATTR_PROTECT);
+	attr->blink = !!(p[0] & ATTR_BLINK);
+	attr->fccode = (int8_t)p[1];
+	attr->bccode = (int8_t)p[2];
+	attr->fr = p[3];
+	attr->fg = p[4];
+	attr->fb = p[5];
+	attr->br = p[6];
+	attr->bg = p[7];
+	attr->bb = p[8];
+}
+
+int load_begin(struct load_buf *b, const void *data, size_t len,
+	       uint32_t magic, uint32_t version)
+{
+	uint32_t v;
+
+	b->data = data;
+	b->len = len;
+	b->pos = 0;
+	b->failed = false;
+
+	if (load_fixed(b, 4) != magic || b->failed)
+		return -EBADMSG;
+
+	v = load_fixed(b, 4);
+	if (b->failed)
+		return -EBADMSG;
+	if (v > version)
+		return -EPROTONOSUPPORT;
+
+	return 0;
+}
+
+/* Returns the next section in @sec or false at the end of the blob. */
+bool load_section(struct load_buf *b, uint32_t *tag, struct load_buf *sec)
+{
+	uint64_t len;
+
+	if (b->failed || b->pos == b->len)
+		return false;
+
+	*tag = load_fixed(b, 4);
+	len = load_fixed(b, 8);
+	if (b->failed || len > b->len - b->pos) {
+		b->failed = true;
+		return false;
+	}
+
+	sec->data = &b->data[b->pos];
+	sec->len = len;
+	sec->pos = 0;
+	sec->failed = false;
+	b->pos += len;
+	return true;
+}
+
+static bool attr_eq(const struct tsm_screen_attr *a,
+		    const struct tsm_screen_attr *b)
+{
+	return a->fccode == b->fccode && a->bccode == b->bccode &&
+	       a->fr == b->fr && a->fg == b->fg && a->fb == b->fb &&
+	       a->br == b->br && a->bg == b->bg && a->bb == b->bb &&
+	       a->bold == b->bold && a->italic == b->italic &&
+	       a->underline == b->underline && a->inverse == b->inverse &&
+	       a->protect == b->protect && a->blink == b->blink;
+}
+
+static void save_line(struct save_buf *b, const struct line *line)
+{
+	const struct cell *c;
+	unsigned int i, n;
+
+	save_uint(b, line->size);
+
+	for (i = 0; i < line->size; i += n) {
+		c = &line->cells[i];
+		for (n = 1; i + n < line->size; ++n) {
+			if (c[n].ch != c->ch || c[n].width != c->width ||
+			    !attr_eq(&c[n].attr, &c->attr))
+				break;
+		}
+
+		save_uint(b, n);
+		save_uint(b, c->ch);
+		save_u8(b, c->width);
+		save_attr(b, &c->attr);
+	}
+}
+
+static void save_lines(struct save_buf *b, uint32_t tag, struct line **lines,
+		       unsigned int num)
+{
+	unsigned int i;
+	size_t start;
+
+	start = save_section_begin(b, tag);
+	save_uint(b, num);
+	for (i = 0; i < num; ++i)
+		save_line(b, lines[i]);
+	save_section_end(b, start);
+}
+
+SHL_EXPORT
+int tsm_screen_save(struct tsm_screen *con, char **out, size_t *out_len)
+{
+	struct save_buf b;
+	struct line *iter;
+	const uint32_t *ucs4;
+	unsigned int i, num;
+	tsm_symbol_t sym;
+	size_t start, j, len;
+
+	if (!con || !out || !out_len)
+		return -EINVAL;
+
+	save_begin(&b, SCREEN_MAGIC, SCREEN_VERSION);
+
+	start = save_section_begin(&b, TAG_SCRN);
+	save_uint(&b, con->size_x);
+	save_uint(&b, con->size_y);
+	save_uint(&b, con->margin_top);
+	save_uint(&b, con->margin_bottom);
+	save_uint(&b, con->cursor_x);
+	save_uint(&b, con->cursor_y);
+	save_uint(&b, con->flags);
+	save_uint(&b, con->opts);
+	save_attr(&b, &con->def_attr);
+	save_attr(&b, &con->def_attr_main);
+	save_uint(&b, con->sb_max);
+	save_uint(&b, con->sb_last_id);
+	save_uint(&b, con->sb_pos ? con->sb_pos->sb_id : 0);
+	for (i = 0; i < con->size_x; ++i)
+		save_u8(&b, con->tab_ruler[i]);
+	save_section_end(&b, start);
+
+	start = save_section_begin(&b, TAG_SYMS);
+	num = tsm_symbol_table_get_count(con->sym_table);
+	save_uint(&b, num);
+	for (i = 0; i < num; ++i) {
+		sym = TSM_SYMBOL_COMBINED(i);
+		ucs4 = tsm_symbol_get(con->sym_table, &sym, &len);
+		save_uint(&b, len);
+		for (j = 0; j < len; ++j)
+			save_uint(&b, ucs4[j]);
+	}
+	save_section_end(&b, start);
+
+	save_lines(&b, TAG_MAIN, con->main_lines, con->size_y);
+	save_lines(&b, TAG_ALTS, con->alt_lines, con->size_y);
+
+	start = save_section_begin(&b, TAG_SBUF);
+	save_uint(&b, con->sb_count);
+	if (con->sb_first)
+		save_uint(&b, con->sb_first->sb_id);
+	for (iter = con->sb_first; iter; iter = iter->next)
+		save_line(&b, iter);
+	save_section_end(&b, start);
+
+	return save_finish(&b, out, out_len);
+}
+
+struct screen_load {
+	struct tsm_screen *con;
+
+	unsigned int size_x;
+	unsigned int size_y;
+	unsigned int margin_top;
+	unsigned int margin_bottom;
+	unsigned int cursor_x;
+	unsigned int cursor_y;
+	unsigned int flags;
+	unsigned int opts;
+	struct tsm_screen_attr def_attr;
+	struct tsm_screen_attr def_attr_main;
+	unsigned int sb_max;
+	uint64_t sb_last_id;
+	uint64_t sb_pos_id;
+	bool *tab_ruler;
+
+	uint32_t *sym_data;		/* saved combined symbols */
+	tsm_symbol_t *syms;		/* their new IDs, set when applied */
+	unsigned int sym_num;
+	uint64_t cells;			/* cells allocated so far */
+
+	struct line **main_lines;
+	struct line **alt_lines;
+	struct line *sb_first;
+	struct line *sb_last;
+	unsigned int sb_count;
+};
+
+static int load_line(struct screen_load *s, struct load_buf *b,
+		     unsigned int min_width, struct line **out)
+{
+	struct tsm_screen_attr attr;
+	struct line *line;
+	unsigned int i, k, n, width, size;
+	uint64_t ch;
+	int ret;
+
+	size = load_uint(b, SAVE_MAX_WIDTH);
+	if (b->failed || !size)
+		return -EBADMSG;
+
+	/* RLE lets tiny blobs describe huge screens, cap the allocations */
+	s->cells += size > min_width ? size : min_width;
+	if (s->cells > SAVE_MAX_CELLS)
+		return -EFBIG;
+
+	ret = line_new(s->con, &line, size > min_width ? size : min_width);
+	if (ret)
+		return ret;
+	line->blank = false;
+
+	for (i = 0; i < size; i += n) {
+		n = load_uint(b, size - i);
+		ch = load_uint(b, UINT32_MAX);
+		width = load_u8(b);
+		load_attr(b, &attr);
+		if (b->failed || !n || width > 2)
+			goto err_msg;
+
+		/* combined symbols are remapped once the blob is valid */
+		if (ch > TSM_UCS4_MAX &&
+		    ch - TSM_SYMBOL_COMBINED(0) >= s->sym_num)
+			goto err_msg;
+
+		for (k = i; k < i + n; ++k) {
+			line->cells[k].ch = ch;
+			line->cells[k].width = width;
+			line->cells[k].attr = attr;
+		}
+	}
+
+	*out = line;
+	return 0;
+
+err_msg:
+	line_free(line);
+	return -EBADMSG;
+}
+
+static void free_lines(struct line **lines, unsigned int num)
+{
+	unsigned int i;
+
+	if (!lines)
+		return;
+
+	for (i = 0; i < num; ++i)
+		if (lines[i])
+			line_free(lines[i]);
+	shl_free(lines);
+}
+
+static int load_scrn(struct screen_load *s, struct load_buf *b)
+{
+	unsigned int i;
+
+	s->size_x = load_uint(b, SAVE_MAX_WIDTH);
+	s->size_y = load_uint(b, SAVE_MAX_WIDTH);
+	s->margin_top = load_uint(b, UINT_MAX);
+	s->margin_bottom = load_uint(b, UINT_MAX);
+	s->cursor_x = load_uint(b, UINT_MAX);
+	s->cursor_y = load_uint(b, UINT_MAX);
+	s->flags = load_uint(b, UINT_MAX);
+	s->opts = load_uint(b, UINT_MAX);
+	load_attr(b, &s->def_attr);
+	load_attr(b, &s->def_attr_main);
+	s->sb_max = load_uint(b, UINT_MAX);
+	s->sb_last_id = load_uint(b, UINT64_MAX);
+	s->sb_pos_id = load_uint(b, UINT64_MAX);
+
+	if (b->failed || !s->size_x || !s->size_y ||
+	    (uint64_t)s->size_x * s->size_y > SAVE_MAX_CELLS ||
+	    s->margin_top > s->margin_bottom ||
+	    s->margin_bottom >= s->size_y ||
+	    s->cursor_x > s->size_x || s->cursor_y >= s->size_y)
+		return -EBADMSG;
+
+	s->tab_ruler = shl_malloc(sizeof(bool) * s->size_x);
+	if (!s->tab_ruler)
+		return -ENOMEM;
+	for (i = 0; i < s->size_x; ++i)
+		s->tab_ruler[i] = load_u8(b);
+
+	return b->failed ? -EBADMSG : 0;
+}
+
+/*
+ * Symbols are only parsed here. They are stored as their length followed by
+ * their codepoints, each value takes at least one byte of the blob. The symbol
+ * table is not touched before the whole blob is known to be valid.
+ */
+static int load_syms(struct screen_load *s, struct load_buf *b)
+{
+	unsigned int i, j, len;
+	size_t pos = 0;
+
+	s->sym_num = load_uint(b, b->len);
+	if (b->failed)
+		return -EBADMSG;
+
+	s->sym_data = shl_malloc(sizeof(*s->sym_data) * b->len);
+	s->syms = shl_malloc(sizeof(*s->syms) * (s->sym_num + 1));
+	if (!s->sym_data || !s->syms)
+		return -ENOMEM;
+
+	for (i = 0; i < s->sym_num; ++i) {
+		len = load_uint(b, TSM_UCS4_MAXLEN);
+		if (b->failed || !len)
+			return -EBADMSG;
+		s->sym_data[pos++] = len;
+
+		for (j = 0; j < len; ++j) {
+			s->sym_data[pos] = load_uint(b, TSM_UCS4_MAX);
+			if (b->failed)
+				return -EBADMSG;
+			++pos;
+		}
+	}
+
+	return 0;
+}
+
+static void remap_line(struct screen_load *s, struct line *line)
+{
+	unsigned int i;
+
+	for (i = 0; i < line->size; ++i)
+		if (line->cells[i].ch > TSM_UCS4_MAX)
+			line->cells[i].ch = s->syms[line->cells[i].ch -
+						    TSM_SYMBOL_COMBINED(0)];
+}
+
+/*
+ * Symbols are saved in order of creation, so each prefix of a symbol is
+ * re-created before the symbol itself and gets the same ID.
+ */
+static void screen_load_syms(struct tsm_screen *con, struct screen_load *s)
+{
+	const uint32_t *p = s->sym_data;
+	struct line *iter;
+	unsigned int i, j, len;
+	tsm_symbol_t sym;
+
+	if (!s->sym_num)
+		return;
+
+	for (i = 0; i < s->sym_num; ++i) {
+		len = *p++;
+		sym = *p++;
+		for (j = 1; j < len; ++j)
+			sym = tsm_symbol_append(con->sym_table, sym, *p++);
+		s->syms[i] = sym;
+	}
+
+	for (i = 0; i < s->size_y; ++i) {
+		remap_line(s, s->main_lines[i]);
+		remap_line(s, s->alt_lines[i]);
+	}
+	for (iter = s->sb_first; iter; iter = iter->next)
+		remap_line(s, iter);
+}
+
+static int load_grid(struct screen_load *s, struct load_buf *b,
+		     struct line ***out)
+{
+	struct line **lines;
+	unsigned int i;
+	int ret;
+
+	if (load_uint(b, UINT_MAX) != s->size_y || b->failed)
+		return -EBADMSG;
+
+	lines = shl_calloc(s->size_y, sizeof(*lines));
+	if (!lines)
+		return -ENOMEM;
+	*out = lines;
+
+	for (i = 0; i < s->size_y; ++i) {
+		ret = load_line(s, b, s->size_x, &lines[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int load_sbuf(struct screen_load *s, struct load_buf *b)
+{
+	struct line *line;
+	unsigned int i, num;
+	uint64_t id;
+	int ret;
+
+	num = load_uint(b, s->sb_max);
+	if (b->failed)
+		return -EBADMSG;
+	if (!num)
+		return 0;
+
+	id = load_uint(b, UINT64_MAX);
+	if (b->failed || id + num - 1 != s->sb_last_id)
+		return -EBADMSG;
+
+	for (i = 0; i < num; ++i) {
+		ret = load_line(s, b, 1, &line);
+		if (ret)
+			return ret;
+
+		line->sb_id = id + i;
+		line->next = NULL;
+		line->prev = s->sb_last;
+		if (s->sb_last)
+			s->sb_last->next = line;
+		else
+			s->sb_first = line;
+		s->sb_last = line;
+		++s->sb_count;
+	}
+
+	return 0;
+}
+
+static void screen_load_free(struct screen_load *s)
+{
+	struct line *iter, *tmp;
+
+	for (iter = s->sb_first; iter; ) {
+		tmp = iter;
+		iter = iter->next;
+		line_free(tmp);
+	}
+
+	free_lines(s->main_lines, s->size_y);
+	free_lines(s->alt_lines, s->size_y);
+	shl_free(s->sym_data);
+	shl_free(s->syms);
+	shl_free(s->tab_ruler);
+}
+
+static void screen_load_apply(struct tsm_screen *con, struct screen_load *s)
+{
+	struct line *iter;
+	unsigned int i;
+
+	screen_load_syms(con, s);
+	tsm_screen_clear_sb(con);
+
+	for (i = 0; i < con->line_num; ++i) {
+		line_free(con->main_lines[i]);
+		line_free(con->alt_lines[i]);
+	}
+	shl_free(con->main_lines);
+	shl_free(con->alt_lines);
+	shl_free(con->tab_ruler);
+
+	con->main_lines = s->main_lines;
+	con->alt_lines = s->alt_lines;
+	con->line_num = s->size_y;
+	con->tab_ruler = s->tab_ruler;
+	s->main_lines = NULL;
+	s->alt_lines = NULL;
+	s->tab_ruler = NULL;
+
+	con->size_x = s->size_x;
+	con->size_y = s->size_y;
+	con->margin_top = s->margin_top;
+	con->margin_bottom = s->margin_bottom;
+	con->cursor_x = s->cursor_x;
+	con->cursor_y = s->cursor_y;
+	con->flags = s->flags;
+	con->opts = s->opts;
+	con->def_attr = s->def_attr;
+	con->def_attr_main = s->def_attr_main;
+
+	if (con->flags & TSM_SCREEN_ALTERNATE)
+		con->lines = con->alt_lines;
+	else
+		con->lines = con->main_lines;
+
+	con->sb_first = s->sb_first;
+	con->sb_last = s->sb_last;
+	con->sb_count = s->sb_count;
+	con->sb_max = s->sb_max;
+	con->sb_last_id = s->sb_last_id;
+	con->sb_pos_num = con->sb_count;
+	s->sb_first = NULL;
+	s->sb_last = NULL;
+
+	for (iter = con->sb_first, i = 0; iter; iter = iter->next, ++i) {
+		if (iter->sb_id == s->sb_pos_id) {
+			con->sb_pos = iter;
+			con->sb_pos_num = i;
+		}
+		if (con->sb_index)
+			screen_index_add(con, iter);
+	}
+
+	con->sel_active = false;
+	con->age = con->age_cnt;
+}
+
+SHL_EXPORT
+int tsm_screen_load(struct tsm_screen *con, const void *data, size_t len)
+{
+	struct load_buf b, sec, scrn, syms, main, alt, sbuf;
+	struct screen_load s;
+	uint32_t tag;
+	int ret;
+
+	if (!con || !data)
+		return -EINVAL;
+
+	ret = load_begin(&b, data, len, SCREEN_MAGIC, SCREEN_VERSION);
+	if (ret)
+		return ret;
+
+	memset(&scrn, 0, sizeof(scrn));
+	memset(&syms, 0, sizeof(syms));
+	memset(&main, 0, sizeof(main));
+	memset(&alt, 0, sizeof(alt));
+	memset(&sbuf, 0, sizeof(sbuf));
+
+	while (load_section(&b, &tag, &sec)) {
+		if (tag == TAG_SCRN)
+			scrn = sec;
+		else if (tag == TAG_SYMS)
+			syms = sec;
+		else if (tag == TAG_MAIN)
+			main = sec;
+		else if (tag == TAG_ALTS)
+			alt = sec;
+		else if (tag == TAG_SBUF)
+			sbuf = sec;
+	}
+
+	if (b.failed || !scrn.data || !syms.data || !main.data ||
+	    !alt.data || !sbuf.data) {
+		llog_warning(con, "invalid screen snapshot");
+		return -EBADMSG;
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.con = con;
+
+	ret = load_scrn(&s, &scrn);
+	if (!ret)
+		ret = load_syms(&s, &syms);
+	if (!ret)
+		ret = load_grid(&s, &main, &s.main_lines);
+	if (!ret)
+		ret = load_grid(&s, &alt, &s.alt_lines);
+	if (!ret)
+		ret = load_sbuf(&s, &sbuf);
+
+	if (ret) {
+		llog_warning(con, "cannot load screen snapshot (%d)", ret);
+	} else {
+		/* new cells must be newer than anything drawn so far */
+		screen_inc_age(con);
+		screen_load_apply(con, &s);
+		llog_debug(con, "loaded %ux%u screen with %u sb lines",
+			   con->size_x, con->size_y, con->sb_count);
+	}
+
+	screen_load_free(&s);
+	return ret;
+}
@@ -67,9 +67,54 @@
 
 #define LLOG_SUBSYSTEM "tsm-screen"
 
+/*
+ * Lines of the screen may be shared with snapshots (see tsm-snapshot.c), which
+ * must never see them change. So before the cells of the line in @slot are
+ * modified, it is made private here: if a snapshot still holds a reference,
+ * the line is copied and @slot is updated. Only the writer takes new references
+ * so a count of 1 stays 1 until we return.
+ * Returns NULL if the copy cannot be allocated. The caller must skip the
+ * modification then.
+ */
+static struct line *line_unshare(struct tsm_screen *con, struct line **slot)
+{
+	struct line *line = *slot, *copy;
+
+	if (__atomic_load_n(&line->ref, __ATOMIC_ACQUIRE) == 1)
+		return line;
+
+	copy = shl_malloc(sizeof(*copy));
+	if (!copy)
+		goto err;
+
+	copy->cells = shl_malloc(sizeof(struct cell) * line->size);
+	if (!copy->cells) {
+		shl_free(copy);
+		goto err;
+	}
+
+	memcpy(copy->cells, line->cells, sizeof(struct cell) * line->size);
+	copy->next = NULL;
+	copy->prev = NULL;
+	copy->size = line->size;
+	copy->sb_id = line->sb_id;
+	copy->age = line->age;
+	copy->ref = 1;
+	copy->blank = line->blank;
+
+	*slot = copy;
+	line_free(line);
+	return copy;
+
+err:
+	llog_warning(con, "cannot allocate private copy of shared line");
+	return NULL;
+}
+
 static struct cell *get_cursor_cell(struct tsm_screen *con)
 {
 	unsigned int cur_x, cur_y;
+	struct line *line;
 
 	cur_x = con->cursor_x;
 	if (cur_x >= con->size_x)
@@ -79,7 +124,11 @@ static struct cell *get_cursor_cell(struct tsm_screen *con)
 	if (cur_y >= con->size_y)
 		cur_y = con->size_y - 1;
 
-	return &con->lines[cur_y]->cells[cur_x];
+	line = line_unshare(con, &con->lines[cur_y]);
+	if (!line)
+		return NULL;
+
+	return &line->cells[cur_x];
 }
 
 static void move_cursor(struct tsm_screen *con, unsigned int x, unsigned int y)
@@ -101,13 +150,15 @@ static void move_cursor(struct tsm_screen *con, unsigned int x, unsigned int y)
 		return;
 
 	c = get_cursor_cell(con);
-	c->age = con->age_cnt;
+	if (c)
+		c->age = con->age_cnt;
 
 	con->cursor_x = x;
 	con->cursor_y = y;
 
 	c = get_cursor_cell(con);
-	c->age = con->age_cnt;
+	if (c)
+		c->age = con->age_cnt;
 }
 
 void screen_cell_init_generic(struct tsm_screen *con, struct cell *cell, struct tsm_screen_attr *attr)
@@ -124,8 +175,28 @@ void screen_cell_init(struct tsm_screen *con, struct cell *cell)
 	screen_cell_init_generic(con, cell, &con->def_attr);
 }
 
-static int line_new(struct tsm_screen *con, struct line **out,
-		    unsigned int width)
+/*
+ * Initializes @num cells. Only the first cell is set up field by field, the
+ * others are copied from the already initialized ones in doubling blocks.
+ */
+static void screen_cells_init(struct tsm_screen *con, struct cell *cells,
+			      unsigned int num)
+{
+	unsigned int done, n;
+
+	if (!num)
+		return;
+
+	screen_cell_init(con, &cells[0]);
+	for (done = 1; done < num; done += n) {
+		n = done;
+		if (n > num - done)
+			n = num - done;
+		memcpy(&cells[done], cells, n * sizeof(*cells));
+	}
+}
+
+int line_new(struct tsm_screen *con, struct line **out, unsigned int width)
 {
 	struct line *line;
 	unsigned int i;
@@ -133,17 +204,19 @@ static int line_new(struct tsm_screen *con, struct line **out,
 	if (!width)
 		return -EINVAL;
 
-	line = malloc(sizeof(*line));
+	line = shl_malloc(sizeof(*line));
 	if (!line)
 		return -ENOMEM;
 	line->next = NULL;
 	line->prev = NULL;
 	line->size = width;
 	line->age = con->age_cnt;
+	line->ref = 1;
+	line->blank = true;
 
-	line->cells = malloc(sizeof(struct cell) * width);
+	line->cells = shl_malloc(sizeof(struct cell) * width);
 	if (!line->cells) {
-		free(line);
+		shl_free(line);
 		return -ENOMEM;
 	}
 
@@ -154,10 +227,55 @@ static int line_new(struct tsm_screen *con, struct line **out,
 	return 0;
 }
 
-static void line_free(struct line *line)
+/* Drops a reference to @line. Snapshots may do that from any thread. */
+void line_free(struct line *line)
 {
-	free(line->cells);
-	free(line);
+	if (__atomic_load_n(&line->ref, __ATOMIC_ACQUIRE) != 1 &&
+	    __atomic_sub_fetch(&line->ref, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	shl_free(line->cells);
+	shl_free(line);
+}
+
+/*
+ * Lines that leave the screen for good are kept as @con->spare instead of being
+ * freed, so once the scrollback-buffer is full, each line scrolled out of it
+ * provides the new line at the bottom and scrolling does not allocate.
+ */
+static void line_recycle(struct tsm_screen *con, struct line *line)
+{
+	if (con->spare || line->size != con->size_x ||
+	    __atomic_load_n(&line->ref, __ATOMIC_ACQUIRE) != 1) {
+		line_free(line);
+		return;
+	}
+
+	con->spare = line;
+}
+
+/* Like line_new() with the screen width, but reuses the spare line if any */
+static int line_new_spare(struct tsm_screen *con, struct line **out)
+{
+	struct line *line = con->spare;
+
+	if (!line || line->size != con->size_x) {
+		if (line) {
+			line_free(line);
+			con->spare = NULL;
+		}
+		return line_new(con, out, con->size_x);
+	}
+
+	con->spare = NULL;
+	line->next = NULL;
+	line->prev = NULL;
+	line->age = con->age_cnt;
+	line->blank = true;
+	screen_cells_init(con, line->cells, line->size);
+
+	*out = line;
+	return 0;
 }
 
 static int line_resize(struct tsm_screen *con, struct line *line,
@@ -169,11 +287,12 @@ static int line_resize(struct tsm_screen *con, struct line *line,
 		return -EINVAL;
 
 	if (line->size < width) {
-		tmp = realloc(line->cells, width * sizeof(struct cell));
+		tmp = shl_realloc(line->cells, width * sizeof(struct cell));
 		if (!tmp)
 			return -ENOMEM;
 
 		line->cells = tmp;
+		line->blank = false;
 
 		while (line->size < width) {
 			screen_cell_init(con, &line->cells[line->size]);
@@ -184,6 +303,34 @@ static int line_resize(struct tsm_screen *con, struct line *line,
 	return 0;
 }
 
+/*
+ * Returns true if clearing the visible cells of @line with the current
+ * attributes would not change it. Erase and scroll sequences check this first
+ * so repeating them on a blank screen does not touch any cells.
+ */
+static inline bool line_is_clear(struct tsm_screen *con,
+				 const struct line *line)
+{
+	return line->blank && !memcmp(&line->cells[0].attr, &con->def_attr,
+				      sizeof(con->def_attr));
+}
+
+/* Clears the visible cells of the line in @slot, unless it is clear already */
+static void line_clear(struct tsm_screen *con, struct line **slot)
+{
+	struct line *line;
+
+	if (line_is_clear(con, *slot))
+		return;
+
+	line = line_unshare(con, slot);
+	if (!line)
+		return;
+
+	screen_cells_init(con, line->cells, con->size_x);
+	line->blank = true;
+}
+
 /* This links the given line into the scrollback-buffer */
 static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 {
@@ -193,6 +340,14 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 	con->age = con->age_cnt;
 
 	if (con->sb_max == 0) {
+		/* the line is dropped, but observers still see it */
+		line->sb_id = ++con->sb_last_id;
+		if (con->sb_log)
+			screen_log_add(con, line);
+		if (con->sb_cb)
+			con->sb_cb(con, (struct tsm_screen_line*)line,
+				   line->sb_id, con->sb_data);
+
 		if (con->sel_active) {
 			if (con->sel_start.line == line) {
 				con->sel_start.line = NULL;
@@ -203,7 +358,9 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 				con->sel_end.y = SELECTION_TOP;
 			}
 		}
-		line_free(line);
+		STAT_ADD(con, sb_evictions, 1);
+		TRACE2(screen_sb_evict, con, line->sb_id);
+		line_recycle(con, line);
 		return;
 	}
 
@@ -250,7 +407,11 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 				con->sel_end.y = SELECTION_TOP;
 			}
 		}
-		line_free(tmp);
+		if (con->sb_index)
+			screen_index_evict(con, tmp);
+		STAT_ADD(con, sb_evictions, 1);
+		TRACE2(screen_sb_evict, con, tmp->sb_id);
+		line_recycle(con, tmp);
 	}
 
 	line->sb_id = ++con->sb_last_id;
@@ -264,6 +425,16 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 	con->sb_last = line;
 	++con->sb_count;
 
+	if (con->sb_index)
+		screen_index_add(con, line);
+
+	if (con->sb_log)
+		screen_log_add(con, line);
+
+	if (con->sb_cb)
+		con->sb_cb(con, (struct tsm_screen_line*)line, line->sb_id,
+			   con->sb_data);
+
 	if (con->sb_pos == NULL) {
 		con->sb_pos_num = con->sb_count;
 	}
@@ -271,7 +442,7 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 
 static void screen_scroll_up(struct tsm_screen *con, unsigned int num)
 {
-	unsigned int i, j, max, pos;
+	unsigned int i, max, pos;
 	int ret;
 
 	if (!num)
@@ -295,19 +466,21 @@ static void screen_scroll_up(struct tsm_screen *con, unsigned int num)
 	}
 	struct line *cache[num];
 
+	STAT_ADD(con, scroll_lines, num);
+	TRACE2(screen_scroll_up, con, num);
+
 	for (i = 0; i < num; ++i) {
 		pos = con->margin_top + i;
 		if (!(con->flags & TSM_SCREEN_ALTERNATE))
-			ret = line_new(con, &cache[i], con->size_x);
+			ret = line_new_spare(con, &cache[i]);
 		else
 			ret = -EAGAIN;
 
 		if (!ret) {
 			link_to_scrollback(con, con->lines[pos]);
 		} else {
+			line_clear(con, &con->lines[pos]);
 			cache[i] = con->lines[pos];
-			for (j = 0; j < con->size_x; ++j)
-				screen_cell_init(con, &cache[i]->cells[j]);
 		}
 	}
 
@@ -344,7 +517,7 @@ static void screen_scroll_up(struct tsm_screen *con, unsigned int num)
 
 static void screen_scroll_down(struct tsm_screen *con, unsigned int num)
 {
-	unsigned int i, j, max;
+	unsigned int i, max;
 
 	if (!num)
 		return;
@@ -363,10 +536,11 @@ static void screen_scroll_down(struct tsm_screen *con, unsigned int num)
 	}
 	struct line *cache[num];
 
+	STAT_ADD(con, scroll_lines, num);
+
 	for (i = 0; i < num; ++i) {
+		line_clear(con, &con->lines[con->margin_bottom - i]);
 		cache[i] = con->lines[con->margin_bottom - i];
-		for (j = 0; j < con->size_x; ++j)
-			screen_cell_init(con, &cache[i]->cells[j]);
 	}
 
 	if (num < max) {
@@ -386,12 +560,36 @@ static void screen_scroll_down(struct tsm_screen *con, unsigned int num)
 	}
 }
 
+/*
+ * Writes @num copies of @ch, which is @len cells wide, starting at @x. The
+ * caller makes sure they fit into the line, only the last one may be cut off.
+ */
+static void line_fill(struct tsm_screen *con, struct line *line,
+		      unsigned int x, tsm_symbol_t ch, unsigned int len,
+		      const struct tsm_screen_attr *attr, unsigned int num)
+{
+	struct cell *cell;
+	unsigned int i;
+
+	for ( ; num; --num, x += len) {
+		cell = &line->cells[x];
+		cell->age = con->age_cnt;
+		cell->ch = ch;
+		cell->width = len;
+		memcpy(&cell->attr, attr, sizeof(*attr));
+
+		for (i = 1; i < len && i + x < con->size_x; ++i) {
+			cell[i].age = con->age_cnt;
+			cell[i].width = 0;
+		}
+	}
+}
+
 static void screen_write(struct tsm_screen *con, unsigned int x,
 			  unsigned int y, tsm_symbol_t ch, unsigned int len,
 			  const struct tsm_screen_attr *attr)
 {
 	struct line *line;
-	unsigned int i;
 
 	if (!len)
 		return;
@@ -401,7 +599,10 @@ static void screen_write(struct tsm_screen *con, unsigned int x,
 		return;
 	}
 
-	line = con->lines[y];
+	line = line_unshare(con, &con->lines[y]);
+	if (!line)
+		return;
+	line->blank = false;
 
 	if ((con->flags & TSM_SCREEN_INSERT_MODE) &&
 	    (int)x < ((int)con->size_x - len)) {
@@ -410,15 +611,7 @@ static void screen_write(struct tsm_screen *con, unsigned int x,
 			sizeof(struct cell) * (con->size_x - len - x));
 	}
 
-	line->cells[x].age = con->age_cnt;
-	line->cells[x].ch = ch;
-	line->cells[x].width = len;
-	memcpy(&line->cells[x].attr, attr, sizeof(*attr));
-
-	for (i = 1; i < len && i + x < con->size_x; ++i) {
-		line->cells[x + i].age = con->age_cnt;
-		line->cells[x + i].width = 0;
-	}
+	line_fill(con, line, x, ch, len, attr, 1);
 }
 
 static void screen_erase_region(struct tsm_screen *con,
@@ -430,6 +623,7 @@ static void screen_erase_region(struct tsm_screen *con,
 {
 	unsigned int to;
 	struct line *line;
+	bool blank;
 
 	/* TODO: more sophisticated ageing */
 	con->age = con->age_cnt;
@@ -439,24 +633,37 @@ static void screen_erase_region(struct tsm_screen *con,
 	if (x_to >= con->size_x)
 		x_to = con->size_x - 1;
 
-	for ( ; y_from <= y_to; ++y_from) {
-		line = con->lines[y_from];
-		if (!line) {
-			x_from = 0;
+	for ( ; y_from <= y_to; ++y_from, x_from = 0) {
+		if (line_is_clear(con, con->lines[y_from]))
+			continue;
+
+		line = line_unshare(con, &con->lines[y_from]);
+		if (!line)
 			continue;
-		}
 
 		if (y_from == y_to)
 			to = x_to;
 		else
 			to = con->size_x - 1;
+
+		/* only a complete erase leaves the line blank */
+		blank = !x_from && to == con->size_x - 1;
+		if (!protect) {
+			screen_cells_init(con, &line->cells[x_from],
+					  to - x_from + 1);
+			line->blank = blank;
+			continue;
+		}
+
 		for ( ; x_from <= to; ++x_from) {
-			if (protect && line->cells[x_from].attr.protect)
+			if (protect && line->cells[x_from].attr.protect) {
+				blank = false;
 				continue;
+			}
 
 			screen_cell_init(con, &line->cells[x_from]);
 		}
-		x_from = 0;
+		line->blank = blank;
 	}
 }
 
@@ -483,7 +690,7 @@ int tsm_screen_new(struct tsm_screen **out, tsm_log_t log, void *log_data)
 	if (!out)
 		return -EINVAL;
 
-	con = malloc(sizeof(*con));
+	con = shl_malloc(sizeof(*con));
 	if (!con)
 		return -ENOMEM;
 
@@ -515,11 +722,11 @@ err_free:
 		line_free(con->main_lines[i]);
 		line_free(con->alt_lines[i]);
 	}
-	free(con->main_lines);
-	free(con->alt_lines);
-	free(con->tab_ruler);
+	shl_free(con->main_lines);
+	shl_free(con->alt_lines);
+	shl_free(con->tab_ruler);
 	tsm_symbol_table_unref(con->sym_table);
-	free(con);
+	shl_free(con);
 	return ret;
 }
 
@@ -547,12 +754,27 @@ void tsm_screen_unref(struct tsm_screen *con)
 		line_free(con->alt_lines[i]);
 	}
 
-	free(con->main_lines);
-	free(con->alt_lines);
-	free(con->tab_ruler);
+	shl_free(con->main_lines);
+	shl_free(con->alt_lines);
+	shl_free(con->tab_ruler);
 	tsm_symbol_table_unref(con->sym_table);
 	tsm_screen_clear_sb(con);
-	free(con);
+	if (con->spare)
+		line_free(con->spare);
+	screen_index_free(con->sb_index);
+	shl_free(con->sb_text.text);
+	shl_free(con);
+}
+
+SHL_EXPORT
+void tsm_screen_set_sb_cb(struct tsm_screen *con, tsm_screen_sb_cb sb_cb,
+			  void *data)
+{
+	if (!con)
+		return;
+
+	con->sb_cb = sb_cb;
+	con->sb_data = data;
 }
 
 void tsm_screen_set_opts(struct tsm_screen *scr, unsigned int opts)
@@ -612,6 +834,8 @@ int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
 	if (con->size_x == x && con->size_y == y)
 		return 0;
 
+	TRACE3(screen_resize, con, x, y);
+
 	/* First make sure the line buffer is big enough for our new screen.
 	 * That is, allocate all new lines and make sure each line has enough
 	 * cells to hold the new screen or the current screen. If we fail, we
@@ -621,7 +845,7 @@ int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
 	 * invalid lines in the buffer. */
 	if (y > con->line_num) {
 		/* resize main buffer */
-		cache = realloc(con->main_lines, sizeof(struct line*) * y);
+		cache = shl_realloc(con->main_lines, sizeof(struct line*) * y);
 		if (!cache)
 			return -ENOMEM;
 
@@ -630,7 +854,7 @@ int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
 		con->main_lines = cache;
 
 		/* resize alt buffer */
-		cache = realloc(con->alt_lines, sizeof(struct line*) * y);
+		cache = shl_realloc(con->alt_lines, sizeof(struct line*) * y);
 		if (!cache)
 			return -ENOMEM;
 
@@ -661,11 +885,18 @@ int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
 		}
 	}
 
+	/* all lines get resized or cleared below */
+	for (i = 0; i < con->line_num; ++i) {
+		if (!line_unshare(con, &con->main_lines[i]) ||
+		    !line_unshare(con, &con->alt_lines[i]))
+			return -ENOMEM;
+	}
+
 	/* Resize all lines in the buffer if we increase screen width. This
 	 * will guarantee that all lines are big enough so we can resize the
 	 * buffer without reallocating them later. */
 	if (x > con->size_x) {
-		tab_ruler = realloc(con->tab_ruler, sizeof(bool) * x);
+		tab_ruler = shl_realloc(con->tab_ruler, sizeof(bool) * x);
 		if (!tab_ruler)
 			return -ENOMEM;
 		con->tab_ruler = tab_ruler;
@@ -703,6 +934,15 @@ int tsm_screen_resize(struct tsm_screen *con, unsigned int x,
 
 		for ( ; i < x; ++i)
 			screen_cell_init(con, &con->alt_lines[j]->cells[i]);
+
+		/* the padding may not match the rest of a visible line */
+		if (j >= con->size_y) {
+			con->main_lines[j]->blank = true;
+			con->alt_lines[j]->blank = true;
+		} else if (x > con->size_x) {
+			con->main_lines[j]->blank = false;
+			con->alt_lines[j]->blank = false;
+		}
 	}
 
 	/* xterm destroys margins on resize, so do we */
@@ -811,6 +1051,9 @@ void tsm_screen_set_max_sb(struct tsm_screen *con,
 				con->sel_end.y = SELECTION_TOP;
 			}
 		}
+		if (con->sb_index)
+			screen_index_evict(con, line);
+		STAT_ADD(con, sb_evictions, 1);
 		line_free(line);
 	}
 
@@ -842,6 +1085,9 @@ void tsm_screen_clear_sb(struct tsm_screen *con)
 	con->sb_pos = NULL;
 	con->sb_pos_num = 0;
 
+	if (con->sb_index)
+		screen_index_clear(con);
+
 	if (con->sel_active) {
 		if (con->sel_start.line) {
 			con->sel_start.line = NULL;
@@ -854,6 +1100,31 @@ void tsm_screen_clear_sb(struct tsm_screen *con)
 	}
 }
 
+SHL_EXPORT
+int tsm_screen_get_stats(struct tsm_screen *con, struct tsm_screen_stats *out)
+{
+#ifdef BUILD_ENABLE_STATS
+	struct line *iter;
+
+	if (!con || !out)
+		return -EINVAL;
+
+	*out = con->stats;
+	out->sb_lines = con->sb_count;
+	out->sb_bytes = 0;
+	for (iter = con->sb_first; iter; iter = iter->next)
+		out->sb_bytes += sizeof(*iter) + iter->size * sizeof(struct cell);
+	out->symbols = tsm_symbol_table_get_count(con->sym_table);
+
+	return 0;
+#else
+	if (!con || !out)
+		return -EINVAL;
+
+	return -EOPNOTSUPP;
+#endif
+}
+
 SHL_EXPORT
 void tsm_screen_sb_up(struct tsm_screen *con, unsigned int num)
 {
@@ -1010,7 +1281,8 @@ void tsm_screen_set_flags(struct tsm_screen *con, unsigned int flags)
 	if (!(old & TSM_SCREEN_HIDE_CURSOR) &&
 	    (flags & TSM_SCREEN_HIDE_CURSOR)) {
 		c = get_cursor_cell(con);
-		c->age = con->age_cnt;
+		if (c)
+			c->age = con->age_cnt;
 	}
 
 	if (!(old & TSM_SCREEN_INVERSE) && (flags & TSM_SCREEN_INVERSE))
@@ -1039,7 +1311,8 @@ void tsm_screen_reset_flags(struct tsm_screen *con, unsigned int flags)
 	if ((old & TSM_SCREEN_HIDE_CURSOR) &&
 	    (flags & TSM_SCREEN_HIDE_CURSOR)) {
 		c = get_cursor_cell(con);
-		c->age = con->age_cnt;
+		if (c)
+			c->age = con->age_cnt;
 	}
 
 	if ((old & TSM_SCREEN_INVERSE) && (flags & TSM_SCREEN_INVERSE))
@@ -1138,6 +1411,85 @@ void tsm_screen_write(struct tsm_screen *con, tsm_symbol_t ch,
 
 	screen_write(con, con->cursor_x, con->cursor_y, ch, len, attr);
 	move_cursor(con, con->cursor_x + len, con->cursor_y);
+	STAT_ADD(con, cells, len);
+}
+
+/*
+ * Repeated characters are written a line at a time with line_fill(). Whenever
+ * the cursor is at the end of a line, a single character goes through
+ * tsm_screen_write() which takes care of wrapping and scrolling.
+ * Beyond a full screen and a full scrollback, more repetitions only push
+ * copies through the scrollback that are evicted again. Unless someone watches
+ * lines leave the screen, the count is cut down to that plus the rest of a
+ * line and the scrollback IDs of the skipped lines are accounted for. Without
+ * auto-wrap, everything after the end of the line overwrites the last cell.
+ */
+SHL_EXPORT
+void tsm_screen_write_repeat(struct tsm_screen *con, tsm_symbol_t ch,
+			     const struct tsm_screen_attr *attr,
+			     unsigned int num)
+{
+	unsigned int len, per_line, n;
+	uint64_t max, rows;
+	struct line *line;
+
+	if (!con || !num || !con->size_x || !con->size_y)
+		return;
+
+	len = tsm_symbol_get_width(con->sym_table, ch);
+	if (!len)
+		return;
+
+	/* a wide character at the end of a line is cut off */
+	per_line = (con->size_x + len - 1) / len;
+
+	if (!(con->flags & TSM_SCREEN_AUTO_WRAP)) {
+		if (num > per_line + 1)
+			num = per_line + 1;
+	} else if (!con->sb_cb && !con->sb_log && !con->sb_pos &&
+		   !con->sel_active) {
+		rows = con->size_y + 2;
+		if (!(con->flags & TSM_SCREEN_ALTERNATE))
+			rows += con->sb_max;
+		max = rows * per_line;
+		if (num > max) {
+			rows = (num - max) / per_line;
+			num = max + (num - max) % per_line;
+			if (!(con->flags & TSM_SCREEN_ALTERNATE))
+				con->sb_last_id += rows;
+		}
+	}
+
+	/* insert mode shifts the line for every character */
+	if (con->flags & TSM_SCREEN_INSERT_MODE) {
+		for ( ; num; --num)
+			tsm_screen_write(con, ch, attr);
+		return;
+	}
+
+	while (num) {
+		n = 0;
+		if (con->cursor_x < con->size_x && con->cursor_y < con->size_y)
+			n = (con->size_x - con->cursor_x) / len;
+		if (!n) {
+			tsm_screen_write(con, ch, attr);
+			--num;
+			continue;
+		}
+		if (n > num)
+			n = num;
+
+		screen_inc_age(con);
+		line = line_unshare(con, &con->lines[con->cursor_y]);
+		if (!line)
+			return;
+		line->blank = false;
+
+		line_fill(con, line, con->cursor_x, ch, len, attr, n);
+		move_cursor(con, con->cursor_x + n * len, con->cursor_y);
+		STAT_ADD(con, cells, n * len);
+		num -= n;
+	}
 }
 
 SHL_EXPORT
@@ -1377,7 +1729,7 @@ void tsm_screen_tab_left(struct tsm_screen *con, unsigned int num)
 SHL_EXPORT
 void tsm_screen_insert_lines(struct tsm_screen *con, unsigned int num)
 {
-	unsigned int i, j, max;
+	unsigned int i, max;
 
 	if (!con || !num)
 		return;
@@ -1397,9 +1749,8 @@ void tsm_screen_insert_lines(struct tsm_screen *con, unsigned int num)
 	struct line *cache[num];
 
 	for (i = 0; i < num; ++i) {
+		line_clear(con, &con->lines[con->margin_bottom - i]);
 		cache[i] = con->lines[con->margin_bottom - i];
-		for (j = 0; j < con->size_x; ++j)
-			screen_cell_init(con, &cache[i]->cells[j]);
 	}
 
 	if (num < max) {
@@ -1417,7 +1768,7 @@ void tsm_screen_insert_lines(struct tsm_screen *con, unsigned int num)
 SHL_EXPORT
 void tsm_screen_delete_lines(struct tsm_screen *con, unsigned int num)
 {
-	unsigned int i, j, max;
+	unsigned int i, max;
 
 	if (!con || !num)
 		return;
@@ -1437,9 +1788,8 @@ void tsm_screen_delete_lines(struct tsm_screen *con, unsigned int num)
 	struct line *cache[num];
 
 	for (i = 0; i < num; ++i) {
+		line_clear(con, &con->lines[con->cursor_y + i]);
 		cache[i] = con->lines[con->cursor_y + i];
-		for (j = 0; j < con->size_x; ++j)
-			screen_cell_init(con, &cache[i]->cells[j]);
 	}
 
 	if (num < max) {
@@ -1457,8 +1807,9 @@ void tsm_screen_delete_lines(struct tsm_screen *con, unsigned int num)
 SHL_EXPORT
 void tsm_screen_insert_chars(struct tsm_screen *con, unsigned int num)
 {
+	struct line *line;
 	struct cell *cells;
-	unsigned int max, mv, i;
+	unsigned int max, mv;
 
 	if (!con || !num || !con->size_y || !con->size_x)
 		return;
@@ -1477,21 +1828,29 @@ void tsm_screen_insert_chars(struct tsm_screen *con, unsigned int num)
 		num = max;
 	mv = max - num;
 
-	cells = con->lines[con->cursor_y]->cells;
+	if (line_is_clear(con, con->lines[con->cursor_y]))
+		return;
+
+	line = line_unshare(con, &con->lines[con->cursor_y]);
+	if (!line)
+		return;
+	line->blank = false;
+
+	cells = line->cells;
 	if (mv)
 		memmove(&cells[con->cursor_x + num],
 			&cells[con->cursor_x],
 			mv * sizeof(*cells));
 
-	for (i = 0; i < num; ++i)
-		screen_cell_init(con, &cells[con->cursor_x + i]);
+	screen_cells_init(con, &cells[con->cursor_x], num);
 }
 
 SHL_EXPORT
 void tsm_screen_delete_chars(struct tsm_screen *con, unsigned int num)
 {
+	struct line *line;
 	struct cell *cells;
-	unsigned int max, mv, i;
+	unsigned int max, mv;
 
 	if (!con || !num || !con->size_y || !con->size_x)
 		return;
@@ -1510,14 +1869,21 @@ void tsm_screen_delete_chars(struct tsm_screen *con, unsigned int num)
 		num = max;
 	mv = max - num;
 
-	cells = con->lines[con->cursor_y]->cells;
+	if (line_is_clear(con, con->lines[con->cursor_y]))
+		return;
+
+	line = line_unshare(con, &con->lines[con->cursor_y]);
+	if (!line)
+		return;
+	line->blank = false;
+
+	cells = line->cells;
 	if (mv)
 		memmove(&cells[con->cursor_x],
 			&cells[con->cursor_x + num],
 			mv * sizeof(*cells));
 
-	for (i = 0; i < num; ++i)
-		screen_cell_init(con, &cells[con->cursor_x + mv + i]);
+	screen_cells_init(con, &cells[con->cursor_x + mv], num);
 }
 
 SHL_EXPORT
@@ -1553,6 +1919,9 @@ void tsm_screen_erase_chars(struct tsm_screen *con, unsigned int num)
 	else
 		x = con->cursor_x;
 
+	if (num > con->size_x - x)
+		num = con->size_x - x;
+
 	screen_erase_region(con, x, con->cursor_y, x + num - 1, con->cursor_y,
 			     false);
 }
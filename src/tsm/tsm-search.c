@@ -0,0 +1,939 @@
+/*
+ * libtsm - Screen Search
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Screen Search
+ * A search object scans the scrollback-buffer and the active screen for a
+ * literal string or a POSIX extended regular expression. Matching is done
+ * line-by-line on the UTF-8 rendering of each line, so matches never span
+ * multiple lines.
+ *
+ * Lines are addressed by "rows". Scrollback lines use their sb_id as row, the
+ * lines of the active screen continue right after the last sb_id. As lines are
+ * only ever appended to the bottom of the scrollback-buffer and evicted from
+ * its top, a row keeps addressing the same line while it scrolls from the
+ * screen into the scrollback-buffer. Hence, a search can be suspended at any
+ * point and resumed later even if new lines were pushed in the meantime.
+ *
+ * tsm_screen_search_next() scans at most a caller-given number of lines per
+ * call. This allows UIs to run long searches in small time slices from their
+ * main-loop without blocking redraws.
+ *
+ * INDEX:
+ * Optionally, the screen maintains a trigram index over the scrollback-buffer.
+ * Each line is case-folded and every 3-byte sequence of its text is hashed
+ * into one of INDEX_SIZE buckets. Each bucket keeps a sorted list of the rows
+ * that contain one of its trigrams. As rows grow monotonically, new rows are
+ * appended to the lists and evicted rows are dropped from their front.
+ * Literal searches intersect the lists of all trigrams of the needle to skip
+ * lines that cannot match. Hash collisions only produce false candidates,
+ * which are rejected when the line is verified, so results are identical with
+ * and without index.
+ * The index never grows beyond its configured size. If it does, the oldest
+ * rows are dropped from the index and scanned linearly instead.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+#include "libtsm.h"
+#include "libtsm-int.h"
+#include "shl-llog.h"
+
+#define LLOG_SUBSYSTEM "tsm-search"
+
+#define INDEX_BITS 14
+#define INDEX_SIZE (1U << INDEX_BITS)
+
+struct index_list {
+	uint32_t *rows;			/* rows relative to index base */
+	uint32_t head;			/* first live entry */
+	uint32_t len;			/* number of used entries */
+	uint32_t cap;			/* number of allocated entries */
+};
+
+struct tsm_screen_index {
+	size_t max_size;		/* memory limit in bytes */
+	size_t size;			/* currently allocated bytes */
+
+	uint64_t base;			/* row of relative row 0 */
+	uint64_t first;			/* first indexed row */
+	uint64_t end;			/* one past the last indexed row */
+	uint64_t swept;			/* @first on last sweep */
+
+	struct line_text buf;
+	struct index_list lists[INDEX_SIZE];
+};
+
+struct tsm_screen_search {
+	struct tsm_screen *con;
+	unsigned int flags;
+
+	char *needle;			/* literal pattern, folded if ICASE */
+	size_t needle_len;
+	regex_t regex;			/* compiled pattern if REGEX */
+
+	uint64_t row;			/* row to continue with */
+	unsigned int x;			/* column limit within @row */
+
+	struct line *line;		/* cached scrollback line */
+	uint64_t line_row;		/* row of @line */
+
+	uint32_t *grams;		/* index buckets of the needle */
+	size_t gram_num;
+
+	struct line_text buf;		/* text of the current line */
+};
+
+/* Renders @line into @t and returns its length. Empty cells are rendered as
+ * spaces, trailing empty cells are skipped. If @fold is set, the text is
+ * converted to lower-case. */
+int line_render(struct tsm_symbol_table *tbl, struct line *line, bool fold,
+		struct line_text *t, size_t *out)
+{
+	unsigned int i, j, end, *cols;
+	size_t n, k, len, max;
+	const uint32_t *ucs4;
+	tsm_symbol_t sym;
+	uint32_t c;
+	char *text;
+
+	end = line->size;
+	while (end && !line->cells[end - 1].ch)
+		--end;
+
+	max = (size_t)end * TSM_UCS4_MAXLEN * 4 + 1;
+	if (max > t->size) {
+		text = shl_realloc(t->text, max);
+		if (!text)
+			return -ENOMEM;
+		t->text = text;
+
+		if (t->cols) {
+			cols = shl_realloc(t->cols, max * sizeof(*cols));
+			if (!cols)
+				return -ENOMEM;
+			t->cols = cols;
+		}
+
+		t->size = max;
+	}
+
+	text = t->text;
+	cols = t->cols;
+	n = 0;
+
+	for (i = 0; i < end; ++i) {
+		/* skip trailing cells of wide characters */
+		if (!line->cells[i].width)
+			continue;
+
+		sym = line->cells[i].ch;
+		if (sym < 0x80) {
+			if (!sym)
+				sym = ' ';
+			else if (fold && sym >= 'A' && sym <= 'Z')
+				sym += 'a' - 'A';
+			if (cols)
+				cols[n] = i;
+			text[n++] = sym;
+			continue;
+		}
+
+		ucs4 = tsm_symbol_get(tbl, &sym, &len);
+		for (j = 0; j < len; ++j) {
+			c = ucs4[j];
+			if (fold)
+				c = towlower(c);
+			k = n;
+			n += tsm_ucs4_to_utf8(c, &text[n]);
+			while (cols && k < n)
+				cols[k++] = i;
+		}
+	}
+
+	text[n] = 0;
+	*out = n;
+	return 0;
+}
+
+/* Converts the UTF-8 string @in to lower-case. @out must have room for
+ * 4 * strlen(@in) bytes. */
+static int search_fold_utf8(const char *in, char *out, size_t *out_len)
+{
+	struct tsm_utf8_mach *mach;
+	uint32_t ucs4;
+	size_t i, n;
+	int ret, state;
+
+	ret = tsm_utf8_mach_new(&mach);
+	if (ret)
+		return ret;
+
+	n = 0;
+	for (i = 0; in[i]; ++i) {
+		state = tsm_utf8_mach_feed(mach, in[i]);
+		if (state != TSM_UTF8_ACCEPT && state != TSM_UTF8_REJECT)
+			continue;
+
+		ucs4 = towlower(tsm_utf8_mach_get(mach));
+		n += tsm_ucs4_to_utf8(ucs4, &out[n]);
+	}
+
+	tsm_utf8_mach_free(mach);
+	*out_len = n;
+	return 0;
+}
+
+static inline uint32_t index_hash(const char *text)
+{
+	uint32_t v;
+
+	v = (uint32_t)(unsigned char)text[0] << 16 |
+	    (uint32_t)(unsigned char)text[1] << 8 |
+	    (uint32_t)(unsigned char)text[2];
+
+	return (v * 2654435761U) >> (32 - INDEX_BITS);
+}
+
+static void index_list_free(struct tsm_screen_index *idx,
+			    struct index_list *l)
+{
+	idx->size -= l->cap * sizeof(*l->rows);
+	shl_free(l->rows);
+	memset(l, 0, sizeof(*l));
+}
+
+/* drops all rows before idx->first from the lists */
+static void index_sweep(struct tsm_screen_index *idx)
+{
+	struct index_list *l;
+	uint32_t *rows, rel, n;
+	unsigned int i;
+
+	rel = idx->first - idx->base;
+
+	for (i = 0; i < INDEX_SIZE; ++i) {
+		l = &idx->lists[i];
+		while (l->head < l->len && l->rows[l->head] < rel)
+			++l->head;
+
+		if (l->head == l->len) {
+			if (l->rows)
+				index_list_free(idx, l);
+			continue;
+		}
+
+		if (!l->head)
+			continue;
+
+		n = l->len - l->head;
+		memmove(l->rows, &l->rows[l->head], n * sizeof(*l->rows));
+		l->head = 0;
+		l->len = n;
+
+		if (l->cap > 4 * n) {
+			rows = shl_realloc(l->rows, 2 * n * sizeof(*l->rows));
+			if (rows) {
+				idx->size -= (l->cap - 2 * n) * sizeof(*rows);
+				l->rows = rows;
+				l->cap = 2 * n;
+			}
+		}
+	}
+
+	idx->swept = idx->first;
+}
+
+/* drops all rows from the index and restarts it at @row */
+static void index_reset(struct tsm_screen_index *idx, uint64_t row)
+{
+	unsigned int i;
+
+	for (i = 0; i < INDEX_SIZE; ++i) {
+		if (idx->lists[i].rows)
+			index_list_free(idx, &idx->lists[i]);
+	}
+
+	idx->base = row;
+	idx->first = row;
+	idx->end = row;
+	idx->swept = row;
+}
+
+/* drops the oldest rows until the lists use at most 3/4 of their budget */
+static void index_shrink(struct tsm_screen_index *idx)
+{
+	size_t limit;
+
+	limit = sizeof(*idx) + (idx->max_size - sizeof(*idx)) / 4 * 3;
+
+	while (idx->size > limit && idx->first < idx->end) {
+		idx->first += (idx->end - idx->first + 3) / 4;
+		index_sweep(idx);
+	}
+}
+
+static int index_add_row(struct tsm_screen_index *idx, uint32_t bucket,
+			 uint32_t rel)
+{
+	struct index_list *l = &idx->lists[bucket];
+	uint32_t *rows, cap;
+
+	/* rows are added in order, so duplicates are always at the end */
+	if (l->len > l->head && l->rows[l->len - 1] == rel)
+		return 0;
+
+	if (l->len == l->cap) {
+		if (l->head && l->head >= l->len / 2) {
+			l->len -= l->head;
+			memmove(l->rows, &l->rows[l->head],
+				l->len * sizeof(*l->rows));
+			l->head = 0;
+		} else {
+			cap = l->cap ? l->cap * 2 : 4;
+			rows = shl_realloc(l->rows, cap * sizeof(*rows));
+			if (!rows)
+				return -ENOMEM;
+
+			idx->size += (cap - l->cap) * sizeof(*rows);
+			l->rows = rows;
+			l->cap = cap;
+		}
+	}
+
+	l->rows[l->len++] = rel;
+	return 0;
+}
+
+void screen_index_add(struct tsm_screen *con, struct line *line)
+{
+	struct tsm_screen_index *idx = con->sb_index;
+	uint64_t row = line->sb_id;
+	size_t i, len;
+	uint32_t rel;
+	int ret;
+
+	if (row != idx->end || row - idx->base >= UINT32_MAX)
+		index_reset(idx, row);
+
+	ret = line_render(con->sym_table, line, true, &idx->buf, &len);
+	if (ret)
+		goto err_reset;
+
+	rel = row - idx->base;
+	for (i = 0; i + 3 <= len; ++i) {
+		ret = index_add_row(idx, index_hash(&idx->buf.text[i]), rel);
+		if (ret)
+			goto err_reset;
+	}
+
+	idx->end = row + 1;
+
+	if (idx->size > idx->max_size)
+		index_shrink(idx);
+	return;
+
+err_reset:
+	/* A partially indexed row would hide matches, so drop everything up to
+	 * and including this row. These rows are scanned linearly instead. */
+	llog_debug(con, "cannot index scrollback line %" PRIu64, row);
+	index_reset(idx, row + 1);
+}
+
+void screen_index_evict(struct tsm_screen *con, struct line *line)
+{
+	struct tsm_screen_index *idx = con->sb_index;
+
+	if (line->sb_id < idx->first)
+		return;
+
+	idx->first = line->sb_id + 1;
+	if (idx->first > idx->end)
+		idx->end = idx->first;
+
+	/* sweep once more rows were evicted than are left in the index */
+	if (idx->first - idx->swept > idx->end - idx->first)
+		index_sweep(idx);
+}
+
+void screen_index_clear(struct tsm_screen *con)
+{
+	index_reset(con->sb_index, con->sb_last_id + 1);
+}
+
+void screen_index_free(struct tsm_screen_index *idx)
+{
+	unsigned int i;
+
+	if (!idx)
+		return;
+
+	for (i = 0; i < INDEX_SIZE; ++i)
+		shl_free(idx->lists[i].rows);
+	shl_free(idx->buf.text);
+	shl_free(idx);
+}
+
+SHL_EXPORT
+int tsm_screen_set_sb_index(struct tsm_screen *con, size_t max_size)
+{
+	struct tsm_screen_index *idx;
+	struct line *iter;
+
+	if (!con)
+		return -EINVAL;
+
+	screen_index_free(con->sb_index);
+	con->sb_index = NULL;
+
+	if (!max_size)
+		return 0;
+	if (max_size < sizeof(*idx))
+		return -EINVAL;
+
+	idx = shl_malloc(sizeof(*idx));
+	if (!idx)
+		return -ENOMEM;
+	memset(idx, 0, sizeof(*idx));
+	idx->max_size = max_size;
+	idx->size = sizeof(*idx);
+	con->sb_index = idx;
+
+	if (con->sb_first)
+		index_reset(idx, con->sb_first->sb_id);
+	else
+		screen_index_clear(con);
+
+	for (iter = con->sb_first; iter; iter = iter->next)
+		screen_index_add(con, iter);
+
+	return 0;
+}
+
+static size_t index_lower_bound(const struct index_list *l, uint32_t rel)
+{
+	size_t lo = l->head, hi = l->len, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (l->rows[mid] < rel)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Finds the first row at or after *row (or the last row at or before *row if
+ * @backward is set) which contains all trigrams of the needle. *row must be
+ * within the indexed range. */
+static bool index_find(struct tsm_screen_index *idx,
+		       const uint32_t *grams, size_t num,
+		       uint64_t *row, bool backward)
+{
+	const struct index_list *l;
+	uint32_t target, first;
+	size_t i, pos;
+	bool again;
+
+	target = *row - idx->base;
+	first = idx->first - idx->base;
+
+	do {
+		again = false;
+		for (i = 0; i < num; ++i) {
+			l = &idx->lists[grams[i]];
+			pos = index_lower_bound(l, target);
+
+			if (pos < l->len && l->rows[pos] == target)
+				continue;
+
+			if (!backward) {
+				if (pos >= l->len)
+					return false;
+				target = l->rows[pos];
+			} else {
+				if (pos <= l->head || l->rows[pos - 1] < first)
+					return false;
+				target = l->rows[pos - 1];
+			}
+			again = true;
+		}
+	} while (again);
+
+	*row = idx->base + target;
+	return true;
+}
+
+static uint64_t search_first_row(struct tsm_screen *con)
+{
+	if (con->sb_first)
+		return con->sb_first->sb_id;
+
+	return con->sb_last_id + 1;
+}
+
+static uint64_t search_end_row(struct tsm_screen *con)
+{
+	return con->sb_last_id + 1 + con->size_y;
+}
+
+static struct line *search_get_line(struct tsm_screen_search *s, uint64_t row)
+{
+	struct tsm_screen *con = s->con;
+	struct line *line;
+	uint64_t id, first, last;
+
+	if (row > con->sb_last_id) {
+		row -= con->sb_last_id + 1;
+		if (row >= con->size_y)
+			return NULL;
+		return con->lines[row];
+	}
+
+	if (!con->sb_first || row < con->sb_first->sb_id)
+		return NULL;
+
+	first = con->sb_first->sb_id;
+	last = con->sb_last->sb_id;
+
+	/* Start walking from the closest known line. The cached line is still
+	 * linked if its row is within the scrollback range, as lines are only
+	 * evicted from the top. */
+	if (row - first < last - row) {
+		line = con->sb_first;
+		id = first;
+	} else {
+		line = con->sb_last;
+		id = last;
+	}
+
+	if (s->line && s->line_row >= first) {
+		if ((s->line_row > row ? s->line_row - row : row - s->line_row) <
+		    (id > row ? id - row : row - id)) {
+			line = s->line;
+			id = s->line_row;
+		}
+	}
+
+	while (id < row) {
+		line = line->next;
+		++id;
+	}
+	while (id > row) {
+		line = line->prev;
+		--id;
+	}
+
+	s->line = line;
+	s->line_row = row;
+	return line;
+}
+
+static inline bool search_fold(struct tsm_screen_search *s)
+{
+	return (s->flags & TSM_SCREEN_SEARCH_ICASE) &&
+	       !(s->flags & TSM_SCREEN_SEARCH_REGEX);
+}
+
+/* returns the offset of the UTF-8 sequence following the one at @pos */
+static inline size_t search_u8_next(const char *text, size_t pos, size_t len)
+{
+	++pos;
+	while (pos < len && ((unsigned char)text[pos] & 0xc0) == 0x80)
+		++pos;
+
+	return pos;
+}
+
+static bool search_match_at(struct tsm_screen_search *s, size_t len,
+			    size_t pos, size_t *start, size_t *end)
+{
+	const char *text = s->buf.text, *res;
+	regmatch_t m;
+
+	if (!(s->flags & TSM_SCREEN_SEARCH_REGEX)) {
+		res = memmem(&text[pos], len - pos, s->needle, s->needle_len);
+		if (!res)
+			return false;
+
+		*start = res - text;
+		*end = *start + s->needle_len;
+		return true;
+	}
+
+	while (pos < len) {
+		if (regexec(&s->regex, &text[pos], 1, &m,
+			    pos ? REG_NOTBOL : 0))
+			return false;
+
+		/* ignore empty matches */
+		if (m.rm_eo > m.rm_so) {
+			*start = pos + m.rm_so;
+			*end = pos + m.rm_eo;
+			return true;
+		}
+
+		pos = search_u8_next(text, pos + m.rm_so, len);
+	}
+
+	return false;
+}
+
+/* Searches the loaded line for the first match starting at or after column
+ * s->x. If searching backwards, the last match starting before s->x is
+ * returned instead. */
+static bool search_line(struct tsm_screen_search *s, size_t len,
+			size_t *start, size_t *end)
+{
+	const unsigned int *cols = s->buf.cols;
+	size_t pos, mstart, mend;
+	bool found;
+
+	if (!(s->flags & TSM_SCREEN_SEARCH_BACKWARD)) {
+		for (pos = 0; pos < len && cols[pos] < s->x; ++pos)
+			/* empty */ ;
+
+		return search_match_at(s, len, pos, start, end);
+	}
+
+	found = false;
+	pos = 0;
+	while (pos < len && search_match_at(s, len, pos, &mstart, &mend)) {
+		if (cols[mstart] >= s->x)
+			break;
+
+		*start = mstart;
+		*end = mend;
+		found = true;
+		pos = search_u8_next(s->buf.text, mstart, len);
+	}
+
+	return found;
+}
+
+/* collects the distinct index buckets of all trigrams of the needle */
+static int search_init_grams(struct tsm_screen_search *s, const char *pattern)
+{
+	char *folded;
+	size_t i, j, len;
+	uint32_t bucket;
+	int ret;
+
+	folded = shl_malloc(strlen(pattern) * 4 + 1);
+	if (!folded)
+		return -ENOMEM;
+
+	ret = search_fold_utf8(pattern, folded, &len);
+	if (ret || len < 3)
+		goto out;
+
+	s->grams = shl_malloc((len - 2) * sizeof(*s->grams));
+	if (!s->grams) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i + 3 <= len; ++i) {
+		bucket = index_hash(&folded[i]);
+		for (j = 0; j < s->gram_num; ++j) {
+			if (s->grams[j] == bucket)
+				break;
+		}
+		if (j == s->gram_num)
+			s->grams[s->gram_num++] = bucket;
+	}
+
+out:
+	shl_free(folded);
+	return ret;
+}
+
+SHL_EXPORT
+int tsm_screen_search_new(struct tsm_screen_search **out,
+			  struct tsm_screen *con, const char *pattern,
+			  unsigned int flags)
+{
+	struct tsm_screen_search *s;
+	int ret, cflags;
+
+	if (!out || !con || !pattern || !*pattern)
+		return -EINVAL;
+
+	s = shl_malloc(sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+	memset(s, 0, sizeof(*s));
+	s->con = con;
+	s->flags = flags;
+
+	/* the search needs the column of each byte, the index does not */
+	s->buf.cols = shl_malloc(sizeof(*s->buf.cols));
+	if (!s->buf.cols) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	if (flags & TSM_SCREEN_SEARCH_REGEX) {
+		cflags = REG_EXTENDED;
+		if (flags & TSM_SCREEN_SEARCH_ICASE)
+			cflags |= REG_ICASE;
+
+		if (regcomp(&s->regex, pattern, cflags)) {
+			llog_debug(con, "invalid search pattern %s", pattern);
+			ret = -EINVAL;
+			goto err_free;
+		}
+	} else {
+		if (search_fold(s)) {
+			s->needle = shl_malloc(strlen(pattern) * 4 + 1);
+			if (!s->needle) {
+				ret = -ENOMEM;
+				goto err_free;
+			}
+
+			ret = search_fold_utf8(pattern, s->needle,
+					       &s->needle_len);
+			if (ret)
+				goto err_free;
+			if (!s->needle_len) {
+				ret = -EINVAL;
+				goto err_free;
+			}
+		} else {
+			s->needle = shl_strdup(pattern);
+			if (!s->needle) {
+				ret = -ENOMEM;
+				goto err_free;
+			}
+			s->needle_len = strlen(pattern);
+		}
+
+		ret = search_init_grams(s, pattern);
+		if (ret)
+			goto err_free;
+	}
+
+	if (flags & TSM_SCREEN_SEARCH_BACKWARD) {
+		s->row = UINT64_MAX;
+		s->x = UINT_MAX;
+	}
+
+	tsm_screen_ref(con);
+	*out = s;
+	return 0;
+
+err_free:
+	shl_free(s->grams);
+	shl_free(s->needle);
+	shl_free(s->buf.cols);
+	shl_free(s);
+	return ret;
+}
+
+SHL_EXPORT
+void tsm_screen_search_free(struct tsm_screen_search *search)
+{
+	if (!search)
+		return;
+
+	if (search->flags & TSM_SCREEN_SEARCH_REGEX)
+		regfree(&search->regex);
+
+	tsm_screen_unref(search->con);
+	shl_free(search->buf.cols);
+	shl_free(search->buf.text);
+	shl_free(search->grams);
+	shl_free(search->needle);
+	shl_free(search);
+}
+
+SHL_EXPORT
+void tsm_screen_search_seek(struct tsm_screen_search *search, uint64_t row,
+			    unsigned int x)
+{
+	if (!search)
+		return;
+
+	search->row = row;
+	search->x = x;
+}
+
+/* Moves the search to the next candidate row if the index covers the current
+ * row. Returns false if the index ruled out the rest of its range; the search
+ * then continues right behind it. */
+static bool search_skip(struct tsm_screen_search *s)
+{
+	struct tsm_screen_index *idx = s->con->sb_index;
+	bool backward = s->flags & TSM_SCREEN_SEARCH_BACKWARD;
+	uint64_t row = s->row;
+
+	if (!idx || !s->gram_num || row < idx->first || row >= idx->end)
+		return true;
+
+	if (index_find(idx, s->grams, s->gram_num, &row, backward)) {
+		if (row != s->row) {
+			s->row = row;
+			s->x = backward ? UINT_MAX : 0;
+		}
+		return true;
+	}
+
+	if (backward) {
+		s->row = idx->first - 1;
+		s->x = UINT_MAX;
+	} else {
+		s->row = idx->end;
+		s->x = 0;
+	}
+
+	return false;
+}
+
+SHL_EXPORT
+int tsm_screen_search_next(struct tsm_screen_search *search,
+			   unsigned int max_lines,
+			   struct tsm_screen_match *out)
+{
+	struct tsm_screen *con;
+	struct line *line;
+	uint64_t first, end;
+	size_t len, start, stop;
+	unsigned int i, w;
+	bool backward;
+	int ret;
+
+	if (!search || !out)
+		return -EINVAL;
+
+	con = search->con;
+	backward = search->flags & TSM_SCREEN_SEARCH_BACKWARD;
+
+	for (i = 0; !max_lines || i < max_lines; ++i) {
+		/* Rows are re-validated on each iteration as the caller might
+		 * have modified the screen since the last call. */
+		first = search_first_row(con);
+		end = search_end_row(con);
+
+		if (backward) {
+			if (search->row >= end) {
+				search->row = end - 1;
+				search->x = UINT_MAX;
+			}
+			if (search->row < first)
+				return -ENOENT;
+		} else {
+			if (search->row < first) {
+				search->row = first;
+				search->x = 0;
+			}
+			if (search->row >= end)
+				return -ENOENT;
+		}
+
+		if (!search_skip(search))
+			continue;
+
+		line = search_get_line(search, search->row);
+		ret = line_render(con->sym_table, line, search_fold(search),
+				  &search->buf, &len);
+		if (ret)
+			return ret;
+
+		if (search_line(search, len, &start, &stop)) {
+			out->row = search->row;
+			out->start_x = search->buf.cols[start];
+			out->end_x = search->buf.cols[stop - 1];
+			w = line->cells[out->end_x].width;
+			if (w > 1)
+				out->end_x += w - 1;
+
+			if (backward)
+				search->x = out->start_x;
+			else
+				search->x = out->start_x + 1;
+			return 0;
+		}
+
+		if (backward) {
+			--search->row;
+			search->x = UINT_MAX;
+		} else {
+			++search->row;
+			search->x = 0;
+		}
+	}
+
+	return -EAGAIN;
+}
+
+SHL_EXPORT
+uint64_t tsm_screen_get_row(struct tsm_screen *con, unsigned int posy)
+{
+	if (!con)
+		return 0;
+
+	if (con->sb_pos)
+		return con->sb_pos->sb_id + posy;
+
+	return con->sb_last_id + 1 + posy;
+}
+
+SHL_EXPORT
+int tsm_screen_search_select(struct tsm_screen *con,
+			     const struct tsm_screen_match *match)
+{
+	uint64_t top;
+	unsigned int y;
+
+	if (!con || !match)
+		return -EINVAL;
+
+	if (match->row < search_first_row(con) ||
+	    match->row >= search_end_row(con))
+		return -ENOENT;
+
+	/* scroll the match into view */
+	top = tsm_screen_get_row(con, 0);
+	if (match->row < top) {
+		tsm_screen_sb_up(con, top - match->row);
+	} else if (match->row >= top + con->size_y) {
+		if (match->row > con->sb_last_id)
+			tsm_screen_sb_reset(con);
+		else
+			tsm_screen_sb_down(con, match->row - top);
+	}
+
+	y = match->row - tsm_screen_get_row(con, 0);
+	tsm_screen_selection_start(con, match->start_x, y);
+	tsm_screen_selection_target(con, match->end_x, y);
+
+	return 0;
+}
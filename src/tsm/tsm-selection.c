@@ -438,7 +438,7 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out)
 	/* invalid selection */
 	if (start->y == SELECTION_TOP && start->line == NULL &&
 		end->y == SELECTION_TOP && end->line == NULL) {
-		*out = strdup("");
+		*out = shl_strdup("");
 		return 0;
 	}
 
@@ -458,7 +458,7 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out)
 	total_lines += selection_count_lines(start, end);
 	buf_size = calc_line_copy_buffer(con, total_lines);
 
-	*out = calloc(buf_size, 1);
+	*out = shl_calloc(buf_size, 1);
 	if (!*out) {
 		return -ENOMEM;
 	}
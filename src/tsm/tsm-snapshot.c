@@ -0,0 +1,336 @@
+/*
+ * libtsm - Shared Screen Snapshots
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Shared Screen Snapshots
+ * A snapshot is a read-only view of the viewport that can be drawn by another
+ * thread while the screen keeps parsing input. Instead of copying cells, the
+ * snapshot takes a reference to each visible line. Lines are reference counted
+ * and the screen copies a line before modifying it if anyone else still holds
+ * a reference (see line_unshare()). Lines that are not touched until the
+ * snapshot is freed are never copied.
+ *
+ * Everything else that tsm_screen_draw() reads from the screen is copied into
+ * the snapshot when it is taken. This includes the selection, which is
+ * resolved into per-row markers, and the index of combined symbols. The
+ * symbol strings are owned by the symbol table, so the snapshot keeps a
+ * reference to it. After tsm_screen_snapshot_new() returns, the screen is
+ * never accessed again.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtsm.h"
+#include "libtsm-int.h"
+
+struct snapshot_row {
+	struct line *line;
+	bool sel_start;			/* selection starts in this row */
+	bool sel_end;			/* selection ends in this row */
+};
+
+struct tsm_screen_snapshot {
+	struct tsm_symbol_table *sym_table;
+	uint32_t **symbols;		/* copy of the symbol index */
+	size_t symbol_num;
+
+	unsigned int size_x;
+	unsigned int size_y;
+	unsigned int cursor_x;
+	unsigned int cursor_y;
+	unsigned int cursor_row;	/* row of the cursor or UINT_MAX */
+	unsigned int flags;
+
+	tsm_age_t age_cnt;
+	tsm_age_t age;
+	bool age_reset;
+	struct cell empty;
+
+	bool sel_active;
+	bool in_sel;			/* selection covers the first cell */
+	unsigned int sel_start_x;
+	unsigned int sel_end_x;
+
+	struct snapshot_row rows[];
+};
+
+SHL_EXPORT
+int tsm_screen_snapshot_new(struct tsm_screen_snapshot **out,
+			    struct tsm_screen *con)
+{
+	struct tsm_screen_snapshot *snap;
+	struct line *iter, *line;
+	unsigned int i, k, cur_y;
+	bool in_sel = false;
+
+	if (!out || !con)
+		return -EINVAL;
+
+	snap = shl_calloc(1, sizeof(*snap) +
+			 sizeof(struct snapshot_row) * con->size_y);
+	if (!snap)
+		return -ENOMEM;
+
+	snap->size_x = con->size_x;
+	snap->size_y = con->size_y;
+	snap->cursor_x = con->cursor_x;
+	snap->cursor_y = con->cursor_y;
+	snap->cursor_row = UINT_MAX;
+	snap->flags = con->flags;
+	snap->age_cnt = con->age_cnt;
+	snap->age = con->age;
+	snap->age_reset = con->age_reset;
+	screen_cell_init(con, &snap->empty);
+
+	cur_y = con->cursor_y;
+	if (cur_y >= con->size_y)
+		cur_y = con->size_y - 1;
+
+	/* symbols may be appended by the screen while we draw */
+	snap->symbols = tsm_symbol_table_copy_index(con->sym_table,
+						    &snap->symbol_num);
+	if (!snap->symbols && tsm_symbol_table_get_count(con->sym_table)) {
+		shl_free(snap);
+		return -ENOMEM;
+	}
+	snap->sym_table = con->sym_table;
+	tsm_symbol_table_ref(snap->sym_table);
+
+	/* This resolves the selection exactly like tsm_screen_draw() does, the
+	 * result is stored per row so scrollback IDs are not needed later. */
+
+	iter = con->sb_pos;
+	k = 0;
+
+	if (con->sel_active) {
+		if (!con->sel_start.line && con->sel_start.y == SELECTION_TOP)
+			in_sel = !in_sel;
+		if (!con->sel_end.line && con->sel_end.y == SELECTION_TOP)
+			in_sel = !in_sel;
+
+		if (con->sel_start.line &&
+		    (!iter || con->sel_start.line->sb_id < iter->sb_id))
+			in_sel = !in_sel;
+		if (con->sel_end.line &&
+		    (!iter || con->sel_end.line->sb_id < iter->sb_id))
+			in_sel = !in_sel;
+
+		snap->sel_active = true;
+		snap->in_sel = in_sel;
+		snap->sel_start_x = con->sel_start.x;
+		snap->sel_end_x = con->sel_end.x;
+	}
+
+	for (i = 0; i < con->size_y; ++i) {
+		if (iter) {
+			line = iter;
+			iter = iter->next;
+		} else {
+			line = con->lines[k];
+			k++;
+			if (k == cur_y + 1)
+				snap->cursor_row = i;
+		}
+
+		/* only the writer takes references, see line_unshare() */
+		__atomic_add_fetch(&line->ref, 1, __ATOMIC_RELAXED);
+		snap->rows[i].line = line;
+
+		if (con->sel_active) {
+			snap->rows[i].sel_start = con->sel_start.line == line ||
+				(!con->sel_start.line &&
+				 con->sel_start.y == k - 1);
+			snap->rows[i].sel_end = con->sel_end.line == line ||
+				(!con->sel_end.line &&
+				 con->sel_end.y == k - 1);
+		}
+	}
+
+	/* the snapshot takes over the age-reset, like a draw would */
+	con->age_reset = 0;
+
+	*out = snap;
+	return 0;
+}
+
+/*
+ * Called if @snap replaces @old before @old was drawn. Ages are monotonic so
+ * the newer snapshot covers all changes, except for a pending age-reset.
+ */
+void screen_snapshot_merge(struct tsm_screen_snapshot *snap,
+			   const struct tsm_screen_snapshot *old)
+{
+	if (old->age_reset)
+		snap->age_reset = true;
+}
+
+SHL_EXPORT
+void tsm_screen_snapshot_free(struct tsm_screen_snapshot *snap)
+{
+	unsigned int i;
+
+	if (!snap)
+		return;
+
+	for (i = 0; i < snap->size_y; ++i)
+		line_free(snap->rows[i].line);
+
+	shl_free(snap->symbols);
+	tsm_symbol_table_unref(snap->sym_table);
+	shl_free(snap);
+}
+
+SHL_EXPORT
+unsigned int tsm_screen_snapshot_get_width(struct tsm_screen_snapshot *snap)
+{
+	if (!snap)
+		return 0;
+
+	return snap->size_x;
+}
+
+SHL_EXPORT
+unsigned int tsm_screen_snapshot_get_height(struct tsm_screen_snapshot *snap)
+{
+	if (!snap)
+		return 0;
+
+	return snap->size_y;
+}
+
+SHL_EXPORT
+unsigned int tsm_screen_snapshot_get_cursor_x(struct tsm_screen_snapshot *snap)
+{
+	if (!snap)
+		return 0;
+
+	return snap->cursor_x;
+}
+
+SHL_EXPORT
+unsigned int tsm_screen_snapshot_get_cursor_y(struct tsm_screen_snapshot *snap)
+{
+	if (!snap)
+		return 0;
+
+	return snap->cursor_y;
+}
+
+SHL_EXPORT
+unsigned int tsm_screen_snapshot_get_flags(struct tsm_screen_snapshot *snap)
+{
+	if (!snap)
+		return 0;
+
+	return snap->flags;
+}
+
+SHL_EXPORT
+tsm_age_t tsm_screen_snapshot_draw(struct tsm_screen_snapshot *snap,
+				   tsm_screen_draw_cb draw_cb, void *data)
+{
+	unsigned int cur_x;
+	unsigned int i, j;
+	const struct snapshot_row *row;
+	const struct line *line;
+	struct cell *cell;
+	struct tsm_screen_attr attr;
+	const uint32_t *ch;
+	uint64_t id;
+	size_t len;
+	bool in_sel, was_sel = false;
+	tsm_age_t age;
+
+	if (!snap || !draw_cb)
+		return 0;
+
+	cur_x = snap->cursor_x;
+	if (snap->cursor_x >= snap->size_x)
+		cur_x = snap->size_x - 1;
+
+	in_sel = snap->in_sel;
+
+	for (i = 0; i < snap->size_y; ++i) {
+		row = &snap->rows[i];
+		line = row->line;
+		was_sel = false;
+
+		for (j = 0; j < snap->size_x; ++j) {
+			if (j < line->size)
+				cell = &line->cells[j];
+			else
+				cell = &snap->empty;
+
+			memcpy(&attr, &cell->attr, sizeof(attr));
+
+			if (snap->sel_active) {
+				if (row->sel_start && j == snap->sel_start_x) {
+					was_sel = in_sel;
+					in_sel = !in_sel;
+				}
+				if (row->sel_end && j == snap->sel_end_x) {
+					was_sel = in_sel;
+					in_sel = !in_sel;
+				}
+			}
+
+			if (i == snap->cursor_row && j == cur_x &&
+			    !(snap->flags & TSM_SCREEN_HIDE_CURSOR))
+				attr.inverse = !attr.inverse;
+
+			if (snap->flags & TSM_SCREEN_INVERSE)
+				attr.inverse = !attr.inverse;
+
+			if (in_sel || was_sel) {
+				was_sel = false;
+				attr.inverse = !attr.inverse;
+			}
+
+			if (snap->age_reset) {
+				age = 0;
+			} else {
+				age = cell->age;
+				if (line->age > age)
+					age = line->age;
+				if (snap->age > age)
+					age = snap->age;
+			}
+
+			ch = tsm_symbol_index_get(snap->symbols,
+						  snap->symbol_num,
+						  &cell->ch, &len);
+			id = screen_cell_id(cell->ch, &attr, &len);
+			draw_cb(NULL, id, ch, len, cell->width, j, i, &attr, age,
+				data);
+		}
+	}
+
+	if (snap->age_reset)
+		return 0;
+	else
+		return snap->age_cnt;
+}
@@ -138,7 +138,7 @@ static void free_ucs4(void *elem, void *priv)
 	uint32_t *v = elem;
 
 	/* key is prefix with actual value so pass correct pointer */
-	free(--v);
+	shl_free(--v);
 }
 
 int tsm_symbol_table_new(struct tsm_symbol_table **out)
@@ -150,7 +150,7 @@ int tsm_symbol_table_new(struct tsm_symbol_table **out)
 	if (!out)
 		return -EINVAL;
 
-	tbl = malloc(sizeof(*tbl));
+	tbl = shl_malloc(sizeof(*tbl));
 	if (!tbl)
 		return -ENOMEM;
 	memset(tbl, 0, sizeof(*tbl));
@@ -169,26 +169,31 @@ int tsm_symbol_table_new(struct tsm_symbol_table **out)
 	return 0;
 
 err_free:
-	free(tbl);
+	shl_free(tbl);
 	return ret;
 }
 
+/*
+ * Screen snapshots hold a reference to the table of their screen and may drop
+ * it from any thread, so the reference count is atomic.
+ */
 void tsm_symbol_table_ref(struct tsm_symbol_table *tbl)
 {
-	if (!tbl || !tbl->ref)
+	if (!tbl || !__atomic_load_n(&tbl->ref, __ATOMIC_RELAXED))
 		return;
 
-	++tbl->ref;
+	__atomic_add_fetch(&tbl->ref, 1, __ATOMIC_RELAXED);
 }
 
 void tsm_symbol_table_unref(struct tsm_symbol_table *tbl)
 {
-	if (!tbl || !tbl->ref || --tbl->ref)
+	if (!tbl || !__atomic_load_n(&tbl->ref, __ATOMIC_RELAXED) ||
+	    __atomic_sub_fetch(&tbl->ref, 1, __ATOMIC_ACQ_REL))
 		return;
 
 	shl_htable_clear(&tbl->symbols, free_ucs4, NULL);
 	shl_array_free(tbl->index);
-	free(tbl);
+	shl_free(tbl);
 }
 
 tsm_symbol_t tsm_symbol_make(uint32_t ucs4)
@@ -213,8 +218,6 @@ tsm_symbol_t tsm_symbol_make(uint32_t ucs4)
 const uint32_t *tsm_symbol_get(struct tsm_symbol_table *tbl,
 			       tsm_symbol_t *sym, size_t *size)
 {
-	uint32_t *ucs4, idx;
-
 	if (*sym <= TSM_UCS4_MAX) {
 		if (size)
 			*size = 1;
@@ -224,11 +227,33 @@ const uint32_t *tsm_symbol_get(struct tsm_symbol_table *tbl,
 	if (!tbl)
 		return sym;
 
-	idx = *sym - (TSM_UCS4_MAX + 1);
-	if (idx >= shl_array_get_length(tbl->index))
+	return tsm_symbol_index_get(shl_array_get_array(tbl->index),
+				    shl_array_get_length(tbl->index),
+				    sym, size);
+}
+
+/*
+ * Same as tsm_symbol_get() but looks the symbol up in an index returned by
+ * tsm_symbol_table_copy_index(). The table itself is not accessed.
+ */
+const uint32_t *tsm_symbol_index_get(uint32_t *const *index, size_t num,
+				     tsm_symbol_t *sym, size_t *size)
+{
+	const uint32_t *ucs4;
+	uint32_t idx;
+
+	if (*sym <= TSM_UCS4_MAX) {
+		if (size)
+			*size = 1;
+		return sym;
+	}
+
+	/* the first ID is TSM_UCS4_MAX + 3 but index 0 holds a dummy */
+	idx = *sym - (TSM_UCS4_MAX + 2);
+	if (idx >= num)
 		ucs4 = NULL;
 	else
-		ucs4 = *SHL_ARRAY_AT(tbl->index, uint32_t*, idx);
+		ucs4 = index[idx];
 
 	if (!ucs4) {
 		if (size)
@@ -245,6 +270,37 @@ const uint32_t *tsm_symbol_get(struct tsm_symbol_table *tbl,
 	return ucs4;
 }
 
+/*
+ * Copies the index of all combined symbols of \tbl. The strings are owned by
+ * the table and never change, so the copy stays valid as long as a reference to
+ * \tbl is held, even if other threads append new symbols meanwhile. The number
+ * of entries is stored in \num and the copy must be freed with shl_free().
+ * Returns NULL if the table has no combined symbols or on allocation failure.
+ */
+uint32_t **tsm_symbol_table_copy_index(struct tsm_symbol_table *tbl,
+				       size_t *num)
+{
+	uint32_t **index;
+	size_t len;
+
+	*num = 0;
+	if (!tbl)
+		return NULL;
+
+	/* index 0 is the dummy */
+	len = shl_array_get_length(tbl->index);
+	if (len <= 1)
+		return NULL;
+
+	index = shl_malloc(sizeof(*index) * len);
+	if (!index)
+		return NULL;
+
+	memcpy(index, shl_array_get_array(tbl->index), sizeof(*index) * len);
+	*num = len;
+	return index;
+}
+
 tsm_symbol_t tsm_symbol_append(struct tsm_symbol_table *tbl,
 			       tsm_symbol_t sym, uint32_t ucs4)
 {
@@ -277,7 +333,7 @@ tsm_symbol_t tsm_symbol_append(struct tsm_symbol_table *tbl,
 
 	/* We save the key in nval and prefix it with the new ID. Note that
 	 * the prefix is hidden, we actually store "++nval" in the htable. */
-	nval = malloc(sizeof(uint32_t) * (s + 1));
+	nval = shl_malloc(sizeof(uint32_t) * (s + 1));
 	if (!nval)
 		return sym;
 
@@ -307,10 +363,23 @@ err_symbol:
 	shl_htable_remove(&tbl->symbols, nval, hash_ucs4(nval, NULL), NULL);
 err_id:
 	--tbl->next_id;
-	free(nval);
+	shl_free(nval);
 	return sym;
 }
 
+/*
+ * Returns the number of combined symbols in \tbl. They use the IDs
+ * TSM_SYMBOL_COMBINED(0) up to TSM_SYMBOL_COMBINED(count - 1) in the order they
+ * were created.
+ */
+unsigned int tsm_symbol_table_get_count(struct tsm_symbol_table *tbl)
+{
+	if (!tbl)
+		return 0;
+
+	return tbl->next_id - (TSM_UCS4_MAX + 2);
+}
+
 unsigned int tsm_symbol_get_width(struct tsm_symbol_table *tbl,
 				  tsm_symbol_t sym)
 {
@@ -397,7 +466,7 @@ char *tsm_ucs4_to_utf8_alloc(const uint32_t *ucs4, size_t len, size_t *len_out)
 	char *val;
 	size_t i, pos;
 
-	val = malloc(4 * len);
+	val = shl_malloc(4 * len);
 	if (!val)
 		return NULL;
 
@@ -406,7 +475,7 @@ char *tsm_ucs4_to_utf8_alloc(const uint32_t *ucs4, size_t len, size_t *len_out)
 		pos += tsm_ucs4_to_utf8(ucs4[i], &val[pos]);
 
 	if (!pos) {
-		free(val);
+		shl_free(val);
 		return NULL;
 	}
 
@@ -475,7 +544,7 @@ int tsm_utf8_mach_new(struct tsm_utf8_mach **out)
 	if (!out)
 		return -EINVAL;
 
-	mach = malloc(sizeof(*mach));
+	mach = shl_malloc(sizeof(*mach));
 	if (!mach)
 		return -ENOMEM;
 
@@ -491,7 +560,7 @@ void tsm_utf8_mach_free(struct tsm_utf8_mach *mach)
 	if (!mach)
 		return;
 
-	free(mach);
+	shl_free(mach);
 }
 
 int tsm_utf8_mach_feed(struct tsm_utf8_mach *mach, char ci)
@@ -578,3 +647,17 @@ void tsm_utf8_mach_reset(struct tsm_utf8_mach *mach)
 
 	mach->state = TSM_UTF8_START;
 }
+
+void tsm_utf8_mach_get_state(struct tsm_utf8_mach *mach, int *state,
+			     uint32_t *ch)
+{
+	*state = mach->state;
+	*ch = mach->ch;
+}
+
+void tsm_utf8_mach_set_state(struct tsm_utf8_mach *mach, int state,
+			     uint32_t ch)
+{
+	mach->state = state;
+	mach->ch = ch;
+}
@@ -47,9 +47,11 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "libtsm.h"
 #include "libtsm-int.h"
 #include "shl-llog.h"
@@ -117,6 +119,12 @@ enum parser_action {
 /* max length of an OSC code */
 #define OSC_MAX_LEN 128
 
+/* size of the buffer for data sent to the client */
+#define VTE_OUT_SIZE 4096
+
+/* default limit of a synchronized update in ms */
+#define VTE_SYNC_TIMEOUT 150
+
 /* terminal flags */
 #define FLAG_CURSOR_KEY_MODE			0x00000001 /* DEC cursor key mode */
 #define FLAG_KEYPAD_APPLICATION_MODE		0x00000002 /* DEC keypad application mode; TODO: toggle on numlock? */
@@ -154,21 +162,46 @@ struct tsm_vte {
 	struct tsm_screen *con;
 	tsm_vte_write_cb write_cb;
 	void *data;
+	unsigned int flush_mode;
+	bool flushing;			/* write_cb is called by tsm_vte_flush() */
+	size_t out_len;
+	char out[VTE_OUT_SIZE];		/* data not passed to write_cb yet */
 	char *palette_name;
 	bool backspace_sends_delete;
 
 	struct tsm_utf8_mach *mach;
 	unsigned long parse_cnt;
+	unsigned long print_cnt;	/* printed characters */
+	unsigned long dispatch_cnt;	/* dispatched control functions */
+	tsm_symbol_t last_sym;		/* last printed character for REP or 0 */
+	struct tsm_vte_stats stats;	/* counters of tsm_vte_get_stats() */
 
 	unsigned int state;
 	unsigned int csi_argc;
 	int csi_argv[CSI_ARG_MAX];
 	unsigned int csi_flags;
+	char csi_collect[5];		/* collected intermediates */
+	unsigned int csi_collect_len;
 
 	tsm_vte_osc_cb osc_cb;
 	void *osc_data;
 	unsigned int osc_len;
 	char osc_arg[OSC_MAX_LEN];
+	tsm_vte_osc_stream_cb osc_stream_cb;
+	void *osc_stream_data;
+	size_t osc_max;			/* max streamed payload or 0 */
+	size_t osc_total;		/* streamed payload so far */
+	bool osc_dropped;		/* payload exceeded osc_max */
+
+	tsm_vte_dcs_cb dcs_cb;
+	void *dcs_data;
+	struct tsm_vte_dcs dcs;		/* DCS passed to dcs_cb */
+	bool dcs_active;		/* dcs_cb got TSM_VTE_DCS_BEGIN */
+
+	tsm_vte_sync_cb sync_cb;
+	void *sync_data;
+	unsigned int sync_timeout;	/* limit of an update in ms or 0 */
+	uint64_t sync_start;		/* begin of the current update */
 
 	tsm_vte_mouse_cb mouse_cb;
 	void *mouse_data;
@@ -466,7 +499,7 @@ int tsm_vte_new(struct tsm_vte **out, struct tsm_screen *con,
 	if (!out || !con || !write_cb)
 		return -EINVAL;
 
-	vte = malloc(sizeof(*vte));
+	vte = shl_malloc(sizeof(*vte));
 	if (!vte)
 		return -ENOMEM;
 
@@ -478,6 +511,7 @@ int tsm_vte_new(struct tsm_vte **out, struct tsm_screen *con,
 	vte->write_cb = write_cb;
 	vte->data = data;
 	vte->backspace_sends_delete = false;
+	vte->sync_timeout = VTE_SYNC_TIMEOUT;
 	vte->osc_cb = NULL;
 	vte->osc_data = NULL;
 	vte->mouse_cb = NULL;
@@ -501,7 +535,7 @@ int tsm_vte_new(struct tsm_vte **out, struct tsm_screen *con,
 	return 0;
 
 err_free:
-	free(vte);
+	shl_free(vte);
 	return ret;
 }
 
@@ -523,12 +557,56 @@ void tsm_vte_unref(struct tsm_vte *vte)
 	if (--vte->ref)
 		return;
 
+	/* the owner may be tearing down already, buffered data is dropped */
 	llog_debug(vte, "destroying vte object");
-	free(vte->palette_name);
+	shl_free(vte->palette_name);
 	tsm_screen_unref(vte->con);
 	tsm_utf8_mach_free(vte->mach);
-	free(vte->custom_palette_storage);
-	free(vte);
+	shl_free(vte->custom_palette_storage);
+	shl_free(vte);
+}
+
+struct tsm_screen *vte_get_screen(struct tsm_vte *vte)
+{
+	return vte->con;
+}
+
+/* Exchanges the write-callback of @vte with @write_cb and @data. Pending data
+ * still goes to the old callback. */
+void vte_swap_write_cb(struct tsm_vte *vte, tsm_vte_write_cb *write_cb,
+		       void **data)
+{
+	tsm_vte_write_cb cb = vte->write_cb;
+	void *d = vte->data;
+
+	tsm_vte_flush(vte);
+	vte->write_cb = *write_cb;
+	vte->data = *data;
+	*write_cb = cb;
+	*data = d;
+}
+
+SHL_EXPORT
+void tsm_vte_set_flush_mode(struct tsm_vte *vte, enum tsm_vte_flush_mode mode)
+{
+	if (!vte)
+		return;
+
+	vte->flush_mode = mode;
+	if (mode != TSM_VTE_FLUSH_MANUAL)
+		tsm_vte_flush(vte);
+}
+
+SHL_EXPORT
+void tsm_vte_flush(struct tsm_vte *vte)
+{
+	if (!vte || !vte->out_len || vte->flushing)
+		return;
+
+	vte->flushing = true;
+	vte->write_cb(vte, vte->out, vte->out_len, vte->data);
+	vte->out_len = 0;
+	vte->flushing = false;
 }
 
 SHL_EXPORT
@@ -541,6 +619,129 @@ void tsm_vte_set_osc_cb(struct tsm_vte *vte, tsm_vte_osc_cb osc_cb, void *osc_da
 	vte->osc_data = osc_data;
 }
 
+SHL_EXPORT
+void tsm_vte_set_osc_stream_cb(struct tsm_vte *vte, tsm_vte_osc_stream_cb cb,
+			       void *data, size_t max_len)
+{
+	if (!vte)
+		return;
+
+	/* @cb never saw the start of an OSC in progress, skip the rest of it */
+	if (vte->state == STATE_OSC_STRING) {
+		if (vte->osc_stream_cb && !vte->osc_dropped)
+			vte->osc_stream_cb(vte, TSM_VTE_OSC_DROP, NULL, 0,
+					   vte->osc_stream_data);
+		vte->osc_dropped = true;
+		vte->osc_len = 0;
+	}
+
+	vte->osc_stream_cb = cb;
+	vte->osc_stream_data = data;
+	vte->osc_max = max_len;
+}
+
+SHL_EXPORT
+void tsm_vte_set_dcs_cb(struct tsm_vte *vte, tsm_vte_dcs_cb cb, void *data)
+{
+	if (!vte)
+		return;
+
+	vte->dcs_cb = cb;
+	vte->dcs_data = data;
+	vte->dcs_active = false;
+}
+
+/*
+ * Synchronized Output
+ * DEC private mode 2026 brackets an update that consists of several writes.
+ * While it is set, the screen has TSM_SCREEN_SYNC_UPDATE set and renderers
+ * should keep showing the last frame. Parsing is not affected at all. An
+ * update that is never finished ends after @sync_timeout, which is enforced
+ * by tsm_vte_check_sync() since we have no timers of our own.
+ */
+
+static uint64_t vte_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void vte_set_sync(struct tsm_vte *vte, bool set)
+{
+	if (set == !!(vte->flags & TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT))
+		return;
+
+	if (set) {
+		vte->flags |= TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT;
+		vte->sync_start = vte_now();
+		tsm_screen_set_flags(vte->con, TSM_SCREEN_SYNC_UPDATE);
+	} else {
+		vte->flags &= ~TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT;
+		tsm_screen_reset_flags(vte->con, TSM_SCREEN_SYNC_UPDATE);
+	}
+
+	if (vte->sync_cb)
+		vte->sync_cb(vte, set, vte->sync_data);
+}
+
+SHL_EXPORT
+void tsm_vte_set_sync_cb(struct tsm_vte *vte, tsm_vte_sync_cb cb, void *data)
+{
+	if (!vte)
+		return;
+
+	vte->sync_cb = cb;
+	vte->sync_data = data;
+}
+
+SHL_EXPORT
+void tsm_vte_set_sync_timeout(struct tsm_vte *vte, unsigned int ms)
+{
+	if (!vte)
+		return;
+
+	vte->sync_timeout = ms;
+	if (!ms)
+		vte_set_sync(vte, false);
+}
+
+SHL_EXPORT
+int tsm_vte_check_sync(struct tsm_vte *vte)
+{
+	uint64_t now, end, ms;
+
+	if (!vte || !(vte->flags & TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT))
+		return -1;
+
+	now = vte_now();
+	end = vte->sync_start + vte->sync_timeout * 1000000ULL;
+	if (now >= end) {
+		llog_debug(vte, "synchronized update timed out");
+		vte_set_sync(vte, false);
+		return -1;
+	}
+
+	/* round up so a timer never fires before the deadline */
+	ms = (end - now + 999999) / 1000000;
+	return ms > INT_MAX ? INT_MAX : ms;
+}
+
+SHL_EXPORT
+int tsm_vte_get_stats(struct tsm_vte *vte, struct tsm_vte_stats *out)
+{
+	if (!vte || !out)
+		return -EINVAL;
+
+#ifdef BUILD_ENABLE_STATS
+	*out = vte->stats;
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
 SHL_EXPORT
 void tsm_vte_set_mouse_cb(struct tsm_vte *vte, tsm_vte_mouse_cb mouse_cb, void *mouse_data)
 {
@@ -575,12 +776,12 @@ int tsm_vte_set_palette(struct tsm_vte *vte, const char *palette_name)
 		return -EINVAL;
 
 	if (palette_name) {
-		tmp = strdup(palette_name);
+		tmp = shl_strdup(palette_name);
 		if (!tmp)
 			return -ENOMEM;
 	}
 
-	free(vte->palette_name);
+	shl_free(vte->palette_name);
 	vte->palette_name = tmp;
 
 	return vte_update_palette(vte);
@@ -596,13 +797,13 @@ int tsm_vte_set_custom_palette(struct tsm_vte *vte, uint8_t (*palette)[3])
 		return -EINVAL;
 
 	if (palette) {
-		tmp = malloc(palette_byte_size);
+		tmp = shl_malloc(palette_byte_size);
 		if (!tmp)
 			return -ENOMEM;
 		memcpy(tmp, palette, palette_byte_size);
 	}
 
-	free(vte->custom_palette_storage);
+	shl_free(vte->custom_palette_storage);
 	vte->custom_palette_storage = tmp;
 
 	return vte_update_palette(vte);
@@ -666,6 +867,11 @@ unsigned int tsm_vte_get_mouse_event(struct tsm_vte *vte)
  * avoid all 8bit escape codes including the C1 codes. This will guarantee that
  * all kind of clients are always compatible to us.
  *
+ * Data is collected in vte->out and passed to the write-callback according to
+ * the flush-mode. By default, this happens once at the end of tsm_vte_input()
+ * so replies to a batch of queries cost a single callback. Outside of
+ * tsm_vte_input(), like for keyboard input, each write is flushed directly.
+ *
  * If SEND_RECEIVE_MODE is off (that is, local echo is on) we have to send all
  * data directly to ourself again. However, we must avoid recursion when
  * tsm_vte_input() itself calls vte_write*(), therefore, we increase the
@@ -679,6 +885,26 @@ unsigned int tsm_vte_get_mouse_event(struct tsm_vte *vte)
  * here. Anyway, only few applications rely on local echo so we can safely
  * ignore this.
  */
+static void vte_out(struct tsm_vte *vte, const char *u8, size_t len)
+{
+	/* writes from inside the write-callback are not reordered */
+	if (vte->flushing) {
+		vte->write_cb(vte, u8, len, vte->data);
+		return;
+	}
+
+	if (vte->out_len + len > sizeof(vte->out)) {
+		tsm_vte_flush(vte);
+		if (len > sizeof(vte->out)) {
+			vte->write_cb(vte, u8, len, vte->data);
+			return;
+		}
+	}
+
+	memcpy(vte->out + vte->out_len, u8, len);
+	vte->out_len += len;
+}
+
 static void vte_write_debug(struct tsm_vte *vte, const char *u8, size_t len,
 			    bool raw, const char *file, int line)
 {
@@ -704,10 +930,14 @@ static void vte_write_debug(struct tsm_vte *vte, const char *u8, size_t len,
 	}
 
 	if (vte->flags & TSM_VTE_FLAG_PREPEND_ESCAPE)
-		vte->write_cb(vte, "\e", 1, vte->data);
-	vte->write_cb(vte, u8, len, vte->data);
+		vte_out(vte, "\e", 1);
+	vte_out(vte, u8, len);
 
 	vte->flags &= ~TSM_VTE_FLAG_PREPEND_ESCAPE;
+
+	if (vte->flush_mode == TSM_VTE_FLUSH_IMMEDIATE ||
+	    (vte->flush_mode == TSM_VTE_FLUSH_INPUT && !vte->parse_cnt))
+		tsm_vte_flush(vte);
 }
 
 #define vte_write(_vte, _u8, _len) \
@@ -720,6 +950,7 @@ static void write_console(struct tsm_vte *vte, tsm_symbol_t sym)
 {
 	to_rgb(vte, &vte->cattr);
 	tsm_screen_write(vte->con, sym, &vte->cattr);
+	vte->last_sym = sym;
 }
 
 static void reset_state(struct tsm_vte *vte)
@@ -789,9 +1020,12 @@ static void restore_state(struct tsm_vte *vte)
 SHL_EXPORT
 void tsm_vte_reset(struct tsm_vte *vte)
 {
+	bool sync;
+
 	if (!vte)
 		return;
 
+	sync = vte->flags & TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT;
 	vte->flags = 0;
 	vte->flags |= TSM_VTE_FLAG_TEXT_CURSOR_MODE;
 	vte->flags |= TSM_VTE_FLAG_AUTO_REPEAT_MODE;
@@ -801,8 +1035,23 @@ void tsm_vte_reset(struct tsm_vte *vte)
 	tsm_screen_reset(vte->con);
 	tsm_screen_set_flags(vte->con, TSM_SCREEN_AUTO_WRAP);
 
+	/* an unterminated OSC or DCS is never completed */
+	if (vte->state == STATE_OSC_STRING && vte->osc_stream_cb &&
+	    !vte->osc_dropped) {
+		vte->osc_dropped = true;
+		vte->osc_stream_cb(vte, TSM_VTE_OSC_DROP, NULL, 0,
+				   vte->osc_stream_data);
+	}
+	if (vte->dcs_active) {
+		vte->dcs_active = false;
+		vte->osc_len = 0;
+		vte->dcs_cb(vte, TSM_VTE_DCS_DROP, &vte->dcs, NULL, 0,
+			    vte->dcs_data);
+	}
+
 	tsm_utf8_mach_reset(vte->mach);
 	vte->state = STATE_GROUND;
+	vte->last_sym = 0;
 	vte->gl = &vte->g0;
 	vte->gr = &vte->g1;
 	vte->glt = NULL;
@@ -822,6 +1071,10 @@ void tsm_vte_reset(struct tsm_vte *vte)
 	tsm_screen_set_def_attr(vte->con, &vte->def_attr);
 
 	reset_state(vte);
+
+	/* the screen flag is gone already, just report the end */
+	if (sync && vte->sync_cb)
+		vte->sync_cb(vte, false, vte->sync_data);
 }
 
 SHL_EXPORT
@@ -946,6 +1199,7 @@ static void do_execute(struct tsm_vte *vte, uint32_t ctrl)
 		/* nothing to do here */
 		break;
 	default:
+		STAT_ADD(vte, unhandled, 1);
 		llog_debug(vte, "unhandled control char %u", ctrl);
 	}
 }
@@ -958,6 +1212,7 @@ static void do_clear(struct tsm_vte *vte)
 	for (i = 0; i < CSI_ARG_MAX; ++i)
 		vte->csi_argv[i] = -1;
 	vte->csi_flags = 0;
+	vte->csi_collect_len = 0;
 
 	vte->osc_len = 0;
 	memset(vte->osc_arg, 0, sizeof(vte->osc_arg));
@@ -965,6 +1220,10 @@ static void do_clear(struct tsm_vte *vte)
 
 static void do_collect(struct tsm_vte *vte, uint32_t data)
 {
+	/* DCS handlers get the raw characters */
+	if (vte->csi_collect_len < sizeof(vte->csi_collect) - 1)
+		vte->csi_collect[vte->csi_collect_len++] = data;
+
 	switch (data) {
 	case '!':
 		vte->csi_flags |= CSI_BANG;
@@ -1138,6 +1397,7 @@ static void do_esc(struct tsm_vte *vte, uint32_t data)
 
 	/* everything below is only valid without CSI flags */
 	if (vte->csi_flags) {
+		STAT_ADD(vte, unhandled, 1);
 		llog_debug(vte, "unhandled escape seq %u", data);
 		return;
 	}
@@ -1216,6 +1476,7 @@ static void do_esc(struct tsm_vte *vte, uint32_t data)
 		restore_state(vte);
 		break;
 	default:
+		STAT_ADD(vte, unhandled, 1);
 		llog_debug(vte, "unhandled escape seq %u", data);
 	}
 }
@@ -1437,6 +1698,7 @@ static void csi_attribute(struct tsm_vte *vte)
 
 			break;
 		default:
+			STAT_ADD(vte, unhandled, 1);
 			llog_debug(vte, "unhandled SGR attr %i",
 				   vte->csi_argv[i]);
 		}
@@ -1488,6 +1750,7 @@ static void csi_compat_mode(struct tsm_vte *vte)
 		vte->g0 = &tsm_vte_unicode_lower;
 		vte->g1 = &tsm_vte_dec_supplemental_graphics;
 	} else {
+		STAT_ADD(vte, unhandled, 1);
 		llog_debug(vte, "unhandled DECSCL 'p' CSI %i, switching to utf-8 mode again",
 			   vte->csi_argv[0]);
 	}
@@ -1534,6 +1797,7 @@ static void csi_mode(struct tsm_vte *vte, bool set)
 					       TSM_VTE_FLAG_LINE_FEED_NEW_LINE_MODE);
 				continue;
 			default:
+				STAT_ADD(vte, unhandled, 1);
 				llog_debug(vte, "unknown non-DEC (Re)Set-Mode %d",
 					   vte->csi_argv[i]);
 				continue;
@@ -1719,6 +1983,10 @@ static void csi_mode(struct tsm_vte *vte, bool set)
 			    continue;
 			}
 			continue;
+		case 2026: /* Synchronized output */
+			if (vte->sync_timeout)
+				vte_set_sync(vte, set);
+			continue;
 		case TSM_VTE_MOUSE_MODE_PIXEL:
 			vte->mouse_mode = set ? vte->csi_argv[i] : 0;
 
@@ -1732,6 +2000,7 @@ static void csi_mode(struct tsm_vte *vte, bool set)
 			}
 			continue;
 		default:
+			STAT_ADD(vte, unhandled, 1);
 			llog_debug(vte, "unknown DEC %set-Mode %d",
 				   set?"S":"Res", vte->csi_argv[i]);
 			continue;
@@ -1739,6 +2008,31 @@ static void csi_mode(struct tsm_vte *vte, bool set)
 	}
 }
 
+/*
+ * DECRQM is only answered for synchronized output so applications can detect
+ * it. Other modes are ignored.
+ * FIXME: Implement DECRQM for all modes
+ */
+static void csi_request_mode(struct tsm_vte *vte)
+{
+	char buf[32];
+	int len, val;
+
+	if (!(vte->csi_flags & CSI_WHAT) || vte->csi_argv[0] != 2026)
+		return;
+
+	/* 1: set, 2: reset, 4: permanently reset */
+	if (!vte->sync_timeout)
+		val = 4;
+	else if (vte->flags & TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT)
+		val = 1;
+	else
+		val = 2;
+
+	len = snprintf(buf, sizeof(buf), "\e[?%d;%d$y", vte->csi_argv[0], val);
+	vte_write(vte, buf, len);
+}
+
 static void csi_dev_attr(struct tsm_vte *vte)
 {
 	if (vte->csi_argc <= 1 && vte->csi_argv[0] <= 0) {
@@ -1751,6 +2045,7 @@ static void csi_dev_attr(struct tsm_vte *vte)
 		}
 	}
 
+	STAT_ADD(vte, unhandled, 1);
 	llog_debug(vte, "unhandled DA: %x %d %d %d...", vte->csi_flags,
 		   vte->csi_argv[0], vte->csi_argv[1], vte->csi_argv[2]);
 }
@@ -1781,6 +2076,8 @@ static void do_csi(struct tsm_vte *vte, uint32_t data)
 	if (vte->csi_argc < CSI_ARG_MAX)
 		vte->csi_argc++;
 
+	TRACE3(vte_csi, vte, data, vte->csi_argv[0]);
+
 	switch (data) {
 	case 'A': /* CUU */
 		/* move cursor up */
@@ -1896,6 +2193,20 @@ static void do_csi(struct tsm_vte *vte, uint32_t data)
 			llog_debug(vte, "unknown parameter to CSI-K: %d",
 				   vte->csi_argv[0]);
 		break;
+	case 'b': /* REP */
+		/* repeat the last printed character */
+		num = vte->csi_argv[0];
+		if (num <= 0)
+			num = 1;
+		if (!vte->last_sym) {
+			llog_debug(vte, "REP without preceding character");
+			break;
+		}
+		vte->print_cnt += num;
+		to_rgb(vte, &vte->cattr);
+		tsm_screen_write_repeat(vte->con, vte->last_sym, &vte->cattr,
+					num);
+		break;
 	case 'X': /* ECH */
 		/* erase characters */
 		num = vte->csi_argv[0];
@@ -1915,12 +2226,7 @@ static void do_csi(struct tsm_vte *vte, uint32_t data)
 			csi_soft_reset(vte);
 		} else if (vte->csi_flags & CSI_CASH) {
 			/* DECRQM: Request DEC Private Mode */
-			/* If CSI_WHAT is set, then enable,
-			 * otherwise disable */
-
-			/* Ignore */
-
-			/* FIXME: Implement DECRQM */
+			csi_request_mode(vte);
 		} else {
 			/* DECSCL: Compatibility Level */
 			/* Sometimes CSI_DQUOTE is set here, too */
@@ -2018,6 +2324,7 @@ static void do_csi(struct tsm_vte *vte, uint32_t data)
 		tsm_screen_scroll_down(vte->con, num);
 		break;
 	default:
+		STAT_ADD(vte, unhandled, 1);
 		llog_debug(vte, "unhandled CSI sequence %c", data);
 	}
 }
@@ -2048,10 +2355,63 @@ static uint32_t vte_map(struct tsm_vte *vte, uint32_t val)
 	return val;
 }
 
+/*
+ * OSC Streaming
+ * With a stream callback, osc_arg is only a staging buffer for characters that
+ * went through the UTF-8 decoder. It is flushed when full and before runs of
+ * printable ASCII, which vte_string_run() passes on without copying. Only the
+ * size of the payload is tracked, so a limit costs no memory.
+ */
+
+static void osc_stream_data(struct tsm_vte *vte, const char *u8, size_t len)
+{
+	if (vte->osc_dropped)
+		return;
+
+	if (vte->osc_max && len > vte->osc_max - vte->osc_total) {
+		vte->osc_dropped = true;
+		vte->osc_stream_cb(vte, TSM_VTE_OSC_DROP, NULL, 0,
+				   vte->osc_stream_data);
+		return;
+	}
+
+	vte->osc_total += len;
+	vte->osc_stream_cb(vte, TSM_VTE_OSC_DATA, u8, len,
+			   vte->osc_stream_data);
+}
+
+static void osc_stream_flush(struct tsm_vte *vte)
+{
+	unsigned int len = vte->osc_len;
+
+	if (!len)
+		return;
+
+	vte->osc_len = 0;
+	osc_stream_data(vte, vte->osc_arg, len);
+}
+
+static void do_osc_start(struct tsm_vte *vte)
+{
+	do_clear(vte);
+	vte->osc_total = 0;
+	vte->osc_dropped = false;
+
+	if (!vte->osc_stream_cb)
+		return;
+
+	vte->osc_stream_cb(vte, TSM_VTE_OSC_BEGIN, NULL, 0,
+			   vte->osc_stream_data);
+}
+
 static void do_osc_collect(struct tsm_vte *vte, uint32_t val) {
 	char buf[4];
 	int len = tsm_ucs4_to_utf8(val, buf);
-	if (vte->osc_len + len > sizeof(vte->osc_arg) - 1) {
+
+	if (vte->osc_stream_cb) {
+		if (vte->osc_len + len > sizeof(vte->osc_arg))
+			osc_stream_flush(vte);
+	} else if (vte->osc_len + len > sizeof(vte->osc_arg) - 1) {
 		return;
 	}
 
@@ -2060,7 +2420,15 @@ static void do_osc_collect(struct tsm_vte *vte, uint32_t val) {
 }
 
 static void do_osc_end(struct tsm_vte *vte) {
-	if (!vte->osc_cb) {
+	if (vte->osc_stream_cb) {
+		osc_stream_flush(vte);
+		if (!vte->osc_dropped)
+			vte->osc_stream_cb(vte, TSM_VTE_OSC_END, NULL, 0,
+					   vte->osc_stream_data);
+		return;
+	}
+
+	if (!vte->osc_cb || vte->osc_dropped) {
 		return;
 	}
 
@@ -2068,6 +2436,70 @@ static void do_osc_end(struct tsm_vte *vte) {
 	vte->osc_cb(vte, vte->osc_arg, vte->osc_len, vte->osc_data);
 }
 
+/*
+ * DCS Passthrough
+ * DCS data is handed to the dcs_cb the same way streamed OSC payloads are.
+ * osc_arg stages decoded characters and vte_string_run() passes runs of 7-bit
+ * data on without copying. Data of a DCS that started without a callback is
+ * discarded.
+ */
+
+static void dcs_flush(struct tsm_vte *vte)
+{
+	unsigned int len = vte->osc_len;
+
+	if (!len)
+		return;
+
+	vte->osc_len = 0;
+	vte->dcs_cb(vte, TSM_VTE_DCS_DATA, &vte->dcs, vte->osc_arg, len,
+		    vte->dcs_data);
+}
+
+static void do_dcs_start(struct tsm_vte *vte, uint32_t final)
+{
+	if (!vte->dcs_cb)
+		return;
+
+	if (vte->csi_argc < CSI_ARG_MAX)
+		vte->csi_argc++;
+	vte->csi_collect[vte->csi_collect_len] = 0;
+
+	vte->dcs.final = final;
+	vte->dcs.intermediates = vte->csi_collect;
+	vte->dcs.argc = vte->csi_argc;
+	vte->dcs.argv = vte->csi_argv;
+	vte->dcs_active = true;
+	vte->osc_len = 0;
+	vte->dcs_cb(vte, TSM_VTE_DCS_BEGIN, &vte->dcs, NULL, 0, vte->dcs_data);
+}
+
+static void do_dcs_collect(struct tsm_vte *vte, uint32_t val)
+{
+	char buf[4];
+	int len;
+
+	if (!vte->dcs_active)
+		return;
+
+	len = tsm_ucs4_to_utf8(val, buf);
+	if (vte->osc_len + len > sizeof(vte->osc_arg))
+		dcs_flush(vte);
+
+	memcpy(vte->osc_arg + vte->osc_len, buf, len);
+	vte->osc_len += len;
+}
+
+static void do_dcs_end(struct tsm_vte *vte)
+{
+	if (!vte->dcs_active)
+		return;
+
+	dcs_flush(vte);
+	vte->dcs_active = false;
+	vte->dcs_cb(vte, TSM_VTE_DCS_END, &vte->dcs, NULL, 0, vte->dcs_data);
+}
+
 /* perform parser action */
 static void do_action(struct tsm_vte *vte, uint32_t data, int action)
 {
@@ -2081,10 +2513,13 @@ static void do_action(struct tsm_vte *vte, uint32_t data, int action)
 			/* ignore character */
 			break;
 		case ACTION_PRINT:
+			++vte->print_cnt;
 			sym = tsm_symbol_make(vte_map(vte, data));
 			write_console(vte, sym);
 			break;
 		case ACTION_EXECUTE:
+			++vte->dispatch_cnt;
+			STAT_ADD(vte, controls, 1);
 			do_execute(vte, data);
 			break;
 		case ACTION_CLEAR:
@@ -2097,24 +2532,35 @@ static void do_action(struct tsm_vte *vte, uint32_t data, int action)
 			do_param(vte, data);
 			break;
 		case ACTION_ESC_DISPATCH:
+			++vte->dispatch_cnt;
+			STAT_ADD(vte, esc, 1);
 			do_esc(vte, data);
 			break;
 		case ACTION_CSI_DISPATCH:
+			++vte->dispatch_cnt;
+			STAT_ADD(vte, csi, 1);
 			do_csi(vte, data);
 			break;
 		case ACTION_DCS_START:
+			STAT_ADD(vte, dcs, 1);
+			do_dcs_start(vte, data);
 			break;
 		case ACTION_DCS_COLLECT:
+			do_dcs_collect(vte, data);
 			break;
 		case ACTION_DCS_END:
+			++vte->dispatch_cnt;
+			do_dcs_end(vte);
 			break;
 		case ACTION_OSC_START:
-			do_clear(vte);
+			STAT_ADD(vte, osc, 1);
+			do_osc_start(vte);
 			break;
 		case ACTION_OSC_COLLECT:
 			do_osc_collect(vte, data);
 			break;
 		case ACTION_OSC_END:
+			++vte->dispatch_cnt;
 			do_osc_end(vte);
 			break;
 		default:
@@ -2504,35 +2950,451 @@ static void parse_data(struct tsm_vte *vte, uint32_t raw)
 	llog_warning(vte, "unhandled input %u in state %d", raw, vte->state);
 }
 
-SHL_EXPORT
-void tsm_vte_input(struct tsm_vte *vte, const char *u8, size_t len)
+static inline void vte_feed(struct tsm_vte *vte, char c)
 {
 	int state;
 	uint32_t ucs4;
-	size_t i;
+
+	if (vte->flags & TSM_VTE_FLAG_7BIT_MODE) {
+		if (c & 0x80)
+			llog_debug(vte, "receiving 8bit character U+%d from pty while in 7bit mode",
+				   (int)c);
+		parse_data(vte, c & 0x7f);
+	} else if (vte->flags & TSM_VTE_FLAG_8BIT_MODE) {
+		parse_data(vte, c);
+	} else {
+		state = tsm_utf8_mach_feed(vte->mach, c);
+		if (state == TSM_UTF8_ACCEPT ||
+		    state == TSM_UTF8_REJECT) {
+			ucs4 = tsm_utf8_mach_get(vte->mach);
+			parse_data(vte, ucs4);
+		}
+	}
+}
+
+static inline bool vte_in_string(struct tsm_vte *vte)
+{
+	return vte->state == STATE_OSC_STRING || vte->state == STATE_DCS_PASS;
+}
+
+/*
+ * Passes the 7-bit data at the start of @u8 to the OSC stream or DCS callback
+ * if such a string is being parsed. This covers printable ASCII for OSC and
+ * everything but CAN, SUB, ESC and DEL for DCS, which are collected unchanged
+ * in all modes.
+ * Returns the number of bytes consumed, 0 if @u8 must go through vte_feed().
+ */
+static size_t vte_string_run(struct tsm_vte *vte, const char *u8, size_t len)
+{
+	unsigned char c;
+	bool dcs;
+	int state;
+	uint32_t ch;
+	size_t n;
+
+	dcs = vte->state == STATE_DCS_PASS;
+	if (dcs ? !vte->dcs_active : !vte->osc_stream_cb)
+		return 0;
+
+	if (!(vte->flags & (TSM_VTE_FLAG_7BIT_MODE | TSM_VTE_FLAG_8BIT_MODE))) {
+		tsm_utf8_mach_get_state(vte->mach, &state, &ch);
+		if (state >= TSM_UTF8_EXPECT1)
+			return 0;
+	}
+
+	for (n = 0; n < len; ++n) {
+		c = u8[n];
+		if (dcs) {
+			if (c >= 0x7f || c == 0x18 || c == 0x1a || c == 0x1b)
+				break;
+		} else if (c < 0x20 || c > 0x7f) {
+			break;
+		}
+	}
+
+	if (!n)
+		return 0;
+
+	if (dcs) {
+		dcs_flush(vte);
+		vte->dcs_cb(vte, TSM_VTE_DCS_DATA, &vte->dcs, u8, n,
+			    vte->dcs_data);
+	} else {
+		osc_stream_flush(vte);
+		osc_stream_data(vte, u8, n);
+	}
+
+	return n;
+}
+
+SHL_EXPORT
+void tsm_vte_input(struct tsm_vte *vte, const char *u8, size_t len)
+{
+	size_t i, n;
 
 	if (!vte || !vte->con)
 		return;
 
+	STAT_ADD(vte, bytes, len);
+	TRACE2(vte_input_begin, vte, len);
 	++vte->parse_cnt;
-	for (i = 0; i < len; ++i) {
-		if (vte->flags & TSM_VTE_FLAG_7BIT_MODE) {
-			if (u8[i] & 0x80)
-				llog_debug(vte, "receiving 8bit character U+%d from pty while in 7bit mode",
-					   (int)u8[i]);
-			parse_data(vte, u8[i] & 0x7f);
-		} else if (vte->flags & TSM_VTE_FLAG_8BIT_MODE) {
-			parse_data(vte, u8[i]);
-		} else {
-			state = tsm_utf8_mach_feed(vte->mach, u8[i]);
-			if (state == TSM_UTF8_ACCEPT ||
-			    state == TSM_UTF8_REJECT) {
-				ucs4 = tsm_utf8_mach_get(vte->mach);
-				parse_data(vte, ucs4);
+	for (i = 0; i < len; ) {
+		if (vte_in_string(vte)) {
+			n = vte_string_run(vte, u8 + i, len - i);
+			if (n) {
+				i += n;
+				continue;
 			}
 		}
+
+		vte_feed(vte, u8[i++]);
+	}
+	--vte->parse_cnt;
+
+	if (!vte->parse_cnt && vte->flush_mode == TSM_VTE_FLUSH_INPUT)
+		tsm_vte_flush(vte);
+
+	TRACE2(vte_input_end, vte, len);
+}
+
+/* bytes between two clock reads if nothing is dispatched */
+#define VTE_CLOCK_INTERVAL 256
+
+/*
+ * The budget is checked after each byte, so we always stop on a byte boundary
+ * and never in the middle of an action. Partial UTF-8 and escape sequences
+ * simply stay in the parser state. The clock is read after every dispatched
+ * control function, as these may be expensive, and every VTE_CLOCK_INTERVAL
+ * bytes otherwise.
+ */
+SHL_EXPORT
+size_t tsm_vte_input_budget(struct tsm_vte *vte, const char *u8, size_t len,
+			    const struct tsm_vte_budget *budget)
+{
+	unsigned long prints, dispatches, last;
+	size_t i, n, next_clock;
+
+	if (!vte || !vte->con)
+		return 0;
+
+	if (!budget) {
+		tsm_vte_input(vte, u8, len);
+		return len;
+	}
+
+	prints = vte->print_cnt;
+	dispatches = vte->dispatch_cnt;
+	last = dispatches;
+	next_clock = VTE_CLOCK_INTERVAL;
+
+	TRACE2(vte_input_begin, vte, len);
+	++vte->parse_cnt;
+	for (i = 0; i < len; ) {
+		n = 0;
+		if (vte_in_string(vte))
+			n = vte_string_run(vte, u8 + i, len - i);
+		if (n)
+			i += n;
+		else
+			vte_feed(vte, u8[i++]);
+
+		if (budget->cells && vte->print_cnt - prints >= budget->cells)
+			break;
+		if (budget->sequences &&
+		    vte->dispatch_cnt - dispatches >= budget->sequences)
+			break;
+
+		if (!budget->deadline)
+			continue;
+		if (i < next_clock && vte->dispatch_cnt == last)
+			continue;
+
+		last = vte->dispatch_cnt;
+		next_clock = i + VTE_CLOCK_INTERVAL;
+		if (vte_now() >= budget->deadline)
+			break;
 	}
 	--vte->parse_cnt;
+	STAT_ADD(vte, bytes, i);
+
+	if (!vte->parse_cnt && vte->flush_mode == TSM_VTE_FLUSH_INPUT)
+		tsm_vte_flush(vte);
+
+	TRACE2(vte_input_end, vte, i);
+	return i;
+}
+
+/*
+ * VTE Snapshots
+ * The parser and terminal state is saved in the same format as screens, see
+ * tsm-save.c. Character sets are stored as index into vte_charsets and the
+ * GL/GR mappings as 1-4 for G0-G3 or 0 for none. Configuration like the
+ * palette, callbacks and the flush mode is not saved; the loading VTE keeps its
+ * own.
+ * The callbacks of the loading VTE never saw the start of an OSC or DCS that
+ * is parsed while saving, so the rest of such a string is ignored.
+ */
+
+#define VTE_MAGIC SAVE_TAG('T', 'S', 'M', 'V')
+#define VTE_VERSION 1
+
+#define TAG_PARS SAVE_TAG('P', 'A', 'R', 'S')
+#define TAG_TERM SAVE_TAG('T', 'E', 'R', 'M')
+
+static tsm_vte_charset *const vte_charsets[] = {
+	&tsm_vte_unicode_lower,
+	&tsm_vte_unicode_upper,
+	&tsm_vte_dec_supplemental_graphics,
+	&tsm_vte_dec_special_graphics,
+};
+
+#define VTE_CHARSET_NUM (sizeof(vte_charsets) / sizeof(*vte_charsets))
+
+static unsigned int charset_to_id(tsm_vte_charset *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < VTE_CHARSET_NUM; ++i)
+		if (vte_charsets[i] == set)
+			return i;
+
+	return 0;
+}
+
+static unsigned int gset_to_id(struct tsm_vte *vte, tsm_vte_charset **g)
+{
+	if (g == &vte->g0)
+		return 1;
+	if (g == &vte->g1)
+		return 2;
+	if (g == &vte->g2)
+		return 3;
+	if (g == &vte->g3)
+		return 4;
+	return 0;
+}
+
+static tsm_vte_charset **gset_from_id(struct tsm_vte *vte, unsigned int id)
+{
+	switch (id) {
+	case 1:
+		return &vte->g0;
+	case 2:
+		return &vte->g1;
+	case 3:
+		return &vte->g2;
+	case 4:
+		return &vte->g3;
+	default:
+		return NULL;
+	}
+}
+
+SHL_EXPORT
+int tsm_vte_save(struct tsm_vte *vte, char **out, size_t *out_len)
+{
+	struct save_buf b;
+	unsigned int i;
+	uint32_t ch;
+	size_t start;
+	int state;
+
+	if (!vte || !out || !out_len)
+		return -EINVAL;
+
+	save_begin(&b, VTE_MAGIC, VTE_VERSION);
+
+	start = save_section_begin(&b, TAG_PARS);
+	save_uint(&b, vte->state);
+	tsm_utf8_mach_get_state(vte->mach, &state, &ch);
+	save_uint(&b, state);
+	save_uint(&b, ch);
+	save_uint(&b, vte->csi_argc);
+	/* arguments are -1 if not given */
+	for (i = 0; i < CSI_ARG_MAX; ++i)
+		save_uint(&b, (unsigned int)(vte->csi_argv[i] + 1));
+	save_uint(&b, vte->csi_flags);
+	save_uint(&b, vte->osc_len);
+	save_bytes(&b, vte->osc_arg, vte->osc_len);
+	save_uint(&b, vte->osc_total);
+	save_uint(&b, vte->osc_dropped);
+	save_uint(&b, vte->csi_collect_len);
+	save_bytes(&b, vte->csi_collect, vte->csi_collect_len);
+	save_section_end(&b, start);
+
+	start = save_section_begin(&b, TAG_TERM);
+	save_uint(&b, vte->flags);
+	save_attr(&b, &vte->def_attr);
+	save_attr(&b, &vte->cattr);
+	save_uint(&b, charset_to_id(vte->g0));
+	save_uint(&b, charset_to_id(vte->g1));
+	save_uint(&b, charset_to_id(vte->g2));
+	save_uint(&b, charset_to_id(vte->g3));
+	save_uint(&b, gset_to_id(vte, vte->gl));
+	save_uint(&b, gset_to_id(vte, vte->gr));
+	save_uint(&b, gset_to_id(vte, vte->glt));
+	save_uint(&b, gset_to_id(vte, vte->grt));
+	save_uint(&b, vte->saved_state.cursor_x);
+	save_uint(&b, vte->saved_state.cursor_y);
+	save_attr(&b, &vte->saved_state.cattr);
+	save_uint(&b, gset_to_id(vte, vte->saved_state.gl));
+	save_uint(&b, gset_to_id(vte, vte->saved_state.gr));
+	save_uint(&b, vte->saved_state.wrap_mode);
+	save_uint(&b, vte->saved_state.origin_mode);
+	save_uint(&b, vte->alt_cursor_x);
+	save_uint(&b, vte->alt_cursor_y);
+	save_uint(&b, vte->mouse_mode);
+	save_uint(&b, vte->mouse_event);
+	save_uint(&b, vte->mouse_last_col);
+	save_uint(&b, vte->mouse_last_row);
+	save_uint(&b, vte->last_sym);
+	save_section_end(&b, start);
+
+	return save_finish(&b, out, out_len);
+}
+
+static void load_pars(struct tsm_vte *vte, struct tsm_vte *tmp,
+		      struct load_buf *b)
+{
+	const void *osc, *collect;
+	unsigned int i;
+	uint32_t ch;
+	int state;
+
+	tmp->state = load_uint(b, STATE_NUM - 1);
+	state = load_uint(b, TSM_UTF8_EXPECT3);
+	ch = load_uint(b, UINT32_MAX);
+	tmp->csi_argc = load_uint(b, CSI_ARG_MAX);
+	for (i = 0; i < CSI_ARG_MAX; ++i)
+		tmp->csi_argv[i] = (int)load_uint(b, INT_MAX) - 1;
+	tmp->csi_flags = load_uint(b, UINT_MAX);
+	tmp->osc_len = load_uint(b, OSC_MAX_LEN - 1);
+	osc = load_bytes(b, tmp->osc_len);
+	tmp->osc_total = load_uint(b, SIZE_MAX);
+	tmp->osc_dropped = load_uint(b, 1);
+	tmp->csi_collect_len = load_uint(b, sizeof(tmp->csi_collect) - 1);
+	collect = load_bytes(b, tmp->csi_collect_len);
+
+	if (b->failed || tmp->state == STATE_NONE) {
+		b->failed = true;
+		return;
+	}
+
+	memcpy(tmp->osc_arg, osc, tmp->osc_len);
+	memcpy(tmp->csi_collect, collect, tmp->csi_collect_len);
+
+	tmp->dcs_active = false;
+	if (tmp->state == STATE_DCS_PASS) {
+		tmp->state = STATE_DCS_IGNORE;
+		tmp->osc_len = 0;
+	} else if (tmp->state == STATE_OSC_STRING) {
+		tmp->osc_dropped = true;
+		tmp->osc_len = 0;
+	}
+	tsm_utf8_mach_set_state(vte->mach, state, ch);
+}
+
+static void load_term(struct tsm_vte *vte, struct tsm_vte *tmp,
+		      struct load_buf *b)
+{
+	tmp->flags = load_uint(b, UINT_MAX);
+	load_attr(b, &tmp->def_attr);
+	load_attr(b, &tmp->cattr);
+	tmp->g0 = vte_charsets[load_uint(b, VTE_CHARSET_NUM - 1)];
+	tmp->g1 = vte_charsets[load_uint(b, VTE_CHARSET_NUM - 1)];
+	tmp->g2 = vte_charsets[load_uint(b, VTE_CHARSET_NUM - 1)];
+	tmp->g3 = vte_charsets[load_uint(b, VTE_CHARSET_NUM - 1)];
+	tmp->gl = gset_from_id(vte, load_uint(b, 4));
+	tmp->gr = gset_from_id(vte, load_uint(b, 4));
+	tmp->glt = gset_from_id(vte, load_uint(b, 4));
+	tmp->grt = gset_from_id(vte, load_uint(b, 4));
+	tmp->saved_state.cursor_x = load_uint(b, UINT_MAX);
+	tmp->saved_state.cursor_y = load_uint(b, UINT_MAX);
+	load_attr(b, &tmp->saved_state.cattr);
+	tmp->saved_state.gl = gset_from_id(vte, load_uint(b, 4));
+	tmp->saved_state.gr = gset_from_id(vte, load_uint(b, 4));
+	tmp->saved_state.wrap_mode = load_uint(b, 1);
+	tmp->saved_state.origin_mode = load_uint(b, 1);
+	tmp->alt_cursor_x = load_uint(b, UINT_MAX);
+	tmp->alt_cursor_y = load_uint(b, UINT_MAX);
+	tmp->mouse_mode = load_uint(b, UINT_MAX);
+	tmp->mouse_event = load_uint(b, UINT_MAX);
+	tmp->mouse_last_col = load_uint(b, UINT_MAX);
+	tmp->mouse_last_row = load_uint(b, UINT_MAX);
+	/* printed characters are never combined symbols */
+	tmp->last_sym = load_uint(b, TSM_UCS4_MAX);
+
+	/* GL and GR are always mapped */
+	if (!tmp->gl || !tmp->gr || !tmp->saved_state.gl ||
+	    !tmp->saved_state.gr)
+		b->failed = true;
+}
+
+SHL_EXPORT
+int tsm_vte_load(struct tsm_vte *vte, const void *data, size_t len)
+{
+	struct load_buf b, sec, pars, term;
+	struct tsm_vte tmp;
+	uint32_t tag;
+	bool sync;
+	int ret;
+
+	if (!vte || !data)
+		return -EINVAL;
+
+	ret = load_begin(&b, data, len, VTE_MAGIC, VTE_VERSION);
+	if (ret)
+		return ret;
+
+	memset(&pars, 0, sizeof(pars));
+	memset(&term, 0, sizeof(term));
+
+	while (load_section(&b, &tag, &sec)) {
+		if (tag == TAG_PARS)
+			pars = sec;
+		else if (tag == TAG_TERM)
+			term = sec;
+	}
+
+	if (b.failed || !pars.data || !term.data) {
+		llog_warning(vte, "invalid vte snapshot");
+		return -EBADMSG;
+	}
+
+	/* parse into a copy so @vte stays untouched on failure */
+	tmp = *vte;
+	load_term(vte, &tmp, &term);
+	if (!term.failed)
+		load_pars(vte, &tmp, &pars);
+	if (term.failed || pars.failed) {
+		llog_warning(vte, "invalid vte snapshot");
+		return -EBADMSG;
+	}
+
+	/* an OSC or DCS of @vte itself is replaced by the loaded state */
+	if (vte->state == STATE_OSC_STRING && vte->osc_stream_cb &&
+	    !vte->osc_dropped)
+		vte->osc_stream_cb(vte, TSM_VTE_OSC_DROP, NULL, 0,
+				   vte->osc_stream_data);
+	if (vte->dcs_active)
+		vte->dcs_cb(vte, TSM_VTE_DCS_DROP, &vte->dcs, NULL, 0,
+			    vte->dcs_data);
+
+	/* observers of mode 2026 see the restored state, a restored update
+	 * starts over */
+	sync = tmp.flags & TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT;
+	tmp.flags &= ~TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT;
+	tmp.flags |= vte->flags & TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT;
+
+	*vte = tmp;
+	vte_set_sync(vte, sync);
+	if (sync) {
+		vte->sync_start = vte_now();
+		tsm_screen_set_flags(vte->con, TSM_SCREEN_SYNC_UPDATE);
+	} else {
+		tsm_screen_reset_flags(vte->con, TSM_SCREEN_SYNC_UPDATE);
+	}
+	return 0;
 }
 
 SHL_EXPORT
@@ -2541,11 +3403,309 @@ void tsm_vte_set_backspace_sends_delete(struct tsm_vte *vte, bool enable)
 	vte->backspace_sends_delete = enable;
 }
 
+/*
+ * Keyboard Translation
+ * Keys are translated with lookup tables. The keysyms of all special keys are
+ * in the 0xff00 page, so there is one entry per keysym of that page in each
+ * table. Modifiers and modes select tables that take precedence over the base
+ * table; the first selected table with an entry for a key wins. Ctrl with an
+ * ASCII key is looked up in a separate table before that.
+ *
+ * TODO: What should we do with Pause and Scroll_Lock? The specs say XOFF and
+ * 0x14 but there is no simple way on modern keyboards to send XON again and
+ * scroll-lock is not used that way today. If someone wants this, we can add
+ * them to a table selected by some flag.
+ * TODO: Check what to transmit for function keys when shift/ctrl etc. are
+ * pressed. Every terminal behaves differently here which is really weird.
+ * We now map F4 to F14 if shift is pressed and so on for all keys. However,
+ * such mappings should rather be done via xkb-configurations and we should
+ * instead add a flags argument to the CSIs as some of the keys here already
+ * do.
+ */
+
+struct vte_key {
+	uint8_t len;
+	char seq[8];
+};
+
+#define KEY(_seq) { sizeof(_seq) - 1, _seq }
+#define KEYSYM_PAGE 0xff00
+#define K(_sym) [(_sym) - KEYSYM_PAGE]
+
+enum vte_key_table {
+	VTE_KEYS_CTRL,			/* Ctrl is pressed */
+	VTE_KEYS_SHIFT,			/* Shift is pressed */
+	VTE_KEYS_KEYPAD,		/* keypad application mode */
+	VTE_KEYS_CURSOR,		/* cursor key mode */
+	VTE_KEYS_NEWLINE,		/* line feed/new line mode */
+	VTE_KEYS_DELETE,		/* backspace sends delete */
+	VTE_KEYS_BASE,
+	VTE_KEYS_NUM,
+};
+
+static const struct vte_key vte_keys[VTE_KEYS_NUM][256] = {
+	[VTE_KEYS_CTRL] = {
+		K(XKB_KEY_Up) = KEY("\e[1;5A"),
+		K(XKB_KEY_KP_Up) = KEY("\e[1;5A"),
+		K(XKB_KEY_Down) = KEY("\e[1;5B"),
+		K(XKB_KEY_KP_Down) = KEY("\e[1;5B"),
+		K(XKB_KEY_Right) = KEY("\e[1;5C"),
+		K(XKB_KEY_KP_Right) = KEY("\e[1;5C"),
+		K(XKB_KEY_Left) = KEY("\e[1;5D"),
+		K(XKB_KEY_KP_Left) = KEY("\e[1;5D"),
+	},
+	[VTE_KEYS_SHIFT] = {
+		K(XKB_KEY_Up) = KEY("\e[1;2A"),
+		K(XKB_KEY_KP_Up) = KEY("\e[1;2A"),
+		K(XKB_KEY_Down) = KEY("\e[1;2B"),
+		K(XKB_KEY_KP_Down) = KEY("\e[1;2B"),
+		K(XKB_KEY_Right) = KEY("\e[1;2C"),
+		K(XKB_KEY_KP_Right) = KEY("\e[1;2C"),
+		K(XKB_KEY_Left) = KEY("\e[1;2D"),
+		K(XKB_KEY_KP_Left) = KEY("\e[1;2D"),
+		K(XKB_KEY_F1) = KEY("\e[23~"),
+		K(XKB_KEY_KP_F1) = KEY("\e[23~"),
+		K(XKB_KEY_F2) = KEY("\e[24~"),
+		K(XKB_KEY_KP_F2) = KEY("\e[24~"),
+		K(XKB_KEY_F3) = KEY("\e[25~"),
+		K(XKB_KEY_KP_F3) = KEY("\e[25~"),
+		K(XKB_KEY_F4) = KEY("\e[26~"),
+		K(XKB_KEY_KP_F4) = KEY("\e[26~"),
+		K(XKB_KEY_F5) = KEY("\e[28~"),
+		K(XKB_KEY_F6) = KEY("\e[29~"),
+		K(XKB_KEY_F7) = KEY("\e[31~"),
+		K(XKB_KEY_F8) = KEY("\e[32~"),
+		K(XKB_KEY_F9) = KEY("\e[33~"),
+		K(XKB_KEY_F10) = KEY("\e[34~"),
+		K(XKB_KEY_F11) = KEY("\e[23;2~"),
+		K(XKB_KEY_F12) = KEY("\e[24;2~"),
+		K(XKB_KEY_F13) = KEY("\e[25;2~"),
+		K(XKB_KEY_F14) = KEY("\e[26;2~"),
+		K(XKB_KEY_F15) = KEY("\e[28;2~"),
+		K(XKB_KEY_F16) = KEY("\e[29;2~"),
+		K(XKB_KEY_F17) = KEY("\e[31;2~"),
+		K(XKB_KEY_F18) = KEY("\e[32;2~"),
+		K(XKB_KEY_F19) = KEY("\e[33;2~"),
+		K(XKB_KEY_F20) = KEY("\e[34;2~"),
+	},
+	[VTE_KEYS_KEYPAD] = {
+		K(XKB_KEY_KP_Enter) = KEY("\eOM"),
+		K(XKB_KEY_KP_Insert) = KEY("\eOp"),
+		K(XKB_KEY_KP_0) = KEY("\eOp"),
+		K(XKB_KEY_KP_1) = KEY("\eOq"),
+		K(XKB_KEY_KP_2) = KEY("\eOr"),
+		K(XKB_KEY_KP_3) = KEY("\eOs"),
+		K(XKB_KEY_KP_4) = KEY("\eOt"),
+		K(XKB_KEY_KP_5) = KEY("\eOu"),
+		K(XKB_KEY_KP_6) = KEY("\eOv"),
+		K(XKB_KEY_KP_7) = KEY("\eOw"),
+		K(XKB_KEY_KP_8) = KEY("\eOx"),
+		K(XKB_KEY_KP_9) = KEY("\eOy"),
+		K(XKB_KEY_KP_Subtract) = KEY("\eOm"),
+		K(XKB_KEY_KP_Separator) = KEY("\eOl"),
+		K(XKB_KEY_KP_Delete) = KEY("\eOn"),
+		K(XKB_KEY_KP_Decimal) = KEY("\eOn"),
+		K(XKB_KEY_KP_Equal) = KEY("\eOj"),
+		K(XKB_KEY_KP_Divide) = KEY("\eOj"),
+		K(XKB_KEY_KP_Multiply) = KEY("\eOo"),
+		K(XKB_KEY_KP_Add) = KEY("\eOk"),
+	},
+	[VTE_KEYS_CURSOR] = {
+		K(XKB_KEY_Up) = KEY("\eOA"),
+		K(XKB_KEY_KP_Up) = KEY("\eOA"),
+		K(XKB_KEY_Down) = KEY("\eOB"),
+		K(XKB_KEY_KP_Down) = KEY("\eOB"),
+		K(XKB_KEY_Right) = KEY("\eOC"),
+		K(XKB_KEY_KP_Right) = KEY("\eOC"),
+		K(XKB_KEY_Left) = KEY("\eOD"),
+		K(XKB_KEY_KP_Left) = KEY("\eOD"),
+		K(XKB_KEY_Home) = KEY("\eOH"),
+		K(XKB_KEY_KP_Home) = KEY("\eOH"),
+		K(XKB_KEY_End) = KEY("\eOF"),
+		K(XKB_KEY_KP_End) = KEY("\eOF"),
+	},
+	[VTE_KEYS_NEWLINE] = {
+		K(XKB_KEY_Return) = KEY("\x0d\x0a"),
+		K(XKB_KEY_KP_Enter) = KEY("\x0d\x0a"),
+	},
+	[VTE_KEYS_DELETE] = {
+		K(XKB_KEY_BackSpace) = KEY("\x7f"),
+	},
+	[VTE_KEYS_BASE] = {
+		K(XKB_KEY_BackSpace) = KEY("\x08"),
+		K(XKB_KEY_Tab) = KEY("\x09"),
+		K(XKB_KEY_KP_Tab) = KEY("\x09"),
+		K(XKB_KEY_Linefeed) = KEY("\x0a"),
+		K(XKB_KEY_Clear) = KEY("\x0b"),
+		K(XKB_KEY_Sys_Req) = KEY("\x15"),
+		K(XKB_KEY_Escape) = KEY("\x1b"),
+		K(XKB_KEY_Return) = KEY("\x0d"),
+		K(XKB_KEY_KP_Enter) = KEY("\x0d"),
+		K(XKB_KEY_Find) = KEY("\e[1~"),
+		K(XKB_KEY_Insert) = KEY("\e[2~"),
+		K(XKB_KEY_Delete) = KEY("\e[3~"),
+		K(XKB_KEY_Select) = KEY("\e[4~"),
+		K(XKB_KEY_Page_Up) = KEY("\e[5~"),
+		K(XKB_KEY_KP_Page_Up) = KEY("\e[5~"),
+		K(XKB_KEY_Page_Down) = KEY("\e[6~"),
+		K(XKB_KEY_KP_Page_Down) = KEY("\e[6~"),
+		K(XKB_KEY_Up) = KEY("\e[A"),
+		K(XKB_KEY_KP_Up) = KEY("\e[A"),
+		K(XKB_KEY_Down) = KEY("\e[B"),
+		K(XKB_KEY_KP_Down) = KEY("\e[B"),
+		K(XKB_KEY_Right) = KEY("\e[C"),
+		K(XKB_KEY_KP_Right) = KEY("\e[C"),
+		K(XKB_KEY_Left) = KEY("\e[D"),
+		K(XKB_KEY_KP_Left) = KEY("\e[D"),
+		K(XKB_KEY_KP_Insert) = KEY("0"),
+		K(XKB_KEY_KP_0) = KEY("0"),
+		K(XKB_KEY_KP_1) = KEY("1"),
+		K(XKB_KEY_KP_2) = KEY("2"),
+		K(XKB_KEY_KP_3) = KEY("3"),
+		K(XKB_KEY_KP_4) = KEY("4"),
+		K(XKB_KEY_KP_5) = KEY("5"),
+		K(XKB_KEY_KP_6) = KEY("6"),
+		K(XKB_KEY_KP_7) = KEY("7"),
+		K(XKB_KEY_KP_8) = KEY("8"),
+		K(XKB_KEY_KP_9) = KEY("9"),
+		K(XKB_KEY_KP_Subtract) = KEY("-"),
+		K(XKB_KEY_KP_Separator) = KEY(","),
+		K(XKB_KEY_KP_Delete) = KEY("."),
+		K(XKB_KEY_KP_Decimal) = KEY("."),
+		K(XKB_KEY_KP_Equal) = KEY("/"),
+		K(XKB_KEY_KP_Divide) = KEY("/"),
+		K(XKB_KEY_KP_Multiply) = KEY("*"),
+		K(XKB_KEY_KP_Add) = KEY("+"),
+		K(XKB_KEY_Home) = KEY("\e[H"),
+		K(XKB_KEY_KP_Home) = KEY("\e[H"),
+		K(XKB_KEY_End) = KEY("\e[F"),
+		K(XKB_KEY_KP_End) = KEY("\e[F"),
+		K(XKB_KEY_KP_Space) = KEY(" "),
+		K(XKB_KEY_F1) = KEY("\eOP"),
+		K(XKB_KEY_KP_F1) = KEY("\eOP"),
+		K(XKB_KEY_F2) = KEY("\eOQ"),
+		K(XKB_KEY_KP_F2) = KEY("\eOQ"),
+		K(XKB_KEY_F3) = KEY("\eOR"),
+		K(XKB_KEY_KP_F3) = KEY("\eOR"),
+		K(XKB_KEY_F4) = KEY("\eOS"),
+		K(XKB_KEY_KP_F4) = KEY("\eOS"),
+		K(XKB_KEY_F5) = KEY("\e[15~"),
+		K(XKB_KEY_F6) = KEY("\e[17~"),
+		K(XKB_KEY_F7) = KEY("\e[18~"),
+		K(XKB_KEY_F8) = KEY("\e[19~"),
+		K(XKB_KEY_F9) = KEY("\e[20~"),
+		K(XKB_KEY_F10) = KEY("\e[21~"),
+		K(XKB_KEY_F11) = KEY("\e[23~"),
+		K(XKB_KEY_F12) = KEY("\e[24~"),
+		K(XKB_KEY_F13) = KEY("\e[25~"),
+		K(XKB_KEY_F14) = KEY("\e[26~"),
+		K(XKB_KEY_F15) = KEY("\e[28~"),
+		K(XKB_KEY_F16) = KEY("\e[29~"),
+		K(XKB_KEY_F17) = KEY("\e[31~"),
+		K(XKB_KEY_F18) = KEY("\e[32~"),
+		K(XKB_KEY_F19) = KEY("\e[33~"),
+		K(XKB_KEY_F20) = KEY("\e[34~"),
+	},
+};
+
+/* Ctrl with an ASCII keysym, letters work with and without shift */
+static const struct vte_key vte_ctrl_keys[128] = {
+	[XKB_KEY_2] = KEY("\x00"),
+	[XKB_KEY_space] = KEY("\x00"),
+	[XKB_KEY_a] = KEY("\x01"), [XKB_KEY_A] = KEY("\x01"),
+	[XKB_KEY_b] = KEY("\x02"), [XKB_KEY_B] = KEY("\x02"),
+	[XKB_KEY_c] = KEY("\x03"), [XKB_KEY_C] = KEY("\x03"),
+	[XKB_KEY_d] = KEY("\x04"), [XKB_KEY_D] = KEY("\x04"),
+	[XKB_KEY_e] = KEY("\x05"), [XKB_KEY_E] = KEY("\x05"),
+	[XKB_KEY_f] = KEY("\x06"), [XKB_KEY_F] = KEY("\x06"),
+	[XKB_KEY_g] = KEY("\x07"), [XKB_KEY_G] = KEY("\x07"),
+	[XKB_KEY_h] = KEY("\x08"), [XKB_KEY_H] = KEY("\x08"),
+	[XKB_KEY_i] = KEY("\x09"), [XKB_KEY_I] = KEY("\x09"),
+	[XKB_KEY_j] = KEY("\x0a"), [XKB_KEY_J] = KEY("\x0a"),
+	[XKB_KEY_k] = KEY("\x0b"), [XKB_KEY_K] = KEY("\x0b"),
+	[XKB_KEY_l] = KEY("\x0c"), [XKB_KEY_L] = KEY("\x0c"),
+	[XKB_KEY_m] = KEY("\x0d"), [XKB_KEY_M] = KEY("\x0d"),
+	[XKB_KEY_n] = KEY("\x0e"), [XKB_KEY_N] = KEY("\x0e"),
+	[XKB_KEY_o] = KEY("\x0f"), [XKB_KEY_O] = KEY("\x0f"),
+	[XKB_KEY_p] = KEY("\x10"), [XKB_KEY_P] = KEY("\x10"),
+	[XKB_KEY_q] = KEY("\x11"), [XKB_KEY_Q] = KEY("\x11"),
+	[XKB_KEY_r] = KEY("\x12"), [XKB_KEY_R] = KEY("\x12"),
+	[XKB_KEY_s] = KEY("\x13"), [XKB_KEY_S] = KEY("\x13"),
+	[XKB_KEY_t] = KEY("\x14"), [XKB_KEY_T] = KEY("\x14"),
+	[XKB_KEY_u] = KEY("\x15"), [XKB_KEY_U] = KEY("\x15"),
+	[XKB_KEY_v] = KEY("\x16"), [XKB_KEY_V] = KEY("\x16"),
+	[XKB_KEY_w] = KEY("\x17"), [XKB_KEY_W] = KEY("\x17"),
+	[XKB_KEY_x] = KEY("\x18"), [XKB_KEY_X] = KEY("\x18"),
+	[XKB_KEY_y] = KEY("\x19"), [XKB_KEY_Y] = KEY("\x19"),
+	[XKB_KEY_z] = KEY("\x1a"), [XKB_KEY_Z] = KEY("\x1a"),
+	[XKB_KEY_3] = KEY("\x1b"),
+	[XKB_KEY_bracketleft] = KEY("\x1b"),
+	[XKB_KEY_braceleft] = KEY("\x1b"),
+	[XKB_KEY_4] = KEY("\x1c"),
+	[XKB_KEY_backslash] = KEY("\x1c"),
+	[XKB_KEY_bar] = KEY("\x1c"),
+	[XKB_KEY_5] = KEY("\x1d"),
+	[XKB_KEY_bracketright] = KEY("\x1d"),
+	[XKB_KEY_braceright] = KEY("\x1d"),
+	[XKB_KEY_6] = KEY("\x1e"),
+	[XKB_KEY_grave] = KEY("\x1e"),
+	[XKB_KEY_asciitilde] = KEY("\x1e"),
+	[XKB_KEY_7] = KEY("\x1f"),
+	[XKB_KEY_slash] = KEY("\x1f"),
+	[XKB_KEY_question] = KEY("\x1f"),
+	[XKB_KEY_8] = KEY("\x7f"),
+};
+
+static const struct vte_key vte_key_backtab = KEY("\e[Z");
+
+/*
+ * Returns the sequence for @keysym or NULL if it is not a special key. @sym is
+ * the ASCII keysym used for Ctrl combinations, see tsm_vte_handle_keyboard().
+ */
+static const struct vte_key *vte_lookup_key(struct tsm_vte *vte,
+					    uint32_t keysym, uint32_t sym,
+					    unsigned int mods)
+{
+	unsigned int tables[VTE_KEYS_NUM], num = 0, i;
+	const struct vte_key *key;
+
+	if ((mods & TSM_CONTROL_MASK) && sym < 128 && vte_ctrl_keys[sym].len)
+		return &vte_ctrl_keys[sym];
+
+	if (keysym == XKB_KEY_ISO_Left_Tab)
+		return &vte_key_backtab;
+	if ((keysym & ~0xffU) != KEYSYM_PAGE)
+		return NULL;
+
+	if (mods & TSM_CONTROL_MASK)
+		tables[num++] = VTE_KEYS_CTRL;
+	if (mods & TSM_SHIFT_MASK)
+		tables[num++] = VTE_KEYS_SHIFT;
+	if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
+		tables[num++] = VTE_KEYS_KEYPAD;
+	if (vte->flags & TSM_VTE_FLAG_CURSOR_KEY_MODE)
+		tables[num++] = VTE_KEYS_CURSOR;
+	if (vte->flags & TSM_VTE_FLAG_LINE_FEED_NEW_LINE_MODE)
+		tables[num++] = VTE_KEYS_NEWLINE;
+	if (vte->backspace_sends_delete)
+		tables[num++] = VTE_KEYS_DELETE;
+	tables[num++] = VTE_KEYS_BASE;
+
+	for (i = 0; i < num; ++i) {
+		key = &vte_keys[tables[i]][keysym - KEYSYM_PAGE];
+		if (key->len)
+			return key;
+	}
+
+	return NULL;
+}
+
 SHL_EXPORT
 bool tsm_vte_handle_keyboard(struct tsm_vte *vte, uint32_t keysym,
 			     uint32_t ascii, unsigned int mods,
 			     uint32_t unicode)
 {
+	const struct vte_key *key;
 	char val, u8[4];
 	size_t len;
 	uint32_t sym;
@@ -2556,9 +3716,7 @@ bool tsm_vte_handle_keyboard(struct tsm_vte *vte, uint32_t keysym,
 
 	/* MOD1 (mostly labeled 'Alt') prepends an escape character to every
 	 * input that is sent by a key.
-	 * TODO: Transform this huge handler into a lookup table to save a lot
-	 * of code and make such modifiers easier to implement.
-	 * Also check whether altSendsEscape should be the default (xterm
+	 * TODO: Check whether altSendsEscape should be the default (xterm
 	 * disables this by default, why?) and whether we should implement the
 	 * fallback shifting that xterm does. */
 	if (mods & TSM_ALT_MASK)
@@ -2578,525 +3736,10 @@ bool tsm_vte_handle_keyboard(struct tsm_vte *vte, uint32_t keysym,
 	if (sym == XKB_KEY_NoSymbol)
 		sym = keysym;
 
-	if (mods & TSM_CONTROL_MASK) {
-		switch (sym) {
-		case XKB_KEY_2:
-		case XKB_KEY_space:
-			vte_write(vte, "\x00", 1);
-			return true;
-		case XKB_KEY_a:
-		case XKB_KEY_A:
-			vte_write(vte, "\x01", 1);
-			return true;
-		case XKB_KEY_b:
-		case XKB_KEY_B:
-			vte_write(vte, "\x02", 1);
-			return true;
-		case XKB_KEY_c:
-		case XKB_KEY_C:
-			vte_write(vte, "\x03", 1);
-			return true;
-		case XKB_KEY_d:
-		case XKB_KEY_D:
-			vte_write(vte, "\x04", 1);
-			return true;
-		case XKB_KEY_e:
-		case XKB_KEY_E:
-			vte_write(vte, "\x05", 1);
-			return true;
-		case XKB_KEY_f:
-		case XKB_KEY_F:
-			vte_write(vte, "\x06", 1);
-			return true;
-		case XKB_KEY_g:
-		case XKB_KEY_G:
-			vte_write(vte, "\x07", 1);
-			return true;
-		case XKB_KEY_h:
-		case XKB_KEY_H:
-			vte_write(vte, "\x08", 1);
-			return true;
-		case XKB_KEY_i:
-		case XKB_KEY_I:
-			vte_write(vte, "\x09", 1);
-			return true;
-		case XKB_KEY_j:
-		case XKB_KEY_J:
-			vte_write(vte, "\x0a", 1);
-			return true;
-		case XKB_KEY_k:
-		case XKB_KEY_K:
-			vte_write(vte, "\x0b", 1);
-			return true;
-		case XKB_KEY_l:
-		case XKB_KEY_L:
-			vte_write(vte, "\x0c", 1);
-			return true;
-		case XKB_KEY_m:
-		case XKB_KEY_M:
-			vte_write(vte, "\x0d", 1);
-			return true;
-		case XKB_KEY_n:
-		case XKB_KEY_N:
-			vte_write(vte, "\x0e", 1);
-			return true;
-		case XKB_KEY_o:
-		case XKB_KEY_O:
-			vte_write(vte, "\x0f", 1);
-			return true;
-		case XKB_KEY_p:
-		case XKB_KEY_P:
-			vte_write(vte, "\x10", 1);
-			return true;
-		case XKB_KEY_q:
-		case XKB_KEY_Q:
-			vte_write(vte, "\x11", 1);
-			return true;
-		case XKB_KEY_r:
-		case XKB_KEY_R:
-			vte_write(vte, "\x12", 1);
-			return true;
-		case XKB_KEY_s:
-		case XKB_KEY_S:
-			vte_write(vte, "\x13", 1);
-			return true;
-		case XKB_KEY_t:
-		case XKB_KEY_T:
-			vte_write(vte, "\x14", 1);
-			return true;
-		case XKB_KEY_u:
-		case XKB_KEY_U:
-			vte_write(vte, "\x15", 1);
-			return true;
-		case XKB_KEY_v:
-		case XKB_KEY_V:
-			vte_write(vte, "\x16", 1);
-			return true;
-		case XKB_KEY_w:
-		case XKB_KEY_W:
-			vte_write(vte, "\x17", 1);
-			return true;
-		case XKB_KEY_x:
-		case XKB_KEY_X:
-			vte_write(vte, "\x18", 1);
-			return true;
-		case XKB_KEY_y:
-		case XKB_KEY_Y:
-			vte_write(vte, "\x19", 1);
-			return true;
-		case XKB_KEY_z:
-		case XKB_KEY_Z:
-			vte_write(vte, "\x1a", 1);
-			return true;
-		case XKB_KEY_3:
-		case XKB_KEY_bracketleft:
-		case XKB_KEY_braceleft:
-			vte_write(vte, "\x1b", 1);
-			return true;
-		case XKB_KEY_4:
-		case XKB_KEY_backslash:
-		case XKB_KEY_bar:
-			vte_write(vte, "\x1c", 1);
-			return true;
-		case XKB_KEY_5:
-		case XKB_KEY_bracketright:
-		case XKB_KEY_braceright:
-			vte_write(vte, "\x1d", 1);
-			return true;
-		case XKB_KEY_6:
-		case XKB_KEY_grave:
-		case XKB_KEY_asciitilde:
-			vte_write(vte, "\x1e", 1);
-			return true;
-		case XKB_KEY_7:
-		case XKB_KEY_slash:
-		case XKB_KEY_question:
-			vte_write(vte, "\x1f", 1);
-			return true;
-		case XKB_KEY_8:
-			vte_write(vte, "\x7f", 1);
-			return true;
-		}
-	}
-
-	switch (keysym) {
-		case XKB_KEY_BackSpace:
-			if (vte->backspace_sends_delete)
-				vte_write(vte, "\x7f", 1);
-			else
-				vte_write(vte, "\x08", 1);
-			return true;
-		case XKB_KEY_Tab:
-		case XKB_KEY_KP_Tab:
-			vte_write(vte, "\x09", 1);
-			return true;
-		case XKB_KEY_ISO_Left_Tab:
-			vte_write(vte, "\e[Z", 3);
-			return true;
-		case XKB_KEY_Linefeed:
-			vte_write(vte, "\x0a", 1);
-			return true;
-		case XKB_KEY_Clear:
-			vte_write(vte, "\x0b", 1);
-			return true;
-		/*
-		 TODO: What should we do with this key? Sending XOFF is awful as
-		       there is no simple way on modern keyboards to send XON
-		       again. If someone wants this, we can re-eanble it and set
-		       some flag.
-		case XKB_KEY_Pause:
-			vte_write(vte, "\x13", 1);
-			return true;
-		*/
-		/*
-		 TODO: What should we do on scroll-lock? Sending 0x14 is what
-		       the specs say but it is not used today the way most
-		       users would expect so we disable it. If someone wants
-		       this, we can re-enable it and set some flag.
-		case XKB_KEY_Scroll_Lock:
-			vte_write(vte, "\x14", 1);
-			return true;
-		*/
-		case XKB_KEY_Sys_Req:
-			vte_write(vte, "\x15", 1);
-			return true;
-		case XKB_KEY_Escape:
-			vte_write(vte, "\x1b", 1);
-			return true;
-		case XKB_KEY_KP_Enter:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE) {
-				vte_write(vte, "\eOM", 3);
-				return true;
-			}
-			/* fallthrough */
-		case XKB_KEY_Return:
-			if (vte->flags & TSM_VTE_FLAG_LINE_FEED_NEW_LINE_MODE)
-				vte_write(vte, "\x0d\x0a", 2);
-			else
-				vte_write(vte, "\x0d", 1);
-			return true;
-		case XKB_KEY_Find:
-			vte_write(vte, "\e[1~", 4);
-			return true;
-		case XKB_KEY_Insert:
-			vte_write(vte, "\e[2~", 4);
-			return true;
-		case XKB_KEY_Delete:
-			vte_write(vte, "\e[3~", 4);
-			return true;
-		case XKB_KEY_Select:
-			vte_write(vte, "\e[4~", 4);
-			return true;
-		case XKB_KEY_Page_Up:
-		case XKB_KEY_KP_Page_Up:
-			vte_write(vte, "\e[5~", 4);
-			return true;
-		case XKB_KEY_KP_Page_Down:
-		case XKB_KEY_Page_Down:
-			vte_write(vte, "\e[6~", 4);
-			return true;
-		case XKB_KEY_Up:
-		case XKB_KEY_KP_Up:
-			if (mods & TSM_CONTROL_MASK) {
-				vte_write(vte, "\e[1;5A", 6);
-			} else if (mods & TSM_SHIFT_MASK) {
-				vte_write(vte, "\e[1;2A", 6);
-			} else if (vte->flags & TSM_VTE_FLAG_CURSOR_KEY_MODE) {
-				vte_write(vte, "\eOA", 3);
-			} else {
-				vte_write(vte, "\e[A", 3);
-			}
-			return true;
-		case XKB_KEY_Down:
-		case XKB_KEY_KP_Down:
-			if (mods & TSM_CONTROL_MASK) {
-				vte_write(vte, "\e[1;5B", 6);
-			} else if (mods & TSM_SHIFT_MASK) {
-				vte_write(vte, "\e[1;2B", 6);
-			} else if (vte->flags & TSM_VTE_FLAG_CURSOR_KEY_MODE) {
-				vte_write(vte, "\eOB", 3);
-			} else {
-				vte_write(vte, "\e[B", 3);
-			}
-			return true;
-		case XKB_KEY_Right:
-		case XKB_KEY_KP_Right:
-			if (mods & TSM_CONTROL_MASK) {
-				vte_write(vte, "\e[1;5C", 6);
-			} else if (mods & TSM_SHIFT_MASK) {
-				vte_write(vte, "\e[1;2C", 6);
-			} else if (vte->flags & TSM_VTE_FLAG_CURSOR_KEY_MODE) {
-				vte_write(vte, "\eOC", 3);
-			} else {
-				vte_write(vte, "\e[C", 3);
-			}
-			return true;
-		case XKB_KEY_Left:
-		case XKB_KEY_KP_Left:
-			if (mods & TSM_CONTROL_MASK) {
-				vte_write(vte, "\e[1;5D", 6);
-			} else if (mods & TSM_SHIFT_MASK) {
-				vte_write(vte, "\e[1;2D", 6);
-			} else if (vte->flags & TSM_VTE_FLAG_CURSOR_KEY_MODE) {
-				vte_write(vte, "\eOD", 3);
-			} else {
-				vte_write(vte, "\e[D", 3);
-			}
-			return true;
-		case XKB_KEY_KP_Insert:
-		case XKB_KEY_KP_0:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOp", 3);
-			else
-				vte_write(vte, "0", 1);
-			return true;
-		case XKB_KEY_KP_1:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOq", 3);
-			else
-				vte_write(vte, "1", 1);
-			return true;
-		case XKB_KEY_KP_2:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOr", 3);
-			else
-				vte_write(vte, "2", 1);
-			return true;
-		case XKB_KEY_KP_3:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOs", 3);
-			else
-				vte_write(vte, "3", 1);
-			return true;
-		case XKB_KEY_KP_4:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOt", 3);
-			else
-				vte_write(vte, "4", 1);
-			return true;
-		case XKB_KEY_KP_5:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOu", 3);
-			else
-				vte_write(vte, "5", 1);
-			return true;
-		case XKB_KEY_KP_6:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOv", 3);
-			else
-				vte_write(vte, "6", 1);
-			return true;
-		case XKB_KEY_KP_7:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOw", 3);
-			else
-				vte_write(vte, "7", 1);
-			return true;
-		case XKB_KEY_KP_8:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOx", 3);
-			else
-				vte_write(vte, "8", 1);
-			return true;
-		case XKB_KEY_KP_9:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOy", 3);
-			else
-				vte_write(vte, "9", 1);
-			return true;
-		case XKB_KEY_KP_Subtract:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOm", 3);
-			else
-				vte_write(vte, "-", 1);
-			return true;
-		case XKB_KEY_KP_Separator:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOl", 3);
-			else
-				vte_write(vte, ",", 1);
-			return true;
-		case XKB_KEY_KP_Delete:
-		case XKB_KEY_KP_Decimal:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOn", 3);
-			else
-				vte_write(vte, ".", 1);
-			return true;
-		case XKB_KEY_KP_Equal:
-		case XKB_KEY_KP_Divide:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOj", 3);
-			else
-				vte_write(vte, "/", 1);
-			return true;
-		case XKB_KEY_KP_Multiply:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOo", 3);
-			else
-				vte_write(vte, "*", 1);
-			return true;
-		case XKB_KEY_KP_Add:
-			if (vte->flags & TSM_VTE_FLAG_KEYPAD_APPLICATION_MODE)
-				vte_write(vte, "\eOk", 3);
-			else
-				vte_write(vte, "+", 1);
-			return true;
-		case XKB_KEY_Home:
-		case XKB_KEY_KP_Home:
-			if (vte->flags & TSM_VTE_FLAG_CURSOR_KEY_MODE)
-				vte_write(vte, "\eOH", 3);
-			else
-				vte_write(vte, "\e[H", 3);
-			return true;
-		case XKB_KEY_End:
-		case XKB_KEY_KP_End:
-			if (vte->flags & TSM_VTE_FLAG_CURSOR_KEY_MODE)
-				vte_write(vte, "\eOF", 3);
-			else
-				vte_write(vte, "\e[F", 3);
-			return true;
-		case XKB_KEY_KP_Space:
-			vte_write(vte, " ", 1);
-			return true;
-		/* TODO: check what to transmit for functions keys when
-		 * shift/ctrl etc. are pressed. Every terminal behaves
-		 * differently here which is really weird.
-		 * We now map F4 to F14 if shift is pressed and so on for all
-		 * keys. However, such mappings should rather be done via
-		 * xkb-configurations and we should instead add a flags argument
-		 * to the CSIs as some of the keys here already do. */
-		case XKB_KEY_F1:
-		case XKB_KEY_KP_F1:
-			if (mods & TSM_SHIFT_MASK)
-				vte_write(vte, "\e[23~", 5);
-			else
-				vte_write(vte, "\eOP", 3);
-			return true;
-		case XKB_KEY_F2:
-		case XKB_KEY_KP_F2:
-			if (mods & TSM_SHIFT_MASK)
-				vte_write(vte, "\e[24~", 5);
-			else
-				vte_write(vte, "\eOQ", 3);
-			return true;
-		case XKB_KEY_F3:
-		case XKB_KEY_KP_F3:
-			if (mods & TSM_SHIFT_MASK)
-				vte_write(vte, "\e[25~", 5);
-			else
-				vte_write(vte, "\eOR", 3);
-			return true;
-		case XKB_KEY_F4:
-		case XKB_KEY_KP_F4:
-			if (mods & TSM_SHIFT_MASK)
-				//vte_write(vte, "\e[1;2S", 6);
-				vte_write(vte, "\e[26~", 5);
-			else
-				vte_write(vte, "\eOS", 3);
-			return true;
-		case XKB_KEY_F5:
-			if (mods & TSM_SHIFT_MASK)
-				//vte_write(vte, "\e[15;2~", 7);
-				vte_write(vte, "\e[28~", 5);
-			else
-				vte_write(vte, "\e[15~", 5);
-			return true;
-		case XKB_KEY_F6:
-			if (mods & TSM_SHIFT_MASK)
-				//vte_write(vte, "\e[17;2~", 7);
-				vte_write(vte, "\e[29~", 5);
-			else
-				vte_write(vte, "\e[17~", 5);
-			return true;
-		case XKB_KEY_F7:
-			if (mods & TSM_SHIFT_MASK)
-				//vte_write(vte, "\e[18;2~", 7);
-				vte_write(vte, "\e[31~", 5);
-			else
-				vte_write(vte, "\e[18~", 5);
-			return true;
-		case XKB_KEY_F8:
-			if (mods & TSM_SHIFT_MASK)
-				//vte_write(vte, "\e[19;2~", 7);
-				vte_write(vte, "\e[32~", 5);
-			else
-				vte_write(vte, "\e[19~", 5);
-			return true;
-		case XKB_KEY_F9:
-			if (mods & TSM_SHIFT_MASK)
-				//vte_write(vte, "\e[20;2~", 7);
-				vte_write(vte, "\e[33~", 5);
-			else
-				vte_write(vte, "\e[20~", 5);
-			return true;
-		case XKB_KEY_F10:
-			if (mods & TSM_SHIFT_MASK)
-				//vte_write(vte, "\e[21;2~", 7);
-				vte_write(vte, "\e[34~", 5);
-			else
-				vte_write(vte, "\e[21~", 5);
-			return true;
-		case XKB_KEY_F11:
-			if (mods & TSM_SHIFT_MASK)
-				vte_write(vte, "\e[23;2~", 7);
-			else
-				vte_write(vte, "\e[23~", 5);
-			return true;
-		case XKB_KEY_F12:
-			if (mods & TSM_SHIFT_MASK)
-				vte_write(vte, "\e[24;2~", 7);
-			else
-				vte_write(vte, "\e[24~", 5);
-			return true;
-		case XKB_KEY_F13:
-			if (mods & TSM_SHIFT_MASK)
-				vte_write(vte, "\e[25;2~", 7);
-			else
-				vte_write(vte, "\e[25~", 5);
-			return true;
-		case XKB_KEY_F14:
-			if (mods & TSM_SHIFT_MASK)
-				vte_write(vte, "\e[26;2~", 7);
-			else
-				vte_write(vte, "\e[26~", 5);
-			return true;
-		case XKB_KEY_F15:
-			if (mods & TSM_SHIFT_MASK)
-				vte_write(vte, "\e[28;2~", 7);
-			else
-				vte_write(vte, "\e[28~", 5);
-			return true;
-		case XKB_KEY_F16:
-			if (mods & TSM_SHIFT_MASK)
-				vte_write(vte, "\e[29;2~", 7);
-			else
-				vte_write(vte, "\e[29~", 5);
-			return true;
-		case XKB_KEY_F17:
-			if (mods & TSM_SHIFT_MASK)
-				vte_write(vte, "\e[31;2~", 7);
-			else
-				vte_write(vte, "\e[31~", 5);
-			return true;
-		case XKB_KEY_F18:
-			if (mods & TSM_SHIFT_MASK)
-				vte_write(vte, "\e[32;2~", 7);
-			else
-				vte_write(vte, "\e[32~", 5);
-			return true;
-		case XKB_KEY_F19:
-			if (mods & TSM_SHIFT_MASK)
-				vte_write(vte, "\e[33;2~", 7);
-			else
-				vte_write(vte, "\e[33~", 5);
-			return true;
-		case XKB_KEY_F20:
-			if (mods & TSM_SHIFT_MASK)
-				vte_write(vte, "\e[34;2~", 7);
-			else
-				vte_write(vte, "\e[34~", 5);
-			return true;
+	key = vte_lookup_key(vte, keysym, sym, mods);
+	if (key) {
+		vte_write(vte, key->seq, key->len);
+		return true;
 	}
 
 	if (unicode != TSM_VTE_INVALID) {
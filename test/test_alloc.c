@@ -0,0 +1,237 @@
+/*
+ * TSM - Allocator Tests
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "test_common.h"
+#include "libtsm.h"
+
+#define WIDTH 80
+#define HEIGHT 24
+
+/* counts allocations and the blocks still allocated */
+struct counter {
+	unsigned long allocs;
+	long live;
+};
+
+static void *count_alloc(void *data, size_t size)
+{
+	struct counter *c = data;
+	void *p;
+
+	p = malloc(size);
+	if (p) {
+		++c->allocs;
+		++c->live;
+	}
+	return p;
+}
+
+static void *count_realloc(void *data, void *ptr, size_t size)
+{
+	struct counter *c = data;
+	void *p;
+
+	p = realloc(ptr, size);
+	if (p) {
+		++c->allocs;
+		if (!ptr)
+			++c->live;
+	}
+	return p;
+}
+
+static void count_free(void *data, void *ptr)
+{
+	struct counter *c = data;
+
+	ck_assert_ptr_ne(ptr, NULL);
+	--c->live;
+	free(ptr);
+}
+
+static struct counter counter;
+
+static const struct tsm_allocator count_allocator = {
+	.alloc_fn = count_alloc,
+	.realloc_fn = count_realloc,
+	.free_fn = count_free,
+	.data = &counter,
+};
+
+struct term {
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+};
+
+static void write_cb(struct tsm_vte *vte, const char *u8, size_t len,
+		     void *data)
+{
+	UNUSED(vte);
+	UNUSED(u8);
+	UNUSED(len);
+	UNUSED(data);
+}
+
+static void term_new(struct term *t, unsigned int sb)
+{
+	int r;
+
+	memset(&counter, 0, sizeof(counter));
+	r = tsm_set_allocator(&count_allocator);
+	ck_assert_int_eq(r, 0);
+
+	r = tsm_screen_new(&t->screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(t->screen, WIDTH, HEIGHT);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_max_sb(t->screen, sb);
+	r = tsm_vte_new(&t->vte, t->screen, write_cb, NULL, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+}
+
+static void term_free(struct term *t)
+{
+	tsm_vte_unref(t->vte);
+	tsm_screen_unref(t->screen);
+
+	/* everything went through the allocator and came back */
+	ck_assert_int_eq(counter.live, 0);
+	tsm_set_allocator(NULL);
+}
+
+static void term_input(struct term *t, const char *str)
+{
+	tsm_vte_input(t->vte, str, strlen(str));
+}
+
+/* prints @num full lines of ASCII */
+static void term_lines(struct term *t, unsigned int num)
+{
+	char line[WIDTH + 3];
+	unsigned int i;
+
+	for (i = 0; i < num; ++i) {
+		snprintf(line, sizeof(line), "%-*u\r\n", WIDTH, i);
+		term_input(t, line);
+	}
+}
+
+START_TEST(test_alloc_invalid)
+{
+	struct tsm_allocator alloc = count_allocator;
+	int r;
+
+	alloc.free_fn = NULL;
+	r = tsm_set_allocator(&alloc);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_set_allocator(NULL);
+	ck_assert_int_eq(r, 0);
+}
+END_TEST
+
+START_TEST(test_alloc_balance)
+{
+	struct term t;
+	char *buf;
+	size_t len;
+	int r;
+
+	term_new(&t, 100);
+	ck_assert_uint_gt(counter.allocs, 0);
+
+	/* combined symbols, wide characters, resizes and the alt screen */
+	term_input(&t, "\e[1;31ma\xcc\x81\xe4\xb8\xad\e[0m\r\n");
+	term_lines(&t, 200);
+	r = tsm_screen_resize(t.screen, WIDTH / 2, HEIGHT / 2);
+	ck_assert_int_eq(r, 0);
+	term_input(&t, "\e[?1049hfull\e[?1049l");
+	r = tsm_screen_resize(t.screen, WIDTH, HEIGHT);
+	ck_assert_int_eq(r, 0);
+
+	/* returned buffers are released to the allocator, too */
+	tsm_screen_selection_start(t.screen, 0, 0);
+	tsm_screen_selection_target(t.screen, 10, 2);
+	r = tsm_screen_selection_copy(t.screen, &buf);
+	ck_assert_int_gt(r, 0);
+	count_free(&counter, buf);
+
+	r = tsm_screen_save(t.screen, &buf, &len);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_load(t.screen, buf, len);
+	ck_assert_int_eq(r, 0);
+	count_free(&counter, buf);
+
+	term_free(&t);
+}
+END_TEST
+
+START_TEST(test_alloc_scroll)
+{
+	struct term t;
+
+	/* scrolling into a full scrollback-buffer */
+	term_new(&t, 100);
+	term_lines(&t, HEIGHT + 100 + 1);
+	counter.allocs = 0;
+	term_lines(&t, 10 * HEIGHT);
+	ck_assert_uint_eq(counter.allocs, 0);
+	term_free(&t);
+
+	/* scrolling without a scrollback-buffer */
+	term_new(&t, 0);
+	term_lines(&t, HEIGHT + 1);
+	counter.allocs = 0;
+	term_lines(&t, 10 * HEIGHT);
+	ck_assert_uint_eq(counter.allocs, 0);
+	term_free(&t);
+
+	/* scrolling a region and the alternate screen */
+	term_new(&t, 100);
+	term_input(&t, "\e[?1049h");
+	term_lines(&t, HEIGHT + 1);
+	term_input(&t, "\e[?1049l\e[5;20r\e[20H");
+	term_lines(&t, 100 + 1);
+	counter.allocs = 0;
+	term_input(&t, "\e[?1049h");
+	term_lines(&t, 10 * HEIGHT);
+	term_input(&t, "\e[?1049l");
+	term_lines(&t, 10 * HEIGHT);
+	ck_assert_uint_eq(counter.allocs, 0);
+	term_free(&t);
+}
+END_TEST
+
+TEST_DEFINE_CASE(misc)
+	TEST(test_alloc_invalid)
+	TEST(test_alloc_balance)
+	TEST(test_alloc_scroll)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(alloc,
+		TEST_CASE(misc),
+		TEST_END
+	)
+)
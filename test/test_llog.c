@@ -0,0 +1,152 @@
+/*
+ * TSM - Log Filter Tests
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "test_common.h"
+#include "shl-llog.h"
+
+struct logger {
+	llog_submit_t llog;
+	void *llog_data;
+	unsigned int num;
+	char last[128];
+};
+
+static void log_cb(void *data, const char *file, int line, const char *func,
+		   const char *subs, unsigned int sev, const char *format,
+		   va_list args)
+{
+	struct logger *l = data;
+
+	UNUSED(file);
+	UNUSED(line);
+	UNUSED(func);
+	UNUSED(subs);
+	UNUSED(sev);
+
+	++l->num;
+	vsnprintf(l->last, sizeof(l->last), format, args);
+}
+
+static void logger_init(struct logger *l)
+{
+	memset(l, 0, sizeof(*l));
+	l->llog = log_cb;
+	l->llog_data = l;
+	llog_level = LLOG_DEBUG;
+}
+
+static unsigned int evaluated;
+
+static int arg(void)
+{
+	return ++evaluated;
+}
+
+START_TEST(test_llog_level)
+{
+	struct logger l;
+
+	logger_init(&l);
+	evaluated = 0;
+
+	llog_warning(&l, "warning %d", arg());
+	ck_assert_uint_eq(l.num, 1);
+	ck_assert_uint_eq(evaluated, 1);
+
+	/* dropped at runtime without evaluating the arguments */
+	llog_level = LLOG_ERROR;
+	llog_warning(&l, "warning %d", arg());
+	ck_assert_uint_eq(l.num, 1);
+	ck_assert_uint_eq(evaluated, 1);
+	llog_error(&l, "error %d", arg());
+	ck_assert_uint_eq(l.num, 2);
+	ck_assert_uint_eq(evaluated, 2);
+
+	/* no log-function, nothing to evaluate */
+	llog_level = LLOG_DEBUG;
+	l.llog = NULL;
+	llog_error(&l, "error %d", arg());
+	ck_assert_uint_eq(evaluated, 2);
+
+	/* compiled out */
+	l.llog = log_cb;
+	if (LLOG_MAX_SEVERITY < LLOG_DEBUG) {
+		llog_debug(&l, "debug %d", arg());
+		ck_assert_uint_eq(l.num, 2);
+		ck_assert_uint_eq(evaluated, 2);
+	}
+}
+END_TEST
+
+START_TEST(test_llog_ratelimit)
+{
+	struct logger l;
+	struct llog_ratelimit rl;
+	unsigned int i, missed;
+
+	logger_init(&l);
+
+	/* a single call site is cut off after the burst */
+	for (i = 0; i < 3 * LLOG_RATELIMIT_BURST; ++i)
+		llog_warning(&l, "message %u", i);
+	ck_assert_uint_eq(l.num, LLOG_RATELIMIT_BURST);
+	ck_assert_str_eq(l.last, "message 9");
+
+	/* others are not affected */
+	llog_warning(&l, "other");
+	ck_assert_uint_eq(l.num, LLOG_RATELIMIT_BURST + 1);
+
+	/* errors are never dropped */
+	l.num = 0;
+	for (i = 0; i < 3 * LLOG_RATELIMIT_BURST; ++i)
+		llog_error(&l, "error %u", i);
+	ck_assert_uint_eq(l.num, 3 * LLOG_RATELIMIT_BURST);
+
+	/* a new interval reports what was dropped */
+	memset(&rl, 0, sizeof(rl));
+	for (i = 0; i < LLOG_RATELIMIT_BURST; ++i) {
+		ck_assert(llog_ratelimit(&rl, &missed));
+		ck_assert_uint_eq(missed, 0);
+	}
+	ck_assert(!llog_ratelimit(&rl, &missed));
+	ck_assert(!llog_ratelimit(&rl, &missed));
+	rl.begin -= LLOG_RATELIMIT_INTERVAL;
+	ck_assert(llog_ratelimit(&rl, &missed));
+	ck_assert_uint_eq(missed, 2);
+	ck_assert(llog_ratelimit(&rl, &missed));
+	ck_assert_uint_eq(missed, 0);
+}
+END_TEST
+
+TEST_DEFINE_CASE(misc)
+	TEST(test_llog_level)
+	TEST(test_llog_ratelimit)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(llog,
+		TEST_CASE(misc),
+		TEST_END
+	)
+)
@@ -0,0 +1,301 @@
+/*
+ * TSM - Scrollback Logger Tests
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_common.h"
+#include "libtsm.h"
+
+#ifdef BUILD_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* length of "YYYY-MM-DDTHH:MM:SS.uuuuuuZ " */
+#define STAMP_LEN 28
+
+static void write_line(struct tsm_screen *screen, const char *str,
+		       const struct tsm_screen_attr *attr)
+{
+	int i;
+
+	for (i = 0; str[i]; i++)
+		tsm_screen_write(screen, str[i], attr);
+	tsm_screen_newline(screen);
+	tsm_screen_move_line_home(screen);
+}
+
+static struct tsm_screen *create_screen(struct tsm_screen_attr *attr)
+{
+	struct tsm_screen *screen;
+	int r;
+
+	memset(attr, 0, sizeof(*attr));
+	attr->fccode = TSM_COLOR_FOREGROUND;
+	attr->bccode = TSM_COLOR_BACKGROUND;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 20, 2);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_def_attr(screen, attr);
+	tsm_screen_erase_screen(screen, false);
+
+	return screen;
+}
+
+/* reads the whole file into a zero-terminated buffer */
+static char *read_file(FILE *f, size_t *len)
+{
+	char *buf;
+	long size;
+
+	ck_assert_int_eq(fseek(f, 0, SEEK_END), 0);
+	size = ftell(f);
+	ck_assert_int_ge(size, 0);
+	rewind(f);
+
+	buf = malloc(size + 1);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_uint_eq(fread(buf, 1, size, f), size);
+	buf[size] = 0;
+	*len = size;
+	return buf;
+}
+
+static void assert_record(const char *rec, const char *text)
+{
+	ck_assert_int_eq(rec[4], '-');
+	ck_assert_int_eq(rec[10], 'T');
+	ck_assert_int_eq(rec[19], '.');
+	ck_assert_int_eq(rec[26], 'Z');
+	ck_assert_int_eq(rec[27], ' ');
+	ck_assert_int_eq(strncmp(rec + STAMP_LEN, text, strlen(text)), 0);
+	ck_assert_int_eq(rec[STAMP_LEN + strlen(text)], '\n');
+}
+
+START_TEST(test_log_invalid)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_log *log, *log2;
+	struct tsm_screen_attr attr;
+	FILE *f;
+	int r;
+
+	screen = create_screen(&attr);
+	f = tmpfile();
+	ck_assert_ptr_ne(f, NULL);
+
+	r = tsm_screen_log_new(NULL, screen, fileno(f), 0, 0);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_screen_log_new(&log, NULL, fileno(f), 0, 0);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_screen_log_new(&log, screen, -1, 0, 0);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_screen_log_new(&log, screen, fileno(f), 0, SIZE_MAX);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_screen_log_new(&log, screen, fileno(f), 0, SIZE_MAX / 2 + 2);
+	ck_assert_int_eq(r, -EINVAL);
+
+	r = tsm_screen_log_new(&log, screen, fileno(f), 0, 0);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_log_new(&log2, screen, fileno(f), 0, 0);
+	ck_assert_int_eq(r, -EALREADY);
+
+	/* the logger keeps the screen alive */
+	tsm_screen_unref(screen);
+	write_line(screen, "x", &attr);
+	write_line(screen, "y", &attr);
+	tsm_screen_log_free(log);
+
+	tsm_screen_log_free(NULL);
+	ck_assert_uint_eq(tsm_screen_log_get_dropped(NULL), 0);
+	fclose(f);
+}
+END_TEST
+
+START_TEST(test_log_plain)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_log *log;
+	struct tsm_screen_attr attr;
+	char *buf, *rec, line[32];
+	uint64_t dropped;
+	size_t len;
+	FILE *f;
+	int r, i, n;
+
+	screen = create_screen(&attr);
+	tsm_screen_set_max_sb(screen, 10);
+	f = tmpfile();
+	ck_assert_ptr_ne(f, NULL);
+
+	/* smallest ring, so records wrap around and may get dropped */
+	r = tsm_screen_log_new(&log, screen, fileno(f), 0, 1);
+	ck_assert_int_eq(r, 0);
+
+	write_line(screen, "first line", &attr);
+	write_line(screen, "", &attr);
+	write_line(screen, "  indented", &attr);
+	for (i = 0; i < 5000; ++i) {
+		sprintf(line, "line %d", i);
+		write_line(screen, line, &attr);
+	}
+
+	/* lines are logged even without scrollback-buffer */
+	tsm_screen_set_max_sb(screen, 0);
+	write_line(screen, "last", &attr);
+	write_line(screen, "", &attr);
+
+	dropped = tsm_screen_log_get_dropped(log);
+	tsm_screen_log_free(log);
+	tsm_screen_unref(screen);
+
+	buf = read_file(f, &len);
+	fclose(f);
+
+	rec = buf;
+	assert_record(rec, "first line");
+	rec += STAMP_LEN + 11;
+	assert_record(rec, "");
+	rec += STAMP_LEN + 1;
+	assert_record(rec, "  indented");
+
+	n = 0;
+	for (rec = buf; *rec; rec = strchr(rec, '\n') + 1) {
+		ck_assert_uint_ge(strlen(rec), STAMP_LEN + 1);
+		++n;
+	}
+	ck_assert_int_eq(n + dropped, 5004);
+	if (!dropped)
+		ck_assert_int_eq(strcmp(&buf[len - 5], "last\n"), 0);
+
+	free(buf);
+}
+END_TEST
+
+START_TEST(test_log_sgr)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_log *log;
+	struct tsm_screen_attr attr, red;
+	char *buf;
+	size_t len;
+	FILE *f;
+	int r;
+
+	screen = create_screen(&attr);
+	f = tmpfile();
+	ck_assert_ptr_ne(f, NULL);
+
+	r = tsm_screen_log_new(&log, screen, fileno(f), TSM_SCREEN_LOG_SGR, 0);
+	ck_assert_int_eq(r, 0);
+
+	red = attr;
+	red.fccode = TSM_COLOR_RED;
+	red.bold = 1;
+	tsm_screen_write(screen, 'a', &red);
+	tsm_screen_write(screen, 'b', &red);
+	write_line(screen, "c", &attr);
+
+	red.fccode = -1;
+	red.fr = 1;
+	red.fg = 2;
+	red.fb = 3;
+	red.bold = 0;
+	red.inverse = 1;
+	write_line(screen, "d", &red);
+	tsm_screen_newline(screen);
+
+	tsm_screen_log_free(log);
+	tsm_screen_unref(screen);
+
+	buf = read_file(f, &len);
+	fclose(f);
+
+	assert_record(buf, "\e[0;1;31mab\e[0mc");
+	assert_record(strchr(buf, '\n') + 1, "\e[0;7;38;2;1;2;3md\e[0m");
+
+	free(buf);
+}
+END_TEST
+
+START_TEST(test_log_gzip)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_log *log;
+	struct tsm_screen_attr attr;
+	FILE *f;
+	int r;
+
+	screen = create_screen(&attr);
+	f = tmpfile();
+	ck_assert_ptr_ne(f, NULL);
+
+	r = tsm_screen_log_new(&log, screen, fileno(f), TSM_SCREEN_LOG_GZIP,
+			       0);
+#ifdef BUILD_HAVE_ZLIB
+	char buf[256];
+	gzFile gz;
+	int i;
+
+	ck_assert_int_eq(r, 0);
+
+	for (i = 0; i < 20000; ++i)
+		write_line(screen, "compressible", &attr);
+
+	tsm_screen_log_free(log);
+	ck_assert_int_lt(lseek(fileno(f), 0, SEEK_END),
+			 20000 * (STAMP_LEN + 13) / 4);
+
+	/* blocks are separate gzip members, gzread() reads through all */
+	lseek(fileno(f), 0, SEEK_SET);
+	gz = gzdopen(dup(fileno(f)), "r");
+	ck_assert_ptr_ne(gz, NULL);
+	for (i = 0; gzgets(gz, buf, sizeof(buf)); ++i)
+		assert_record(buf, "compressible");
+	ck_assert_int_eq(i, 19999);
+	gzclose(gz);
+#else
+	ck_assert_int_eq(r, -EOPNOTSUPP);
+	UNUSED(log);
+#endif
+
+	tsm_screen_unref(screen);
+	fclose(f);
+}
+END_TEST
+
+TEST_DEFINE_CASE(misc)
+	TEST(test_log_invalid)
+	TEST(test_log_plain)
+	TEST(test_log_sgr)
+	TEST(test_log_gzip)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(log,
+		TEST_CASE(misc),
+		TEST_END
+	)
+)
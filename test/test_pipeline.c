@@ -0,0 +1,303 @@
+/*
+ * TSM - Pipeline Tests
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "test_common.h"
+#include "libtsm.h"
+
+#define WIDTH 20
+#define HEIGHT 4
+
+struct term {
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	struct tsm_pipeline *pl;
+	pthread_t app;			/* thread of the write-callback */
+
+	char out[256];			/* data of the write-callback */
+	size_t out_len;
+	char text[HEIGHT][WIDTH + 1];	/* content of the last frame */
+};
+
+static void write_cb(struct tsm_vte *vte, const char *u8, size_t len,
+		     void *data)
+{
+	struct term *t = data;
+
+	UNUSED(vte);
+
+	ck_assert(pthread_equal(pthread_self(), t->app));
+	ck_assert_uint_le(t->out_len + len, sizeof(t->out));
+	memcpy(t->out + t->out_len, u8, len);
+	t->out_len += len;
+}
+
+static int text_cb(struct tsm_screen *con, uint64_t id, const uint32_t *ch,
+		   size_t len, unsigned int width, unsigned int posx,
+		   unsigned int posy, const struct tsm_screen_attr *attr,
+		   tsm_age_t age, void *data)
+{
+	struct term *t = data;
+
+	UNUSED(con);
+	UNUSED(id);
+	UNUSED(width);
+	UNUSED(attr);
+	UNUSED(age);
+
+	t->text[posy][posx] = len ? ch[0] : ' ';
+	return 0;
+}
+
+static void term_new(struct term *t)
+{
+	int r;
+
+	memset(t, 0, sizeof(*t));
+	t->app = pthread_self();
+
+	r = tsm_screen_new(&t->screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(t->screen, WIDTH, HEIGHT);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&t->vte, t->screen, write_cb, t, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_pipeline_new(&t->pl, t->vte);
+	ck_assert_int_eq(r, 0);
+}
+
+static void term_free(struct term *t)
+{
+	tsm_pipeline_free(t->pl);
+	tsm_vte_unref(t->vte);
+	tsm_screen_unref(t->screen);
+}
+
+static void term_input(struct term *t, const char *str)
+{
+	int r;
+
+	r = tsm_pipeline_input(t->pl, str, strlen(str));
+	ck_assert_int_eq(r, 0);
+}
+
+/* milliseconds on the monotonic clock */
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Dispatches events until the first row of a frame starts with @text. The
+ * timeout is generous so slow or sanitized builds do not fail spuriously.
+ */
+static void term_wait(struct term *t, const char *text)
+{
+	struct tsm_screen_snapshot *frame;
+	struct pollfd pfd;
+	long long end;
+	int r;
+
+	pfd.fd = tsm_pipeline_get_fd(t->pl);
+	pfd.events = POLLIN;
+
+	for (end = now_ms() + 60000; now_ms() < end; ) {
+		r = poll(&pfd, 1, 10);
+		ck_assert_int_ge(r, 0);
+		tsm_pipeline_dispatch(t->pl);
+
+		frame = tsm_pipeline_get_frame(t->pl);
+		if (!frame)
+			continue;
+
+		tsm_screen_snapshot_draw(frame, text_cb, t);
+		tsm_screen_snapshot_free(frame);
+		if (!strncmp(t->text[0], text, strlen(text)))
+			return;
+	}
+
+	ck_abort_msg("no frame with \"%s\"", text);
+}
+
+START_TEST(test_pipeline_invalid)
+{
+	struct tsm_pipeline *pl;
+	int r;
+
+	r = tsm_pipeline_new(&pl, NULL);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_pipeline_input(NULL, "a", 1);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_pipeline_call(NULL, NULL, NULL);
+	ck_assert_int_eq(r, -EINVAL);
+	ck_assert_int_eq(tsm_pipeline_get_fd(NULL), -EINVAL);
+	ck_assert_ptr_eq(tsm_pipeline_get_frame(NULL), NULL);
+	tsm_pipeline_dispatch(NULL);
+	tsm_pipeline_free(NULL);
+}
+END_TEST
+
+START_TEST(test_pipeline_frames)
+{
+	struct term t;
+
+	term_new(&t);
+
+	term_input(&t, "hel");
+	term_input(&t, "lo\e[5n\e[1;2H\e[6n");
+	term_wait(&t, "hello");
+	ck_assert_int_eq(tsm_pipeline_get_pending(t.pl), 0);
+
+	/* responses arrive in order, on the application thread */
+	tsm_pipeline_dispatch(t.pl);
+	ck_assert_uint_eq(t.out_len, 10);
+	ck_assert_int_eq(memcmp(t.out, "\e[0n\e[1;2R", 10), 0);
+
+	term_input(&t, "\rworld");
+	term_wait(&t, "world");
+
+	term_free(&t);
+}
+END_TEST
+
+static void key_call(struct tsm_screen *con, struct tsm_vte *vte, void *data)
+{
+	struct term *t = data;
+
+	UNUSED(con);
+
+	/* heavy output does not delay calls */
+	ck_assert_uint_gt(tsm_pipeline_get_pending(t->pl), 0);
+	tsm_vte_handle_keyboard(vte, 0, 'k', 0, 'k');
+}
+
+static void resize_call(struct tsm_screen *con, struct tsm_vte *vte,
+			void *data)
+{
+	UNUSED(vte);
+	UNUSED(data);
+
+	tsm_screen_resize(con, WIDTH, HEIGHT - 1);
+}
+
+START_TEST(test_pipeline_calls)
+{
+	struct term t;
+	char *buf;
+	size_t len = 4 << 20;
+	int r;
+
+	term_new(&t);
+
+	buf = malloc(len);
+	ck_assert_ptr_ne(buf, NULL);
+	memset(buf, 'x', len);
+	r = tsm_pipeline_input(t.pl, buf, len);
+	ck_assert_int_eq(r, 0);
+	free(buf);
+
+	r = tsm_pipeline_call(t.pl, key_call, &t);
+	ck_assert_int_eq(r, 0);
+	r = tsm_pipeline_call(t.pl, resize_call, &t);
+	ck_assert_int_eq(r, 0);
+
+	term_input(&t, "\e[Hdone");
+	term_wait(&t, "done");
+	tsm_pipeline_dispatch(t.pl);
+	ck_assert_uint_eq(t.out_len, 1);
+	ck_assert_int_eq(t.out[0], 'k');
+
+	/* input queued before free is still parsed */
+	term_input(&t, "\e[Hlast\e[5n");
+	tsm_pipeline_free(t.pl);
+	ck_assert_uint_eq(tsm_screen_get_height(t.screen), HEIGHT - 1);
+	tsm_screen_draw(t.screen, text_cb, &t);
+	ck_assert_int_eq(strncmp(t.text[0], "last", 4), 0);
+	ck_assert_uint_eq(t.out_len, 5);
+
+	/* the VTE has its own write-callback again */
+	tsm_vte_input(t.vte, "\e[5n", 4);
+	ck_assert_uint_eq(t.out_len, 9);
+
+	tsm_vte_unref(t.vte);
+	tsm_screen_unref(t.screen);
+}
+END_TEST
+
+static void sync_call(struct tsm_screen *con, struct tsm_vte *vte, void *data)
+{
+	UNUSED(con);
+	UNUSED(data);
+
+	tsm_vte_set_sync_timeout(vte, 50);
+}
+
+START_TEST(test_pipeline_sync)
+{
+	struct term t;
+	struct timespec start, end;
+	long ms;
+	int r;
+
+	term_new(&t);
+
+	r = tsm_pipeline_call(t.pl, sync_call, NULL);
+	ck_assert_int_eq(r, 0);
+
+	term_input(&t, "\e[?2026h\e[Hbeg");
+	term_input(&t, "in\e[?2026l");
+	term_wait(&t, "begin");
+
+	/* an unfinished update is shown after the timeout */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	term_input(&t, "\e[?2026h\e[Hheld");
+	term_wait(&t, "held");
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ms = (end.tv_sec - start.tv_sec) * 1000 +
+	     (end.tv_nsec - start.tv_nsec) / 1000000;
+	ck_assert_int_ge(ms, 49);
+
+	term_free(&t);
+}
+END_TEST
+
+TEST_DEFINE_CASE(misc)
+	TEST(test_pipeline_invalid)
+	TEST(test_pipeline_frames)
+	TEST(test_pipeline_calls)
+	TEST(test_pipeline_sync)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(pipeline,
+		TEST_CASE(misc),
+		TEST_END
+	)
+)
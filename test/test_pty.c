@@ -0,0 +1,584 @@
+/*
+ * TSM - PTY Bridge Tests
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Every test runs once with the epoll bridge and once with the io_uring
+ * bridge. The io_uring run is skipped if the kernel does not support it.
+ * Children switch their pty to raw mode so output arrives unmodified.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "test_common.h"
+#include "shl-pty.h"
+
+#define COUNT_LINES 20000
+
+static const unsigned int bridge_modes[] = { SHL_PTY_BRIDGE_EPOLL, 0 };
+
+#define for_each_bridge(_b, _i) \
+	for ((_i) = 0; (_i) < 2; ++(_i)) \
+		if (bridge_new(&(_b), bridge_modes[(_i)]))
+
+struct rec {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+struct flow {
+	size_t got;
+	size_t pending;
+	size_t max;
+};
+
+static bool bridge_new(struct shl_pty_bridge **out, unsigned int flags)
+{
+	int r;
+
+	r = shl_pty_bridge_new(out, flags);
+	ck_assert_int_eq(r, 0);
+	ck_assert(!(flags & SHL_PTY_BRIDGE_EPOLL) ||
+		  !shl_pty_bridge_is_uring(*out));
+
+	if (!flags && !shl_pty_bridge_is_uring(*out)) {
+		fprintf(stderr, "io_uring not supported, skipping\n");
+		shl_pty_bridge_free(*out);
+		return false;
+	}
+
+	return true;
+}
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void rec_input(struct shl_pty *pty, void *data, char *u8, size_t len)
+{
+	struct rec *rec = data;
+
+	UNUSED(pty);
+
+	if (rec->len + len > rec->size) {
+		rec->size = (rec->len + len) * 2;
+		rec->buf = realloc(rec->buf, rec->size);
+		ck_assert_ptr_ne(rec->buf, NULL);
+	}
+
+	memcpy(rec->buf + rec->len, u8, len);
+	rec->len += len;
+}
+
+/* counts input and reports all of it as pending work */
+static void flow_input(struct shl_pty *pty, void *data, char *u8, size_t len)
+{
+	struct flow *flow = data;
+
+	UNUSED(u8);
+
+	flow->got += len;
+	flow->pending += len;
+	if (len > flow->max)
+		flow->max = len;
+	shl_pty_set_in_pending(pty, flow->pending);
+}
+
+static void child_raw(void)
+{
+	struct termios attr;
+
+	if (!tcgetattr(0, &attr)) {
+		cfmakeraw(&attr);
+		tcsetattr(0, TCSANOW, &attr);
+	}
+}
+
+/* prints the numbers 0 to COUNT_LINES - 1, one per line, then waits */
+static void child_count(void)
+{
+	unsigned int i;
+
+	child_raw();
+	for (i = 0; i < COUNT_LINES; ++i)
+		dprintf(1, "%u\n", i);
+	for (;;)
+		pause();
+}
+
+/* writes as fast as possible */
+static void child_flood(void)
+{
+	char buf[4096];
+
+	child_raw();
+	memset(buf, 'x', sizeof(buf));
+	for (;;)
+		if (write(1, buf, sizeof(buf)) < 0)
+			_exit(1);
+}
+
+static volatile sig_atomic_t burst_stop;
+
+static void burst_handler(int sig)
+{
+	UNUSED(sig);
+
+	burst_stop = 1;
+}
+
+/* writes as fast as possible until SIGUSR1, then a byte per millisecond */
+static void child_burst(void)
+{
+	struct timespec ts = { 0, 1000000 };
+	char buf[4096];
+
+	child_raw();
+	signal(SIGUSR1, burst_handler);
+	memset(buf, 'x', sizeof(buf));
+	while (!burst_stop)
+		if (write(1, buf, sizeof(buf)) < 0 && errno != EINTR)
+			_exit(1);
+	for (;;) {
+		if (write(1, buf, 1) < 0)
+			_exit(1);
+		nanosleep(&ts, NULL);
+	}
+}
+
+/* stops itself, then reads everything once continued */
+static void child_sink(void)
+{
+	char buf[4096];
+
+	child_raw();
+	raise(SIGSTOP);
+	for (;;)
+		if (read(0, buf, sizeof(buf)) <= 0)
+			_exit(1);
+}
+
+static struct shl_pty *pty_new(void (*child) (void), shl_pty_input_fn fn,
+			       void *data)
+{
+	struct shl_pty *pty;
+	pid_t pid;
+	int st;
+
+	pid = shl_pty_open(&pty, fn, data, 80, 24);
+	if (!pid) {
+		child();
+		_exit(1);
+	}
+	ck_assert_int_gt(pid, 0);
+
+	if (child == child_sink) {
+		waitpid(pid, &st, WUNTRACED);
+		ck_assert(WIFSTOPPED(st));
+	}
+
+	return pty;
+}
+
+static void pty_free(struct shl_pty *pty)
+{
+	pid_t pid = shl_pty_get_child(pty);
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	shl_pty_close(pty);
+	shl_pty_unref(pty);
+}
+
+static void assert_count(const struct rec *rec)
+{
+	char expect[16];
+	unsigned int i;
+	size_t pos = 0;
+	int len;
+
+	for (i = 0; i < COUNT_LINES; ++i) {
+		len = sprintf(expect, "%u\n", i);
+		ck_assert_msg(pos + len <= rec->len &&
+			      !memcmp(rec->buf + pos, expect, len),
+			      "line %u missing or out of order", i);
+		pos += len;
+	}
+	ck_assert_uint_eq(pos, rec->len);
+}
+
+static size_t count_len(void)
+{
+	char buf[16];
+	unsigned int i;
+	size_t len = 0;
+
+	for (i = 0; i < COUNT_LINES; ++i)
+		len += sprintf(buf, "%u\n", i);
+
+	return len;
+}
+
+/* dispatches @b until @rec has @len bytes or two seconds passed */
+static void pump_rec(struct shl_pty_bridge *b, struct rec *rec, size_t len)
+{
+	long long end = now_ms() + 2000;
+
+	while (rec->len < len && now_ms() < end)
+		ck_assert_int_ge(shl_pty_bridge_dispatch(b, 10), 0);
+}
+
+/* dispatches @b for @num rounds of up to @timeout milliseconds */
+static void pump(struct shl_pty_bridge *b, unsigned int num, int timeout)
+{
+	while (num--)
+		ck_assert_int_ge(shl_pty_bridge_dispatch(b, timeout), 0);
+}
+
+/* dispatches @b until @flow got more than @len bytes or two seconds passed */
+static void pump_flow(struct shl_pty_bridge *b, struct flow *flow, size_t len)
+{
+	long long end = now_ms() + 2000;
+
+	while (flow->got <= len && now_ms() < end)
+		ck_assert_int_ge(shl_pty_bridge_dispatch(b, 10), 0);
+}
+
+START_TEST(test_pty_order)
+{
+	struct shl_pty_bridge *b;
+	struct shl_pty *pty;
+	struct rec rec;
+	unsigned int i;
+	int r;
+
+	for_each_bridge(b, i) {
+		memset(&rec, 0, sizeof(rec));
+		pty = pty_new(child_count, rec_input, &rec);
+		r = shl_pty_bridge_add(b, pty);
+		ck_assert_int_eq(r, 0);
+		r = shl_pty_bridge_add(b, pty);
+		ck_assert_int_eq(r, -EALREADY);
+
+		pump_rec(b, &rec, count_len());
+		assert_count(&rec);
+
+		shl_pty_bridge_remove(b, pty);
+		pty_free(pty);
+		shl_pty_bridge_free(b);
+		free(rec.buf);
+	}
+}
+END_TEST
+
+START_TEST(test_pty_readd)
+{
+	struct shl_pty_bridge *b, *other;
+	struct shl_pty *pty;
+	struct rec rec;
+	unsigned int i, j;
+	long long end;
+	int r;
+
+	for_each_bridge(b, i) {
+		memset(&rec, 0, sizeof(rec));
+		pty = pty_new(child_count, rec_input, &rec);
+		r = shl_pty_bridge_add(b, pty);
+		ck_assert_int_eq(r, 0);
+
+		/* remove and re-add before the cancel completed */
+		end = now_ms() + 2000;
+		for (j = 0; rec.len < count_len() && now_ms() < end; ++j) {
+			r = shl_pty_bridge_dispatch(b, j % 2 ? 10 : 0);
+			ck_assert_int_ge(r, 0);
+			shl_pty_bridge_remove(b, pty);
+			r = shl_pty_bridge_add(b, pty);
+			ck_assert_int_eq(r, 0);
+		}
+		assert_count(&rec);
+
+		/* another bridge has to wait for pending requests */
+		r = shl_pty_bridge_new(&other, SHL_PTY_BRIDGE_EPOLL);
+		ck_assert_int_eq(r, 0);
+		shl_pty_bridge_remove(b, pty);
+		r = shl_pty_bridge_add(other, pty);
+		if (shl_pty_bridge_is_uring(b)) {
+			ck_assert_int_eq(r, -EBUSY);
+			end = now_ms() + 2000;
+			while (r == -EBUSY && now_ms() < end) {
+				shl_pty_bridge_dispatch(b, 10);
+				r = shl_pty_bridge_add(other, pty);
+			}
+		}
+		ck_assert_int_eq(r, 0);
+
+		shl_pty_bridge_remove(other, pty);
+		shl_pty_bridge_free(other);
+		pty_free(pty);
+		shl_pty_bridge_free(b);
+		free(rec.buf);
+	}
+}
+END_TEST
+
+START_TEST(test_pty_teardown)
+{
+	struct shl_pty_bridge *b;
+	struct shl_pty *flood, *sink, *idle;
+	struct rec rec;
+	char buf[4096];
+	unsigned int i, j;
+	int r;
+
+	memset(buf, 'x', sizeof(buf));
+
+	for_each_bridge(b, i) {
+		memset(&rec, 0, sizeof(rec));
+		flood = pty_new(child_flood, NULL, NULL);
+		sink = pty_new(child_sink, NULL, NULL);
+		idle = pty_new(child_count, rec_input, &rec);
+		ck_assert_int_eq(shl_pty_bridge_add(b, flood), 0);
+		ck_assert_int_eq(shl_pty_bridge_add(b, sink), 0);
+		ck_assert_int_eq(shl_pty_bridge_add(b, idle), 0);
+
+		/* the stopped sink leaves output queued behind a poll */
+		for (j = 0; j < 64; ++j) {
+			r = shl_pty_write(sink, buf, sizeof(buf));
+			ck_assert_int_ge(r, 0);
+		}
+		shl_pty_bridge_dispatch_pty(b, sink);
+		for (j = 0; j < 10; ++j)
+			shl_pty_bridge_dispatch(b, 1);
+
+		/* free with cancels and reads in flight */
+		shl_pty_bridge_remove(b, flood);
+		shl_pty_bridge_remove(b, idle);
+		shl_pty_bridge_free(b);
+
+		ck_assert(shl_pty_is_open(flood));
+		ck_assert(shl_pty_is_open(sink));
+		pty_free(flood);
+		pty_free(sink);
+		pty_free(idle);
+		free(rec.buf);
+	}
+}
+END_TEST
+
+START_TEST(test_pty_out_watermarks)
+{
+	struct shl_pty_bridge *b;
+	struct shl_pty *pty;
+	char buf[4096];
+	unsigned int i, j;
+	long long end;
+	int r;
+
+	memset(buf, 'x', sizeof(buf));
+
+	for_each_bridge(b, i) {
+		pty = pty_new(child_sink, NULL, NULL);
+		r = shl_pty_set_out_watermarks(pty, 16384, 65536);
+		ck_assert_int_eq(r, 0);
+		r = shl_pty_set_out_watermarks(pty, 65536, 16384);
+		ck_assert_int_eq(r, -EINVAL);
+		ck_assert_int_eq(shl_pty_bridge_add(b, pty), 0);
+
+		/* nothing is flushed without a dispatch */
+		for (j = 0; j < 16; ++j) {
+			r = shl_pty_write(pty, buf, sizeof(buf));
+			ck_assert_int_eq(r, 0);
+		}
+		ck_assert(!shl_pty_is_full(pty));
+		r = shl_pty_write(pty, buf, 1);
+		ck_assert_int_eq(r, -ENOBUFS);
+		ck_assert(shl_pty_is_full(pty));
+
+		/* stays full until the queue drops to the low watermark */
+		r = shl_pty_set_out_watermarks(pty, 16384, 1024 * 1024);
+		ck_assert_int_eq(r, 0);
+		ck_assert(shl_pty_is_full(pty));
+		r = shl_pty_write(pty, buf, 1);
+		ck_assert_int_eq(r, -ENOBUFS);
+
+		kill(shl_pty_get_child(pty), SIGCONT);
+		shl_pty_bridge_dispatch_pty(b, pty);
+		end = now_ms() + 2000;
+		while (shl_pty_is_full(pty) && now_ms() < end)
+			pump(b, 1, 10);
+		ck_assert(!shl_pty_is_full(pty));
+		r = shl_pty_write(pty, buf, sizeof(buf));
+		ck_assert_int_eq(r, 0);
+
+		shl_pty_bridge_remove(b, pty);
+		pty_free(pty);
+		shl_pty_bridge_free(b);
+	}
+}
+END_TEST
+
+START_TEST(test_pty_in_watermarks)
+{
+	struct shl_pty_bridge *b;
+	struct shl_pty *pty;
+	struct flow flow;
+	unsigned int i;
+	size_t at;
+	int r;
+
+	for_each_bridge(b, i) {
+		memset(&flow, 0, sizeof(flow));
+		pty = pty_new(child_flood, flow_input, &flow);
+		r = shl_pty_set_in_watermarks(pty, 64 * 1024, 256 * 1024);
+		ck_assert_int_eq(r, 0);
+		ck_assert_int_eq(shl_pty_bridge_add(b, pty), 0);
+
+		/* reading stops at the high watermark */
+		pump_flow(b, &flow, 256 * 1024);
+		ck_assert(shl_pty_is_paused(pty));
+
+		/* requests in flight may still complete, then nothing is read */
+		pump(b, 10, 5);
+		at = flow.got;
+		pump(b, 20, 5);
+		ck_assert_uint_eq(flow.got, at);
+
+		/* still paused between the watermarks */
+		flow.pending = 128 * 1024;
+		shl_pty_set_in_pending(pty, flow.pending);
+		ck_assert(shl_pty_is_paused(pty));
+		pump(b, 10, 5);
+		ck_assert_uint_eq(flow.got, at);
+
+		/* reading resumes at the low watermark */
+		flow.pending = 64 * 1024;
+		shl_pty_set_in_pending(pty, flow.pending);
+		ck_assert(!shl_pty_is_paused(pty));
+		pump_flow(b, &flow, at);
+		ck_assert_uint_gt(flow.got, at);
+
+		/* pause and resume without a dispatch in between */
+		shl_pty_set_in_pending(pty, 256 * 1024);
+		ck_assert(shl_pty_is_paused(pty));
+		flow.pending = 0;
+		shl_pty_set_in_pending(pty, flow.pending);
+		ck_assert(!shl_pty_is_paused(pty));
+		at = flow.got;
+		pump_flow(b, &flow, at);
+		ck_assert_uint_gt(flow.got, at);
+
+		/* disabling the watermarks resumes reading */
+		pump_flow(b, &flow, at + 256 * 1024);
+		ck_assert(shl_pty_is_paused(pty));
+		r = shl_pty_set_in_watermarks(pty, 0, 0);
+		ck_assert_int_eq(r, 0);
+		ck_assert(!shl_pty_is_paused(pty));
+		pump(b, 10, 5);
+		at = flow.got;
+		pump_flow(b, &flow, at);
+		ck_assert_uint_gt(flow.got, at);
+
+		shl_pty_bridge_remove(b, pty);
+		pty_free(pty);
+		shl_pty_bridge_free(b);
+	}
+}
+END_TEST
+
+/* only the epoll bridge reads into the buffer of the pty */
+START_TEST(test_pty_read_policy)
+{
+	struct shl_pty_bridge *b;
+	struct shl_pty *pty;
+	struct flow flow;
+	size_t base, size;
+	unsigned int num;
+	long long end;
+	int r;
+
+	r = shl_pty_bridge_new(&b, SHL_PTY_BRIDGE_EPOLL);
+	ck_assert_int_eq(r, 0);
+	memset(&flow, 0, sizeof(flow));
+	pty = pty_new(child_burst, flow_input, &flow);
+
+	base = shl_pty_get_read_size(pty);
+	r = shl_pty_set_read_policy(pty, base / 2, 4);
+	ck_assert_int_eq(r, -EINVAL);
+	r = shl_pty_set_read_policy(pty, base * 4, 4);
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(shl_pty_bridge_add(b, pty), 0);
+
+	/* full reads grow the buffer up to the limit */
+	end = now_ms() + 2000;
+	while (shl_pty_get_read_size(pty) < base * 4 && now_ms() < end)
+		pump(b, 1, 10);
+	ck_assert_uint_eq(shl_pty_get_read_size(pty), base * 4);
+	pump(b, 10, 1);
+	ck_assert_uint_eq(shl_pty_get_read_size(pty), base * 4);
+	ck_assert_uint_gt(flow.max, base);
+	ck_assert_uint_le(flow.max, base * 4);
+
+	/* short reads shrink it back, one step per several drains */
+	kill(shl_pty_get_child(pty), SIGUSR1);
+	end = now_ms() + 2000;
+	while (shl_pty_get_read_size(pty) == base * 4 && now_ms() < end)
+		pump(b, 1, 10);
+	size = shl_pty_get_read_size(pty);
+	ck_assert_uint_eq(size, base * 2);
+
+	for (num = 0; shl_pty_get_read_size(pty) == size &&
+		      now_ms() < end; ++num)
+		pump(b, 1, 10);
+	ck_assert_uint_eq(shl_pty_get_read_size(pty), base);
+	ck_assert_uint_ge(num, 8);
+
+	shl_pty_bridge_remove(b, pty);
+	pty_free(pty);
+	shl_pty_bridge_free(b);
+}
+END_TEST
+
+TEST_DEFINE_CASE(misc)
+	TEST(test_pty_order)
+	TEST(test_pty_readd)
+	TEST(test_pty_teardown)
+	TEST(test_pty_out_watermarks)
+	TEST(test_pty_in_watermarks)
+	TEST(test_pty_read_policy)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(pty,
+		TEST_CASE(misc),
+		TEST_END
+	)
+)
@@ -0,0 +1,650 @@
+/*
+ * TSM - Snapshot Tests
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "test_common.h"
+#include "libtsm.h"
+#include "libtsm-int.h"
+
+struct term {
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+};
+
+static void write_cb(struct tsm_vte *vte, const char *u8, size_t len,
+		     void *data)
+{
+	UNUSED(vte);
+	UNUSED(u8);
+	UNUSED(len);
+	UNUSED(data);
+}
+
+static void term_new(struct term *t)
+{
+	int r;
+
+	r = tsm_screen_new(&t->screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&t->vte, t->screen, write_cb, NULL, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+}
+
+static void term_free(struct term *t)
+{
+	tsm_vte_unref(t->vte);
+	tsm_screen_unref(t->screen);
+}
+
+static void term_input(struct term *t, const char *str)
+{
+	tsm_vte_input(t->vte, str, strlen(str));
+}
+
+/* saves @t and loads it into @copy */
+static void term_load(struct term *t, struct term *copy)
+{
+	char *buf;
+	size_t len;
+	int r;
+
+	r = tsm_screen_save(t->screen, &buf, &len);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_load(copy->screen, buf, len);
+	ck_assert_int_eq(r, 0);
+	free(buf);
+
+	r = tsm_vte_save(t->vte, &buf, &len);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_load(copy->vte, buf, len);
+	ck_assert_int_eq(r, 0);
+	free(buf);
+}
+
+/* saves @t and loads it into a fresh terminal */
+static void term_copy(struct term *t, struct term *copy)
+{
+	term_new(copy);
+	term_load(t, copy);
+}
+
+/* both terminals must produce identical snapshots */
+static void assert_term_eq(struct term *a, struct term *b)
+{
+	char *buf_a, *buf_b;
+	size_t len_a, len_b;
+	int r;
+
+	r = tsm_screen_save(a->screen, &buf_a, &len_a);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_save(b->screen, &buf_b, &len_b);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(len_a, len_b);
+	ck_assert_int_eq(memcmp(buf_a, buf_b, len_a), 0);
+	free(buf_a);
+	free(buf_b);
+
+	r = tsm_vte_save(a->vte, &buf_a, &len_a);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_save(b->vte, &buf_b, &len_b);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(len_a, len_b);
+	ck_assert_int_eq(memcmp(buf_a, buf_b, len_a), 0);
+	free(buf_a);
+	free(buf_b);
+}
+
+static void fill_term(struct term *t)
+{
+	char buf[64];
+	int i;
+
+	tsm_screen_resize(t->screen, 30, 6);
+	tsm_screen_set_max_sb(t->screen, 20);
+
+	for (i = 0; i < 30; ++i) {
+		sprintf(buf, "\e[3%dm line %d \e[1;48;2;1;2;3mbold\e[m\r\n",
+			i % 8, i);
+		term_input(t, buf);
+	}
+
+	/* wide characters, charsets, margins and a saved cursor */
+	term_input(t, "\xe4\xb8\xad\xe6\x96\x87 \e(0lqk\e(B");
+	term_input(t, "\e[2;5r\e[3;4H\e7\e[?6h\e[4h\e[7m");
+
+	/* alternate screen with content */
+	term_input(t, "\e[?1049h\e[Halt screen\e[5;10H");
+}
+
+START_TEST(test_save_roundtrip)
+{
+	struct term t, copy;
+
+	term_new(&t);
+	fill_term(&t);
+
+	/* stop in the middle of a CSI and a UTF-8 sequence */
+	term_input(&t, "\e[38;5;1");
+	term_copy(&t, &copy);
+	assert_term_eq(&t, &copy);
+
+	/* both continue identically */
+	term_input(&t, "00mX\xc3");
+	term_input(&copy, "00mX\xc3");
+	assert_term_eq(&t, &copy);
+	term_input(&t, "\xa4\e8\e[?1049l more\r\n\n\n\n\n\n");
+	term_input(&copy, "\xa4\e8\e[?1049l more\r\n\n\n\n\n\n");
+	assert_term_eq(&t, &copy);
+
+	ck_assert_uint_eq(tsm_screen_get_cursor_x(copy.screen),
+			  tsm_screen_get_cursor_x(t.screen));
+	ck_assert_uint_eq(tsm_screen_sb_get_line_count(copy.screen), 20);
+
+	term_free(&copy);
+	term_free(&t);
+}
+END_TEST
+
+START_TEST(test_save_symbols)
+{
+	struct tsm_screen *screen, *copy;
+	struct tsm_screen_attr attr;
+	tsm_symbol_t sym, a, b;
+	const uint32_t *ucs4;
+	char *buf, *sbuf;
+	size_t len;
+	int r;
+
+	memset(&attr, 0, sizeof(attr));
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_new(&copy, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+
+	a = tsm_symbol_append(screen->sym_table, 'a', 0x301);
+	b = tsm_symbol_append(screen->sym_table, a, 0x302);
+	ck_assert_uint_ne(a, b);
+	tsm_screen_write(screen, b, &attr);
+	tsm_screen_write(screen, a, &attr);
+
+	r = tsm_screen_save(screen, &buf, &len);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_load(copy, buf, len);
+	ck_assert_int_eq(r, 0);
+	free(buf);
+
+	sym = copy->lines[0]->cells[0].ch;
+	ck_assert_uint_eq(sym, b);
+	ucs4 = tsm_symbol_get(copy->sym_table, &sym, &len);
+	ck_assert_uint_eq(len, 3);
+	ck_assert_uint_eq(ucs4[0], 'a');
+	ck_assert_uint_eq(ucs4[1], 0x301);
+	ck_assert_uint_eq(ucs4[2], 0x302);
+	ck_assert_uint_eq(copy->lines[0]->cells[1].ch, a);
+	tsm_screen_unref(copy);
+
+	/* a blob that fails late does not leak symbols into the target */
+	r = tsm_screen_new(&copy, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_save(screen, &buf, &len);
+	ck_assert_int_eq(r, 0);
+	sbuf = memmem(buf, len, "SBUF", 4);
+	ck_assert_ptr_ne(sbuf, NULL);
+	sbuf[12] = 5;
+	r = tsm_screen_load(copy, buf, len);
+	ck_assert_int_eq(r, -EBADMSG);
+	ck_assert_uint_eq(tsm_symbol_table_get_count(copy->sym_table), 0);
+	free(buf);
+
+	tsm_screen_unref(copy);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+/* writes a screen blob of @x*@y cells with @sb scrollback lines of @sb_width */
+static void save_fake_screen(struct save_buf *b, unsigned int x,
+			     unsigned int y, unsigned int sb,
+			     unsigned int sb_width)
+{
+	struct tsm_screen_attr attr;
+	unsigned int i, k;
+	size_t start;
+
+	memset(&attr, 0, sizeof(attr));
+	save_begin(b, SAVE_TAG('T', 'S', 'M', 'S'), 1);
+
+	start = save_section_begin(b, SAVE_TAG('S', 'C', 'R', 'N'));
+	save_uint(b, x);
+	save_uint(b, y);
+	save_uint(b, 0);
+	save_uint(b, y - 1);
+	save_uint(b, 0);
+	save_uint(b, 0);
+	save_uint(b, 0);
+	save_uint(b, 0);
+	save_attr(b, &attr);
+	save_attr(b, &attr);
+	save_uint(b, sb);
+	save_uint(b, sb);
+	save_uint(b, 0);
+	for (i = 0; i < x; ++i)
+		save_u8(b, 0);
+	save_section_end(b, start);
+
+	start = save_section_begin(b, SAVE_TAG('S', 'Y', 'M', 'S'));
+	save_uint(b, 0);
+	save_section_end(b, start);
+
+	for (k = 0; k < 2; ++k) {
+		start = save_section_begin(b, k ? SAVE_TAG('A', 'L', 'T', 'S') :
+						  SAVE_TAG('M', 'A', 'I', 'N'));
+		save_uint(b, y);
+		for (i = 0; i < y; ++i) {
+			save_uint(b, 1);
+			save_uint(b, 1);
+			save_uint(b, 'x');
+			save_u8(b, 1);
+			save_attr(b, &attr);
+		}
+		save_section_end(b, start);
+	}
+
+	start = save_section_begin(b, SAVE_TAG('S', 'B', 'U', 'F'));
+	save_uint(b, sb);
+	if (sb)
+		save_uint(b, 1);
+	for (i = 0; i < sb; ++i) {
+		save_uint(b, sb_width);
+		save_uint(b, sb_width);
+		save_uint(b, 'x');
+		save_u8(b, 1);
+		save_attr(b, &attr);
+	}
+	save_section_end(b, start);
+}
+
+START_TEST(test_save_limits)
+{
+	struct tsm_screen *screen;
+	struct save_buf b;
+	tsm_age_t age_cnt, age;
+	char *buf;
+	size_t len;
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+
+	save_fake_screen(&b, 20, 4, 3, 50);
+	r = save_finish(&b, &buf, &len);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_load(screen, buf, len);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(tsm_screen_get_width(screen), 20);
+	ck_assert_uint_eq(tsm_screen_sb_get_line_count(screen), 3);
+	free(buf);
+
+	/* rejected snapshots leave the screen and its age alone */
+	age_cnt = screen->age_cnt;
+	age = screen->age;
+
+	/* a few bytes must not allocate a 0xffff*0xffff grid */
+	save_fake_screen(&b, 0xffff, 0xffff, 0, 0);
+	r = save_finish(&b, &buf, &len);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_load(screen, buf, len);
+	ck_assert_int_eq(r, -EBADMSG);
+	free(buf);
+
+	/* nor can the run-length encoded scrollback */
+	save_fake_screen(&b, 20, 4, 1000, 0xffff);
+	r = save_finish(&b, &buf, &len);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_load(screen, buf, len);
+	ck_assert_int_eq(r, -EFBIG);
+	free(buf);
+
+	ck_assert_uint_eq(tsm_screen_get_width(screen), 20);
+	ck_assert_uint_eq(tsm_screen_sb_get_line_count(screen), 3);
+	ck_assert_uint_eq(screen->age_cnt, age_cnt);
+	ck_assert_uint_eq(screen->age, age);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+START_TEST(test_save_invalid)
+{
+	struct term t, copy;
+	char *buf, *vbuf, *tmp;
+	size_t len, vlen, i;
+	tsm_age_t age_cnt, age;
+	int r;
+
+	term_new(&t);
+	fill_term(&t);
+	term_new(&copy);
+
+	r = tsm_screen_save(NULL, &buf, &len);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_screen_load(t.screen, NULL, 0);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_vte_save(NULL, &buf, &len);
+	ck_assert_int_eq(r, -EINVAL);
+
+	r = tsm_screen_save(t.screen, &buf, &len);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_save(t.vte, &vbuf, &vlen);
+	ck_assert_int_eq(r, 0);
+
+	/* screen and vte snapshots are not interchangeable */
+	r = tsm_screen_load(copy.screen, vbuf, vlen);
+	ck_assert_int_eq(r, -EBADMSG);
+	r = tsm_vte_load(copy.vte, buf, len);
+	ck_assert_int_eq(r, -EBADMSG);
+
+	/* truncated snapshots never load nor touch the screen */
+	age_cnt = copy.screen->age_cnt;
+	age = copy.screen->age;
+	for (i = 0; i < len; i += 7) {
+		r = tsm_screen_load(copy.screen, buf, i);
+		ck_assert_int_lt(r, 0);
+	}
+	ck_assert_uint_eq(copy.screen->age_cnt, age_cnt);
+	ck_assert_uint_eq(copy.screen->age, age);
+	for (i = 0; i < vlen; ++i) {
+		r = tsm_vte_load(copy.vte, vbuf, i);
+		ck_assert_int_lt(r, 0);
+	}
+
+	/* unknown sections are skipped */
+	tmp = malloc(len + 16);
+	ck_assert_ptr_ne(tmp, NULL);
+	memcpy(tmp, buf, len);
+	memcpy(tmp + len, "XTRA\4\0\0\0\0\0\0\0abcd", 16);
+	r = tsm_screen_load(copy.screen, tmp, len + 16);
+	ck_assert_int_eq(r, 0);
+
+	/* newer versions are rejected */
+	tmp[4] = 2;
+	r = tsm_screen_load(copy.screen, tmp, len);
+	ck_assert_int_eq(r, -EPROTONOSUPPORT);
+	free(tmp);
+
+	free(vbuf);
+	free(buf);
+	term_free(&copy);
+	term_free(&t);
+}
+END_TEST
+
+struct stream_rec {
+	size_t data;
+	unsigned int ends;
+	unsigned int drops;
+};
+
+static void osc_stream_cb(struct tsm_vte *vte, enum tsm_vte_osc_phase phase,
+			  const char *u8, size_t len, void *data)
+{
+	struct stream_rec *rec = data;
+
+	UNUSED(vte);
+	UNUSED(u8);
+
+	if (phase == TSM_VTE_OSC_DATA)
+		rec->data += len;
+	else if (phase == TSM_VTE_OSC_END)
+		++rec->ends;
+	else if (phase == TSM_VTE_OSC_DROP)
+		++rec->drops;
+}
+
+START_TEST(test_save_osc_stream)
+{
+	struct stream_rec rec = { 0 }, copy_rec = { 0 }, other_rec = { 0 };
+	struct term t, copy;
+
+	term_new(&t);
+	tsm_vte_set_osc_stream_cb(t.vte, osc_stream_cb, &rec, 16);
+
+	/* the copy never saw the start of the OSC and skips the rest */
+	term_input(&t, "\e]0;abcdefghij");
+	term_new(&copy);
+	tsm_vte_set_osc_stream_cb(copy.vte, osc_stream_cb, &copy_rec, 16);
+	term_load(&t, &copy);
+	term_input(&copy, "klmnop\a");
+	ck_assert_uint_eq(copy_rec.data, 0);
+	ck_assert_uint_eq(copy_rec.ends, 0);
+	ck_assert_uint_eq(copy_rec.drops, 0);
+
+	/* the next OSC is complete */
+	term_input(&copy, "\e]0;abc\a");
+	ck_assert_uint_eq(copy_rec.data, 5);
+	ck_assert_uint_eq(copy_rec.ends, 1);
+
+	/* so is a callback set in the middle of an OSC */
+	term_input(&copy, "\e]0;x");
+	tsm_vte_set_osc_stream_cb(copy.vte, osc_stream_cb, &other_rec, 16);
+	ck_assert_uint_eq(copy_rec.drops, 1);
+	term_input(&copy, "yz\a");
+	ck_assert_uint_eq(copy_rec.ends, 1);
+	ck_assert_uint_eq(other_rec.data, 0);
+	ck_assert_uint_eq(other_rec.ends, 0);
+
+	/* an OSC of the loading vte itself is dropped */
+	ck_assert_uint_eq(rec.drops, 0);
+	term_load(&copy, &t);
+	ck_assert_uint_eq(rec.drops, 1);
+	ck_assert_uint_eq(rec.ends, 0);
+
+	term_free(&copy);
+	term_free(&t);
+}
+END_TEST
+
+struct dcs_rec {
+	char inter[8];
+	uint32_t final;
+	size_t data;
+	unsigned int calls;
+};
+
+static void dcs_cb(struct tsm_vte *vte, enum tsm_vte_dcs_phase phase,
+		   const struct tsm_vte_dcs *dcs, const char *u8, size_t len,
+		   void *data)
+{
+	struct dcs_rec *rec = data;
+
+	UNUSED(vte);
+	UNUSED(u8);
+
+	++rec->calls;
+	if (phase == TSM_VTE_DCS_BEGIN) {
+		snprintf(rec->inter, sizeof(rec->inter), "%s",
+			 dcs->intermediates);
+		rec->final = dcs->final;
+	} else if (phase == TSM_VTE_DCS_DATA) {
+		rec->data += len;
+	}
+}
+
+START_TEST(test_save_dcs)
+{
+	struct dcs_rec rec = { { 0 } };
+	struct term t, copy;
+
+	/* intermediates collected before the save are kept */
+	term_new(&t);
+	term_input(&t, "\eP$");
+	term_copy(&t, &copy);
+	tsm_vte_set_dcs_cb(copy.vte, dcs_cb, &rec);
+	term_input(&copy, "qm\e\\");
+	ck_assert_uint_eq(rec.calls, 3);
+	ck_assert_str_eq(rec.inter, "$");
+	ck_assert_uint_eq(rec.final, 'q');
+	ck_assert_uint_eq(rec.data, 1);
+	term_free(&copy);
+
+	/* the rest of a DCS in passthrough is ignored, not printed */
+	memset(&rec, 0, sizeof(rec));
+	term_input(&t, "qab");
+	term_copy(&t, &copy);
+	tsm_vte_set_dcs_cb(copy.vte, dcs_cb, &rec);
+	term_input(&t, "cd\e\\text");
+	term_input(&copy, "cd\e\\text");
+	ck_assert_uint_eq(rec.calls, 0);
+	assert_term_eq(&t, &copy);
+
+	term_free(&copy);
+	term_free(&t);
+}
+END_TEST
+
+START_TEST(test_save_rep)
+{
+	struct term t, copy;
+
+	term_new(&t);
+	term_input(&t, "ab");
+	term_copy(&t, &copy);
+
+	/* REP repeats the last character printed before saving */
+	term_input(&t, "\e[3b");
+	term_input(&copy, "\e[3b");
+	assert_term_eq(&t, &copy);
+	ck_assert_uint_eq(copy.screen->lines[0]->cells[4].ch, 'b');
+	ck_assert_uint_eq(tsm_screen_get_cursor_x(copy.screen), 5);
+
+	term_free(&copy);
+	term_free(&t);
+}
+END_TEST
+
+static void count_cb(struct tsm_vte *vte, const char *u8, size_t len,
+		     void *data)
+{
+	size_t *cnt = data;
+
+	UNUSED(vte);
+	UNUSED(u8);
+
+	*cnt += len;
+}
+
+START_TEST(test_save_flush_mode)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	struct term t;
+	size_t cnt = 0;
+	char *buf;
+	size_t len;
+	int r;
+
+	term_new(&t);
+	r = tsm_vte_save(t.vte, &buf, &len);
+	ck_assert_int_eq(r, 0);
+
+	/* the flush mode is configuration of the loading VTE */
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&vte, screen, count_cb, &cnt, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	tsm_vte_set_flush_mode(vte, TSM_VTE_FLUSH_MANUAL);
+	r = tsm_vte_load(vte, buf, len);
+	ck_assert_int_eq(r, 0);
+	free(buf);
+
+	tsm_vte_input(vte, "\e[5n", 4);
+	ck_assert_uint_eq(cnt, 0);
+	tsm_vte_flush(vte);
+	ck_assert_uint_eq(cnt, 4);
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+	term_free(&t);
+}
+END_TEST
+
+static void sync_cb(struct tsm_vte *vte, bool active, void *data)
+{
+	int *state = data;
+
+	UNUSED(vte);
+
+	*state = active;
+}
+
+START_TEST(test_save_sync)
+{
+	struct term t, copy;
+	int state = -1;
+
+	term_new(&t);
+	term_input(&t, "\e[?2026h");
+	term_new(&copy);
+	tsm_vte_set_sync_cb(copy.vte, sync_cb, &state);
+
+	/* observers see an update that was active when saving */
+	term_load(&t, &copy);
+	ck_assert_int_eq(state, 1);
+	ck_assert(tsm_screen_get_flags(copy.screen) & TSM_SCREEN_SYNC_UPDATE);
+
+	/* and its end */
+	term_free(&t);
+	term_new(&t);
+	term_load(&t, &copy);
+	ck_assert_int_eq(state, 0);
+	ck_assert(!(tsm_screen_get_flags(copy.screen) &
+		    TSM_SCREEN_SYNC_UPDATE));
+
+	/* nothing is reported without a change */
+	state = -1;
+	term_load(&t, &copy);
+	ck_assert_int_eq(state, -1);
+
+	term_free(&copy);
+	term_free(&t);
+}
+END_TEST
+
+TEST_DEFINE_CASE(misc)
+	TEST(test_save_roundtrip)
+	TEST(test_save_symbols)
+	TEST(test_save_invalid)
+	TEST(test_save_limits)
+	TEST(test_save_osc_stream)
+	TEST(test_save_dcs)
+	TEST(test_save_rep)
+	TEST(test_save_flush_mode)
+	TEST(test_save_sync)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(save,
+		TEST_CASE(misc),
+		TEST_END
+	)
+)
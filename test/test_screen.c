@@ -70,6 +70,7 @@ START_TEST(test_screen_null)
 	ck_assert_int_eq(r, -EINVAL);
 
 	tsm_screen_set_max_sb(NULL, 0u);
+	tsm_screen_set_sb_cb(NULL, NULL, NULL);
 
 	tsm_screen_clear_sb(NULL);
 
@@ -100,6 +101,7 @@ START_TEST(test_screen_null)
 	tsm_screen_reset_all_tabstops(NULL);
 
 	tsm_screen_write(NULL, 0u, NULL);
+	tsm_screen_write_repeat(NULL, 0u, NULL, 0u);
 
 	tsm_screen_newline(NULL);
 
@@ -262,12 +264,244 @@ START_TEST(test_screen_sb_get_line_pos)
 }
 END_TEST
 
+struct sb_log {
+	unsigned int num;
+	uint64_t last_id;
+	char text[8][16];
+	unsigned int cells;
+};
+
+static int sb_draw_cb(struct tsm_screen *con, uint64_t id, const uint32_t *ch,
+		      size_t len, unsigned int width, unsigned int posx,
+		      unsigned int posy, const struct tsm_screen_attr *attr,
+		      tsm_age_t age, void *data)
+{
+	struct sb_log *log = data;
+
+	ck_assert_int_eq(posy, 0);
+	++log->cells;
+	return 0;
+}
+
+static void sb_cb(struct tsm_screen *con, const struct tsm_screen_line *line,
+		  uint64_t id, void *data)
+{
+	struct sb_log *log = data;
+	const char *text;
+	size_t len;
+	int r;
+
+	if (log->num)
+		ck_assert_uint_eq(id, log->last_id + 1);
+	log->last_id = id;
+
+	r = tsm_screen_line_get_text(con, line, &text, &len);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(strlen(text), len);
+	ck_assert_int_lt(log->num, 8);
+	strcpy(log->text[log->num++], text);
+
+	r = tsm_screen_line_draw(con, line, sb_draw_cb, log);
+	ck_assert_int_eq(r, 0);
+}
+
+START_TEST(test_screen_sb_cb)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_attr attr;
+	struct sb_log log;
+	int r;
+
+	memset(&log, 0, sizeof(log));
+	memset(&attr, 0, sizeof(attr));
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+
+	r = tsm_screen_resize(screen, 5, 2);
+	ck_assert_int_eq(r, 0);
+
+	tsm_screen_set_sb_cb(screen, sb_cb, &log);
+	tsm_screen_set_max_sb(screen, 5);
+
+	tsm_screen_write(screen, 'a', &attr);
+	tsm_screen_newline(screen);
+	tsm_screen_write(screen, 'b', &attr);
+	tsm_screen_write(screen, ' ', &attr);
+	tsm_screen_write(screen, 'c', &attr);
+	ck_assert_int_eq(log.num, 0);
+
+	tsm_screen_newline(screen);
+	ck_assert_int_eq(log.num, 1);
+	ck_assert_str_eq(log.text[0], "a");
+	ck_assert_int_eq(log.cells, 5);
+
+	/* lines are reported even if the scrollback-buffer is disabled */
+	tsm_screen_set_max_sb(screen, 0);
+	tsm_screen_newline(screen);
+	ck_assert_int_eq(log.num, 2);
+	ck_assert_str_eq(log.text[1], "b c");
+	ck_assert_int_eq(tsm_screen_sb_get_line_count(screen), 0);
+
+	/* nothing is reported for the alternate screen */
+	tsm_screen_set_flags(screen, TSM_SCREEN_ALTERNATE);
+	tsm_screen_newline(screen);
+	tsm_screen_newline(screen);
+	ck_assert_int_eq(log.num, 2);
+	tsm_screen_reset_flags(screen, TSM_SCREEN_ALTERNATE);
+
+	tsm_screen_set_sb_cb(screen, NULL, NULL);
+	tsm_screen_newline(screen);
+	ck_assert_int_eq(log.num, 2);
+
+	r = tsm_screen_line_get_text(screen, NULL, NULL, NULL);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_screen_line_draw(screen, NULL, sb_draw_cb, NULL);
+	ck_assert_int_eq(r, -EINVAL);
+
+	tsm_screen_unref(screen);
+	screen = NULL;
+}
+END_TEST
+
+
+#define REP_W 7
+#define REP_H 3
+
+struct rep_grid {
+	uint32_t ch[REP_H][REP_W];
+	unsigned int width[REP_H][REP_W];
+	unsigned int x, y;
+	unsigned int sb_calls;
+	uint64_t sb_id;
+	char *save;
+	size_t save_len;
+};
+
+static void rep_sb_cb(struct tsm_screen *con,
+		      const struct tsm_screen_line *line, uint64_t id,
+		      void *data)
+{
+	struct rep_grid *g = data;
+
+	UNUSED(con);
+	UNUSED(line);
+
+	++g->sb_calls;
+	g->sb_id = id;
+}
+
+static int rep_draw_cb(struct tsm_screen *con, uint64_t id,
+		       const uint32_t *ch, size_t len, unsigned int width,
+		       unsigned int posx, unsigned int posy,
+		       const struct tsm_screen_attr *attr, tsm_age_t age,
+		       void *data)
+{
+	struct rep_grid *g = data;
+
+	g->ch[posy][posx] = len ? ch[0] : 0;
+	g->width[posy][posx] = width;
+	return 0;
+}
+
+/* with @sb_cb, lines leaving the screen are counted, otherwise scrollback
+ * keeps @sb_max of them */
+static void rep_run(struct rep_grid *g, tsm_symbol_t ch, unsigned int flags,
+		    unsigned int x, unsigned int y, unsigned int num,
+		    unsigned int sb_max, bool sb_cb, bool repeat)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_attr attr;
+	unsigned int i;
+	int r;
+
+	memset(&attr, 0, sizeof(attr));
+	memset(g, 0, sizeof(*g));
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, REP_W, REP_H);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_max_sb(screen, sb_max);
+	if (sb_cb)
+		tsm_screen_set_sb_cb(screen, rep_sb_cb, g);
+
+	for (i = 0; i < REP_W * REP_H - 1; ++i)
+		tsm_screen_write(screen, 'a' + i, &attr);
+	tsm_screen_set_margins(screen, 1, 2);
+	tsm_screen_set_flags(screen, flags);
+	tsm_screen_move_to(screen, x, y);
+
+	if (repeat) {
+		tsm_screen_write_repeat(screen, ch, &attr, num);
+	} else {
+		for (i = 0; i < num; ++i)
+			tsm_screen_write(screen, ch, &attr);
+	}
+
+	tsm_screen_set_flags(screen, TSM_SCREEN_HIDE_CURSOR);
+	tsm_screen_draw(screen, rep_draw_cb, g);
+	g->x = tsm_screen_get_cursor_x(screen);
+	g->y = tsm_screen_get_cursor_y(screen);
+
+	/* covers scrollback contents and IDs */
+	r = tsm_screen_save(screen, &g->save, &g->save_len);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_unref(screen);
+}
+
+static bool rep_eq(struct rep_grid *a, struct rep_grid *b)
+{
+	bool eq;
+
+	eq = a->save_len == b->save_len &&
+	     !memcmp(a->save, b->save, a->save_len);
+	free(a->save);
+	free(b->save);
+	a->save = NULL;
+	b->save = NULL;
+
+	return eq && !memcmp(a, b, sizeof(*a));
+}
+
+START_TEST(test_screen_write_repeat)
+{
+	static const tsm_symbol_t chars[] = { 'x', 0x4e00 };
+	static const unsigned int flags[] = {
+		TSM_SCREEN_AUTO_WRAP,
+		0,
+		TSM_SCREEN_AUTO_WRAP | TSM_SCREEN_INSERT_MODE,
+	};
+	static const unsigned int nums[] = { 1, 2, 5, 6, 7, 8, 13, 20, 40, 1001 };
+	/* scrollback sizes, the last one with a callback */
+	static const unsigned int sbs[] = { 0, 4, 100, 4 };
+	struct rep_grid a, b;
+	unsigned int c, f, n, x, y, sb;
+
+	for (sb = 0; sb < 4; ++sb)
+	for (c = 0; c < 2; ++c)
+	for (f = 0; f < 3; ++f)
+	for (n = 0; n < sizeof(nums) / sizeof(*nums); ++n)
+	for (y = 0; y < REP_H; ++y)
+	for (x = 0; x < REP_W; ++x) {
+		rep_run(&a, chars[c], flags[f], x, y, nums[n], sbs[sb],
+			sb == 3, false);
+		rep_run(&b, chars[c], flags[f], x, y, nums[n], sbs[sb],
+			sb == 3, true);
+		ck_assert_msg(rep_eq(&a, &b),
+			      "char %u flags %u num %u at %u/%u sb %u", c, f,
+			      nums[n], x, y, sbs[sb]);
+	}
+}
+END_TEST
 
 TEST_DEFINE_CASE(misc)
 	TEST(test_screen_init)
 	TEST(test_screen_null)
 	TEST(test_screen_resize_alt_colors)
 	TEST(test_screen_sb_get_line_pos)
+	TEST(test_screen_sb_cb)
+	TEST(test_screen_write_repeat)
 TEST_END_CASE
 
 TEST_DEFINE(
@@ -0,0 +1,417 @@
+/*
+ * TSM - Screen Search Tests
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include "test_common.h"
+#include "libtsm.h"
+#include "libtsm-int.h"
+
+static void write_string(struct tsm_screen *screen, const char *str)
+{
+	struct tsm_screen_attr attr;
+	int i;
+
+	memset(&attr, 0, sizeof(attr));
+
+	for (i = 0; str[i]; i++) {
+		tsm_screen_write(screen, str[i], &attr);
+	}
+}
+
+/* creates a 40x4 screen with 20 lines "line N: ..." of which 16 are in sb */
+static struct tsm_screen *create_screen(void)
+{
+	struct tsm_screen *screen;
+	char buf[64];
+	int r, i;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+
+	r = tsm_screen_resize(screen, 40, 4);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_max_sb(screen, 100);
+
+	for (i = 0; i < 20; i++) {
+		if (i)
+			tsm_screen_newline(screen);
+		sprintf(buf, "line %d: %s", i, i % 5 ? "ok" : "Error E42");
+		write_string(screen, buf);
+	}
+
+	ck_assert_int_eq(tsm_screen_sb_get_line_count(screen), 16);
+	return screen;
+}
+
+START_TEST(test_search_invalid)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_search *search;
+	struct tsm_screen_match m;
+	int r;
+
+	screen = create_screen();
+
+	r = tsm_screen_search_new(NULL, screen, "x", 0);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_screen_search_new(&search, NULL, "x", 0);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_screen_search_new(&search, screen, "", 0);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_screen_search_new(&search, screen, "a(", TSM_SCREEN_SEARCH_REGEX);
+	ck_assert_int_eq(r, -EINVAL);
+
+	r = tsm_screen_search_next(NULL, 0, &m);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_screen_search_select(NULL, &m);
+	ck_assert_int_eq(r, -EINVAL);
+	tsm_screen_search_free(NULL);
+	tsm_screen_search_seek(NULL, 0, 0);
+
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+START_TEST(test_search_forward)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_search *search;
+	struct tsm_screen_match m;
+	uint64_t first;
+	int r, i;
+
+	screen = create_screen();
+	first = tsm_screen_get_row(screen, 0) - 16;
+
+	r = tsm_screen_search_new(&search, screen, "Error", 0);
+	ck_assert_int_eq(r, 0);
+
+	/* matches on lines 0, 5, 10 (scrollback) and 15 (screen) */
+	for (i = 0; i < 4; i++) {
+		r = tsm_screen_search_next(search, 0, &m);
+		ck_assert_int_eq(r, 0);
+		ck_assert_uint_eq(m.row, first + i * 5);
+		ck_assert_uint_eq(m.start_x, i < 2 ? 8 : 9);
+		ck_assert_uint_eq(m.end_x, i < 2 ? 12 : 13);
+	}
+
+	r = tsm_screen_search_next(search, 0, &m);
+	ck_assert_int_eq(r, -ENOENT);
+
+	/* new lines are picked up when resuming */
+	tsm_screen_newline(screen);
+	write_string(screen, "Error again");
+	r = tsm_screen_search_next(search, 0, &m);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(m.row, first + 20);
+	ck_assert_uint_eq(m.start_x, 0);
+
+	tsm_screen_search_free(search);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+START_TEST(test_search_backward)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_search *search;
+	struct tsm_screen_match m;
+	uint64_t first;
+	int r;
+
+	screen = create_screen();
+	first = tsm_screen_get_row(screen, 0) - 16;
+
+	r = tsm_screen_search_new(&search, screen, "l",
+				  TSM_SCREEN_SEARCH_BACKWARD);
+	ck_assert_int_eq(r, 0);
+
+	/* start in the middle of line 3 and walk backwards */
+	tsm_screen_search_seek(search, first + 3, 2);
+
+	r = tsm_screen_search_next(search, 0, &m);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(m.row, first + 3);
+	ck_assert_uint_eq(m.start_x, 0);
+
+	r = tsm_screen_search_next(search, 0, &m);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(m.row, first + 2);
+	ck_assert_uint_eq(m.start_x, 0);
+
+	r = tsm_screen_search_next(search, 0, &m);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(m.row, first + 1);
+
+	r = tsm_screen_search_next(search, 0, &m);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(m.row, first);
+
+	r = tsm_screen_search_next(search, 0, &m);
+	ck_assert_int_eq(r, -ENOENT);
+
+	tsm_screen_search_free(search);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+START_TEST(test_search_icase_regex)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_search *search;
+	struct tsm_screen_match m;
+	uint64_t first;
+	int r;
+
+	screen = create_screen();
+	first = tsm_screen_get_row(screen, 0) - 16;
+
+	r = tsm_screen_search_new(&search, screen, "error e42",
+				  TSM_SCREEN_SEARCH_ICASE |
+				  TSM_SCREEN_SEARCH_BACKWARD);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_search_next(search, 0, &m);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(m.row, first + 15);
+	ck_assert_uint_eq(m.start_x, 9);
+	ck_assert_uint_eq(m.end_x, 17);
+	tsm_screen_search_free(search);
+
+	r = tsm_screen_search_new(&search, screen, "E[0-9]+$",
+				  TSM_SCREEN_SEARCH_REGEX);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_search_seek(search, first + 1, 0);
+	r = tsm_screen_search_next(search, 0, &m);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(m.row, first + 5);
+	ck_assert_uint_eq(m.start_x, 14);
+	ck_assert_uint_eq(m.end_x, 16);
+	tsm_screen_search_free(search);
+
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+START_TEST(test_search_budget)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_search *search;
+	struct tsm_screen_match m;
+	int r, calls;
+
+	screen = create_screen();
+
+	r = tsm_screen_search_new(&search, screen, "line 19", 0);
+	ck_assert_int_eq(r, 0);
+
+	calls = 0;
+	do {
+		r = tsm_screen_search_next(search, 3, &m);
+		++calls;
+	} while (r == -EAGAIN);
+
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_eq(calls, 7);
+	ck_assert_uint_eq(m.row, tsm_screen_get_row(screen, 3));
+
+	tsm_screen_search_free(search);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+START_TEST(test_search_select)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_search *search;
+	struct tsm_screen_match m;
+	char *str = NULL;
+	int r;
+
+	screen = create_screen();
+
+	r = tsm_screen_search_new(&search, screen, "line 5", 0);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_search_next(search, 0, &m);
+	ck_assert_int_eq(r, 0);
+
+	r = tsm_screen_search_select(screen, &m);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(tsm_screen_get_row(screen, 0), m.row);
+
+	r = tsm_screen_selection_copy(screen, &str);
+	ck_assert_int_eq(r, 6);
+	ck_assert_str_eq(str, "line 5");
+	free(str);
+
+	/* matches on evicted lines cannot be selected anymore */
+	tsm_screen_set_max_sb(screen, 2);
+	r = tsm_screen_search_select(screen, &m);
+	ck_assert_int_eq(r, -ENOENT);
+
+	tsm_screen_search_free(search);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+/* collects all matches of @pattern into @rows and returns their number */
+static int collect_rows(struct tsm_screen *screen, const char *pattern,
+			unsigned int flags, uint64_t *rows, int max)
+{
+	struct tsm_screen_search *search;
+	struct tsm_screen_match m;
+	int r, num = 0;
+
+	r = tsm_screen_search_new(&search, screen, pattern, flags);
+	ck_assert_int_eq(r, 0);
+
+	while (!(r = tsm_screen_search_next(search, 0, &m))) {
+		ck_assert_int_lt(num, max);
+		rows[num++] = m.row;
+	}
+	ck_assert_int_eq(r, -ENOENT);
+
+	tsm_screen_search_free(search);
+	return num;
+}
+
+START_TEST(test_search_index)
+{
+	static const char *patterns[] = { "Error", "ERROR E4", "line 1", "ok", NULL };
+	static const unsigned int flags[] = {
+		0,
+		TSM_SCREEN_SEARCH_ICASE,
+		TSM_SCREEN_SEARCH_BACKWARD,
+		TSM_SCREEN_SEARCH_ICASE | TSM_SCREEN_SEARCH_BACKWARD,
+	};
+	struct tsm_screen *screen;
+	uint64_t plain[32], indexed[32];
+	int r, i, j, n;
+
+	screen = create_screen();
+
+	r = tsm_screen_set_sb_index(screen, 16);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_screen_set_sb_index(NULL, 1 << 22);
+	ck_assert_int_eq(r, -EINVAL);
+
+	for (i = 0; patterns[i]; i++) {
+		for (j = 0; j < 4; j++) {
+			tsm_screen_set_sb_index(screen, 0);
+			n = collect_rows(screen, patterns[i], flags[j],
+					 plain, 32);
+
+			r = tsm_screen_set_sb_index(screen, 1 << 22);
+			ck_assert_int_eq(r, 0);
+			r = collect_rows(screen, patterns[i], flags[j],
+					 indexed, 32);
+			ck_assert_int_eq(r, n);
+			ck_assert_mem_eq(plain, indexed, n * sizeof(*plain));
+		}
+	}
+
+	/* evicted lines are pruned, new lines are added */
+	tsm_screen_set_max_sb(screen, 8);
+	tsm_screen_newline(screen);
+	write_string(screen, "line 20: Error E42");
+	n = collect_rows(screen, "Error", 0, indexed, 32);
+	ck_assert_int_eq(n, 3);
+
+	tsm_screen_clear_sb(screen);
+	n = collect_rows(screen, "Error", 0, indexed, 32);
+	ck_assert_int_eq(n, 1);
+
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+START_TEST(test_search_index_skip)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_search *search;
+	struct tsm_screen_match m;
+	char buf[64];
+	int r, i, calls;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 40, 4);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_max_sb(screen, 2000);
+	r = tsm_screen_set_sb_index(screen, 1 << 22);
+	ck_assert_int_eq(r, 0);
+
+	for (i = 0; i < 1000; i++) {
+		sprintf(buf, "line %d: payload %d", i, i * 7);
+		write_string(screen, buf);
+		tsm_screen_newline(screen);
+	}
+
+	/* the index skips all lines without the trigrams of the needle */
+	r = tsm_screen_search_new(&search, screen, "line 500", 0);
+	ck_assert_int_eq(r, 0);
+
+	calls = 0;
+	do {
+		r = tsm_screen_search_next(search, 2, &m);
+		++calls;
+	} while (r == -EAGAIN);
+
+	ck_assert_int_eq(r, 0);
+	ck_assert_int_le(calls, 2);
+	tsm_screen_search_free(search);
+
+	/* a tiny index drops old lines but finds the same matches */
+	r = tsm_screen_set_sb_index(screen, 450 * 1024);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_search_new(&search, screen, "line 5",
+				  TSM_SCREEN_SEARCH_BACKWARD);
+	ck_assert_int_eq(r, 0);
+	for (i = 0; i < 111; i++) {
+		r = tsm_screen_search_next(search, 0, &m);
+		ck_assert_int_eq(r, 0);
+	}
+	r = tsm_screen_search_next(search, 0, &m);
+	ck_assert_int_eq(r, -ENOENT);
+	tsm_screen_search_free(search);
+
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+TEST_DEFINE_CASE(misc)
+	TEST(test_search_invalid)
+	TEST(test_search_forward)
+	TEST(test_search_backward)
+	TEST(test_search_icase_regex)
+	TEST(test_search_budget)
+	TEST(test_search_select)
+	TEST(test_search_index)
+	TEST(test_search_index_skip)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(search,
+		TEST_CASE(misc),
+		TEST_END
+	)
+)
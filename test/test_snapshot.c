@@ -0,0 +1,332 @@
+/*
+ * TSM - Shared Snapshot Tests
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "test_common.h"
+#include "libtsm.h"
+#include "libtsm-int.h"
+
+#define WIDTH 8
+#define HEIGHT 4
+
+struct cell_rec {
+	uint64_t id;
+	uint32_t ch;
+	size_t len;
+	unsigned int width;
+	bool inverse;
+	tsm_age_t age;
+};
+
+struct frame {
+	struct cell_rec cells[HEIGHT][WIDTH];
+	unsigned int num;
+};
+
+static int record_cb(struct tsm_screen *con, uint64_t id, const uint32_t *ch,
+		     size_t len, unsigned int width, unsigned int posx,
+		     unsigned int posy, const struct tsm_screen_attr *attr,
+		     tsm_age_t age, void *data)
+{
+	struct frame *f = data;
+	struct cell_rec *c;
+
+	UNUSED(con);
+
+	ck_assert_uint_lt(posx, WIDTH);
+	ck_assert_uint_lt(posy, HEIGHT);
+
+	c = &f->cells[posy][posx];
+	c->id = id;
+	c->ch = len ? ch[len - 1] : 0;
+	c->len = len;
+	c->width = width;
+	c->inverse = attr->inverse;
+	c->age = age;
+	++f->num;
+
+	return 0;
+}
+
+static void write_str(struct tsm_screen *screen, const char *str)
+{
+	struct tsm_screen_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	for ( ; *str; ++str) {
+		if (*str == '\n') {
+			tsm_screen_newline(screen);
+			tsm_screen_move_line_home(screen);
+		} else {
+			tsm_screen_write(screen, *str, &attr);
+		}
+	}
+}
+
+static struct tsm_screen *create_screen(void)
+{
+	struct tsm_screen *screen;
+	int r;
+
+	r = tsm_screen_new(&screen, NULL, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, WIDTH, HEIGHT);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_max_sb(screen, 16);
+
+	return screen;
+}
+
+static void draw_snapshot(struct tsm_screen_snapshot *snap, struct frame *f)
+{
+	memset(f, 0, sizeof(*f));
+	tsm_screen_snapshot_draw(snap, record_cb, f);
+	ck_assert_uint_eq(f->num, WIDTH * HEIGHT);
+}
+
+static void draw_screen(struct tsm_screen *screen, struct frame *f)
+{
+	memset(f, 0, sizeof(*f));
+	tsm_screen_draw(screen, record_cb, f);
+	ck_assert_uint_eq(f->num, WIDTH * HEIGHT);
+}
+
+START_TEST(test_snapshot_invalid)
+{
+	struct tsm_screen_snapshot *snap;
+	int r;
+
+	r = tsm_screen_snapshot_new(&snap, NULL);
+	ck_assert_int_eq(r, -EINVAL);
+	r = tsm_screen_snapshot_new(NULL, NULL);
+	ck_assert_int_eq(r, -EINVAL);
+
+	tsm_screen_snapshot_free(NULL);
+	ck_assert_uint_eq(tsm_screen_snapshot_draw(NULL, record_cb, NULL), 0);
+	ck_assert_uint_eq(tsm_screen_snapshot_get_width(NULL), 0);
+	ck_assert_uint_eq(tsm_screen_snapshot_get_height(NULL), 0);
+}
+END_TEST
+
+/* a snapshot draws exactly like the screen it was taken from */
+START_TEST(test_snapshot_draw)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_snapshot *snap;
+	struct tsm_screen_attr attr;
+	struct frame a, b;
+	tsm_symbol_t sym;
+	int r, i;
+
+	screen = create_screen();
+	memset(&attr, 0, sizeof(attr));
+
+	for (i = 0; i < 10; ++i)
+		write_str(screen, "line\n");
+	write_str(screen, "ab");
+	sym = tsm_symbol_append(screen->sym_table, 'e', 0x301);
+	tsm_screen_write(screen, sym, &attr);
+
+	/* scrolled back with a selection from the scrollback onto the screen */
+	tsm_screen_sb_up(screen, 2);
+	tsm_screen_selection_start(screen, 2, 1);
+	tsm_screen_sb_down(screen, 2);
+	tsm_screen_selection_target(screen, 1, 2);
+	tsm_screen_sb_up(screen, 1);
+
+	r = tsm_screen_snapshot_new(&snap, screen);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(tsm_screen_snapshot_get_width(snap), WIDTH);
+	ck_assert_uint_eq(tsm_screen_snapshot_get_height(snap), HEIGHT);
+	ck_assert_uint_eq(tsm_screen_snapshot_get_cursor_x(snap), 3);
+	ck_assert_uint_eq(tsm_screen_snapshot_get_cursor_y(snap), 3);
+
+	draw_snapshot(snap, &a);
+	draw_screen(screen, &b);
+	ck_assert_int_eq(memcmp(&a, &b, sizeof(a)), 0);
+	ck_assert(a.cells[0][2].inverse);
+
+	tsm_screen_snapshot_free(snap);
+
+	/* same without scrollback, with the cursor on the screen */
+	tsm_screen_sb_reset(screen);
+	r = tsm_screen_snapshot_new(&snap, screen);
+	ck_assert_int_eq(r, 0);
+	draw_snapshot(snap, &a);
+	draw_screen(screen, &b);
+	ck_assert_int_eq(memcmp(&a, &b, sizeof(a)), 0);
+	ck_assert_uint_eq(a.cells[3][2].ch, 0x301);
+	ck_assert(a.cells[3][3].inverse);
+	tsm_screen_snapshot_free(snap);
+
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+/* the writer never changes what a snapshot shows */
+START_TEST(test_snapshot_cow)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_snapshot *snap;
+	struct line *untouched;
+	struct frame a, b;
+	int r;
+
+	screen = create_screen();
+	write_str(screen, "first\nsecond\nthird");
+
+	r = tsm_screen_snapshot_new(&snap, screen);
+	ck_assert_int_eq(r, 0);
+	draw_snapshot(snap, &a);
+
+	/* only modified lines get copied */
+	untouched = screen->lines[1];
+	write_str(screen, "!");
+	ck_assert_ptr_eq(screen->lines[1], untouched);
+	ck_assert_uint_eq(untouched->ref, 2);
+
+	tsm_screen_erase_screen(screen, false);
+	write_str(screen, "\n\n\n\n\nscrolled");
+	tsm_screen_resize(screen, WIDTH + 4, HEIGHT);
+	tsm_screen_resize(screen, WIDTH, HEIGHT);
+	tsm_screen_set_flags(screen, TSM_SCREEN_INVERSE);
+
+	draw_snapshot(snap, &b);
+	ck_assert_int_eq(memcmp(&a, &b, sizeof(a)), 0);
+	ck_assert_uint_eq(b.cells[2][4].ch, 'd');
+
+	/* the snapshot outlives the screen */
+	tsm_screen_unref(screen);
+	draw_snapshot(snap, &b);
+	ck_assert_int_eq(memcmp(&a, &b, sizeof(a)), 0);
+	tsm_screen_snapshot_free(snap);
+}
+END_TEST
+
+/* snapshots are drawn and freed by a second thread */
+
+#define QUEUE_SIZE 4
+#define FRAMES 2000
+
+struct queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct tsm_screen_snapshot *snaps[QUEUE_SIZE];
+	char expect[QUEUE_SIZE];
+	unsigned int head;
+	unsigned int tail;
+};
+
+static void *reader_thread(void *data)
+{
+	struct queue *q = data;
+	struct tsm_screen_snapshot *snap;
+	struct frame f;
+	unsigned int n, x, y;
+	char expect;
+
+	for (n = 0; n < FRAMES; ++n) {
+		pthread_mutex_lock(&q->lock);
+		while (q->head == q->tail)
+			pthread_cond_wait(&q->cond, &q->lock);
+		snap = q->snaps[q->tail % QUEUE_SIZE];
+		expect = q->expect[q->tail % QUEUE_SIZE];
+		++q->tail;
+		pthread_cond_signal(&q->cond);
+		pthread_mutex_unlock(&q->lock);
+
+		draw_snapshot(snap, &f);
+		for (y = 0; y < HEIGHT - 1; ++y)
+			for (x = 0; x < WIDTH; ++x)
+				ck_assert_uint_eq(f.cells[y][x].ch, expect);
+		tsm_screen_snapshot_free(snap);
+	}
+
+	return NULL;
+}
+
+START_TEST(test_snapshot_thread)
+{
+	struct tsm_screen *screen;
+	struct tsm_screen_snapshot *snap;
+	struct queue q;
+	pthread_t thread;
+	char line[WIDTH + 2];
+	unsigned int n, y;
+	int r;
+
+	screen = create_screen();
+	memset(&q, 0, sizeof(q));
+	pthread_mutex_init(&q.lock, NULL);
+	pthread_cond_init(&q.cond, NULL);
+
+	r = pthread_create(&thread, NULL, reader_thread, &q);
+	ck_assert_int_eq(r, 0);
+
+	for (n = 0; n < FRAMES; ++n) {
+		/* fill all rows but the last with one character */
+		memset(line, 'a' + n % 26, WIDTH);
+		line[WIDTH] = '\n';
+		line[WIDTH + 1] = 0;
+		for (y = 0; y < HEIGHT - 1; ++y)
+			write_str(screen, line);
+
+		r = tsm_screen_snapshot_new(&snap, screen);
+		ck_assert_int_eq(r, 0);
+
+		pthread_mutex_lock(&q.lock);
+		while (q.head - q.tail == QUEUE_SIZE)
+			pthread_cond_wait(&q.cond, &q.lock);
+		q.snaps[q.head % QUEUE_SIZE] = snap;
+		q.expect[q.head % QUEUE_SIZE] = 'a' + n % 26;
+		++q.head;
+		pthread_cond_signal(&q.cond);
+		pthread_mutex_unlock(&q.lock);
+
+		/* keep modifying the lines the reader looks at */
+		tsm_screen_erase_screen(screen, false);
+		tsm_screen_move_to(screen, 0, 0);
+	}
+
+	pthread_join(thread, NULL);
+	pthread_cond_destroy(&q.cond);
+	pthread_mutex_destroy(&q.lock);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+TEST_DEFINE_CASE(misc)
+	TEST(test_snapshot_invalid)
+	TEST(test_snapshot_draw)
+	TEST(test_snapshot_cow)
+	TEST(test_snapshot_thread)
+TEST_END_CASE
+
+TEST_DEFINE(
+	TEST_SUITE(snapshot,
+		TEST_CASE(misc),
+		TEST_END
+	)
+)
@@ -29,6 +29,8 @@
 
 #include <xkbcommon/xkbcommon-keysyms.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 static void log_cb(void *data, const char *file, int line, const char *func, const char *subs,
 				   unsigned int sev, const char *format, va_list args)
@@ -84,6 +86,8 @@ START_TEST(test_vte_null)
 	tsm_vte_unref(NULL);
 
 	tsm_vte_set_osc_cb(NULL, NULL, NULL);
+	tsm_vte_set_osc_stream_cb(NULL, NULL, NULL, 0);
+	tsm_vte_set_dcs_cb(NULL, NULL, NULL);
 
 	r = tsm_vte_set_palette(NULL, "");
 	ck_assert_int_eq(r, -EINVAL);
@@ -333,6 +337,777 @@ START_TEST(test_vte_csi_cursor_up_down)
 }
 END_TEST
 
+START_TEST(test_vte_input_budget)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	struct tsm_vte_budget budget;
+	const char *in;
+	size_t n;
+	int r;
+
+	r = tsm_screen_new(&screen, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+
+	r = tsm_vte_new(&vte, screen, write_cb, NULL, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+
+	ck_assert_uint_eq(tsm_vte_input_budget(NULL, "a", 1, NULL), 0);
+	ck_assert_uint_eq(tsm_vte_input_budget(vte, "ab", 2, NULL), 2);
+	assert_tsm_screen_cursor_pos(screen, 2, 0);
+
+	/* stops after two characters, in the middle of a UTF-8 sequence */
+	memset(&budget, 0, sizeof(budget));
+	budget.cells = 2;
+	in = "\r\xc3\xa4\xc3\xb6\xc3\xbc";
+	n = tsm_vte_input_budget(vte, in, strlen(in), &budget);
+	ck_assert_uint_eq(n, 5);
+	assert_tsm_screen_cursor_pos(screen, 2, 0);
+
+	/* resumes with a partial UTF-8 sequence */
+	n = tsm_vte_input_budget(vte, in + 5, 1, &budget);
+	ck_assert_uint_eq(n, 1);
+	n = tsm_vte_input_budget(vte, in + 6, 1, &budget);
+	ck_assert_uint_eq(n, 1);
+	assert_tsm_screen_cursor_pos(screen, 3, 0);
+
+	/* stops after one sequence, resumes a partial CSI */
+	memset(&budget, 0, sizeof(budget));
+	budget.sequences = 1;
+	in = "\033[2;5H\033[1";
+	n = tsm_vte_input_budget(vte, in, strlen(in), &budget);
+	ck_assert_uint_eq(n, 6);
+	assert_tsm_screen_cursor_pos(screen, 4, 1);
+	n = tsm_vte_input_budget(vte, in + 6, strlen(in) - 6, &budget);
+	ck_assert_uint_eq(n, strlen(in) - 6);
+	n = tsm_vte_input_budget(vte, "0G", 2, &budget);
+	ck_assert_uint_eq(n, 2);
+	assert_tsm_screen_cursor_pos(screen, 9, 1);
+
+	/* an expired deadline stops at the first control function */
+	memset(&budget, 0, sizeof(budget));
+	budget.deadline = 1;
+	in = "abc\ndef\n";
+	n = tsm_vte_input_budget(vte, in, strlen(in), &budget);
+	ck_assert_uint_eq(n, 4);
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+/*
+ * Adversarial input: sequences that do much work for few bytes. Repeating a
+ * sequence that does not change anything must not touch any line, everything
+ * else is bounded by the size of the screen and the scrollback. The same sequences are timed by the
+ * "adversarial" corpus of bench_vte.
+ */
+
+#define AMP_WIDTH 80
+#define AMP_HEIGHT 24
+#define AMP_SB 100
+#define AMP_REPEAT 1000
+
+static const struct {
+	const char *seq;
+	bool noop;		/* every repetition after the first is a no-op */
+} amp_corpus[] = {
+	{ "\033[2J", true },
+	{ "\033[?2J", true },
+	{ "\033[2K", true },
+	{ "\033[H\033[65535X", true },
+	{ "\033[H\033[65535@", true },
+	{ "\033[H\033[65535P", true },
+	{ "\033[H\033[65535L", true },
+	{ "\033[H\033[65535M", true },
+	{ "\033[65535T", true },
+	{ "\033[65535I", true },
+	{ "\033[65535Z", true },
+	{ "\033[?1049h\033[65535S", true },
+	{ "\033[2;20r\033[3H\033[65535L", true },
+	{ "x\033[2J", false },
+	{ "\033[41m\033[2J\033[42m\033[2J", false },
+	{ "\033[65535S", false },
+	{ "\033[65535;65535H\033[1J", false },
+	{ "x\033[2147483647b", false },
+};
+
+START_TEST(test_vte_amplification)
+{
+	struct tsm_screen_snapshot *snap;
+	struct tsm_screen_stats start, end;
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	const char *seq;
+	size_t i, j, len;
+	int r;
+
+	for (i = 0; i < sizeof(amp_corpus) / sizeof(*amp_corpus); ++i) {
+		seq = amp_corpus[i].seq;
+		len = strlen(seq);
+
+		r = tsm_screen_new(&screen, NULL, NULL);
+		ck_assert_int_eq(r, 0);
+		r = tsm_screen_resize(screen, AMP_WIDTH, AMP_HEIGHT);
+		ck_assert_int_eq(r, 0);
+		tsm_screen_set_max_sb(screen, AMP_SB);
+		r = tsm_vte_new(&vte, screen, write_cb, NULL, NULL, NULL);
+		ck_assert_int_eq(r, 0);
+
+		/* a snapshot shares all lines, writing to one unshares it */
+		tsm_vte_input(vte, seq, len);
+		r = tsm_screen_snapshot_new(&snap, screen);
+		ck_assert_int_eq(r, 0);
+		r = tsm_screen_get_stats(screen, &start);
+
+		for (j = 0; j < AMP_REPEAT; ++j)
+			tsm_vte_input(vte, seq, len);
+
+		if (amp_corpus[i].noop) {
+			for (j = 0; j < AMP_HEIGHT; ++j)
+				ck_assert_msg(screen->lines[j]->ref > 1,
+					      "%s rewrites line %zu",
+					      seq + 1, j);
+		} else if (r != -EOPNOTSUPP) {
+			r = tsm_screen_get_stats(screen, &end);
+			ck_assert_int_eq(r, 0);
+			ck_assert_msg(end.cells - start.cells <=
+				      AMP_REPEAT * (AMP_HEIGHT + AMP_SB + 3) *
+				      AMP_WIDTH,
+				      "%s writes %" PRIu64 " cells", seq + 1,
+				      end.cells - start.cells);
+			ck_assert_msg(end.scroll_lines - start.scroll_lines <=
+				      AMP_REPEAT * (AMP_HEIGHT + AMP_SB + 3),
+				      "%s scrolls %" PRIu64 " lines", seq + 1,
+				      end.scroll_lines - start.scroll_lines);
+		}
+
+		tsm_screen_snapshot_free(snap);
+		tsm_vte_unref(vte);
+		tsm_screen_unref(screen);
+	}
+}
+END_TEST
+
+/* skipped erases and scrolls still leave the right attributes behind */
+START_TEST(test_vte_blank_lines)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	const char *in;
+	int r;
+
+	r = tsm_screen_new(&screen, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 10, 3);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&vte, screen, write_cb, NULL, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+
+	in = "\033[41m\033[2J\033[2J\033[0m\033[1;5H\033[K";
+	tsm_vte_input(vte, in, strlen(in));
+	ck_assert_int_eq(screen->lines[0]->cells[3].attr.bccode, TSM_COLOR_RED);
+	ck_assert_int_eq(screen->lines[0]->cells[4].attr.bccode, TSM_COLOR_BACKGROUND);
+	ck_assert(!screen->lines[0]->blank);
+	ck_assert(screen->lines[1]->blank);
+
+	/* insert and delete on a blank line with other attributes */
+	in = "\033[2H\033[3@";
+	tsm_vte_input(vte, in, strlen(in));
+	ck_assert_int_eq(screen->lines[1]->cells[2].attr.bccode, TSM_COLOR_BACKGROUND);
+	ck_assert_int_eq(screen->lines[1]->cells[3].attr.bccode, TSM_COLOR_RED);
+	ck_assert(!screen->lines[1]->blank);
+
+	/* scrolled-in lines get the current attributes */
+	in = "\033[44m\033[3Hx\033[S\033[S\033[S";
+	tsm_vte_input(vte, in, strlen(in));
+	ck_assert_int_eq(screen->lines[0]->cells[9].attr.bccode, TSM_COLOR_BLUE);
+	ck_assert_int_eq(screen->lines[2]->cells[0].ch, 0);
+	ck_assert(screen->lines[2]->blank);
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+struct osc_stream {
+	char payload[4096];
+	size_t len;
+	unsigned int begin;
+	unsigned int end;
+	unsigned int drop;
+	unsigned int borrowed;		/* fragments pointing into the input */
+	const char *in;
+	size_t in_len;
+};
+
+static void osc_stream_cb(struct tsm_vte *vte, enum tsm_vte_osc_phase phase,
+			  const char *u8, size_t len, void *data)
+{
+	struct osc_stream *o = data;
+
+	UNUSED(vte);
+
+	switch (phase) {
+	case TSM_VTE_OSC_BEGIN:
+		++o->begin;
+		o->len = 0;
+		break;
+	case TSM_VTE_OSC_DATA:
+		ck_assert_uint_gt(len, 0);
+		ck_assert_uint_le(o->len + len, sizeof(o->payload));
+		memcpy(o->payload + o->len, u8, len);
+		o->len += len;
+		if (u8 >= o->in && u8 + len <= o->in + o->in_len)
+			++o->borrowed;
+		break;
+	case TSM_VTE_OSC_END:
+		++o->end;
+		break;
+	case TSM_VTE_OSC_DROP:
+		++o->drop;
+		break;
+	}
+}
+
+static void osc_legacy_cb(struct tsm_vte *vte, const char *u8, size_t len,
+			  void *data)
+{
+	UNUSED(vte);
+	UNUSED(u8);
+	UNUSED(len);
+	UNUSED(data);
+
+	ck_abort_msg("legacy OSC callback called while streaming");
+}
+
+static void osc_input(struct tsm_vte *vte, struct osc_stream *o,
+		      const char *in, size_t len)
+{
+	o->in = in;
+	o->in_len = len;
+	tsm_vte_input(vte, in, len);
+}
+
+START_TEST(test_vte_osc_stream)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	struct osc_stream o;
+	char in[3000];
+	size_t len;
+	int r;
+
+	r = tsm_screen_new(&screen, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&vte, screen, write_cb, NULL, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+
+	memset(&o, 0, sizeof(o));
+	tsm_vte_set_osc_cb(vte, osc_legacy_cb, NULL);
+	tsm_vte_set_osc_stream_cb(vte, osc_stream_cb, &o, 0);
+
+	/* a clipboard push far beyond OSC_MAX_LEN, without copies */
+	len = sprintf(in, "\033]52;c;");
+	memset(in + len, 'A', 2500);
+	len += 2500;
+	in[len++] = '\a';
+	osc_input(vte, &o, in, len);
+	ck_assert_uint_eq(o.begin, 1);
+	ck_assert_uint_eq(o.end, 1);
+	ck_assert_uint_eq(o.len, 2505);
+	ck_assert_int_eq(memcmp(o.payload, "52;c;AAA", 8), 0);
+	ck_assert_uint_eq(o.borrowed, 1);
+
+	/* UTF-8 split across calls, terminated by ST */
+	osc_input(vte, &o, "\033]8;;http://x/\xc3", 15);
+	ck_assert_uint_eq(o.begin, 2);
+	osc_input(vte, &o, "\xa4z\033\\", 4);
+	ck_assert_uint_eq(o.end, 2);
+	ck_assert_uint_eq(o.len, 15);
+	ck_assert_int_eq(memcmp(o.payload, "8;;http://x/\xc3\xa4z", 15), 0);
+	ck_assert_uint_eq(tsm_screen_get_cursor_x(screen), 0);
+
+	/* oversized payloads are dropped, the next one is delivered */
+	tsm_vte_set_osc_stream_cb(vte, osc_stream_cb, &o, 10);
+	osc_input(vte, &o, "\033]0;0123456789\a\033]0;ok\a", 22);
+	ck_assert_uint_eq(o.begin, 4);
+	ck_assert_uint_eq(o.drop, 1);
+	ck_assert_uint_eq(o.end, 3);
+	ck_assert_uint_eq(o.len, 4);
+	ck_assert_int_eq(memcmp(o.payload, "0;ok", 4), 0);
+
+	/* a reset in the middle of an OSC drops it */
+	osc_input(vte, &o, "\033]0;x", 5);
+	tsm_vte_reset(vte);
+	ck_assert_uint_eq(o.drop, 2);
+	ck_assert_uint_eq(o.end, 3);
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+struct dcs_rec {
+	char data[8192];
+	size_t len;
+	unsigned int begin;
+	unsigned int end;
+	unsigned int drop;
+	unsigned int chunks;
+	uint32_t final;
+	char inter[8];
+	unsigned int argc;
+	int argv[4];
+};
+
+static void dcs_cb(struct tsm_vte *vte, enum tsm_vte_dcs_phase phase,
+		   const struct tsm_vte_dcs *dcs, const char *u8, size_t len,
+		   void *data)
+{
+	struct dcs_rec *d = data;
+	unsigned int i;
+
+	UNUSED(vte);
+
+	switch (phase) {
+	case TSM_VTE_DCS_BEGIN:
+		++d->begin;
+		d->len = 0;
+		d->chunks = 0;
+		d->final = dcs->final;
+		snprintf(d->inter, sizeof(d->inter), "%s", dcs->intermediates);
+		d->argc = dcs->argc;
+		for (i = 0; i < dcs->argc && i < 4; ++i)
+			d->argv[i] = dcs->argv[i];
+		break;
+	case TSM_VTE_DCS_DATA:
+		ck_assert_uint_eq(dcs->final, d->final);
+		ck_assert_uint_le(d->len + len, sizeof(d->data));
+		memcpy(d->data + d->len, u8, len);
+		d->len += len;
+		++d->chunks;
+		break;
+	case TSM_VTE_DCS_END:
+		++d->end;
+		break;
+	case TSM_VTE_DCS_DROP:
+		++d->drop;
+		break;
+	}
+}
+
+START_TEST(test_vte_dcs)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	struct dcs_rec d;
+	char in[6000];
+	const char *str;
+	size_t len;
+	int r;
+
+	r = tsm_screen_new(&screen, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&vte, screen, write_cb, NULL, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+
+	/* without a handler the DCS is discarded */
+	str = "\033P1$qm\033\\";
+	tsm_vte_input(vte, str, strlen(str));
+	ck_assert_uint_eq(tsm_screen_get_cursor_x(screen), 0);
+
+	memset(&d, 0, sizeof(d));
+	tsm_vte_set_dcs_cb(vte, dcs_cb, &d);
+
+	/* DECRQSS */
+	tsm_vte_input(vte, str, strlen(str));
+	ck_assert_uint_eq(d.begin, 1);
+	ck_assert_uint_eq(d.end, 1);
+	ck_assert_uint_eq(d.final, 'q');
+	ck_assert_str_eq(d.inter, "$");
+	ck_assert_uint_eq(d.argc, 1);
+	ck_assert_int_eq(d.argv[0], 1);
+	ck_assert_uint_eq(d.len, 1);
+	ck_assert_int_eq(d.data[0], 'm');
+
+	/* a large sixel image arrives in one chunk per input call */
+	len = sprintf(in, "\033P0;1;0q");
+	memset(in + len, '~', 5000);
+	len += 5000;
+	in[len++] = '\n';
+	tsm_vte_input(vte, in, len);
+	ck_assert_uint_eq(d.begin, 2);
+	ck_assert_uint_eq(d.end, 1);
+	ck_assert_uint_eq(d.chunks, 1);
+	tsm_vte_input(vte, "#1\033\\", 4);
+	ck_assert_uint_eq(d.end, 2);
+	ck_assert_uint_eq(d.final, 'q');
+	ck_assert_str_eq(d.inter, "");
+	ck_assert_uint_eq(d.argc, 3);
+	ck_assert_int_eq(d.argv[1], 1);
+	ck_assert_uint_eq(d.len, 5003);
+	ck_assert_int_eq(memcmp(d.data + 4999, "~\n#1", 4), 0);
+
+	/* private marker, UTF-8 data and DEL, terminated by C1 ST */
+	str = "\033P>|x\xc3\xa4\x7fy\xc2\x9c";
+	tsm_vte_input(vte, str, strlen(str));
+	ck_assert_uint_eq(d.end, 3);
+	ck_assert_str_eq(d.inter, ">");
+	ck_assert_int_eq(d.argv[0], -1);
+	ck_assert_uint_eq(d.final, '|');
+	ck_assert_uint_eq(d.len, 4);
+	ck_assert_int_eq(memcmp(d.data, "x\xc3\xa4y", 4), 0);
+
+	/* a reset in the middle of a DCS drops it */
+	tsm_vte_input(vte, "\033Pqabc", 6);
+	tsm_vte_reset(vte);
+	ck_assert_uint_eq(d.drop, 1);
+	ck_assert_uint_eq(d.end, 3);
+	tsm_vte_input(vte, "z", 1);
+	ck_assert_uint_eq(d.begin, 4);
+	ck_assert_uint_eq(d.len, 3);
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+struct out_rec {
+	char buf[256];
+	size_t len;
+	unsigned int calls;
+};
+
+static void recording_write_cb(struct tsm_vte *vte, const char *u8, size_t len,
+			       void *data)
+{
+	struct out_rec *o = data;
+
+	UNUSED(vte);
+
+	ck_assert_uint_le(o->len + len, sizeof(o->buf));
+	memcpy(o->buf + o->len, u8, len);
+	o->len += len;
+	++o->calls;
+}
+
+START_TEST(test_vte_flush)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	struct out_rec o;
+	const char *in = "\033[5n\033[6n\033[5n";
+	int r;
+
+	r = tsm_screen_new(&screen, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&vte, screen, recording_write_cb, &o, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+
+	/* replies to one input are passed on at once */
+	memset(&o, 0, sizeof(o));
+	tsm_vte_input(vte, in, strlen(in));
+	ck_assert_uint_eq(o.calls, 1);
+	ck_assert_uint_eq(o.len, 14);
+	ck_assert_int_eq(memcmp(o.buf, "\033[0n\033[1;1R\033[0n", 14), 0);
+
+	/* keys are not delayed, the escape prefix is merged */
+	memset(&o, 0, sizeof(o));
+	tsm_vte_handle_keyboard(vte, XKB_KEY_a, 'a', TSM_ALT_MASK, 'a');
+	ck_assert_uint_eq(o.calls, 1);
+	ck_assert_int_eq(memcmp(o.buf, "\033a", 2), 0);
+
+	memset(&o, 0, sizeof(o));
+	tsm_vte_set_flush_mode(vte, TSM_VTE_FLUSH_IMMEDIATE);
+	tsm_vte_input(vte, in, strlen(in));
+	ck_assert_uint_eq(o.calls, 3);
+
+	memset(&o, 0, sizeof(o));
+	tsm_vte_set_flush_mode(vte, TSM_VTE_FLUSH_MANUAL);
+	tsm_vte_input(vte, in, strlen(in));
+	tsm_vte_handle_keyboard(vte, XKB_KEY_b, 'b', 0, 'b');
+	ck_assert_uint_eq(o.calls, 0);
+	tsm_vte_flush(vte);
+	ck_assert_uint_eq(o.calls, 1);
+	ck_assert_uint_eq(o.len, 15);
+	tsm_vte_flush(vte);
+	ck_assert_uint_eq(o.calls, 1);
+
+	/* pending data is dropped with the vte */
+	memset(&o, 0, sizeof(o));
+	tsm_vte_input(vte, "\033[5n", 4);
+	tsm_vte_unref(vte);
+	ck_assert_uint_eq(o.calls, 0);
+
+	tsm_vte_flush(NULL);
+	tsm_vte_set_flush_mode(NULL, TSM_VTE_FLUSH_INPUT);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+static void assert_key(struct tsm_vte *vte, struct out_rec *o,
+		       uint32_t keysym, unsigned int mods, const char *seq)
+{
+	bool r;
+
+	memset(o, 0, sizeof(*o));
+	r = tsm_vte_handle_keyboard(vte, keysym, XKB_KEY_NoSymbol, mods,
+				    TSM_VTE_INVALID);
+	ck_assert(r);
+	ck_assert_uint_eq(o->len, strlen(seq));
+	ck_assert_int_eq(memcmp(o->buf, seq, o->len), 0);
+}
+
+START_TEST(test_vte_keys)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	struct out_rec o;
+	int r;
+
+	r = tsm_screen_new(&screen, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&vte, screen, recording_write_cb, &o, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+
+	assert_key(vte, &o, XKB_KEY_Up, 0, "\033[A");
+	assert_key(vte, &o, XKB_KEY_KP_Home, 0, "\033[H");
+	assert_key(vte, &o, XKB_KEY_KP_5, 0, "5");
+	assert_key(vte, &o, XKB_KEY_KP_Enter, 0, "\r");
+	assert_key(vte, &o, XKB_KEY_F12, TSM_SHIFT_MASK, "\033[24;2~");
+	assert_key(vte, &o, XKB_KEY_ISO_Left_Tab, TSM_SHIFT_MASK, "\033[Z");
+	assert_key(vte, &o, XKB_KEY_bracketleft, TSM_CONTROL_MASK, "\033");
+	assert_key(vte, &o, XKB_KEY_Delete, TSM_ALT_MASK, "\033\033[3~");
+
+	/* modes select tables, modifiers take precedence over them */
+	tsm_vte_input(vte, "\033[?1h\033=\033[20h", 12);
+	assert_key(vte, &o, XKB_KEY_Up, 0, "\033OA");
+	assert_key(vte, &o, XKB_KEY_Up, TSM_SHIFT_MASK, "\033[1;2A");
+	assert_key(vte, &o, XKB_KEY_Up, TSM_SHIFT_MASK | TSM_CONTROL_MASK,
+		   "\033[1;5A");
+	assert_key(vte, &o, XKB_KEY_End, TSM_CONTROL_MASK, "\033OF");
+	assert_key(vte, &o, XKB_KEY_KP_5, 0, "\033Ou");
+	assert_key(vte, &o, XKB_KEY_KP_Enter, 0, "\033OM");
+	assert_key(vte, &o, XKB_KEY_Return, 0, "\r\n");
+
+	tsm_vte_input(vte, "\033>", 2);
+	assert_key(vte, &o, XKB_KEY_KP_Enter, 0, "\r\n");
+
+	/* keysyms outside of the special page do not hit the tables */
+	memset(&o, 0, sizeof(o));
+	r = tsm_vte_handle_keyboard(vte, XKB_KEY_BackSpace & 0xff,
+				    XKB_KEY_NoSymbol, 0, TSM_VTE_INVALID);
+	ck_assert(!r);
+	ck_assert_uint_eq(o.len, 0);
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+static void sync_cb(struct tsm_vte *vte, bool active, void *data)
+{
+	int *cnt = data;
+
+	UNUSED(vte);
+
+	cnt[active]++;
+}
+
+START_TEST(test_vte_sync)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	struct out_rec o;
+	struct timespec ts = { 0, 5 * 1000 * 1000 };
+	int cnt[2] = { 0, 0 };
+	int r;
+
+	r = tsm_screen_new(&screen, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&vte, screen, recording_write_cb, &o, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+	tsm_vte_set_sync_cb(vte, sync_cb, cnt);
+	ck_assert_int_eq(tsm_vte_check_sync(vte), -1);
+
+	memset(&o, 0, sizeof(o));
+	tsm_vte_input(vte, "\033[?2026h\033[?2026h\033[?2026$p", 25);
+	ck_assert(tsm_vte_get_flags(vte) & TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT);
+	ck_assert(tsm_screen_get_flags(screen) & TSM_SCREEN_SYNC_UPDATE);
+	ck_assert_int_eq(cnt[1], 1);
+	ck_assert_int_ge(tsm_vte_check_sync(vte), 0);
+	ck_assert_int_le(tsm_vte_check_sync(vte), 150);
+	ck_assert_uint_eq(o.len, 11);
+	ck_assert_int_eq(memcmp(o.buf, "\033[?2026;1$y", 11), 0);
+
+	tsm_vte_input(vte, "\033[?2026l", 8);
+	ck_assert(!(tsm_screen_get_flags(screen) & TSM_SCREEN_SYNC_UPDATE));
+	ck_assert_int_eq(cnt[0], 1);
+	ck_assert_int_eq(tsm_vte_check_sync(vte), -1);
+
+	/* an update ends on timeout and on reset */
+	tsm_vte_set_sync_timeout(vte, 1);
+	tsm_vte_input(vte, "\033[?2026h", 8);
+	nanosleep(&ts, NULL);
+	ck_assert_int_eq(tsm_vte_check_sync(vte), -1);
+	ck_assert_int_eq(cnt[0], 2);
+	ck_assert(!(tsm_vte_get_flags(vte) & TSM_VTE_FLAG_SYNCHRONIZED_OUTPUT));
+
+	tsm_vte_input(vte, "\033[?2026h\033c", 10);
+	ck_assert_int_eq(cnt[1], 3);
+	ck_assert_int_eq(cnt[0], 3);
+	ck_assert(!(tsm_screen_get_flags(screen) & TSM_SCREEN_SYNC_UPDATE));
+
+	/* disabled, the mode is permanently reset */
+	tsm_vte_set_sync_timeout(vte, 0);
+	memset(&o, 0, sizeof(o));
+	tsm_vte_input(vte, "\033[?2026h\033[?2026$p", 17);
+	ck_assert_int_eq(cnt[1], 3);
+	ck_assert_int_eq(tsm_vte_check_sync(vte), -1);
+	ck_assert_int_eq(memcmp(o.buf, "\033[?2026;4$y", 11), 0);
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+/* compares the characters of row @y, blank cells are given as ' ' */
+static void assert_row(struct tsm_screen *screen, unsigned int y,
+		       const char *text)
+{
+	struct cell *cells = screen->lines[y]->cells;
+	unsigned int i;
+
+	for (i = 0; text[i]; ++i)
+		ck_assert_uint_eq(cells[i].ch ? cells[i].ch : ' ',
+				  (unsigned char)text[i]);
+}
+
+START_TEST(test_vte_rep)
+{
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	struct out_rec o;
+	int r;
+
+	r = tsm_screen_new(&screen, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 10, 3);
+	ck_assert_int_eq(r, 0);
+	r = tsm_vte_new(&vte, screen, recording_write_cb, &o, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+
+	/* nothing to repeat yet */
+	tsm_vte_input(vte, "\033[5b", 4);
+	ck_assert_uint_eq(tsm_screen_get_cursor_x(screen), 0);
+
+	/* the count wraps like single characters, 0 means 1 */
+	tsm_vte_input(vte, "ab\033[3b\033[0b\033[H\033[2Bc\033[b", 21);
+	ck_assert_uint_eq(tsm_screen_get_cursor_x(screen), 2);
+	ck_assert_uint_eq(tsm_screen_get_cursor_y(screen), 2);
+	tsm_vte_input(vte, "\033[1;9H\033[4b", 10);
+	ck_assert_uint_eq(tsm_screen_get_cursor_x(screen), 2);
+	ck_assert_uint_eq(tsm_screen_get_cursor_y(screen), 1);
+
+	assert_row(screen, 0, "abbbbb  cc");
+	assert_row(screen, 1, "cc        ");
+	assert_row(screen, 2, "cc        ");
+
+	tsm_vte_input(vte, "\033c\033[3b", 6);
+	ck_assert_uint_eq(tsm_screen_get_cursor_x(screen), 0);
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
+static int stats_draw_cb(struct tsm_screen *con, uint64_t id,
+			 const uint32_t *ch, size_t len, unsigned int width,
+			 unsigned int posx, unsigned int posy,
+			 const struct tsm_screen_attr *attr, tsm_age_t age,
+			 void *data)
+{
+	UNUSED(con);
+	UNUSED(id);
+	UNUSED(ch);
+	UNUSED(len);
+	UNUSED(width);
+	UNUSED(posx);
+	UNUSED(posy);
+	UNUSED(attr);
+	UNUSED(age);
+	UNUSED(data);
+
+	return 0;
+}
+
+START_TEST(test_vte_stats)
+{
+	struct tsm_screen_stats ss, base;
+	struct tsm_vte_stats vs;
+	struct tsm_screen *screen;
+	struct tsm_vte *vte;
+	struct out_rec o;
+	int r;
+
+	r = tsm_screen_new(&screen, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+	r = tsm_screen_resize(screen, 10, 3);
+	ck_assert_int_eq(r, 0);
+	tsm_screen_set_max_sb(screen, 2);
+	r = tsm_vte_new(&vte, screen, recording_write_cb, &o, log_cb, NULL);
+	ck_assert_int_eq(r, 0);
+
+	ck_assert_int_eq(tsm_vte_get_stats(NULL, &vs), -EINVAL);
+	ck_assert_int_eq(tsm_vte_get_stats(vte, NULL), -EINVAL);
+	ck_assert_int_eq(tsm_screen_get_stats(NULL, &ss), -EINVAL);
+	ck_assert_int_eq(tsm_screen_get_stats(screen, NULL), -EINVAL);
+
+	/* shrinking the screen scrolled already */
+	memset(&base, 0, sizeof(base));
+	tsm_screen_get_stats(screen, &base);
+
+	/* 4 scrolled lines overflow the scrollback-buffer by 2 */
+	tsm_vte_input(vte, "ab\033[2b\r\n\n\n\n\n\n", 13);
+	tsm_vte_input(vte, "e\0337\033]0;t\007\033[?9999h", 17);
+	tsm_screen_draw(screen, stats_draw_cb, NULL);
+
+	r = tsm_vte_get_stats(vte, &vs);
+#ifndef BUILD_ENABLE_STATS
+	ck_assert_int_eq(r, -EOPNOTSUPP);
+	ck_assert_int_eq(tsm_screen_get_stats(screen, &ss), -EOPNOTSUPP);
+#else
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(vs.bytes, 30);
+	ck_assert_uint_eq(vs.controls, 7);
+	ck_assert_uint_eq(vs.esc, 1);
+	ck_assert_uint_eq(vs.csi, 2);
+	ck_assert_uint_eq(vs.osc, 1);
+	ck_assert_uint_eq(vs.dcs, 0);
+	ck_assert_uint_eq(vs.unhandled, 1);
+
+	r = tsm_screen_get_stats(screen, &ss);
+	ck_assert_int_eq(r, 0);
+	ck_assert_uint_eq(ss.cells, 5);
+	ck_assert_uint_eq(ss.scroll_lines - base.scroll_lines, 4);
+	ck_assert_uint_eq(ss.sb_evictions - base.sb_evictions, 2);
+	ck_assert_uint_eq(ss.draws, 1);
+	ck_assert_uint_eq(ss.sb_lines, 2);
+	ck_assert_uint_gt(ss.sb_bytes, 0);
+	ck_assert_uint_eq(ss.symbols, 0);
+
+	tsm_screen_clear_sb(screen);
+	tsm_screen_get_stats(screen, &ss);
+	ck_assert_uint_eq(ss.sb_lines, 0);
+	ck_assert_uint_eq(ss.sb_bytes, 0);
+#endif
+
+	tsm_vte_unref(vte);
+	tsm_screen_unref(screen);
+}
+END_TEST
+
 TEST_DEFINE_CASE(misc)
 	TEST(test_vte_init)
 	TEST(test_vte_null)
@@ -341,6 +1116,16 @@ TEST_DEFINE_CASE(misc)
 	TEST(test_vte_get_flags)
 	TEST(test_vte_decrqm_no_reset)
 	TEST(test_vte_csi_cursor_up_down)
+	TEST(test_vte_input_budget)
+	TEST(test_vte_amplification)
+	TEST(test_vte_blank_lines)
+	TEST(test_vte_osc_stream)
+	TEST(test_vte_dcs)
+	TEST(test_vte_flush)
+	TEST(test_vte_keys)
+	TEST(test_vte_sync)
+	TEST(test_vte_rep)
+	TEST(test_vte_stats)
 TEST_END_CASE
 
 // clang-format off